@@ -0,0 +1,221 @@
+#include "avl.hpp"
+#include <algorithm>
+
+static void avl_update(AVLNode *node)
+{
+    node->height = 1 + std::max(avl_height(node->left), avl_height(node->right));
+    node->cnt = 1 + avl_cnt(node->left) + avl_cnt(node->right);
+}
+
+// the right child takes node's place, node becomes its left child and takes
+// over its old left subtree as the right one
+static AVLNode *rot_left(AVLNode *node)
+{
+    AVLNode *parent = node->parent;
+    AVLNode *new_node = node->right;
+    AVLNode *inner = new_node->left;
+    node->right = inner;
+    if (inner)
+    {
+        inner->parent = node;
+    }
+    new_node->parent = parent;
+    new_node->left = node;
+    node->parent = new_node;
+    avl_update(node);
+    avl_update(new_node);
+    return new_node;
+}
+
+static AVLNode *rot_right(AVLNode *node)
+{
+    AVLNode *parent = node->parent;
+    AVLNode *new_node = node->left;
+    AVLNode *inner = new_node->right;
+    node->left = inner;
+    if (inner)
+    {
+        inner->parent = node;
+    }
+    new_node->parent = parent;
+    new_node->right = node;
+    node->parent = new_node;
+    avl_update(node);
+    avl_update(new_node);
+    return new_node;
+}
+
+// the left subtree is 2 levels taller
+static AVLNode *avl_fix_left(AVLNode *node)
+{
+    if (avl_height(node->left->left) < avl_height(node->left->right))
+    {
+        node->left = rot_left(node->left); // the left-right case
+    }
+    return rot_right(node);
+}
+
+// the right subtree is 2 levels taller
+static AVLNode *avl_fix_right(AVLNode *node)
+{
+    if (avl_height(node->right->right) < avl_height(node->right->left))
+    {
+        node->right = rot_right(node->right); // the right-left case
+    }
+    return rot_left(node);
+}
+
+AVLNode *avl_fix(AVLNode *node)
+{
+    while (true)
+    {
+        // where the (possibly rotated) subtree gets attached
+        AVLNode **from = &node;
+        AVLNode *parent = node->parent;
+        if (parent)
+        {
+            from = parent->left == node ? &parent->left : &parent->right;
+        }
+        avl_update(node);
+        uint32_t l = avl_height(node->left);
+        uint32_t r = avl_height(node->right);
+        if (l == r + 2)
+        {
+            *from = avl_fix_left(node);
+        }
+        else if (l + 2 == r)
+        {
+            *from = avl_fix_right(node);
+        }
+        if (!parent)
+        {
+            return *from;
+        }
+        node = parent;
+    }
+}
+
+// a node with at most one child: the child takes its place
+static AVLNode *avl_del_easy(AVLNode *node)
+{
+    AVLNode *child = node->left ? node->left : node->right;
+    AVLNode *parent = node->parent;
+    if (child)
+    {
+        child->parent = parent;
+    }
+    if (!parent)
+    {
+        return child;
+    }
+    AVLNode **from = parent->left == node ? &parent->left : &parent->right;
+    *from = child;
+    return avl_fix(parent);
+}
+
+AVLNode *avl_del(AVLNode *node)
+{
+    if (!node->left || !node->right)
+    {
+        return avl_del_easy(node);
+    }
+    // two children: the successor leaves its place and takes node's
+    AVLNode *victim = node->right;
+    while (victim->left)
+    {
+        victim = victim->left;
+    }
+    AVLNode *root = avl_del_easy(victim);
+    *victim = *node; // links, height and count, as updated by the fix
+    if (victim->left)
+    {
+        victim->left->parent = victim;
+    }
+    if (victim->right)
+    {
+        victim->right->parent = victim;
+    }
+    AVLNode **from = &root;
+    AVLNode *parent = node->parent;
+    if (parent)
+    {
+        from = parent->left == node ? &parent->left : &parent->right;
+    }
+    *from = victim;
+    return root;
+}
+
+AVLNode *avl_offset(AVLNode *node, int64_t offset)
+{
+    int64_t pos = 0; // of node, relative to the starting node
+    while (offset != pos)
+    {
+        if (pos < offset && pos + avl_cnt(node->right) >= offset)
+        {
+            // the target is in the right subtree
+            node = node->right;
+            pos += avl_cnt(node->left) + 1;
+        }
+        else if (pos > offset && pos - avl_cnt(node->left) <= offset)
+        {
+            // the target is in the left subtree
+            node = node->left;
+            pos -= avl_cnt(node->right) + 1;
+        }
+        else
+        {
+            // go up
+            AVLNode *parent = node->parent;
+            if (!parent)
+            {
+                return nullptr;
+            }
+            if (parent->right == node)
+            {
+                pos -= avl_cnt(node->left) + 1;
+            }
+            else
+            {
+                pos += avl_cnt(node->right) + 1;
+            }
+            node = parent;
+        }
+    }
+    return node;
+}
+
+uint64_t avl_rank(const AVLNode *node)
+{
+    uint64_t rank = avl_cnt(node->left);
+    for (; node->parent; node = node->parent)
+    {
+        if (node->parent->right == node)
+        {
+            rank += avl_cnt(node->parent->left) + 1;
+        }
+    }
+    return rank;
+}
+
+AVLNode *avl_at(AVLNode *root, uint64_t rank)
+{
+    AVLNode *node = root;
+    while (node)
+    {
+        uint64_t left = avl_cnt(node->left);
+        if (rank == left)
+        {
+            return node;
+        }
+        if (rank < left)
+        {
+            node = node->left;
+        }
+        else
+        {
+            rank -= left + 1;
+            node = node->right;
+        }
+    }
+    return nullptr;
+}
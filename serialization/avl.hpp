@@ -0,0 +1,47 @@
+#ifndef AVL_HPP
+#define AVL_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// Intrusive AVL tree whose nodes also count the nodes of their subtree, so
+// the node at a rank and the rank of a node are found in O(log n).
+//
+// The tree knows nothing about keys: the caller walks down to the insert
+// position itself, links the new node as a leaf, and calls avl_fix() on it
+// to rebalance. Every function that restructures the tree returns the new
+// root.
+
+struct AVLNode
+{
+    AVLNode *parent = nullptr;
+    AVLNode *left = nullptr;
+    AVLNode *right = nullptr;
+    uint32_t height = 1;
+    uint32_t cnt = 1; // nodes in this subtree, itself included
+};
+
+static inline uint32_t avl_height(const AVLNode *node)
+{
+    return node ? node->height : 0;
+}
+
+static inline uint32_t avl_cnt(const AVLNode *node)
+{
+    return node ? node->cnt : 0;
+}
+
+// rebalances the path from a node that was just linked in (or whose
+// subtree changed) up to the root
+AVLNode *avl_fix(AVLNode *node);
+// unlinks node, which keeps its memory
+AVLNode *avl_del(AVLNode *node);
+// The node `offset` positions after node in order (before it if negative),
+// nullptr past either end. O(log n), and O(1) amortized for offset 1.
+AVLNode *avl_offset(AVLNode *node, int64_t offset);
+// 0-based position of node in order
+uint64_t avl_rank(const AVLNode *node);
+// the node at `rank` under root, nullptr if rank >= avl_cnt(root)
+AVLNode *avl_at(AVLNode *root, uint64_t rank);
+
+#endif // AVL_HPP
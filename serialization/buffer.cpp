@@ -1,9 +1,10 @@
 #include "buffer.hpp"
 #include <cstring>
+#include <new>
 #include <stdio.h>
 
 Buffer::Buffer(size_t max_size) : max_size(max_size) {
-  start = new uint8_t[max_size];
+  start = max_size ? new uint8_t[max_size] : nullptr;
   end = start + max_size;
   data_start = start;
   data_end = start;
@@ -24,19 +25,44 @@ size_t Buffer::free_space() {
   return (end - data_end) + (data_start - start);
 }
 
-void Buffer::append(uint8_t *new_data, size_t len) {
-  if ((data_size() + len) > max_size) {
-    size_t new_max_size = (data_size() + len) * 2;
-    if (!_expand(new_max_size)) {
-      fprintf(stderr, "[buffer] failed to expand to %zu\n", new_max_size);
-      return;
-    }
+uint8_t *Buffer::reserve_tail(size_t len) {
+  if ((size_t)(end - data_end) >= len) {
+    return data_end;
   }
-  if (data_end + len > end) {
+  size_t current_data_size = data_size();
+  // only compact when it frees at least as much as it moves, otherwise a
+  // nearly full buffer would memmove everything for every small append
+  if (free_space() >= len && (size_t)(data_start - start) >= current_data_size) {
     compact();
+    return data_end;
   }
+  size_t new_max_size = max_size * 2;
+  if (new_max_size < current_data_size + len) {
+    new_max_size = current_data_size + len;
+  }
+  if (!_expand(new_max_size)) {
+    fprintf(stderr, "[buffer] failed to expand to %zu\n", new_max_size);
+    return nullptr;
+  }
+  return data_end;
+}
+
+void Buffer::commit_tail(size_t len) {
+  if (len > tail_space()) {
+    return;
+  }
+  data_end += len;
+}
 
-  std::memcpy(data_end, new_data, len);
+void Buffer::append(const uint8_t *new_data, size_t len) {
+  if (len == 0) {
+    return;
+  }
+  uint8_t *dst = reserve_tail(len);
+  if (!dst) {
+    return;
+  }
+  std::memcpy(dst, new_data, len);
   data_end += len;
 }
 
@@ -56,6 +82,18 @@ void Buffer::consume(size_t len) {
     return;
   }
   data_start += len;
+  if (data_start == data_end) {
+    // empty: rewind for free instead of compacting later
+    data_start = start;
+    data_end = start;
+  }
+}
+
+void Buffer::truncate(size_t len) {
+  if (len > data_size()) {
+    return;
+  }
+  data_end = data_start + len;
 }
 
 bool Buffer::_expand(size_t new_max_size) {
@@ -64,13 +102,15 @@ bool Buffer::_expand(size_t new_max_size) {
     return false;
   }
   auto current_data_size = data_size();
-  uint8_t *new_start = static_cast<uint8_t *>(malloc(new_max_size));
+  uint8_t *new_start = new (std::nothrow) uint8_t[new_max_size];
 
   if (new_start == nullptr) {
     return false;
   }
 
-  std::memcpy(new_start, data_start, current_data_size);
+  if (current_data_size) {
+    std::memcpy(new_start, data_start, current_data_size);
+  }
   delete[] start;
 
   start = new_start;
@@ -80,4 +120,4 @@ bool Buffer::_expand(size_t new_max_size) {
   max_size = new_max_size;
 
   return true;
-}
\ No newline at end of file
+}
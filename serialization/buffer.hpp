@@ -3,9 +3,15 @@
 #include <cstdint>
 #include <cstdlib>
 
+// Byte queue with a head (data_start) and a tail (data_end): consuming only
+// advances data_start, appending writes at data_end. The data is moved back
+// to the start only when that frees at least as many bytes as it copies, so
+// both ends are amortized O(1).
 struct Buffer {
-    Buffer(size_t max_size);
+    Buffer(size_t max_size = 0);
     ~Buffer();
+    Buffer(const Buffer &) = delete;
+    Buffer &operator=(const Buffer &) = delete;
 
     // Returns the current size of data in the buffer
     size_t data_size();
@@ -13,8 +19,19 @@ struct Buffer {
     // Returns available free space in the buffer
     size_t free_space();
 
+    // Pointer to the first byte of data
+    uint8_t *data() { return data_start; }
+
     // Append new data to the buffer
-    void append(uint8_t* new_data, size_t len);
+    void append(const uint8_t* new_data, size_t len);
+
+    // Make room for at least `len` bytes after the data and return a pointer
+    // to it, e.g. to read() from a socket straight into the buffer.
+    // tail_space() tells how much was actually made available.
+    uint8_t *reserve_tail(size_t len);
+    size_t tail_space() { return end - data_end; }
+    // Mark `len` bytes written to the reserved tail as data
+    void commit_tail(size_t len);
 
     // Compact the buffer by moving data to the start
     void compact();
@@ -22,13 +39,16 @@ struct Buffer {
     // Consume (remove) data from the start of the buffer
     void consume(size_t len);
 
-private:
-    // Expand buffer to new size
-    bool _expand(size_t new_max_size);
+    // Drop data after the first `len` bytes
+    void truncate(size_t len);
 
     uint8_t* start;      // pointer to start of the buffer
     uint8_t* end;        // pointer to end of the buffer
     uint8_t* data_start; // pointer to start of actual data
     uint8_t* data_end;   // pointer to end of actual data
     size_t max_size;     // maximum size of the buffer
-};
\ No newline at end of file
+
+private:
+    // Expand buffer to new size
+    bool _expand(size_t new_max_size);
+};
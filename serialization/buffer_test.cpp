@@ -3,9 +3,14 @@
 #include <cstring>
 #include <iostream>
 
+static int failures = 0;
+
 // Helper function to print test results
 void runTest(const char *testName, bool passed) {
   std::cout << testName << ": " << (passed ? "PASSED" : "FAILED") << std::endl;
+  if (!passed) {
+    failures++;
+  }
 }
 
 // Test initialization of buffer
@@ -171,6 +176,119 @@ void testFragmentation() {
   runTest("Fragmentation Handling", passed);
 }
 
+// Consuming only moves the head, the remaining bytes stay where they are
+void testConsumeIsO1() {
+  Buffer buffer(64);
+
+  uint8_t testData[] = {1, 2, 3, 4, 5, 6, 7, 8};
+  buffer.append(testData, sizeof(testData));
+  uint8_t *oldDataEnd = buffer.data_end;
+
+  buffer.consume(3);
+  bool passed = (buffer.data_start == buffer.start + 3) &&
+                (buffer.data_end == oldDataEnd) && (buffer.data()[0] == 4);
+
+  // consuming everything rewinds to the start without copying
+  buffer.consume(buffer.data_size());
+  passed = passed && (buffer.data_size() == 0) &&
+           (buffer.data_start == buffer.start) &&
+           (buffer.data_end == buffer.start);
+
+  runTest("Consume Is O(1)", passed);
+}
+
+// A nearly full buffer with a small consumed head grows instead of moving
+// all of its data for a few bytes of space
+void testNoCompactWhenHeadIsSmall() {
+  Buffer buffer(16);
+
+  uint8_t testData[14] = {0};
+  for (size_t i = 0; i < sizeof(testData); i++) {
+    testData[i] = (uint8_t)i;
+  }
+  buffer.append(testData, sizeof(testData));
+  buffer.consume(2); // 2 bytes wasted at the head, 12 bytes of data
+
+  uint8_t more[3] = {100, 101, 102};
+  buffer.append(more, sizeof(more));
+
+  bool passed = (buffer.max_size > 16) && (buffer.data_size() == 15) &&
+                (buffer.data()[0] == 2) && (buffer.data()[11] == 13) &&
+                (buffer.data()[12] == 100) && (buffer.data()[14] == 102);
+
+  runTest("No Compact When Head Is Small", passed);
+}
+
+// Reading into the free tail: reserve, write in place, commit
+void testReserveTail() {
+  Buffer buffer;
+
+  uint8_t *tail = buffer.reserve_tail(100);
+  bool passed = (tail != nullptr) && (buffer.tail_space() >= 100) &&
+                (buffer.data_size() == 0);
+
+  for (int i = 0; i < 10; i++) {
+    tail[i] = (uint8_t)(i + 1);
+  }
+  buffer.commit_tail(10);
+  passed = passed && (buffer.data_size() == 10) && (buffer.data()[9] == 10);
+
+  // committing more than was reserved is ignored
+  buffer.commit_tail(buffer.tail_space() + 1);
+  passed = passed && (buffer.data_size() == 10);
+
+  // reserving more than the capacity keeps the data
+  buffer.consume(4);
+  tail = buffer.reserve_tail(4096);
+  passed = passed && (tail != nullptr) && (buffer.tail_space() >= 4096) &&
+           (buffer.data_size() == 6) && (buffer.data()[0] == 5) &&
+           (tail == buffer.data_end);
+
+  runTest("Reserve Tail", passed);
+}
+
+// Dropping the end of the data, as response_end() does on oversized replies
+void testTruncate() {
+  Buffer buffer(16);
+
+  uint8_t testData[] = {1, 2, 3, 4, 5};
+  buffer.append(testData, sizeof(testData));
+  buffer.truncate(2);
+  bool passed = (buffer.data_size() == 2) && (buffer.data()[1] == 2);
+
+  buffer.truncate(10); // larger than the data: no-op
+  passed = passed && (buffer.data_size() == 2);
+
+  runTest("Truncate", passed);
+}
+
+// Pipelined requests: many small appends and consumes keep the data intact
+// and the capacity bounded by the amount of live data
+void testPipeline() {
+  Buffer buffer(32);
+
+  bool passed = true;
+  uint32_t next_in = 0;
+  uint32_t next_out = 0;
+  for (int round = 0; round < 1000 && passed; round++) {
+    for (int i = 0; i < 7; i++) {
+      buffer.append((const uint8_t *)&next_in, 4);
+      next_in++;
+    }
+    // keep a backlog of ~3 messages around
+    while (buffer.data_size() > 12) {
+      uint32_t v = 0;
+      memcpy(&v, buffer.data(), 4);
+      buffer.consume(4);
+      passed = passed && (v == next_out);
+      next_out++;
+    }
+  }
+  passed = passed && (buffer.max_size <= 4 * 40); // at most 40 bytes live
+
+  runTest("Pipeline", passed);
+}
+
 int main() {
   std::cout << "Running Buffer Tests:" << std::endl;
 
@@ -181,7 +299,12 @@ int main() {
   testExpandBuffer();
   testEdgeCases();
   testFragmentation();
+  testConsumeIsO1();
+  testNoCompactWhenHeadIsSmall();
+  testReserveTail();
+  testTruncate();
+  testPipeline();
 
   std::cout << "All tests completed." << std::endl;
-  return 0;
+  return failures ? 1 : 0;
 }
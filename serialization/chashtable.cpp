@@ -0,0 +1,294 @@
+#include "chashtable.hpp"
+#include "ebr.hpp"
+#include <assert.h>
+#include <cstdlib>
+
+static CTab *ctab_new(size_t n)
+{
+    assert((n > 0) && ((n - 1) & n) == 0); // assert if n is power of 2
+    CTab *tab = new CTab();
+    tab->slots = (std::atomic<CNode *> *)calloc(n, sizeof(std::atomic<CNode *>));
+    tab->mask = n - 1;
+    return tab;
+}
+
+static void ctab_free(void *ptr)
+{
+    CTab *tab = (CTab *)ptr;
+    free(tab->slots);
+    delete tab;
+}
+
+void chm_init(CHMap *hmap)
+{
+    hmap->newer.store(ctab_new(k_chm_stripes), std::memory_order_release);
+}
+
+void chm_destroy(CHMap *hmap)
+{
+    if (CTab *tab = hmap->older.exchange(nullptr))
+    {
+        ctab_free(tab);
+    }
+    if (CTab *tab = hmap->newer.exchange(nullptr))
+    {
+        ctab_free(tab);
+    }
+}
+
+static CStripe *chm_stripe(CHMap *hmap, uint64_t hcode)
+{
+    return &hmap->stripes[hcode & (k_chm_stripes - 1)];
+}
+
+// readers: acquire loads all the way, a node is complete once it is linked
+static CNode *ctab_lookup(CTab *tab, CNode *key, bool (*eq)(CNode *, CNode *))
+{
+    CNode *cur = tab->slots[key->hcode & tab->mask].load(std::memory_order_acquire);
+    for (; cur; cur = cur->next.load(std::memory_order_acquire))
+    {
+        if (cur->hcode == key->hcode && eq(cur, key))
+        {
+            return cur;
+        }
+    }
+    return nullptr;
+}
+
+CNode *chm_lookup(CHMap *hmap, CNode *key, bool (*eq)(CNode *, CNode *))
+{
+    CStripe *st = chm_stripe(hmap, key->hcode);
+    while (true)
+    {
+        uint64_t seq = st->seq.load(std::memory_order_acquire);
+        if (seq & 1)
+        {
+            continue; // a bucket of this stripe is being moved right now
+        }
+        // newer first: the resize publishes older before newer
+        CNode *node = ctab_lookup(hmap->newer.load(std::memory_order_acquire), key, eq);
+        if (!node)
+        {
+            if (CTab *older = hmap->older.load(std::memory_order_acquire))
+            {
+                node = ctab_lookup(older, key, eq);
+            }
+        }
+        if (node)
+        {
+            return node;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (st->seq.load(std::memory_order_relaxed) == seq)
+        {
+            return nullptr;
+        }
+    }
+}
+
+// Writers, under the stripe lock. The tables cannot change meanwhile: a
+// resize starts and ends with every stripe locked.
+
+// the link that points to the node equal to key
+static std::atomic<CNode *> *ctab_find(CTab *tab, CNode *key,
+                                       bool (*eq)(CNode *, CNode *))
+{
+    std::atomic<CNode *> *from = &tab->slots[key->hcode & tab->mask];
+    for (CNode *cur; (cur = from->load(std::memory_order_relaxed)) != nullptr;
+         from = &cur->next)
+    {
+        if (cur->hcode == key->hcode && eq(cur, key))
+        {
+            return from;
+        }
+    }
+    return nullptr;
+}
+
+static std::atomic<CNode *> *chm_find(CHMap *hmap, CNode *key,
+                                      bool (*eq)(CNode *, CNode *))
+{
+    std::atomic<CNode *> *from = ctab_find(hmap->newer.load(std::memory_order_relaxed), key, eq);
+    if (!from)
+    {
+        if (CTab *older = hmap->older.load(std::memory_order_relaxed))
+        {
+            from = ctab_find(older, key, eq);
+        }
+    }
+    return from;
+}
+
+static void ctab_push(CTab *tab, CNode *node)
+{
+    std::atomic<CNode *> &slot = tab->slots[node->hcode & tab->mask];
+    node->next.store(slot.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    slot.store(node, std::memory_order_release);
+}
+
+static void chm_lock_all(CHMap *hmap)
+{
+    for (CStripe &st : hmap->stripes)
+    {
+        st.mu.lock();
+    }
+}
+
+static void chm_unlock_all(CHMap *hmap)
+{
+    for (CStripe &st : hmap->stripes)
+    {
+        st.mu.unlock();
+    }
+}
+
+// start migrating into a table twice the size of `from`, unless another
+// thread got there first
+static void chm_trigger_rehashing(CHMap *hmap, CTab *from)
+{
+    std::lock_guard<std::mutex> lock(hmap->migrate_mu);
+    if (hmap->older.load(std::memory_order_relaxed) ||
+        hmap->newer.load(std::memory_order_relaxed) != from)
+    {
+        return;
+    }
+    CTab *bigger = ctab_new((from->mask + 1) * 2);
+    chm_lock_all(hmap);
+    hmap->older.store(from, std::memory_order_relaxed);
+    hmap->newer.store(bigger, std::memory_order_release);
+    hmap->migrate_pos = 0;
+    chm_unlock_all(hmap);
+}
+
+bool chm_help_rehashing(CHMap *hmap, size_t work)
+{
+    if (!hmap->older.load(std::memory_order_acquire))
+    {
+        return false;
+    }
+    std::unique_lock<std::mutex> lock(hmap->migrate_mu, std::try_to_lock);
+    if (!lock.owns_lock())
+    {
+        return true; // someone else is on it
+    }
+    CTab *older = hmap->older.load(std::memory_order_relaxed);
+    if (!older)
+    {
+        return false;
+    }
+    CTab *newer = hmap->newer.load(std::memory_order_relaxed);
+    while (work > 0 && hmap->migrate_pos <= older->mask)
+    {
+        size_t pos = hmap->migrate_pos++;
+        CStripe *st = &hmap->stripes[pos & (k_chm_stripes - 1)];
+        std::lock_guard<std::mutex> slock(st->mu);
+        std::atomic<CNode *> &from = older->slots[pos];
+        if (from.load(std::memory_order_relaxed))
+        {
+            // seqlock write side: odd before the first relink is visible,
+            // even again after the last
+            uint64_t seq = st->seq.load(std::memory_order_relaxed);
+            st->seq.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            // release: readers reach the rest of the chain through it
+            while (CNode *node = from.load(std::memory_order_relaxed))
+            {
+                from.store(node->next.load(std::memory_order_relaxed),
+                           std::memory_order_release);
+                ctab_push(newer, node);
+            }
+            st->seq.store(seq + 2, std::memory_order_release);
+        }
+        work--;
+    }
+    if (hmap->migrate_pos <= older->mask)
+    {
+        return true;
+    }
+    chm_lock_all(hmap);
+    hmap->older.store(nullptr, std::memory_order_release);
+    chm_unlock_all(hmap);
+    ebr_retire(older, ctab_free); // readers may still be walking it
+    return false;
+}
+
+static CNode *chm_write(CHMap *hmap, CNode *node, bool (*eq)(CNode *, CNode *),
+                        bool replace)
+{
+    CStripe *st = chm_stripe(hmap, node->hcode);
+    CTab *grow = nullptr;
+    CNode *old = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(st->mu);
+        if (std::atomic<CNode *> *from = chm_find(hmap, node, eq))
+        {
+            old = from->load(std::memory_order_relaxed);
+            if (!replace)
+            {
+                return old;
+            }
+            node->next.store(old->next.load(std::memory_order_relaxed),
+                             std::memory_order_relaxed);
+            from->store(node, std::memory_order_release);
+        }
+        else
+        {
+            CTab *newer = hmap->newer.load(std::memory_order_relaxed);
+            ctab_push(newer, node);
+            size_t size = st->size.load(std::memory_order_relaxed) + 1;
+            st->size.store(size, std::memory_order_relaxed);
+            // the stripes fill up evenly, one of them stands for all
+            if (size * k_chm_stripes >= (newer->mask + 1) * k_chm_max_load_factor &&
+                !hmap->older.load(std::memory_order_relaxed))
+            {
+                grow = newer;
+            }
+        }
+    }
+    if (grow)
+    {
+        chm_trigger_rehashing(hmap, grow);
+    }
+    chm_help_rehashing(hmap, k_chm_rehashing_work);
+    return old;
+}
+
+CNode *chm_insert(CHMap *hmap, CNode *node, bool (*eq)(CNode *, CNode *))
+{
+    return chm_write(hmap, node, eq, false);
+}
+
+CNode *chm_upsert(CHMap *hmap, CNode *node, bool (*eq)(CNode *, CNode *))
+{
+    return chm_write(hmap, node, eq, true);
+}
+
+CNode *chm_delete(CHMap *hmap, CNode *key, bool (*eq)(CNode *, CNode *))
+{
+    CStripe *st = chm_stripe(hmap, key->hcode);
+    CNode *node = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(st->mu);
+        if (std::atomic<CNode *> *from = chm_find(hmap, key, eq))
+        {
+            node = from->load(std::memory_order_relaxed);
+            // the node keeps its next pointer, for readers standing on it
+            from->store(node->next.load(std::memory_order_relaxed),
+                        std::memory_order_release);
+            st->size.store(st->size.load(std::memory_order_relaxed) - 1,
+                           std::memory_order_relaxed);
+        }
+    }
+    chm_help_rehashing(hmap, k_chm_rehashing_work);
+    return node;
+}
+
+size_t chm_size(CHMap *hmap)
+{
+    size_t n = 0;
+    for (CStripe &st : hmap->stripes)
+    {
+        n += st.size.load(std::memory_order_relaxed);
+    }
+    return n;
+}
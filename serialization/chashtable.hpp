@@ -0,0 +1,75 @@
+#ifndef CHASHTABLE_HPP
+#define CHASHTABLE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+// Concurrent variant of the chained HMap, for read-mostly workloads served
+// by several threads:
+//  - readers take no lock: they walk the chains inside an EBR critical
+//    section (ebr.hpp), so nodes and tables are not freed under them.
+//  - writers lock one of k_chm_stripes stripes, picked by the low bits of
+//    the hash. Every table has at least that many buckets, so a bucket, and
+//    the two buckets it splits into on a resize, always share a stripe.
+//  - resizing is incremental as in hashtable.cpp: writers move a few old
+//    buckets each. Moving a bucket relinks its nodes, which can send a
+//    reader walking it off into the new table, so the stripe's sequence
+//    count is odd meanwhile and a lookup that found nothing retries when
+//    the count changed (a hit is always right). The new table, and the end
+//    of the migration, are published with release stores; the old table is
+//    retired through EBR.
+// Tables only grow. Nodes are intrusive; a node that was deleted or
+// replaced goes to ebr_retire() before it is freed or reused.
+
+const size_t k_chm_stripes = 256; // a power of 2
+const size_t k_chm_max_load_factor = 8;
+// old buckets moved per write while a resize is pending
+const size_t k_chm_rehashing_work = 8;
+
+struct CNode
+{
+    std::atomic<CNode *> next{nullptr};
+    uint64_t hcode = 0;
+};
+
+struct CTab
+{
+    std::atomic<CNode *> *slots = nullptr;
+    size_t mask = 0;
+};
+
+struct CStripe
+{
+    alignas(64) std::mutex mu;
+    std::atomic<uint64_t> seq{0}; // odd while one of its buckets is moved
+    std::atomic<size_t> size{0};  // nodes, written under mu
+};
+
+struct CHMap
+{
+    std::atomic<CTab *> newer{nullptr};
+    std::atomic<CTab *> older{nullptr};
+    std::mutex migrate_mu; // one migrating thread at a time
+    size_t migrate_pos = 0; // next old bucket, under migrate_mu
+    CStripe stripes[k_chm_stripes];
+};
+
+void chm_init(CHMap *hmap);
+// frees the tables, not the nodes; no other thread may use the map anymore
+void chm_destroy(CHMap *hmap);
+
+// Must be called inside ebr_enter() / ebr_exit(), and the node may only be
+// used until ebr_exit().
+CNode *chm_lookup(CHMap *hmap, CNode *key, bool (*eq)(CNode *, CNode *));
+// Inserts `node` unless an equal one exists, which is returned instead.
+CNode *chm_insert(CHMap *hmap, CNode *node, bool (*eq)(CNode *, CNode *));
+// Inserts `node` in place of an equal one and returns that, or nullptr.
+CNode *chm_upsert(CHMap *hmap, CNode *node, bool (*eq)(CNode *, CNode *));
+CNode *chm_delete(CHMap *hmap, CNode *key, bool (*eq)(CNode *, CNode *));
+// moves up to `work` old buckets; false once no resize is pending
+bool chm_help_rehashing(CHMap *hmap, size_t work);
+size_t chm_size(CHMap *hmap);
+
+#endif // CHASHTABLE_HPP
@@ -0,0 +1,424 @@
+// Concurrent hash table (chashtable.hpp) stress test and throughput
+// benchmark.
+//
+// Stress: rounds on a fresh map, so it keeps growing and migrating while
+// readers run. Half the threads write (insert, replace, delete) keys that
+// only they touch and remember what they should hold; the other half look up
+// keys at random and check what they find. A set of keys that is never
+// written must always be found, which catches lookups that miss a node while
+// its bucket is moved. At the end every writer key must be as its writer
+// left it. Retired items are poisoned before they are freed.
+//
+// Throughput: --keys items, then for each --threads value every thread runs
+// --read-pct lookups and replaces the rest, on the concurrent map and on the
+// serial HMap behind one mutex.
+//
+//   ./chm_bench [--threads 1,2,4,8] [--keys 1000000] [--read-pct 95]
+//               [--seconds 2] [--stress-seconds 2]
+#include "chashtable.hpp"
+#include "ebr.hpp"
+#include "hash.hpp"
+#include "hashtable.hpp"
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+#define container_of(ptr, T, member) ((T *)((char *)ptr - offsetof(T, member)))
+
+const uint64_t k_live = 0x11FE11FE11FE11FEull;
+const uint64_t k_dead = 0xDEADDEADDEADDEADull;
+
+// where the throughput workers put what they read, so the reads stay
+static std::atomic<uint64_t> g_sink{0};
+
+struct Item {
+    CNode node;
+    uint64_t key = 0;
+    uint64_t version = 0;
+    uint64_t magic = k_live;
+};
+
+static uint64_t now_ns() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t &s) {
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+}
+
+static uint64_t key_hash(uint64_t key) {
+    return hash64(&key, 8, g_hash_seed);
+}
+
+static bool item_eq(CNode *x, CNode *y) {
+    return container_of(x, Item, node)->key == container_of(y, Item, node)->key;
+}
+
+static Item *item_new(uint64_t key, uint64_t version) {
+    Item *item = new Item();
+    item->key = key;
+    item->version = version;
+    item->node.hcode = key_hash(key);
+    return item;
+}
+
+static void item_free(void *ptr) {
+    Item *item = (Item *)ptr;
+    item->magic = k_dead;
+    delete item;
+}
+
+static void fail(const char *what, uint64_t key) {
+    fprintf(stderr, "FAILED: %s (key %llu)\n", what, (unsigned long long)key);
+    exit(1);
+}
+
+// at the end of a run: free what this thread retired, nobody reads anymore
+static void ebr_drain() {
+    while (ebr_pending() > 0) {
+        ebr_collect();
+    }
+}
+
+struct Config {
+    std::vector<size_t> threads = {1, 2, 4, 8};
+    size_t keys = 1000000;
+    uint32_t read_pct = 95;
+    double seconds = 2;
+    double stress_seconds = 2;
+};
+
+const size_t k_stable_keys = 1000;
+const size_t k_writer_keys = 50000; // per writer
+const uint64_t k_stress_round_ns = 200 * 1000 * 1000;
+
+// writer w owns the keys k_stable_keys + w + i * nwriters
+static void stress_writer(CHMap *map, size_t w, size_t nwriters,
+                          std::vector<uint64_t> &expect, std::atomic<bool> &stop) {
+    uint64_t rnd = 0x9E3779B97F4A7C15ull * (w + 1);
+    uint64_t version = 0;
+    while (!stop.load(std::memory_order_relaxed)) {
+        size_t i = xorshift(rnd) % expect.size();
+        uint64_t key = k_stable_keys + w + i * nwriters;
+        uint32_t op = xorshift(rnd) % 3;
+        if (op == 0) {
+            Item *item = item_new(key, ++version);
+            if (CNode *old = chm_insert(map, &item->node, item_eq)) {
+                if (container_of(old, Item, node)->version != expect[i]) {
+                    fail("insert found the wrong version", key);
+                }
+                delete item; // never linked
+            } else {
+                if (expect[i]) {
+                    fail("insert found nothing", key);
+                }
+                expect[i] = version;
+            }
+        } else if (op == 1) {
+            Item *item = item_new(key, ++version);
+            CNode *old = chm_upsert(map, &item->node, item_eq);
+            if ((old ? container_of(old, Item, node)->version : 0) != expect[i]) {
+                fail("upsert replaced the wrong version", key);
+            }
+            if (old) {
+                ebr_retire(container_of(old, Item, node), item_free);
+            }
+            expect[i] = version;
+        } else {
+            Item key_item;
+            key_item.key = key;
+            key_item.node.hcode = key_hash(key);
+            CNode *old = chm_delete(map, &key_item.node, item_eq);
+            if ((old ? container_of(old, Item, node)->version : 0) != expect[i]) {
+                fail("delete removed the wrong version", key);
+            }
+            if (old) {
+                ebr_retire(container_of(old, Item, node), item_free);
+            }
+            expect[i] = 0;
+        }
+    }
+    ebr_drain();
+}
+
+static void stress_reader(CHMap *map, size_t r, size_t nwriters,
+                          std::atomic<bool> &stop, std::atomic<uint64_t> &lookups) {
+    uint64_t rnd = 0xD1B54A32D192ED03ull * (r + 1);
+    uint64_t n = 0;
+    while (!stop.load(std::memory_order_relaxed)) {
+        uint64_t x = xorshift(rnd);
+        bool stable = x & 1;
+        uint64_t key = stable ? (x >> 1) % k_stable_keys
+                              : k_stable_keys + (x >> 1) % (k_writer_keys * nwriters);
+        Item key_item;
+        key_item.key = key;
+        key_item.node.hcode = key_hash(key);
+        ebr_enter();
+        CNode *node = chm_lookup(map, &key_item.node, item_eq);
+        if (node) {
+            Item *item = container_of(node, Item, node);
+            if (item->magic != k_live || item->key != key) {
+                fail("lookup returned a dead or wrong item", key);
+            }
+        } else if (stable) {
+            fail("stable key not found", key);
+        }
+        ebr_exit();
+        n++;
+    }
+    lookups += n;
+}
+
+static void run_stress(const Config &cfg) {
+    size_t nthreads = 0;
+    for (size_t n : cfg.threads) {
+        nthreads = n > nthreads ? n : nthreads;
+    }
+    nthreads = nthreads < 2 ? 2 : nthreads;
+    size_t nwriters = nthreads / 2;
+    size_t nreaders = nthreads - nwriters;
+
+    uint64_t end = now_ns() + uint64_t(cfg.stress_seconds * 1e9);
+    size_t rounds = 0;
+    std::atomic<uint64_t> lookups{0};
+    while (rounds == 0 || now_ns() < end) {
+        CHMap *map = new CHMap();
+        chm_init(map);
+        for (uint64_t key = 0; key < k_stable_keys; ++key) {
+            chm_insert(map, &item_new(key, 1)->node, item_eq);
+        }
+        std::vector<std::vector<uint64_t>> expect(nwriters,
+                                                  std::vector<uint64_t>(k_writer_keys, 0));
+        std::atomic<bool> stop{false};
+        std::vector<std::thread> threads;
+        for (size_t w = 0; w < nwriters; ++w) {
+            threads.emplace_back(stress_writer, map, w, nwriters, std::ref(expect[w]),
+                                 std::ref(stop));
+        }
+        for (size_t r = 0; r < nreaders; ++r) {
+            threads.emplace_back(stress_reader, map, r, nwriters, std::ref(stop),
+                                 std::ref(lookups));
+        }
+        uint64_t round_end = now_ns() + k_stress_round_ns;
+        while (now_ns() < round_end) {
+            struct timespec ts = {0, 1000000};
+            nanosleep(&ts, NULL);
+        }
+        stop = true;
+        for (std::thread &t : threads) {
+            t.join();
+        }
+
+        // what the writers left must be exactly what is in the map
+        size_t present = k_stable_keys;
+        for (size_t w = 0; w < nwriters; ++w) {
+            for (size_t i = 0; i < k_writer_keys; ++i) {
+                uint64_t key = k_stable_keys + w + i * nwriters;
+                Item key_item;
+                key_item.key = key;
+                key_item.node.hcode = key_hash(key);
+                CNode *node = chm_delete(map, &key_item.node, item_eq);
+                uint64_t got = node ? container_of(node, Item, node)->version : 0;
+                if (got != expect[w][i]) {
+                    fail("final state differs", key);
+                }
+                if (node) {
+                    present++;
+                    item_free(container_of(node, Item, node));
+                }
+            }
+        }
+        if (chm_size(map) != k_stable_keys) {
+            fail("size differs", present);
+        }
+        for (uint64_t key = 0; key < k_stable_keys; ++key) {
+            Item key_item;
+            key_item.key = key;
+            key_item.node.hcode = key_hash(key);
+            item_free(container_of(chm_delete(map, &key_item.node, item_eq), Item, node));
+        }
+        ebr_drain();
+        chm_destroy(map);
+        delete map;
+        rounds++;
+    }
+    EbrStats st;
+    ebr_stats(&st);
+    printf("stress: %zu writers, %zu readers, %zu rounds, %llu lookups, "
+           "%llu retired, %llu freed: ok\n",
+           nwriters, nreaders, rounds, (unsigned long long)lookups.load(),
+           (unsigned long long)st.retired, (unsigned long long)st.freed);
+    fflush(stdout);
+}
+
+// the serial HMap behind one mutex, what a single keyspace thread amounts to
+struct LockedItem {
+    HNode node;
+    uint64_t key = 0;
+    uint64_t version = 0;
+};
+
+static bool locked_item_eq(HNode *x, HNode *y) {
+    return container_of(x, LockedItem, node)->key == container_of(y, LockedItem, node)->key;
+}
+
+struct LockedMap {
+    std::mutex mu;
+    HMap map;
+};
+
+static void chm_worker(CHMap *map, const Config &cfg, size_t t, uint64_t deadline,
+                       std::atomic<uint64_t> &ops) {
+    uint64_t rnd = 0x9E3779B97F4A7C15ull * (t + 1);
+    uint64_t n = 0, sum = 0;
+    while ((n & 255) || now_ns() < deadline) {
+        uint64_t key = xorshift(rnd) % cfg.keys;
+        if (xorshift(rnd) % 100 < cfg.read_pct) {
+            Item key_item;
+            key_item.key = key;
+            key_item.node.hcode = key_hash(key);
+            ebr_enter();
+            if (CNode *node = chm_lookup(map, &key_item.node, item_eq)) {
+                sum += container_of(node, Item, node)->version;
+            }
+            ebr_exit();
+        } else {
+            Item *item = item_new(key, n);
+            if (CNode *old = chm_upsert(map, &item->node, item_eq)) {
+                ebr_retire(container_of(old, Item, node), item_free);
+            }
+        }
+        n++;
+    }
+    ebr_drain();
+    ops += n;
+    g_sink += sum;
+}
+
+static void locked_worker(LockedMap *lm, const Config &cfg, size_t t, uint64_t deadline,
+                          std::atomic<uint64_t> &ops) {
+    uint64_t rnd = 0x9E3779B97F4A7C15ull * (t + 1);
+    uint64_t n = 0, sum = 0;
+    while ((n & 255) || now_ns() < deadline) {
+        uint64_t key = xorshift(rnd) % cfg.keys;
+        LockedItem key_item;
+        key_item.key = key;
+        key_item.node.hcode = key_hash(key);
+        if (xorshift(rnd) % 100 < cfg.read_pct) {
+            std::lock_guard<std::mutex> lock(lm->mu);
+            if (HNode *node = h_lookup(&lm->map, &key_item.node, locked_item_eq)) {
+                sum += container_of(node, LockedItem, node)->version;
+            }
+        } else {
+            LockedItem *item = new LockedItem();
+            item->key = key;
+            item->version = n;
+            item->node.hcode = key_item.node.hcode;
+            HNode *old = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(lm->mu);
+                old = hm_delete(&lm->map, &key_item.node, locked_item_eq);
+                hm_insert(&lm->map, &item->node);
+            }
+            if (old) {
+                delete container_of(old, LockedItem, node);
+            }
+        }
+        n++;
+    }
+    ops += n;
+    g_sink += sum;
+}
+
+static void run_throughput(const Config &cfg) {
+    CHMap *cmap = new CHMap();
+    chm_init(cmap);
+    LockedMap *lmap = new LockedMap();
+    for (uint64_t key = 0; key < cfg.keys; ++key) {
+        chm_insert(cmap, &item_new(key, 0)->node, item_eq);
+        LockedItem *item = new LockedItem();
+        item->key = key;
+        item->node.hcode = key_hash(key);
+        hm_insert(&lmap->map, &item->node);
+    }
+    while (chm_help_rehashing(cmap, 1 << 20)) {
+    }
+    while (hm_rehash_for(&lmap->map, 1000000)) {
+    }
+
+    printf("%zu keys, %u%% reads\n", cfg.keys, cfg.read_pct);
+    for (size_t nthreads : cfg.threads) {
+        double mops[2];
+        for (int locked = 0; locked < 2; ++locked) {
+            std::atomic<uint64_t> ops{0};
+            uint64_t start = now_ns();
+            uint64_t deadline = start + uint64_t(cfg.seconds * 1e9);
+            std::vector<std::thread> threads;
+            for (size_t t = 0; t < nthreads; ++t) {
+                if (locked) {
+                    threads.emplace_back(locked_worker, lmap, std::cref(cfg), t, deadline,
+                                         std::ref(ops));
+                } else {
+                    threads.emplace_back(chm_worker, cmap, std::cref(cfg), t, deadline,
+                                         std::ref(ops));
+                }
+            }
+            for (std::thread &t : threads) {
+                t.join();
+            }
+            mops[locked] = ops.load() * 1e3 / (now_ns() - start);
+        }
+        printf("threads=%-3zu chm %8.2f M ops/s   mutex+HMap %8.2f M ops/s\n", nthreads,
+               mops[0], mops[1]);
+        fflush(stdout);
+    }
+    ebr_drain();
+}
+
+static std::vector<size_t> parse_list(const char *s) {
+    std::vector<size_t> out;
+    while (*s) {
+        char *end = NULL;
+        out.push_back(strtoull(s, &end, 10));
+        s = (*end == ',') ? end + 1 : end;
+        if (end == s && *s) {
+            break;
+        }
+    }
+    return out;
+}
+
+int main(int argc, char **argv) {
+    Config cfg;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "--threads")) {
+            cfg.threads = parse_list(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--keys")) {
+            cfg.keys = strtoull(argv[i + 1], NULL, 10);
+        } else if (!strcmp(argv[i], "--read-pct")) {
+            cfg.read_pct = atoi(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--seconds")) {
+            cfg.seconds = atof(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--stress-seconds")) {
+            cfg.stress_seconds = atof(argv[i + 1]);
+        } else {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    hash_seed_init();
+    run_stress(cfg);
+    run_throughput(cfg);
+    return 0;
+}
@@ -0,0 +1,161 @@
+// SET/DEL churn benchmark for the entry allocator. Built twice by make bench:
+// slab_churn_bench uses the slab allocator, malloc_churn_bench the same code
+// with -DSLAB_USE_MALLOC. Reports throughput, and RSS against the bytes the
+// live entries actually hold.
+//
+//   ./slab_churn_bench [live keys] [churn ops]     default 1000000 10000000
+#include "entry.hpp"
+#include "hash.hpp"
+#include "hashtable.hpp"
+#include "slab.hpp"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <time.h>
+#include <unistd.h>
+
+#define container_of(ptr, T, member) ((T *)((char *)ptr - offsetof(T, member)))
+
+struct BenchKey {
+    HNode node;
+    std::string_view key;
+};
+
+static bool bench_eq(HNode *node, HNode *key) {
+    return entry_key(container_of(node, Entry, node)) ==
+           container_of(key, BenchKey, node)->key;
+}
+
+static uint64_t now_ns() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+static size_t rss_bytes() {
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) {
+        return 0;
+    }
+    unsigned long pages = 0, resident = 0;
+    if (fscanf(f, "%lu %lu", &pages, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(f);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static uint64_t xorshift(uint64_t &s) {
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+}
+
+static HMap g_map;
+static size_t g_live_bytes = 0;
+static char g_val[1024];
+
+// mostly small values with a tail of larger ones, like a cache
+static size_t value_size(uint64_t r) {
+    return (r % 8 == 0) ? 65 + r % 700 : 4 + r % 60;
+}
+
+static void do_set(uint64_t id, size_t vlen) {
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "key:%llu", (unsigned long long)id);
+    BenchKey key;
+    key.key = std::string_view(buf, n);
+    key.node.hcode = hash64(buf, n, g_hash_seed);
+    HNode *node = h_lookup(&g_map, &key.node, bench_eq);
+    if (node) {
+        Entry *ent = container_of(node, Entry, node);
+        g_live_bytes -= entry_mem_usage(ent);
+        entry_set_val(ent, std::string_view(g_val, vlen));
+        g_live_bytes += entry_mem_usage(ent);
+        return;
+    }
+    Entry *ent = entry_new(key.key, key.node.hcode, std::string_view(g_val, vlen));
+    g_live_bytes += entry_mem_usage(ent);
+    hm_insert(&g_map, &ent->node);
+}
+
+static bool do_del(uint64_t id) {
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "key:%llu", (unsigned long long)id);
+    BenchKey key;
+    key.key = std::string_view(buf, n);
+    key.node.hcode = hash64(buf, n, g_hash_seed);
+    HNode *node = hm_delete(&g_map, &key.node, bench_eq);
+    if (!node) {
+        return false;
+    }
+    Entry *ent = container_of(node, Entry, node);
+    g_live_bytes -= entry_mem_usage(ent);
+    entry_del(ent);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    size_t nkeys = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+    size_t nops = argc > 2 ? strtoull(argv[2], NULL, 10) : 10000000;
+    hash_seed_init();
+    memset(g_val, 'v', sizeof(g_val));
+
+#ifdef SLAB_USE_MALLOC
+    printf("allocator: malloc\n");
+#else
+    printf("allocator: slab\n");
+#endif
+    size_t rss0 = rss_bytes();
+    uint64_t rnd = 0x9E3779B97F4A7C15ull;
+    uint64_t t0 = now_ns();
+    for (size_t i = 0; i < nkeys; ++i) {
+        do_set(i, value_size(xorshift(rnd)));
+    }
+    uint64_t t1 = now_ns();
+    printf("fill   %8zu keys   %6.2f M ops/s  rss %7.1f MiB  live %7.1f MiB\n",
+           nkeys, nkeys * 1e3 / (t1 - t0), (rss_bytes() - rss0) / 1048576.0,
+           g_live_bytes / 1048576.0);
+
+    // churn: the key space is twice the live set, so about half of the
+    // random SETs create a key and half of the DELs find one
+    for (int round = 0; round < 3; ++round) {
+        uint64_t t2 = now_ns();
+        for (size_t i = 0; i < nops; ++i) {
+            uint64_t r = xorshift(rnd);
+            uint64_t id = (r >> 8) % (nkeys * 2);
+            if (r & 1) {
+                do_set(id, value_size(r >> 20));
+            } else {
+                do_del(id);
+            }
+        }
+        uint64_t t3 = now_ns();
+        size_t rss = rss_bytes() - rss0;
+        printf("churn  %8zu ops    %6.2f M ops/s  rss %7.1f MiB  live %7.1f MiB"
+               "  rss/live %.2f\n",
+               nops, nops * 1e3 / (t3 - t2), rss / 1048576.0,
+               g_live_bytes / 1048576.0, double(rss) / g_live_bytes);
+    }
+
+    // mass delete: how much memory goes back
+    for (size_t id = 0; id < nkeys * 2; ++id) {
+        if (id % 10 != 0) {
+            do_del(id);
+        }
+    }
+    printf("delete 90%%                            rss %7.1f MiB  live %7.1f MiB\n",
+           (rss_bytes() - rss0) / 1048576.0, g_live_bytes / 1048576.0);
+
+#ifndef SLAB_USE_MALLOC
+    SlabStats st;
+    slab_stats(&st);
+    printf("slabs %zu, free slabs %zu, used %.1f MiB of %.1f MiB resident\n",
+           st.slabs, st.free_slabs, st.used_bytes / 1048576.0,
+           st.resident_bytes / 1048576.0);
+#endif
+    return 0;
+}
@@ -0,0 +1,298 @@
+// Connection-count scaling benchmark for the server's event loop backends.
+//
+// For every backend and every idle-connection count, this starts a fresh
+// ./server, parks N idle connections on it, then drives a few active
+// connections with pipelined GETs for a fixed time. With the poll backend the
+// cost of each loop iteration grows with the idle connections, with epoll it
+// should stay flat.
+//
+//   ./conn_bench [--server ./server] [--idle 0,1000,10000] [--active 4]
+//                [--pipeline 16] [--seconds 3]
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/ip.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+static void die(const char *msg) {
+    int err = errno;
+    fprintf(stderr, "[%d] %s\n", err, msg);
+    abort();
+}
+
+static uint64_t now_us() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return uint64_t(tv.tv_sec) * 1000000 + tv.tv_nsec / 1000;
+}
+
+static int connect_to(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        die("socket()");
+    }
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = ntohs(port);
+    addr.sin_addr.s_addr = ntohl(INADDR_LOOPBACK);
+    if (connect(fd, (const struct sockaddr *)&addr, sizeof(addr))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// one request: [len][nstr][len][str]...
+static void append_req(std::string &out, const std::vector<std::string> &cmd) {
+    uint32_t len = 4;
+    for (const std::string &s : cmd) {
+        len += 4 + s.size();
+    }
+    out.append((const char *)&len, 4);
+    uint32_t n = cmd.size();
+    out.append((const char *)&n, 4);
+    for (const std::string &s : cmd) {
+        uint32_t p = s.size();
+        out.append((const char *)&p, 4);
+        out.append(s);
+    }
+}
+
+static bool write_all(int fd, const char *buf, size_t n) {
+    while (n > 0) {
+        ssize_t rv = write(fd, buf, n);
+        if (rv <= 0) {
+            return false;
+        }
+        n -= rv;
+        buf += rv;
+    }
+    return true;
+}
+
+struct Active {
+    int fd = -1;
+    std::string rbuf;
+    uint32_t inflight = 0;
+};
+
+// returns the number of complete responses consumed from the buffer
+static uint32_t consume_responses(std::string &rbuf) {
+    uint32_t n = 0;
+    size_t pos = 0;
+    while (rbuf.size() - pos >= 4) {
+        uint32_t len = 0;
+        memcpy(&len, rbuf.data() + pos, 4);
+        if (rbuf.size() - pos < 4 + len) {
+            break;
+        }
+        pos += 4 + len;
+        n++;
+    }
+    rbuf.erase(0, pos);
+    return n;
+}
+
+static double proc_cpu_seconds(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return 0;
+    }
+    char buf[1024];
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    // fields after the ")" of the command name; utime and stime are 14 and 15
+    const char *p = strrchr(buf, ')');
+    unsigned long utime = 0, stime = 0;
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                     &utime, &stime) != 2) {
+        return 0;
+    }
+    return double(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+struct Config {
+    const char *server = "./server";
+    std::vector<size_t> idle = {0, 1000, 10000};
+    size_t active = 4;
+    uint32_t pipeline = 16;
+    double seconds = 3;
+    uint16_t port = 12340;
+};
+
+static void run_one(const Config &cfg, const char *backend, bool et, size_t idle) {
+    uint16_t port = cfg.port;
+    pid_t pid = fork();
+    if (pid < 0) {
+        die("fork()");
+    }
+    if (pid == 0) {
+        // silence the per-connection log lines
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, 2);
+        char portbuf[16];
+        snprintf(portbuf, sizeof(portbuf), "%u", port);
+        if (et) {
+            execl(cfg.server, cfg.server, "--port", portbuf, "--backend", backend,
+                  "--edge-triggered", (char *)NULL);
+        } else {
+            execl(cfg.server, cfg.server, "--port", portbuf, "--backend", backend,
+                  (char *)NULL);
+        }
+        _exit(127);
+    }
+
+    // wait for the server to come up
+    int probe = -1;
+    for (int i = 0; i < 200 && probe < 0; ++i) {
+        usleep(10000);
+        probe = connect_to(port);
+    }
+    if (probe < 0) {
+        die("server did not start");
+    }
+    close(probe);
+
+    std::vector<int> idle_fds;
+    for (size_t i = 0; i < idle; ++i) {
+        int fd = connect_to(port);
+        if (fd < 0) {
+            fprintf(stderr, "only opened %zu idle connections\n", i);
+            break;
+        }
+        idle_fds.push_back(fd);
+    }
+
+    std::string batch;
+    for (uint32_t i = 0; i < cfg.pipeline; ++i) {
+        append_req(batch, {"get", "bench:key"});
+    }
+
+    std::vector<Active> conns(cfg.active);
+    std::vector<struct pollfd> pfds(cfg.active);
+    for (size_t i = 0; i < conns.size(); ++i) {
+        conns[i].fd = connect_to(port);
+        if (conns[i].fd < 0) {
+            die("connect(active)");
+        }
+        pfds[i] = {conns[i].fd, POLLIN, 0};
+    }
+
+    double cpu_start = proc_cpu_seconds(pid);
+    uint64_t start = now_us();
+    uint64_t deadline = start + uint64_t(cfg.seconds * 1e6);
+    uint64_t done = 0;
+    char rbuf[64 * 1024];
+    while (now_us() < deadline) {
+        for (Active &c : conns) {
+            if (c.inflight == 0) {
+                if (!write_all(c.fd, batch.data(), batch.size())) {
+                    die("write()");
+                }
+                c.inflight = cfg.pipeline;
+            }
+        }
+        int rv = poll(pfds.data(), pfds.size(), 1000);
+        if (rv < 0 && errno != EINTR) {
+            die("poll()");
+        }
+        for (size_t i = 0; i < conns.size(); ++i) {
+            if (!(pfds[i].revents & POLLIN)) {
+                continue;
+            }
+            ssize_t n = read(conns[i].fd, rbuf, sizeof(rbuf));
+            if (n <= 0) {
+                die("read()");
+            }
+            conns[i].rbuf.append(rbuf, n);
+            uint32_t got = consume_responses(conns[i].rbuf);
+            assert(got <= conns[i].inflight);
+            conns[i].inflight -= got;
+            done += got;
+        }
+    }
+    double elapsed = (now_us() - start) / 1e6;
+    double cpu = proc_cpu_seconds(pid) - cpu_start;
+
+    printf("%-16s idle=%-7zu active=%-3zu %10.0f req/s  %7.2f us server cpu/req\n",
+           et ? "epoll (ET)" : backend, idle_fds.size(), conns.size(),
+           done / elapsed, done ? cpu * 1e6 / done : 0.0);
+    fflush(stdout);
+
+    for (Active &c : conns) {
+        close(c.fd);
+    }
+    for (int fd : idle_fds) {
+        close(fd);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+}
+
+static std::vector<size_t> parse_list(const char *s) {
+    std::vector<size_t> out;
+    while (*s) {
+        char *end = NULL;
+        out.push_back(strtoull(s, &end, 10));
+        s = (*end == ',') ? end + 1 : end;
+        if (end == s && *s) {
+            break;
+        }
+    }
+    return out;
+}
+
+int main(int argc, char **argv) {
+    Config cfg;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "--server")) {
+            cfg.server = argv[i + 1];
+        } else if (!strcmp(argv[i], "--idle")) {
+            cfg.idle = parse_list(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--active")) {
+            cfg.active = atoi(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--pipeline")) {
+            cfg.pipeline = atoi(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--seconds")) {
+            cfg.seconds = atof(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--port")) {
+            cfg.port = atoi(argv[i + 1]);
+        } else {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    // idle connections need one fd each on both sides
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    for (size_t idle : cfg.idle) {
+        run_one(cfg, "poll", false, idle);
+        run_one(cfg, "epoll", false, idle);
+        run_one(cfg, "epoll", true, idle);
+        run_one(cfg, "uring", false, idle);
+        cfg.port++; // avoid TIME_WAIT leftovers on the previous port
+    }
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include "ebr.hpp"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+// a thread's published state: (epoch << 1) | 1 inside a critical section,
+// 0 outside
+struct EbrRecord
+{
+    alignas(64) std::atomic<uint64_t> state{0};
+    std::atomic<bool> used{false};
+};
+
+struct EbrRetired
+{
+    void *ptr;
+    void (*fn)(void *);
+    uint64_t epoch; // when it was retired
+};
+
+static struct
+{
+    std::atomic<uint64_t> epoch{1};
+    EbrRecord records[k_ebr_max_threads];
+    std::atomic<size_t> nrecords{0}; // records[0..nrecords) were ever used
+    std::atomic<uint64_t> retired{0};
+    std::atomic<uint64_t> freed{0};
+    // left by threads that exited, adopted by the next ebr_collect()
+    std::mutex orphans_mu;
+    std::vector<EbrRetired> orphans;
+    std::atomic<bool> has_orphans{false};
+} g_ebr;
+
+struct EbrLocal
+{
+    EbrRecord *rec = nullptr;
+    uint32_t depth = 0;
+    std::vector<EbrRetired> limbo;
+
+    ~EbrLocal();
+};
+
+static thread_local EbrLocal t_ebr;
+
+EbrLocal::~EbrLocal()
+{
+    if (!limbo.empty())
+    {
+        std::lock_guard<std::mutex> lock(g_ebr.orphans_mu);
+        g_ebr.orphans.insert(g_ebr.orphans.end(), limbo.begin(), limbo.end());
+        g_ebr.has_orphans.store(true, std::memory_order_release);
+    }
+    if (rec)
+    {
+        rec->state.store(0, std::memory_order_release);
+        rec->used.store(false, std::memory_order_release);
+    }
+}
+
+static EbrRecord *ebr_record()
+{
+    if (t_ebr.rec)
+    {
+        return t_ebr.rec;
+    }
+    for (size_t i = 0; i < k_ebr_max_threads; ++i)
+    {
+        EbrRecord *rec = &g_ebr.records[i];
+        bool expected = false;
+        if (!rec->used.load(std::memory_order_relaxed) &&
+            rec->used.compare_exchange_strong(expected, true))
+        {
+            size_t n = g_ebr.nrecords.load();
+            while (n < i + 1 && !g_ebr.nrecords.compare_exchange_weak(n, i + 1))
+            {
+            }
+            t_ebr.rec = rec;
+            return rec;
+        }
+    }
+    fprintf(stderr, "ebr: more than %zu threads\n", k_ebr_max_threads);
+    abort();
+}
+
+void ebr_enter()
+{
+    if (t_ebr.depth++ > 0)
+    {
+        return;
+    }
+    EbrRecord *rec = ebr_record();
+    uint64_t e = g_ebr.epoch.load(std::memory_order_relaxed);
+    rec->state.store((e << 1) | 1, std::memory_order_relaxed);
+    // the state must be visible before any pointer of the structure is read
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void ebr_exit()
+{
+    if (--t_ebr.depth > 0)
+    {
+        return;
+    }
+    t_ebr.rec->state.store(0, std::memory_order_release);
+}
+
+// the epoch can move on once every thread inside a critical section has
+// seen the current one
+static void ebr_try_advance()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t e = g_ebr.epoch.load(std::memory_order_relaxed);
+    size_t n = g_ebr.nrecords.load(std::memory_order_acquire);
+    for (size_t i = 0; i < n; ++i)
+    {
+        // acquire: pairs with the release in ebr_exit(), so whatever the
+        // reader did comes before what is freed after this
+        uint64_t s = g_ebr.records[i].state.load(std::memory_order_acquire);
+        if ((s & 1) && (s >> 1) != e)
+        {
+            return;
+        }
+    }
+    g_ebr.epoch.compare_exchange_strong(e, e + 1);
+}
+
+void ebr_collect()
+{
+    if (g_ebr.has_orphans.load(std::memory_order_acquire))
+    {
+        std::lock_guard<std::mutex> lock(g_ebr.orphans_mu);
+        g_ebr.has_orphans.store(false, std::memory_order_relaxed);
+        t_ebr.limbo.insert(t_ebr.limbo.end(), g_ebr.orphans.begin(),
+                           g_ebr.orphans.end());
+        g_ebr.orphans.clear();
+    }
+    ebr_try_advance();
+    uint64_t e = g_ebr.epoch.load(std::memory_order_acquire);
+    std::vector<EbrRetired> &limbo = t_ebr.limbo;
+    size_t kept = 0;
+    for (size_t i = 0; i < limbo.size(); ++i)
+    {
+        if (limbo[i].epoch + 2 <= e)
+        {
+            limbo[i].fn(limbo[i].ptr);
+        }
+        else
+        {
+            limbo[kept++] = limbo[i];
+        }
+    }
+    g_ebr.freed.fetch_add(limbo.size() - kept, std::memory_order_relaxed);
+    limbo.resize(kept);
+}
+
+void ebr_retire(void *ptr, void (*fn)(void *))
+{
+    // read after the unlink that made ptr unreachable
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t e = g_ebr.epoch.load(std::memory_order_relaxed);
+    t_ebr.limbo.push_back(EbrRetired{ptr, fn, e});
+    g_ebr.retired.fetch_add(1, std::memory_order_relaxed);
+    if (t_ebr.limbo.size() % k_ebr_batch == 0)
+    {
+        ebr_collect();
+    }
+}
+
+size_t ebr_pending()
+{
+    return t_ebr.limbo.size();
+}
+
+void ebr_stats(EbrStats *out)
+{
+    out->epoch = g_ebr.epoch.load(std::memory_order_relaxed);
+    out->retired = g_ebr.retired.load(std::memory_order_relaxed);
+    out->freed = g_ebr.freed.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,46 @@
+#ifndef EBR_HPP
+#define EBR_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// Epoch-based reclamation: lets readers walk shared structures without
+// locks while writers unlink and free nodes under them.
+//
+// A reader brackets its accesses with ebr_enter() / ebr_exit(), which
+// publish the global epoch it started in. A writer that unlinked an object
+// hands it to ebr_retire() instead of freeing it; the object is freed once
+// the global epoch has advanced twice since, which only happens after every
+// thread that was inside a critical section at the time has left it. The
+// epoch advances when a thread retiring objects finds every active thread
+// already in the current epoch.
+//
+// Pointers found inside a critical section stay valid until its ebr_exit().
+// Critical sections nest. Threads register themselves on first use, and
+// what a thread leaves behind at exit is freed by the others later.
+
+const size_t k_ebr_max_threads = 256;
+// retired objects a thread collects before it tries to advance the epoch
+const size_t k_ebr_batch = 64;
+
+void ebr_enter();
+void ebr_exit();
+// fn(ptr) once no reader can still see ptr
+void ebr_retire(void *ptr, void (*fn)(void *));
+// Advances the epoch if it can and frees what became safe. A thread that
+// retired objects and then stops (e.g. at shutdown, with no reader left)
+// calls it until ebr_pending() is 0.
+void ebr_collect();
+// objects this thread retired that are not freed yet
+size_t ebr_pending();
+
+struct EbrStats
+{
+    uint64_t epoch = 0;
+    uint64_t retired = 0; // by all threads so far
+    uint64_t freed = 0;
+};
+
+void ebr_stats(EbrStats *out);
+
+#endif // EBR_HPP
@@ -0,0 +1,141 @@
+#include "entry.hpp"
+#include "slab.hpp"
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+static char *val_area(Entry *ent)
+{
+    return ent->data + ent->klen;
+}
+
+static char *ext_ptr(Entry *ent)
+{
+    char *ext;
+    memcpy(&ext, val_area(ent), sizeof(ext));
+    return ext;
+}
+
+static size_t entry_alloc_size(const Entry *ent)
+{
+    return sizeof(Entry) + ent->klen + ent->vcap;
+}
+
+// a value over k_slab_max gets a ValBlock
+static char *ext_alloc(size_t len)
+{
+    if (len <= k_slab_max)
+    {
+        return (char *)slab_alloc(len);
+    }
+    ValBlock *blk = new (slab_alloc(valblock_size(len))) ValBlock();
+    blk->len = (uint32_t)len;
+    return blk->data;
+}
+
+static void entry_free_ext(Entry *ent)
+{
+    if (!(ent->flags & ENT_VAL_EXT))
+    {
+        return;
+    }
+    if (ValBlock *blk = entry_val_block(ent))
+    {
+        // the last reference may go on another thread
+        slab_disown_large(valblock_size(ent->vlen));
+        valblock_unref(blk);
+    }
+    else
+    {
+        slab_free(ext_ptr(ent), ent->vlen);
+    }
+    ent->flags &= ~ENT_VAL_EXT;
+}
+
+Entry *entry_new(std::string_view key, uint64_t hcode, std::string_view val)
+{
+    size_t inline_len = val.size() <= k_entry_inline_max ? val.size() : 0;
+    if (inline_len < sizeof(int64_t))
+    {
+        inline_len = sizeof(int64_t); // room for the external pointer or an integer
+    }
+    // the allocator's rounding slack goes to the value area
+    size_t size = slab_good_size(sizeof(Entry) + key.size() + inline_len);
+    void *mem = slab_alloc(size);
+    Entry *ent = new (mem) Entry();
+    ent->node.hcode = hcode;
+    ent->klen = (uint32_t)key.size();
+    ent->vcap = (uint32_t)(size - sizeof(Entry) - key.size());
+    memcpy(ent->data, key.data(), key.size());
+    entry_set_val(ent, val);
+    return ent;
+}
+
+void entry_del(Entry *ent)
+{
+    entry_free_ext(ent);
+    size_t size = entry_alloc_size(ent);
+    ent->~Entry();
+    slab_free(ent, size);
+}
+
+void entry_set_val(Entry *ent, std::string_view val)
+{
+    if (val.size() <= ent->vcap && val.size() <= k_entry_inline_max)
+    {
+        entry_free_ext(ent);
+        memcpy(val_area(ent), val.data(), val.size());
+    }
+    else
+    {
+        char *ext = ext_alloc(val.size());
+        memcpy(ext, val.data(), val.size());
+        entry_free_ext(ent);
+        memcpy(val_area(ent), &ext, sizeof(ext));
+        ent->flags |= ENT_VAL_EXT;
+    }
+    ent->vlen = (uint32_t)val.size();
+    ent->flags &= ~ENT_VAL_INT;
+    ent->type = ENT_STR;
+}
+
+void entry_set_int(Entry *ent, int64_t val)
+{
+    entry_free_ext(ent);
+    memcpy(val_area(ent), &val, sizeof(val));
+    ent->vlen = 0;
+    ent->flags |= ENT_VAL_INT;
+    ent->type = ENT_STR;
+}
+
+void entry_set_obj(Entry *ent, uint8_t type, void *obj)
+{
+    assert(type != ENT_STR);
+    entry_free_ext(ent);
+    memcpy(val_area(ent), &obj, sizeof(obj));
+    ent->vlen = 0;
+    ent->flags &= ~ENT_VAL_INT;
+    ent->type = type;
+}
+
+ValBlock *entry_take_val(Entry *ent)
+{
+    ValBlock *blk = entry_val_block(ent);
+    assert(blk);
+    slab_disown_large(valblock_size(ent->vlen));
+    ent->flags &= ~ENT_VAL_EXT;
+    ent->vlen = 0;
+    return blk;
+}
+
+size_t entry_mem_usage(const Entry *ent)
+{
+    size_t size = entry_alloc_size(ent);
+    if (ent->flags & ENT_VAL_EXT)
+    {
+        size += ent->vlen > k_slab_max ? valblock_size(ent->vlen)
+                                       : slab_good_size(ent->vlen);
+    }
+    return size;
+}
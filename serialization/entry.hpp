@@ -0,0 +1,159 @@
+#ifndef ENTRY_HPP
+#define ENTRY_HPP
+
+#include "hashtable.hpp"
+#include "heap.hpp"
+#include "slab.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string_view>
+
+// A key-value pair in the keyspace, in a single allocation:
+//
+//   [ header | key bytes | value area ]
+//
+// The value area holds the value inline when it fits (vcap bytes were
+// reserved for it when the entry was allocated), otherwise a pointer to a
+// separate heap block (ENT_VAL_EXT).
+//
+// An external value over k_slab_max is a ValBlock: the bytes behind a
+// reference count, so a response can send them from there (see OutRef in
+// server.hpp) while the key is overwritten or deleted. The entry holds one
+// reference. A block is never written after it was filled, and whoever
+// drops the last reference free()s it, on any thread.
+//
+// A string that is an int64 in canonical form can be kept as the integer
+// itself (ENT_VAL_INT): 8 bytes in the value area, vlen 0, so INCR and
+// friends never parse or format it, and only a read formats it.
+//
+// A value of another type is a container the server owns; the value area
+// then holds a pointer to it (entry_obj()), and entry_del() leaves it alone.
+enum
+{
+    ENT_VAL_EXT = 1 << 0, // the value area holds a char * to the value
+    ENT_VAL_INT = 1 << 1, // the value area holds an int64_t, see entry_int()
+};
+
+enum
+{
+    ENT_STR = 0,
+    ENT_ZSET = 1,
+    ENT_LIST = 2,
+    ENT_HASH = 3,
+    ENT_SET = 4,
+};
+
+// values larger than this are never stored inline
+const uint32_t k_entry_inline_max = 64;
+
+struct ValBlock
+{
+    std::atomic<uint32_t> refs{1};
+    uint32_t len = 0;
+    char data[];
+};
+
+struct Entry
+{
+    struct HNode node;
+    size_t heap_idx = k_heap_none; // position in the TTL heap
+    uint32_t klen = 0;
+    uint32_t vlen = 0;
+    uint32_t vcap = 0; // bytes in the value area, always >= 8
+    // bit-fields cannot have initializers before C++20; entry_new()
+    // value-initializes the Entry, which zeroes them
+    uint8_t flags : 4;
+    uint8_t type : 4; // ENT_STR, ...
+    // eviction: the access clock (LRU), or the last decay time and a log
+    // access counter (LFU), see evict.hpp. Fills the header's spare bytes.
+    uint32_t lru : 24;
+    char data[]; // key, then the value area
+};
+
+Entry *entry_new(std::string_view key, uint64_t hcode, std::string_view val);
+void entry_del(Entry *ent);
+// makes it a string; the caller freed any container before
+void entry_set_val(Entry *ent, std::string_view val);
+// makes it a string kept as an integer
+void entry_set_int(Entry *ent, int64_t val);
+// makes it a value of another type, held in `obj`
+void entry_set_obj(Entry *ent, uint8_t type, void *obj);
+// bytes allocated for the entry, including an external value
+size_t entry_mem_usage(const Entry *ent);
+// Takes the ValBlock out of the entry, which is left with an empty value,
+// along with the entry's reference.
+ValBlock *entry_take_val(Entry *ent);
+
+static inline std::string_view entry_key(const Entry *ent)
+{
+    return std::string_view(ent->data, ent->klen);
+}
+
+// the string; not for an ENT_VAL_INT one
+static inline std::string_view entry_val(const Entry *ent)
+{
+    const char *area = ent->data + ent->klen;
+    if (ent->flags & ENT_VAL_EXT)
+    {
+        const char *ext;
+        __builtin_memcpy(&ext, area, sizeof(ext));
+        return std::string_view(ext, ent->vlen);
+    }
+    return std::string_view(area, ent->vlen);
+}
+
+static inline int64_t entry_int(const Entry *ent)
+{
+    int64_t val;
+    __builtin_memcpy(&val, ent->data + ent->klen, sizeof(val));
+    return val;
+}
+
+static inline void *entry_obj(const Entry *ent)
+{
+    void *obj;
+    __builtin_memcpy(&obj, ent->data + ent->klen, sizeof(obj));
+    return obj;
+}
+
+// the block holding the value, nullptr if it is inline or in a slab
+static inline ValBlock *entry_val_block(const Entry *ent)
+{
+    if (!(ent->flags & ENT_VAL_EXT) || ent->vlen <= k_slab_max)
+    {
+        return nullptr;
+    }
+    const char *ext;
+    __builtin_memcpy(&ext, ent->data + ent->klen, sizeof(ext));
+    return (ValBlock *)(ext - offsetof(ValBlock, data));
+}
+
+static inline size_t valblock_size(size_t len)
+{
+    return sizeof(ValBlock) + len;
+}
+
+static inline void valblock_ref(ValBlock *blk)
+{
+    blk->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+// a block that only its entry references can be handed to another thread
+// to free
+static inline bool valblock_unique(ValBlock *blk)
+{
+    return blk->refs.load(std::memory_order_acquire) == 1;
+}
+
+static inline void valblock_unref(ValBlock *blk)
+{
+    if (blk->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        blk->~ValBlock();
+        free(blk);
+    }
+}
+
+#endif // ENTRY_HPP
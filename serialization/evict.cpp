@@ -0,0 +1,195 @@
+#include "evict.hpp"
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+
+#define container_of(ptr, T, member) ((T *)((char *)ptr - offsetof(T, member)))
+
+const uint32_t k_lru_max = (1 << 24) - 1;
+
+static const char *const k_policy_names[] = {
+    "noeviction",
+    "allkeys-lru",
+    "allkeys-lfu",
+    "allkeys-random",
+};
+
+int evict_policy_parse(const char *name)
+{
+    for (size_t i = 0; i < sizeof(k_policy_names) / sizeof(k_policy_names[0]); ++i)
+    {
+        if (!strcmp(name, k_policy_names[i]))
+        {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+const char *evict_policy_name(int policy)
+{
+    return k_policy_names[policy];
+}
+
+// xorshift64, for the sampling position and the LFU coin flips
+static uint64_t evict_rand()
+{
+    static thread_local uint64_t s = 0x9E3779B97F4A7C15ull;
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+}
+
+static uint32_t lru_clock(uint64_t now_ms)
+{
+    return (uint32_t)(now_ms / k_lru_clock_ms) & k_lru_max;
+}
+
+static uint32_t lfu_minutes(uint64_t now_ms)
+{
+    return (uint32_t)(now_ms / 60000) & 0xFFFF;
+}
+
+// the counter after the decay for the minutes since it was last updated
+static uint32_t lfu_counter(const Entry *ent, uint64_t now_ms)
+{
+    uint32_t ldt = ent->lru >> 8;
+    uint32_t counter = ent->lru & 0xFF;
+    uint32_t elapsed = (lfu_minutes(now_ms) - ldt) & 0xFFFF;
+    uint64_t periods = elapsed / k_lfu_decay_min;
+    return periods >= counter ? 0 : counter - (uint32_t)periods;
+}
+
+static uint32_t lfu_log_incr(uint32_t counter)
+{
+    if (counter == 255)
+    {
+        return counter;
+    }
+    double base = counter > k_lfu_init ? counter - k_lfu_init : 0;
+    double p = 1.0 / (base * k_lfu_log_factor + 1);
+    double r = (evict_rand() >> 11) * 0x1.0p-53;
+    return r < p ? counter + 1 : counter;
+}
+
+void evict_init(Entry *ent, int policy, uint64_t now_ms)
+{
+    if (policy == EVICT_ALLKEYS_LFU)
+    {
+        ent->lru = (lfu_minutes(now_ms) << 8) | k_lfu_init;
+    }
+    else
+    {
+        ent->lru = lru_clock(now_ms);
+    }
+}
+
+void evict_touch(Entry *ent, int policy, uint64_t now_ms)
+{
+    if (policy == EVICT_ALLKEYS_LFU)
+    {
+        uint32_t counter = lfu_log_incr(lfu_counter(ent, now_ms));
+        ent->lru = (lfu_minutes(now_ms) << 8) | counter;
+    }
+    else
+    {
+        ent->lru = lru_clock(now_ms);
+    }
+}
+
+// higher goes first
+static uint64_t evict_score(const Entry *ent, int policy, uint64_t now_ms)
+{
+    if (policy == EVICT_ALLKEYS_LFU)
+    {
+        return 255 - lfu_counter(ent, now_ms);
+    }
+    return (lru_clock(now_ms) - ent->lru) & k_lru_max;
+}
+
+static void pool_insert(EvictPool *pool, const Entry *ent, uint64_t score)
+{
+    std::string_view key = entry_key(ent);
+    size_t pos = 0;
+    for (size_t i = 0; i < pool->size; ++i)
+    {
+        const EvictCandidate &c = pool->items[i];
+        if (c.hcode == ent->node.hcode && c.key == key)
+        {
+            return; // sampled again
+        }
+        if (c.score < score)
+        {
+            pos = i + 1;
+        }
+    }
+    if (pool->size == k_evict_pool_size)
+    {
+        if (pos == 0)
+        {
+            return; // worse than everything in the pool
+        }
+        // drop the lowest score to make room; rotating keeps the strings'
+        // buffers around for reuse
+        std::rotate(pool->items, pool->items + 1, pool->items + pos);
+        pos--;
+    }
+    else
+    {
+        std::rotate(pool->items + pos, pool->items + pool->size,
+                    pool->items + pool->size + 1);
+        pool->size++;
+    }
+    EvictCandidate &c = pool->items[pos];
+    c.score = score;
+    c.hcode = ent->node.hcode;
+    c.key.assign(key.data(), key.size());
+}
+
+struct PoolKey
+{
+    HNode node;
+    std::string_view key;
+};
+
+static bool pool_key_eq(HNode *node, HNode *key)
+{
+    Entry *ent = container_of(node, Entry, node);
+    PoolKey *pk = container_of(key, PoolKey, node);
+    return entry_key(ent) == pk->key;
+}
+
+Entry *evict_pick(HMap *db, EvictPool *pool, int policy, uint64_t now_ms)
+{
+    if (policy == EVICT_NONE)
+    {
+        return nullptr;
+    }
+    HNode *sample[k_evict_samples];
+    if (policy == EVICT_ALLKEYS_RANDOM)
+    {
+        size_t n = hm_sample(db, evict_rand(), sample, 1);
+        return n ? container_of(sample[0], Entry, node) : nullptr;
+    }
+
+    size_t n = hm_sample(db, evict_rand(), sample, k_evict_samples);
+    for (size_t i = 0; i < n; ++i)
+    {
+        Entry *ent = container_of(sample[i], Entry, node);
+        pool_insert(pool, ent, evict_score(ent, policy, now_ms));
+    }
+    // best first; candidates whose key is gone by now are skipped
+    while (pool->size > 0)
+    {
+        EvictCandidate &c = pool->items[--pool->size];
+        PoolKey key;
+        key.node.hcode = c.hcode;
+        key.key = c.key;
+        if (HNode *node = h_lookup(db, &key.node, pool_key_eq))
+        {
+            return container_of(node, Entry, node);
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,61 @@
+#ifndef EVICT_HPP
+#define EVICT_HPP
+
+#include "entry.hpp"
+#include "hashtable.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Approximated LRU / LFU eviction, as in Redis: instead of keeping every key
+// ordered by access, each eviction samples a few keys and feeds them into a
+// small pool of the best candidates seen so far, sorted by score. The key
+// with the highest score in the pool goes first.
+//
+// The per-key state lives in Entry::lru (24 bits):
+//  - LRU: the access clock in k_lru_clock_ms ticks, wraps after ~46 h
+//  - LFU: the minute of the last decay (16 bits) and an 8 bit logarithmic
+//    access counter. The counter grows with probability
+//    1 / ((counter - k_lfu_init) * k_lfu_log_factor + 1), so 255 stands for
+//    about a million accesses, and loses one per k_lfu_decay_min minutes
+//    without access.
+enum
+{
+    EVICT_NONE = 0, // writes fail once over the limit
+    EVICT_ALLKEYS_LRU = 1,
+    EVICT_ALLKEYS_LFU = 2,
+    EVICT_ALLKEYS_RANDOM = 3,
+};
+
+const size_t k_evict_samples = 5;    // keys sampled per eviction
+const size_t k_evict_pool_size = 16; // best candidates kept across evictions
+const uint64_t k_lru_clock_ms = 10;
+const uint32_t k_lfu_init = 5; // new keys start here, not at 0
+const uint32_t k_lfu_log_factor = 10;
+const uint64_t k_lfu_decay_min = 1;
+
+struct EvictCandidate
+{
+    uint64_t score = 0; // idle ticks (LRU), 255 - counter (LFU)
+    uint64_t hcode = 0;
+    std::string key; // a copy: the entry may be gone when its turn comes
+};
+
+struct EvictPool
+{
+    EvictCandidate items[k_evict_pool_size]; // ascending score
+    size_t size = 0;
+};
+
+// returns -1 for an unknown name
+int evict_policy_parse(const char *name);
+const char *evict_policy_name(int policy);
+
+// stamp a new entry, and record an access to an existing one
+void evict_init(Entry *ent, int policy, uint64_t now_ms);
+void evict_touch(Entry *ent, int policy, uint64_t now_ms);
+// The entry to evict next, still in `db`; the caller deletes it. nullptr if
+// the policy never evicts or nothing could be sampled.
+Entry *evict_pick(HMap *db, EvictPool *pool, int policy, uint64_t now_ms);
+
+#endif // EVICT_HPP
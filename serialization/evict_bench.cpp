@@ -0,0 +1,205 @@
+// Eviction policy benchmark on the server's own structures (Entry, HMap and
+// the evict_* sampling), used as a cache under Zipfian load: every request is
+// a GET, and a miss SETs the key and then evicts until the data fits in the
+// memory limit again, as db_make_room() does. Each policy replays the same
+// request trace; the clock is simulated at 1M requests/s so the LRU and LFU
+// stamps do not depend on the speed of the machine.
+//
+//   ./evict_bench [--keys 1000000] [--requests 10000000] [--theta 0.99]
+//                 [--memory-pct 10] [--value 100]
+//
+// --memory-pct is the limit as a share of the memory all keys would take.
+#include "entry.hpp"
+#include "evict.hpp"
+#include "hash.hpp"
+#include "hashtable.hpp"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+#define container_of(ptr, T, member) ((T *)((char *)ptr - offsetof(T, member)))
+
+static uint64_t now_ns() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t &s) {
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+}
+
+static double rand01(uint64_t &s) {
+    return (xorshift(s) >> 11) * 0x1.0p-53;
+}
+
+// Zipfian ranks in [0, n), rank 0 the most popular (Gray et al., "Quickly
+// generating billion-record synthetic databases", as used by YCSB)
+struct Zipf {
+    size_t n = 0;
+    double theta = 0, alpha = 0, zetan = 0, eta = 0;
+};
+
+static void zipf_init(Zipf &z, size_t n, double theta) {
+    double zeta2 = 1 + pow(0.5, theta);
+    double zetan = 0;
+    for (size_t i = 1; i <= n; ++i) {
+        zetan += 1 / pow((double)i, theta);
+    }
+    z.n = n;
+    z.theta = theta;
+    z.alpha = 1 / (1 - theta);
+    z.zetan = zetan;
+    z.eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan);
+}
+
+static size_t zipf_next(const Zipf &z, uint64_t &rnd) {
+    double u = rand01(rnd);
+    double uz = u * z.zetan;
+    if (uz < 1) {
+        return 0;
+    }
+    if (uz < 1 + pow(0.5, z.theta)) {
+        return 1;
+    }
+    size_t r = (size_t)(z.n * pow(z.eta * u - z.eta + 1, z.alpha));
+    return r < z.n ? r : z.n - 1;
+}
+
+struct Key {
+    HNode node;
+    std::string_view key;
+};
+
+static bool entry_eq_key(HNode *node, HNode *key) {
+    return entry_key(container_of(node, Entry, node)) == container_of(key, Key, node)->key;
+}
+
+static bool hnode_same(HNode *node, HNode *key) {
+    return node == key;
+}
+
+static bool cb_collect(HNode *node, void *arg) {
+    ((std::vector<Entry *> *)arg)->push_back(container_of(node, Entry, node));
+    return true;
+}
+
+struct Config {
+    size_t keys = 1000000;
+    size_t requests = 10000000;
+    double theta = 0.99;
+    double memory_pct = 10;
+    size_t value = 100;
+};
+
+static void run_policy(const Config &cfg, int policy, const std::vector<uint32_t> &trace,
+                       const std::vector<std::string> &names, size_t maxmemory) {
+    HMap db;
+    EvictPool pool;
+    size_t entry_bytes = 0;
+    std::string val(cfg.value, 'v');
+    size_t hits = 0, evicted = 0;
+
+    uint64_t t0 = now_ns();
+    for (size_t i = 0; i < trace.size(); ++i) {
+        uint64_t now_ms = i / 1000;
+        const std::string &name = names[trace[i]];
+        Key key;
+        key.key = name;
+        key.node.hcode = hash64(name.data(), name.size(), g_hash_seed);
+        if (HNode *node = h_lookup(&db, &key.node, entry_eq_key)) {
+            evict_touch(container_of(node, Entry, node), policy, now_ms);
+            hits++;
+            continue;
+        }
+        while (entry_bytes + hm_mem_usage(&db) > maxmemory) {
+            Entry *victim = evict_pick(&db, &pool, policy, now_ms);
+            if (!victim) {
+                break;
+            }
+            hm_delete(&db, &victim->node, hnode_same);
+            entry_bytes -= entry_mem_usage(victim);
+            entry_del(victim);
+            evicted++;
+        }
+        Entry *ent = entry_new(name, key.node.hcode, val);
+        evict_init(ent, policy, now_ms);
+        entry_bytes += entry_mem_usage(ent);
+        hm_insert(&db, &ent->node);
+    }
+    uint64_t t1 = now_ns();
+
+    printf("%-15s hit rate %6.2f%%  %6.2f M req/s  %9zu evicted  %8zu keys\n",
+           evict_policy_name(policy), hits * 100.0 / trace.size(),
+           trace.size() * 1e3 / (t1 - t0), evicted, hm_size(&db));
+    fflush(stdout);
+
+    std::vector<Entry *> ents;
+    hm_foreach(&db, cb_collect, &ents);
+    for (Entry *ent : ents) {
+        hm_delete(&db, &ent->node, hnode_same);
+        entry_del(ent);
+    }
+}
+
+int main(int argc, char **argv) {
+    Config cfg;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "--keys")) {
+            cfg.keys = strtoull(argv[i + 1], NULL, 10);
+        } else if (!strcmp(argv[i], "--requests")) {
+            cfg.requests = strtoull(argv[i + 1], NULL, 10);
+        } else if (!strcmp(argv[i], "--theta")) {
+            cfg.theta = atof(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--memory-pct")) {
+            cfg.memory_pct = atof(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--value")) {
+            cfg.value = strtoull(argv[i + 1], NULL, 10);
+        } else {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    hash_seed_init();
+
+    std::vector<std::string> names(cfg.keys);
+    for (size_t i = 0; i < cfg.keys; ++i) {
+        names[i] = "key:" + std::to_string(i);
+    }
+    Zipf z;
+    zipf_init(z, cfg.keys, cfg.theta);
+    uint64_t rnd = 0x9E3779B97F4A7C15ull;
+    // scatter the popular ranks over the key names
+    std::vector<uint32_t> perm(cfg.keys);
+    for (size_t i = 0; i < cfg.keys; ++i) {
+        perm[i] = (uint32_t)i;
+    }
+    for (size_t i = cfg.keys - 1; i > 0; --i) {
+        std::swap(perm[i], perm[xorshift(rnd) % (i + 1)]);
+    }
+    std::vector<uint32_t> trace(cfg.requests);
+    for (size_t i = 0; i < cfg.requests; ++i) {
+        trace[i] = perm[zipf_next(z, rnd)];
+    }
+
+    // the limit, from the size of one entry and a table that holds every key
+    Entry *probe = entry_new(names[cfg.keys - 1], 0, std::string(cfg.value, 'v'));
+    size_t all_bytes = entry_mem_usage(probe) * cfg.keys + cfg.keys * sizeof(HNode *);
+    entry_del(probe);
+    size_t maxmemory = (size_t)(all_bytes * cfg.memory_pct / 100);
+    printf("%zu keys, %zu requests, zipf theta %.2f, maxmemory %.1f MiB (%.0f%%)\n",
+           cfg.keys, cfg.requests, cfg.theta, maxmemory / 1048576.0, cfg.memory_pct);
+
+    for (int policy : {EVICT_ALLKEYS_RANDOM, EVICT_ALLKEYS_LRU, EVICT_ALLKEYS_LFU}) {
+        run_policy(cfg, policy, trace, names, maxmemory);
+    }
+    return 0;
+}
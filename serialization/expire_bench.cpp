@@ -0,0 +1,109 @@
+// Key expiration benchmark on the server's own structures (Entry, HMap and
+// the TTL heap), with a simulated clock so the run does not take real time:
+//  - set px: new volatile keys, random deadlines within 10 s
+//  - pexpire: move every deadline
+//  - active expiry: advance the clock 1 ms per tick and delete the due keys
+//    in batches of k_expire_batch, as the event loop does
+//
+//   ./expire_bench [nkeys]        default 10000000
+#include "entry.hpp"
+#include "hash.hpp"
+#include "hashtable.hpp"
+#include "heap.hpp"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#define container_of(ptr, T, member) ((T *)((char *)ptr - offsetof(T, member)))
+
+const size_t k_expire_batch = 2000; // k_max_expire_work in server.cpp
+const uint64_t k_ttl_span_ms = 10000;
+
+static uint64_t now_ns() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t &s) {
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+}
+
+static bool hnode_same(HNode *node, HNode *key) {
+    return node == key;
+}
+
+static HMap g_db;
+static std::vector<HeapItem> g_heap;
+
+static void set_deadline(Entry *ent, uint64_t deadline) {
+    HeapItem item;
+    item.val = deadline;
+    item.ref = &ent->heap_idx;
+    heap_upsert(g_heap, ent->heap_idx, item);
+}
+
+int main(int argc, char **argv) {
+    size_t n = argc > 1 ? strtoull(argv[1], NULL, 10) : 10000000;
+    hash_seed_init();
+    std::vector<Entry *> ents(n);
+    uint64_t rnd = 0x9E3779B97F4A7C15ull;
+
+    uint64_t t0 = now_ns();
+    char key[32];
+    for (size_t i = 0; i < n; ++i) {
+        int len = snprintf(key, sizeof(key), "key:%zu", i);
+        std::string_view k(key, len);
+        ents[i] = entry_new(k, hash64(key, len, g_hash_seed), "value");
+        hm_insert(&g_db, &ents[i]->node);
+        set_deadline(ents[i], 1 + xorshift(rnd) % k_ttl_span_ms);
+    }
+    uint64_t t1 = now_ns();
+    printf("set px   %9zu keys  %6.2f M ops/s  heap %4.1f B/key\n", n,
+           n * 1e3 / (t1 - t0), double(g_heap.capacity() * sizeof(HeapItem)) / n);
+
+    for (size_t i = 0; i < n; ++i) {
+        set_deadline(ents[i], 1 + xorshift(rnd) % k_ttl_span_ms);
+    }
+    uint64_t t2 = now_ns();
+    printf("pexpire  %9zu keys  %6.2f M ops/s\n", n, n * 1e3 / (t2 - t1));
+
+    uint64_t clock_ms = 0;
+    uint64_t max_batch_ns = 0;
+    size_t expired = 0, ticks = 0;
+    while (!g_heap.empty()) {
+        uint64_t b0 = now_ns();
+        size_t nwork = 0;
+        while (!g_heap.empty() && g_heap[0].val <= clock_ms && nwork++ < k_expire_batch) {
+            Entry *ent = container_of(g_heap[0].ref, Entry, heap_idx);
+            hm_delete(&g_db, &ent->node, hnode_same);
+            heap_delete(g_heap, ent->heap_idx);
+            entry_del(ent);
+            expired++;
+        }
+        uint64_t b1 = now_ns();
+        if (b1 - b0 > max_batch_ns) {
+            max_batch_ns = b1 - b0;
+        }
+        ticks++;
+        if (nwork <= k_expire_batch) {
+            clock_ms++; // nothing more due at this time
+        }
+    }
+    uint64_t t3 = now_ns();
+    printf("expire   %9zu keys  %6.2f M keys/s  %zu ticks, longest batch %.1f us\n",
+           expired, expired * 1e3 / (t3 - t2), ticks, max_batch_ns / 1e3);
+    if (expired != n || hm_size(&g_db) != 0) {
+        fprintf(stderr, "bad result: expired %zu, %zu keys left\n", expired,
+                hm_size(&g_db));
+        return 1;
+    }
+    return 0;
+}
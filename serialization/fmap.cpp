@@ -0,0 +1,429 @@
+#include "fmap.hpp"
+#include "hash.hpp"
+#include "slab.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+#define container_of(ptr, T, member) ((T *)((char *)ptr - offsetof(T, member)))
+
+// Packed records: [flen, 1 byte][field][vlen, 1 byte][value]
+
+static std::string_view rec_field(const uint8_t *rec)
+{
+    return std::string_view((const char *)rec + 1, rec[0]);
+}
+
+static std::string_view rec_val(const uint8_t *rec)
+{
+    const uint8_t *v = rec + 1 + rec[0];
+    return std::string_view((const char *)v + 1, v[0]);
+}
+
+static uint32_t rec_size(const uint8_t *rec)
+{
+    return 2 + rec[0] + rec[1 + rec[0]];
+}
+
+// offset of the field's record; false if it is not there
+static bool packed_find(FMap *fmap, std::string_view field, uint32_t *pos)
+{
+    for (uint32_t p = 0; p < fmap->packed_used; p += rec_size(fmap->packed + p))
+    {
+        const uint8_t *rec = fmap->packed + p;
+        if (rec[0] == field.size() && rec_field(rec) == field)
+        {
+            *pos = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void packed_reserve(FMap *fmap, uint32_t extra)
+{
+    if (fmap->packed_used + extra <= fmap->packed_cap)
+    {
+        return;
+    }
+    uint32_t cap = fmap->packed_cap ? fmap->packed_cap : 64;
+    while (cap < fmap->packed_used + extra)
+    {
+        cap *= 2;
+    }
+    fmap->packed = (uint8_t *)realloc(fmap->packed, cap);
+    fmap->packed_cap = cap;
+}
+
+static void packed_append(FMap *fmap, std::string_view field, std::string_view val)
+{
+    packed_reserve(fmap, 2 + (uint32_t)(field.size() + val.size()));
+    uint8_t *rec = fmap->packed + fmap->packed_used;
+    rec[0] = (uint8_t)field.size();
+    memcpy(rec + 1, field.data(), field.size());
+    uint8_t *v = rec + 1 + field.size();
+    v[0] = (uint8_t)val.size();
+    memcpy(v + 1, val.data(), val.size());
+    fmap->packed_used += 2 + (uint32_t)(field.size() + val.size());
+}
+
+// the record at `pos` gets the new value, in place
+static void packed_replace(FMap *fmap, uint32_t pos, std::string_view val)
+{
+    uint32_t voff = pos + 1 + fmap->packed[pos]; // of the value's length byte
+    uint32_t old_len = fmap->packed[voff];
+    uint32_t new_len = (uint32_t)val.size();
+    if (new_len > old_len)
+    {
+        packed_reserve(fmap, new_len - old_len);
+    }
+    uint8_t *v = fmap->packed + voff;
+    memmove(v + 1 + new_len, v + 1 + old_len, fmap->packed_used - (voff + 1 + old_len));
+    v[0] = (uint8_t)new_len;
+    memcpy(v + 1, val.data(), new_len);
+    fmap->packed_used = fmap->packed_used + new_len - old_len;
+}
+
+static void packed_remove(FMap *fmap, uint32_t pos)
+{
+    uint32_t size = rec_size(fmap->packed + pos);
+    memmove(fmap->packed + pos, fmap->packed + pos + size,
+            fmap->packed_used - pos - size);
+    fmap->packed_used -= size;
+}
+
+// Table
+
+struct FKey
+{
+    HNode node;
+    std::string_view field;
+};
+
+static bool fnode_eq(HNode *node, HNode *key)
+{
+    FNode *fnode = container_of(node, FNode, node);
+    FKey *fkey = container_of(key, FKey, node);
+    return std::string_view(fnode->data, fnode->flen) == fkey->field;
+}
+
+static size_t fnode_size(size_t flen, size_t vlen)
+{
+    return sizeof(FNode) + flen + vlen;
+}
+
+static bool hnode_same(HNode *node, HNode *key)
+{
+    return node == key;
+}
+
+static void fkey_init(FKey *key, std::string_view field)
+{
+    key->node.hcode = hash64(field.data(), field.size(), g_hash_seed);
+    key->field = field;
+}
+
+static FNode *table_insert(FTable *table, std::string_view field, std::string_view val)
+{
+    size_t size = fnode_size(field.size(), val.size());
+    FNode *node = new (slab_alloc(size)) FNode();
+    node->node.hcode = hash64(field.data(), field.size(), g_hash_seed);
+    node->flen = (uint32_t)field.size();
+    node->vlen = (uint32_t)val.size();
+    memcpy(node->data, field.data(), field.size());
+    memcpy(node->data + field.size(), val.data(), val.size());
+    hm_insert(&table->hmap, &node->node);
+    table->node_bytes += slab_good_size(size);
+    return node;
+}
+
+static void table_free_node(FTable *table, FNode *node)
+{
+    size_t size = fnode_size(node->flen, node->vlen);
+    table->node_bytes -= slab_good_size(size);
+    node->~FNode();
+    slab_free(node, size);
+}
+
+// the records move to a table
+static void fmap_convert(FMap *fmap)
+{
+    FTable *table = new FTable();
+    for (uint32_t p = 0; p < fmap->packed_used; p += rec_size(fmap->packed + p))
+    {
+        const uint8_t *rec = fmap->packed + p;
+        table_insert(table, rec_field(rec), rec_val(rec));
+    }
+    free(fmap->packed);
+    fmap->packed = nullptr;
+    fmap->packed_used = fmap->packed_cap = 0;
+    fmap->table = table;
+}
+
+bool fmap_set(FMap *fmap, std::string_view field, std::string_view val)
+{
+    bool fits = field.size() <= k_fmap_packed_len_max && val.size() <= k_fmap_packed_len_max;
+    if (!fmap->table)
+    {
+        uint32_t pos = 0;
+        bool found = packed_find(fmap, field, &pos);
+        if (found && fits)
+        {
+            packed_replace(fmap, pos, val);
+            return false;
+        }
+        if (!found && fits && fmap->size < k_fmap_packed_max)
+        {
+            packed_append(fmap, field, val);
+            fmap->size++;
+            return true;
+        }
+        fmap_convert(fmap);
+    }
+
+    FTable *table = fmap->table;
+    FKey key;
+    fkey_init(&key, field);
+    if (HNode *found = h_lookup(&table->hmap, &key.node, fnode_eq))
+    {
+        FNode *node = container_of(found, FNode, node);
+        if (node->vlen == val.size())
+        {
+            memcpy(node->data + node->flen, val.data(), val.size());
+            return false;
+        }
+        hm_delete(&table->hmap, &key.node, fnode_eq);
+        table_free_node(table, node);
+        table_insert(table, field, val);
+        return false;
+    }
+    table_insert(table, field, val);
+    fmap->size++;
+    return true;
+}
+
+bool fmap_get(FMap *fmap, std::string_view field, std::string_view *val)
+{
+    if (!fmap->table)
+    {
+        uint32_t pos = 0;
+        if (!packed_find(fmap, field, &pos))
+        {
+            return false;
+        }
+        *val = rec_val(fmap->packed + pos);
+        return true;
+    }
+    FKey key;
+    fkey_init(&key, field);
+    HNode *found = h_lookup(&fmap->table->hmap, &key.node, fnode_eq);
+    if (!found)
+    {
+        return false;
+    }
+    FNode *node = container_of(found, FNode, node);
+    *val = std::string_view(node->data + node->flen, node->vlen);
+    return true;
+}
+
+bool fmap_find_or_add(FMap *fmap, std::string_view field, FSlot *slot, std::string_view *val)
+{
+    *slot = FSlot();
+    if (!fmap->table)
+    {
+        if (packed_find(fmap, field, &slot->pos))
+        {
+            *val = rec_val(fmap->packed + slot->pos);
+            return false;
+        }
+        if (field.size() <= k_fmap_packed_len_max && fmap->size < k_fmap_packed_max)
+        {
+            slot->pos = fmap->packed_used;
+            packed_append(fmap, field, "");
+            fmap->size++;
+            *val = std::string_view();
+            return true;
+        }
+        fmap_convert(fmap);
+    }
+
+    FKey key;
+    fkey_init(&key, field);
+    bool added = false;
+    if (HNode *found = h_lookup(&fmap->table->hmap, &key.node, fnode_eq))
+    {
+        slot->node = container_of(found, FNode, node);
+    }
+    else
+    {
+        slot->node = table_insert(fmap->table, field, "");
+        fmap->size++;
+        added = true;
+    }
+    *val = std::string_view(slot->node->data + slot->node->flen, slot->node->vlen);
+    return added;
+}
+
+void fmap_slot_set(FMap *fmap, FSlot *slot, std::string_view val)
+{
+    if (!fmap->table)
+    {
+        if (val.size() <= k_fmap_packed_len_max)
+        {
+            packed_replace(fmap, slot->pos, val);
+            return;
+        }
+        // too long for a record: the slot moves to the table
+        std::string field(rec_field(fmap->packed + slot->pos));
+        fmap_convert(fmap);
+        FKey key;
+        fkey_init(&key, field);
+        slot->node = container_of(h_lookup(&fmap->table->hmap, &key.node, fnode_eq), FNode, node);
+    }
+
+    FTable *table = fmap->table;
+    FNode *node = slot->node;
+    size_t old_size = fnode_size(node->flen, node->vlen);
+    size_t new_size = fnode_size(node->flen, val.size());
+    if (slab_good_size(old_size) == slab_good_size(new_size))
+    {
+        // the same size class, so the slack takes the new value
+        memcpy(node->data + node->flen, val.data(), val.size());
+        node->vlen = (uint32_t)val.size();
+        return;
+    }
+    FNode *moved = new (slab_alloc(new_size)) FNode();
+    moved->node.hcode = node->node.hcode;
+    moved->flen = node->flen;
+    moved->vlen = (uint32_t)val.size();
+    memcpy(moved->data, node->data, node->flen);
+    memcpy(moved->data + node->flen, val.data(), val.size());
+    hm_delete(&table->hmap, &node->node, hnode_same);
+    hm_insert(&table->hmap, &moved->node);
+    table->node_bytes += slab_good_size(new_size);
+    table_free_node(table, node);
+    slot->node = moved;
+}
+
+bool fmap_del(FMap *fmap, std::string_view field)
+{
+    if (!fmap->table)
+    {
+        uint32_t pos = 0;
+        if (!packed_find(fmap, field, &pos))
+        {
+            return false;
+        }
+        packed_remove(fmap, pos);
+        fmap->size--;
+        return true;
+    }
+    FKey key;
+    fkey_init(&key, field);
+    HNode *found = hm_delete(&fmap->table->hmap, &key.node, fnode_eq);
+    if (!found)
+    {
+        return false;
+    }
+    table_free_node(fmap->table, container_of(found, FNode, node));
+    fmap->size--;
+    return true;
+}
+
+struct ForeachCtx
+{
+    void (*f)(std::string_view field, std::string_view val, void *arg);
+    void *arg;
+};
+
+static bool foreach_node(HNode *hnode, void *arg)
+{
+    ForeachCtx *ctx = (ForeachCtx *)arg;
+    FNode *node = container_of(hnode, FNode, node);
+    ctx->f(std::string_view(node->data, node->flen),
+           std::string_view(node->data + node->flen, node->vlen), ctx->arg);
+    return true;
+}
+
+void fmap_foreach(FMap *fmap, void (*f)(std::string_view field, std::string_view val, void *arg),
+                  void *arg)
+{
+    if (fmap->table)
+    {
+        ForeachCtx ctx = {f, arg};
+        hm_foreach(&fmap->table->hmap, foreach_node, &ctx);
+        return;
+    }
+    for (uint32_t p = 0; p < fmap->packed_used; p += rec_size(fmap->packed + p))
+    {
+        const uint8_t *rec = fmap->packed + p;
+        f(rec_field(rec), rec_val(rec), arg);
+    }
+}
+
+static bool collect_node(HNode *node, void *arg)
+{
+    ((std::vector<FNode *> *)arg)->push_back(container_of(node, FNode, node));
+    return true;
+}
+
+void fmap_clear(FMap *fmap)
+{
+    if (FTable *table = fmap->table)
+    {
+        // hm_foreach() reads a node's link after the callback, so the nodes
+        // are collected first and freed after
+        std::vector<FNode *> nodes;
+        nodes.reserve(fmap->size);
+        hm_foreach(&table->hmap, collect_node, &nodes);
+        for (FNode *node : nodes)
+        {
+            table_free_node(table, node);
+        }
+        hm_clear(&table->hmap);
+        delete table;
+    }
+    free(fmap->packed);
+    *fmap = FMap();
+}
+
+static void collect_hnode(HNode *node, void *arg)
+{
+    ((std::vector<HNode *> *)arg)->push_back(node);
+}
+
+bool fmap_clear_some(FMap *fmap, uint64_t *cursor, size_t work)
+{
+    FTable *table = fmap->table;
+    std::vector<HNode *> nodes;
+    // a bucket at a time, as in zset_clear_some()
+    for (size_t done = 0; table && hm_size(&table->hmap) > 0 && done < work;)
+    {
+        nodes.clear();
+        *cursor = hm_scan(&table->hmap, *cursor, collect_hnode, &nodes);
+        for (HNode *node : nodes)
+        {
+            hm_delete(&table->hmap, node, hnode_same);
+            table_free_node(table, container_of(node, FNode, node));
+        }
+        done += nodes.size() + 1;
+    }
+    if (table && hm_size(&table->hmap) > 0)
+    {
+        return false;
+    }
+    fmap_clear(fmap);
+    return true;
+}
+
+size_t fmap_mem_usage(const FMap *fmap)
+{
+    size_t size = sizeof(FMap) + fmap->packed_cap;
+    if (const FTable *table = fmap->table)
+    {
+        size += sizeof(FTable) + table->node_bytes + hm_mem_usage((HMap *)&table->hmap);
+    }
+    return size;
+}
@@ -0,0 +1,77 @@
+#ifndef FMAP_HPP
+#define FMAP_HPP
+
+#include "hashtable.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Hash value: a map of fields to values inside one key.
+//
+// A small map is packed: one buffer of [flen][field][vlen][value] records,
+// in insertion order, up to k_fmap_packed_max fields with fields and values
+// of up to k_fmap_packed_len_max bytes. A lookup scans it, which at this size
+// costs less than hashing, and a field takes its own bytes plus 2. A map
+// that outgrows either limit converts, for good, to an FTable: an FNode per
+// field in an HMap (hashtable.cpp), like the keyspace itself.
+
+const size_t k_fmap_packed_max = 128;
+const size_t k_fmap_packed_len_max = 64;
+
+struct FNode
+{
+    HNode node;
+    uint32_t flen = 0;
+    uint32_t vlen = 0;
+    char data[]; // field, then value
+};
+
+struct FTable
+{
+    HMap hmap;
+    size_t node_bytes = 0; // allocated for the FNodes
+};
+
+struct FMap
+{
+    size_t size = 0; // fields
+    // packed: the records, and the bytes in use / allocated for them
+    uint8_t *packed = nullptr;
+    uint32_t packed_used = 0;
+    uint32_t packed_cap = 0;
+    FTable *table = nullptr; // once converted
+};
+
+// A field's place in the map, from fmap_find_or_add(). It stays valid until
+// the map is modified other than by fmap_slot_set().
+struct FSlot
+{
+    uint32_t pos = 0;      // packed: offset of the record
+    FNode *node = nullptr; // converted
+};
+
+// true if the field is new, false if it only got the new value
+bool fmap_set(FMap *fmap, std::string_view field, std::string_view val);
+// false if there is no such field. The value is valid until the map is
+// modified.
+bool fmap_get(FMap *fmap, std::string_view field, std::string_view *val);
+// Finds the field, or adds it with an empty value, with one lookup. True if
+// it was added. *val is the value, valid until the map is modified.
+bool fmap_find_or_add(FMap *fmap, std::string_view field, FSlot *slot, std::string_view *val);
+// the field at the slot gets the new value, in place where it fits
+void fmap_slot_set(FMap *fmap, FSlot *slot, std::string_view val);
+// false if there was no such field
+bool fmap_del(FMap *fmap, std::string_view field);
+// calls f for each field, in no particular order
+void fmap_foreach(FMap *fmap, void (*f)(std::string_view field, std::string_view val, void *arg),
+                  void *arg);
+// frees the fields, the map is left empty and packed
+void fmap_clear(FMap *fmap);
+// Frees about `work` fields of a map that is being dropped, resuming from
+// *cursor (0 the first time). True once all of it is freed, as by
+// fmap_clear(); the map is not usable before.
+bool fmap_clear_some(FMap *fmap, uint64_t *cursor, size_t work);
+// bytes allocated for the map, the FMap itself included
+size_t fmap_mem_usage(const FMap *fmap);
+
+#endif // FMAP_HPP
@@ -0,0 +1,170 @@
+// Hash memory benchmark on the server's own structures: objects of f fields
+// stored as one string key per field ("obj:<i>:<field>", the old way), and as
+// one hash key per object (FMap, fmap.cpp). Counts the bytes the server
+// accounts for (entries, table arrays, hash containers) per field, and the
+// time of a random field read either way.
+//
+//   ./fmap_bench [fields in total]        default 2000000
+#include "entry.hpp"
+#include "fmap.hpp"
+#include "hash.hpp"
+#include "hashtable.hpp"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+#define container_of(ptr, T, member) ((T *)((char *)ptr - offsetof(T, member)))
+
+const size_t k_reads = 1000000;
+const size_t k_value_len = 16;
+
+static uint64_t now_ns() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t &s) {
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+}
+
+struct Key {
+    HNode node;
+    std::string_view key;
+};
+
+static bool entry_eq_key(HNode *node, HNode *key) {
+    return entry_key(container_of(node, Entry, node)) == container_of(key, Key, node)->key;
+}
+
+static bool cb_collect(HNode *node, void *arg) {
+    ((std::vector<Entry *> *)arg)->push_back(container_of(node, Entry, node));
+    return true;
+}
+
+static Entry *lookup(HMap *db, std::string_view name) {
+    Key key;
+    key.key = name;
+    key.node.hcode = hash64(name.data(), name.size(), g_hash_seed);
+    HNode *node = h_lookup(db, &key.node, entry_eq_key);
+    return node ? container_of(node, Entry, node) : nullptr;
+}
+
+static std::string_view obj_name(char *buf, size_t i) {
+    return std::string_view(buf, snprintf(buf, 64, "obj:%zu", i));
+}
+
+static std::string_view field_name(char *buf, size_t j) {
+    return std::string_view(buf, snprintf(buf, 64, "field%zu", j));
+}
+
+static std::string_view field_key(char *buf, size_t i, size_t j) {
+    return std::string_view(buf, snprintf(buf, 64, "obj:%zu:field%zu", i, j));
+}
+
+static void free_db(HMap *db) {
+    std::vector<Entry *> ents;
+    hm_foreach(db, cb_collect, &ents);
+    for (Entry *ent : ents) {
+        if (ent->type == ENT_HASH) {
+            FMap *fmap = (FMap *)entry_obj(ent);
+            fmap_clear(fmap);
+            delete fmap;
+        }
+        entry_del(ent);
+    }
+    hm_clear(db);
+}
+
+static void fail(const char *what, size_t i) {
+    fprintf(stderr, "bad result: %s for object %zu\n", what, i);
+    exit(1);
+}
+
+// one string key per field
+static void run_keys(size_t nobj, size_t nfield) {
+    HMap db;
+    size_t bytes = 0;
+    char kbuf[64];
+    std::string val(k_value_len, 'v');
+    for (size_t i = 0; i < nobj; ++i) {
+        for (size_t j = 0; j < nfield; ++j) {
+            std::string_view name = field_key(kbuf, i, j);
+            Entry *ent = entry_new(name, hash64(name.data(), name.size(), g_hash_seed), val);
+            hm_insert(&db, &ent->node);
+            bytes += entry_mem_usage(ent);
+        }
+    }
+    bytes += hm_mem_usage(&db);
+
+    uint64_t rnd = 0x9E3779B97F4A7C15ull;
+    uint64_t t0 = now_ns();
+    for (size_t q = 0; q < k_reads; ++q) {
+        size_t i = xorshift(rnd) % nobj;
+        Entry *ent = lookup(&db, field_key(kbuf, i, xorshift(rnd) % nfield));
+        if (!ent || entry_val(ent) != val) {
+            fail("get", i);
+        }
+    }
+    uint64_t t1 = now_ns();
+    printf("keys   %5zu fields  %7.1f B/field  get   %6.1f ns\n", nfield,
+           double(bytes) / (nobj * nfield), double(t1 - t0) / k_reads);
+    free_db(&db);
+}
+
+// one hash key per object
+static void run_hash(size_t nobj, size_t nfield) {
+    HMap db;
+    size_t bytes = 0;
+    char kbuf[64], fbuf[64];
+    std::string val(k_value_len, 'v');
+    for (size_t i = 0; i < nobj; ++i) {
+        std::string_view name = obj_name(kbuf, i);
+        Entry *ent = entry_new(name, hash64(name.data(), name.size(), g_hash_seed), "");
+        FMap *fmap = new FMap();
+        entry_set_obj(ent, ENT_HASH, fmap);
+        hm_insert(&db, &ent->node);
+        for (size_t j = 0; j < nfield; ++j) {
+            fmap_set(fmap, field_name(fbuf, j), val);
+        }
+        bytes += entry_mem_usage(ent) + fmap_mem_usage(fmap);
+    }
+    bytes += hm_mem_usage(&db);
+
+    uint64_t rnd = 0x9E3779B97F4A7C15ull;
+    uint64_t t0 = now_ns();
+    for (size_t q = 0; q < k_reads; ++q) {
+        size_t i = xorshift(rnd) % nobj;
+        Entry *ent = lookup(&db, obj_name(kbuf, i));
+        std::string_view got;
+        if (!ent || !fmap_get((FMap *)entry_obj(ent), field_name(fbuf, xorshift(rnd) % nfield),
+                              &got) ||
+            got != val) {
+            fail("hget", i);
+        }
+    }
+    uint64_t t1 = now_ns();
+    printf("hash   %5zu fields  %7.1f B/field  hget  %6.1f ns  (%s)\n", nfield,
+           double(bytes) / (nobj * nfield), double(t1 - t0) / k_reads,
+           nfield <= k_fmap_packed_max ? "packed" : "table");
+    free_db(&db);
+}
+
+int main(int argc, char **argv) {
+    size_t total = argc > 1 ? strtoull(argv[1], NULL, 10) : 2000000;
+    hash_seed_init();
+    const size_t nfields[] = {4, 16, 100, 1000};
+    for (size_t nfield : nfields) {
+        size_t nobj = total / nfield;
+        run_keys(nobj, nfield);
+        run_hash(nobj, nfield);
+    }
+    return 0;
+}
@@ -0,0 +1,216 @@
+#include "fmap.hpp"
+#include "test_util.hpp"
+#include <iostream>
+#include <map>
+#include <stdint.h>
+#include <string>
+
+typedef std::map<std::string, std::string> Model;
+
+static void collectField(std::string_view field, std::string_view val, void *arg) {
+  (*(Model *)arg)[std::string(field)] = std::string(val);
+}
+
+// fmap_foreach() visits the model's fields, and every field is found
+static bool sameAsModel(FMap *fmap, const Model &model) {
+  Model seen;
+  fmap_foreach(fmap, collectField, &seen);
+  if (fmap->size != model.size() || seen != model) {
+    return false;
+  }
+  for (const auto &m : model) {
+    std::string_view val;
+    if (!fmap_get(fmap, m.first, &val) || val != m.second) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The map stays packed up to k_fmap_packed_max fields, and converts on the
+// next one
+void testConversionThreshold() {
+  FMap fmap;
+  Model model;
+  bool passed = true;
+  for (size_t i = 0; i < k_fmap_packed_max; ++i) {
+    std::string field = "f" + std::to_string(i);
+    passed = passed && fmap_set(&fmap, field, "v" + field);
+    model[field] = "v" + field;
+  }
+  passed = passed && fmap.table == nullptr && sameAsModel(&fmap, model);
+
+  passed = passed && fmap_set(&fmap, "last", "x");
+  model["last"] = "x";
+  passed = passed && fmap.table != nullptr && fmap.packed == nullptr && sameAsModel(&fmap, model);
+
+  fmap_clear(&fmap);
+  passed = passed && fmap.size == 0 && fmap.table == nullptr;
+
+  runTest("Conversion Threshold", passed);
+}
+
+// a field or a value over k_fmap_packed_len_max converts a small map too,
+// and a new value of an existing field as well
+void testLongConverts() {
+  bool passed = true;
+  std::string fits(k_fmap_packed_len_max, 'x');
+  std::string big(k_fmap_packed_len_max + 1, 'y');
+  for (int which = 0; which < 3; ++which) {
+    FMap fmap;
+    Model model = {{"a", "1"}, {fits, fits}};
+    passed = passed && fmap_set(&fmap, "a", "1") && fmap_set(&fmap, fits, fits) &&
+             fmap.table == nullptr;
+    if (which == 0) {
+      passed = passed && fmap_set(&fmap, big, "v");
+      model[big] = "v";
+    } else if (which == 1) {
+      passed = passed && fmap_set(&fmap, "b", big);
+      model["b"] = big;
+    } else {
+      passed = passed && !fmap_set(&fmap, "a", big);
+      model["a"] = big;
+    }
+    passed = passed && fmap.table != nullptr && sameAsModel(&fmap, model);
+    fmap_clear(&fmap);
+  }
+
+  runTest("Long Converts", passed);
+}
+
+// new values of other lengths, deletes, and fields that are not there
+void testSetGetDel() {
+  bool passed = true;
+  for (bool table : {false, true}) {
+    FMap fmap;
+    Model model;
+    if (table) {
+      for (size_t i = 0; i < 2 * k_fmap_packed_max; ++i) {
+        fmap_set(&fmap, "pad" + std::to_string(i), "p");
+        model["pad" + std::to_string(i)] = "p";
+      }
+    }
+    passed = passed && fmap_set(&fmap, "a", "1") && fmap_set(&fmap, "b", "") &&
+             fmap_set(&fmap, "", "empty");
+    model["a"] = "1";
+    model["b"] = "";
+    model[""] = "empty";
+    passed = passed && !fmap_set(&fmap, "a", "2") && !fmap_set(&fmap, "b", "longer value");
+    model["a"] = "2";
+    model["b"] = "longer value";
+    passed = passed && sameAsModel(&fmap, model);
+
+    std::string_view val;
+    passed = passed && fmap_del(&fmap, "a") && !fmap_del(&fmap, "a") &&
+             !fmap_get(&fmap, "a", &val) && !fmap_del(&fmap, "missing");
+    model.erase("a");
+    passed = passed && sameAsModel(&fmap, model) && (fmap.table != nullptr) == table;
+    fmap_clear(&fmap);
+  }
+
+  runTest("Set Get Del", passed);
+}
+
+// a slot from fmap_find_or_add() takes new values of any length, in both
+// encodings and across the conversion
+void testFindOrAdd() {
+  bool passed = true;
+  for (bool table : {false, true}) {
+    FMap fmap;
+    Model model;
+    if (table) {
+      for (size_t i = 0; i < 2 * k_fmap_packed_max; ++i) {
+        fmap_set(&fmap, "pad" + std::to_string(i), "p");
+        model["pad" + std::to_string(i)] = "p";
+      }
+    }
+    fmap_set(&fmap, "old", "123");
+    model["old"] = "123";
+    FSlot slot;
+    std::string_view val;
+    passed = passed && !fmap_find_or_add(&fmap, "old", &slot, &val) && val == "123";
+    const char *vals[] = {"1", "12345678901234567890", "", "-9"};
+    for (const char *v : vals) {
+      fmap_slot_set(&fmap, &slot, v);
+      model["old"] = v;
+      passed = passed && sameAsModel(&fmap, model);
+    }
+
+    passed = passed && fmap_find_or_add(&fmap, "new", &slot, &val) && val.empty();
+    model["new"] = "";
+    passed = passed && sameAsModel(&fmap, model);
+    std::string big(k_fmap_packed_len_max + 1, 'b');
+    fmap_slot_set(&fmap, &slot, big);
+    model["new"] = big;
+    fmap_slot_set(&fmap, &slot, "small again");
+    model["new"] = "small again";
+    passed = passed && fmap.table != nullptr && sameAsModel(&fmap, model);
+    fmap_clear(&fmap);
+  }
+
+  runTest("Find Or Add", passed);
+}
+
+// sets, deletes and slot updates of 300 fields with values up to 40 bytes,
+// packed then as a table
+void testRandomAgainstModel() {
+  FMap fmap;
+  Model model;
+  uint64_t rnd = 0x9E3779B97F4A7C15ull;
+  bool passed = true;
+  for (int i = 0; i < 20000 && passed; ++i) {
+    std::string field = "f" + std::to_string(xorshift(rnd) % 300);
+    std::string val(xorshift(rnd) % 40, char('a' + i % 26));
+    bool had = model.count(field) != 0;
+    uint64_t op = xorshift(rnd) % 3;
+    if (op == 0) {
+      passed = fmap_del(&fmap, field) == had;
+      model.erase(field);
+    } else if (op == 1) {
+      passed = fmap_set(&fmap, field, val) == !had;
+      model[field] = val;
+    } else {
+      FSlot slot;
+      std::string_view old;
+      passed = fmap_find_or_add(&fmap, field, &slot, &old) == !had &&
+               old == (had ? model[field] : "");
+      fmap_slot_set(&fmap, &slot, val);
+      model[field] = val;
+    }
+    if (i % 500 == 0) {
+      passed = passed && sameAsModel(&fmap, model);
+    }
+  }
+  passed = passed && fmap.table != nullptr && sameAsModel(&fmap, model);
+  fmap_clear(&fmap);
+
+  runTest("Random Against Model", passed);
+}
+
+// 5000 FNodes, about 100 a call, then the FTable itself
+void testClearSome() {
+  FMap fmap;
+  for (int i = 0; i < 5000; ++i) {
+    fmap_set(&fmap, "f" + std::to_string(i), "v");
+  }
+  uint64_t cursor = 0;
+  int calls = callsUntilDone([&]() { return fmap_clear_some(&fmap, &cursor, 100); });
+  bool passed = calls >= 25 && fmap.size == 0 && fmap.table == nullptr &&
+                fmap_mem_usage(&fmap) == sizeof(FMap);
+
+  runTest("Clear Some", passed);
+}
+
+int main() {
+  std::cout << "Running FMap Tests:" << std::endl;
+
+  testConversionThreshold();
+  testLongConverts();
+  testSetGetDel();
+  testFindOrAdd();
+  testRandomAgainstModel();
+  testClearSome();
+
+  std::cout << "All tests completed." << std::endl;
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,113 @@
+#include "hash.hpp"
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/random.h>
+#endif
+
+uint64_t g_hash_seed = 0;
+
+static const uint64_t k_p0 = 0xa0761d6478bd642full;
+static const uint64_t k_p1 = 0xe7037ed1a0b428dbull;
+static const uint64_t k_p2 = 0x8ebc6af09c88c6e3ull;
+static const uint64_t k_p3 = 0x589965cc75374cc3ull;
+
+// full 64x64 -> 128 multiply, folded back to 64 bits
+static inline uint64_t mix(uint64_t a, uint64_t b)
+{
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+// 1..3 bytes: first, middle and last byte
+static inline uint64_t read_small(const uint8_t *p, size_t len)
+{
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+}
+
+uint64_t hash64(const void *data, size_t len, uint64_t seed)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    seed ^= k_p0;
+    uint64_t a = 0;
+    uint64_t b = 0;
+    if (len <= 16)
+    {
+        if (len >= 4)
+        {
+            // two pairs of possibly overlapping 4-byte loads cover 4..16 bytes
+            size_t off = (len >> 3) << 2;
+            a = (read32(p) << 32) | read32(p + off);
+            b = (read32(p + len - 4) << 32) | read32(p + len - 4 - off);
+        }
+        else if (len > 0)
+        {
+            a = read_small(p, len);
+        }
+    }
+    else
+    {
+        size_t i = len;
+        if (i > 48)
+        {
+            uint64_t see1 = seed;
+            uint64_t see2 = seed;
+            do
+            {
+                seed = mix(read64(p) ^ k_p1, read64(p + 8) ^ seed);
+                see1 = mix(read64(p + 16) ^ k_p2, read64(p + 24) ^ see1);
+                see2 = mix(read64(p + 32) ^ k_p3, read64(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16)
+        {
+            seed = mix(read64(p) ^ k_p1, read64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        // last 16 bytes, overlapping what was already consumed if needed
+        a = read64(p + i - 16);
+        b = read64(p + i - 8);
+    }
+    a ^= k_p1;
+    b ^= seed;
+    __uint128_t r = (__uint128_t)a * b;
+    a = (uint64_t)r;
+    b = (uint64_t)(r >> 64);
+    return mix(a ^ k_p0 ^ len, b ^ k_p1);
+}
+
+void hash_seed_init()
+{
+    uint64_t seed = 0;
+#ifdef __linux__
+    if (getrandom(&seed, sizeof(seed), 0) == (ssize_t)sizeof(seed))
+    {
+        g_hash_seed = seed;
+        return;
+    }
+#endif
+    struct timespec ts = {0, 0};
+    clock_gettime(CLOCK_REALTIME, &ts);
+    seed = (uint64_t)ts.tv_nsec ^ ((uint64_t)ts.tv_sec << 32) ^
+           ((uint64_t)getpid() << 16);
+    g_hash_seed = mix(seed ^ k_p2, k_p3);
+}
@@ -0,0 +1,17 @@
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// 64-bit keyed hash for the keyspace. It consumes 48 bytes per step on long
+// inputs (three independent 64x64->128 multiply lanes) and reads short keys
+// with a couple of overlapping loads instead of a byte loop.
+uint64_t hash64(const void *data, size_t len, uint64_t seed);
+
+// Process-wide seed so that colliding keys can not be precomputed.
+// hash_seed_init() picks a random one and must run before any key is hashed.
+extern uint64_t g_hash_seed;
+void hash_seed_init();
+
+#endif // HASH_HPP
@@ -0,0 +1,95 @@
+// Hashing microbenchmark: the old 32-bit byte-at-a-time FNV str_hash against
+// hash64 across key lengths, plus how well each spreads typical keys over a
+// large power-of-2 table (low bits) and over the upper 32 bits.
+//
+//   ./hash_bench
+#include "hash.hpp"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+// the previous str_hash from server.hpp
+static uint64_t fnv32_hash(const uint8_t *data, size_t len) {
+    uint32_t h = 0x811C9DC5;
+    for (size_t i = 0; i < len; i++) {
+        h = (h + data[i]) * 0x01000193;
+    }
+    return h;
+}
+
+static uint64_t hash64_seeded(const uint8_t *data, size_t len) {
+    return hash64(data, len, g_hash_seed);
+}
+
+static uint64_t now_ns() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+// keep the compiler from dropping the hash calls
+static volatile uint64_t g_sink;
+
+static double bench(uint64_t (*f)(const uint8_t *, size_t), const uint8_t *buf,
+                    size_t len, size_t iters) {
+    uint64_t acc = 0;
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < iters; ++i) {
+        // vary the start so the loop is not one repeated input
+        acc += f(buf + (i & 7), len);
+    }
+    uint64_t elapsed = now_ns() - start;
+    g_sink = acc;
+    return double(elapsed) / iters;
+}
+
+// fraction of distinct slots hit by `nkeys` keys in a table of 2^bits slots,
+// using either the low bits or bits 32..63 of the hash
+static double spread(uint64_t (*f)(const uint8_t *, size_t), size_t nkeys,
+                     unsigned bits, bool high) {
+    std::vector<uint8_t> seen((size_t)1 << bits, 0);
+    size_t distinct = 0;
+    char key[32];
+    for (size_t i = 0; i < nkeys; ++i) {
+        int n = snprintf(key, sizeof(key), "user:%zu", i);
+        uint64_t h = f((const uint8_t *)key, n);
+        size_t slot = (high ? (h >> 32) : h) & (((size_t)1 << bits) - 1);
+        if (!seen[slot]) {
+            seen[slot] = 1;
+            distinct++;
+        }
+    }
+    return double(distinct) / nkeys;
+}
+
+int main() {
+    hash_seed_init();
+    std::vector<uint8_t> buf(4096 + 8);
+    for (size_t i = 0; i < buf.size(); ++i) {
+        buf[i] = (uint8_t)(i * 131 + 7);
+    }
+
+    printf("%8s %14s %14s %12s %12s\n", "key len", "fnv32 ns/op", "hash64 ns/op",
+           "fnv32 GB/s", "hash64 GB/s");
+    const size_t lens[] = {4, 8, 16, 24, 32, 64, 128, 256, 1024, 4096};
+    for (size_t len : lens) {
+        size_t iters = (size_t)(200u << 20) / (len + 16);
+        double fnv = bench(fnv32_hash, buf.data(), len, iters);
+        double h64 = bench(hash64_seeded, buf.data(), len, iters);
+        printf("%8zu %14.2f %14.2f %12.2f %12.2f\n", len, fnv, h64, len / fnv,
+               len / h64);
+    }
+
+    // a random table would fill 1 - 1/e = 63% of the slots with as many keys
+    const size_t nkeys = 1 << 20;
+    printf("\nspread of %zu \"user:N\" keys over 2^20 slots (random: 0.632)\n",
+           nkeys);
+    printf("%8s %14s %14s\n", "bits", "fnv32", "hash64");
+    printf("%8s %14.3f %14.3f\n", "0..19", spread(fnv32_hash, nkeys, 20, false),
+           spread(hash64_seeded, nkeys, 20, false));
+    printf("%8s %14.3f %14.3f\n", "32..51", spread(fnv32_hash, nkeys, 20, true),
+           spread(hash64_seeded, nkeys, 20, true));
+    return 0;
+}
@@ -1,6 +1,29 @@
 #include "hashtable.hpp"
+
+#ifndef HMAP_OPEN_ADDRESSING
 #include "assert.h"
 #include <cstdlib>
+#include <time.h>
+#include <utility>
+
+static void table_free_default(void *ptr, size_t)
+{
+    free(ptr);
+}
+
+static void (*g_table_free)(void *ptr, size_t size) = table_free_default;
+
+void hm_set_table_free(void (*fn)(void *ptr, size_t size))
+{
+    g_table_free = fn;
+}
+
+static uint64_t hm_now_ns()
+{
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
 
 // Initialize Hashtable
 void h_init(HTab *htab, size_t n)
@@ -8,7 +31,7 @@ void h_init(HTab *htab, size_t n)
     assert((n > 0) && ((n - 1) & n) == 0); // assert if n is power of 2
     htab->tab = (HNode **)calloc(n, sizeof(HNode *));
     htab->mask = n - 1;
-    htab->size = n;
+    htab->size = 0;
 }
 
 void h_insert(HTab *htab, HNode *node)
@@ -48,15 +71,69 @@ HNode *h_detach(HTab *htab, HNode **from)
     return node;
 }
 
-void hm_trigger_rehasing(HMap *hmap)
+// start migrating everything into a new table of n slots
+void hm_trigger_rehasing(HMap *hmap, size_t n)
 {
+    assert(!hmap->older.tab);
+    hmap->stats.resizes++;
+    if (n < hmap->newer.mask + 1)
+    {
+        hmap->stats.shrinks++;
+    }
     hmap->older = hmap->newer;
-    h_init(&hmap->newer, (hmap->newer.mask + 1) * 2);
+    h_init(&hmap->newer, n);
     hmap->migrate_pos = 0;
 }
 
+static void hm_record_pause(HMap *hmap, uint64_t ns)
+{
+    hmap->stats.pause_total_ns += ns;
+    if (ns > hmap->stats.pause_max_ns)
+    {
+        hmap->stats.pause_max_ns = ns;
+    }
+}
+
+// Moves nodes from older to newer for up to `work` units. Empty buckets cost
+// a unit too, so a sparse old table (after a shrink) is bounded as well.
+static void hm_migrate(HMap *hmap, size_t work)
+{
+    while (work > 0 && hmap->older.size > 0)
+    {
+        HNode **from = &hmap->older.tab[hmap->migrate_pos];
+        if (!*from)
+        {
+            hmap->migrate_pos++;
+            work--;
+            continue;
+        }
+        h_insert(&hmap->newer, h_detach(&hmap->older, from));
+        hmap->stats.migrated++;
+        work--;
+    }
+    if (hmap->older.size == 0 && hmap->older.tab)
+    {
+        g_table_free(hmap->older.tab, (hmap->older.mask + 1) * sizeof(HNode *));
+        hmap->older = HTab{};
+    }
+}
+
+void hm_help_rehashing(HMap *hmap, size_t work)
+{
+    if (!hmap->older.tab)
+    {
+        return;
+    }
+    uint64_t start = hm_now_ns();
+    hm_migrate(hmap, work);
+    hm_record_pause(hmap, hm_now_ns() - start);
+}
+
 HNode *h_lookup(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *))
 {
+    // reads move the migration along too, or a read-only workload would
+    // probe both tables forever
+    hm_help_rehashing(hmap, k_rehashing_read_work);
     HNode **from = h_lookup(&hmap->newer, key, eq);
     if (!from)
     {
@@ -65,18 +142,39 @@ HNode *h_lookup(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *))
     return from ? *from : nullptr;
 }
 
+// shrink once the load factor collapsed, to about one node per slot
+static void hm_maybe_shrink(HMap *hmap)
+{
+    size_t slots = hmap->newer.mask + 1;
+    if (hmap->older.tab || slots <= 4 || hmap->newer.size >= slots / k_shrink_ratio)
+    {
+        return;
+    }
+    size_t n = 4;
+    while (n < hmap->newer.size)
+    {
+        n *= 2;
+    }
+    hm_trigger_rehasing(hmap, n);
+}
+
 HNode *hm_delete(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *))
 {
+    hm_help_rehashing(hmap, k_rehashing_work);
+    HNode *node = nullptr;
     if (HNode **from = h_lookup(&hmap->newer, key, eq))
     {
-        return h_detach(&hmap->newer, from);
+        node = h_detach(&hmap->newer, from);
     }
-
-    if (HNode **from = h_lookup(&hmap->older, key, eq))
+    else if (HNode **from = h_lookup(&hmap->older, key, eq))
     {
-        return h_detach(&hmap->older, from);
+        node = h_detach(&hmap->older, from);
     }
-    return nullptr;
+    if (node)
+    {
+        hm_maybe_shrink(hmap);
+    }
+    return node;
 }
 
 void hm_insert(HMap *hmap, HNode *node)
@@ -91,44 +189,148 @@ void hm_insert(HMap *hmap, HNode *node)
         size_t shreshold = (hmap->newer.mask + 1) * k_max_load_factor;
         if (hmap->newer.size >= shreshold)
         {
-            hm_trigger_rehasing(hmap);
+            hm_trigger_rehasing(hmap, (hmap->newer.mask + 1) * 2);
         }
     }
-    hm_help_rehashing(hmap);
+    hm_help_rehashing(hmap, k_rehashing_work);
 }
 
-void hm_help_rehashing(HMap *hmap)
+bool hm_rehashing(HMap *hmap)
 {
-    size_t n_work = 0;
-    while (n_work < k_rehashing_work && hmap->older.size > 0)
+    return hmap->older.tab != nullptr;
+}
+
+bool hm_rehash_for(HMap *hmap, uint64_t budget_us)
+{
+    if (!hmap->older.tab)
     {
-        HNode **from = &hmap->older.tab[hmap->migrate_pos];
-        if (!*from)
-        {
-            hmap->migrate_pos++;
-            continue;
-        }
-        h_insert(&hmap->newer, h_detach(&hmap->older, from));
-        n_work++;
+        return false;
     }
-    if (hmap->older.size == 0 && hmap->older.tab)
+    uint64_t start = hm_now_ns();
+    uint64_t deadline = start + budget_us * 1000;
+    uint64_t now = start;
+    while (hmap->older.tab && now < deadline)
     {
-        free(hmap->older.tab);
-        hmap->older = HTab{};
+        hm_migrate(hmap, k_rehashing_work);
+        now = hm_now_ns();
     }
+    hm_record_pause(hmap, now - start);
+    return hmap->older.tab != nullptr;
 }
 
 void hm_foreach(HMap *hmap, bool (*cb)(HNode *, void *), void *out) {
-    HTab htab = hmap->newer;
-    for (size_t i = 0; i < htab.size; ++i) {
-        HNode *head = htab.tab[i];
-        while (head != nullptr) {
-            cb(head, out);
-            head = head->next;
+    // mid-rehash, the nodes not migrated yet are still in older
+    for (HTab *htab : {&hmap->newer, &hmap->older}) {
+        for (size_t i = 0; htab->tab && i <= htab->mask; ++i) {
+            for (HNode *node = htab->tab[i]; node != nullptr; node = node->next) {
+                if (!cb(node, out)) {
+                    return;
+                }
+            }
         }
     }
 }
 
+static void h_scan_bucket(HTab *htab, uint64_t cursor,
+                          void (*cb)(HNode *, void *), void *arg) {
+    for (HNode *node = htab->tab[cursor & htab->mask]; node; node = node->next) {
+        cb(node, arg);
+    }
+}
+
+uint64_t hm_scan(HMap *hmap, uint64_t cursor, void (*cb)(HNode *, void *),
+                 void *arg) {
+    if (!hmap->newer.tab) {
+        return 0;
+    }
+    if (!hmap->older.tab) {
+        h_scan_bucket(&hmap->newer, cursor, cb, arg);
+        return hm_cursor_next(cursor, hmap->newer.mask);
+    }
+    // Mid-rehash: the bucket of the smaller table, then every bucket of the
+    // larger one that it splits into. Those share the low bits of the cursor
+    // and differ in the bits only the larger mask has.
+    HTab *small = &hmap->newer;
+    HTab *large = &hmap->older;
+    if (small->mask > large->mask) {
+        std::swap(small, large);
+    }
+    h_scan_bucket(small, cursor, cb, arg);
+    do {
+        h_scan_bucket(large, cursor, cb, arg);
+        cursor = hm_cursor_next(cursor, large->mask);
+    } while (cursor & (small->mask ^ large->mask));
+    return cursor;
+}
+
+// mid-rehash the bucket is looked at in both tables
+size_t hm_sample(HMap *hmap, uint64_t start, HNode **out, size_t n) {
+    size_t got = 0;
+    for (size_t step = 0; got < n && step < n * 10; ++step) {
+        for (HTab *htab : {&hmap->newer, &hmap->older}) {
+            if (!htab->tab) {
+                continue;
+            }
+            HNode *node = htab->tab[(start + step) & htab->mask];
+            for (; node && got < n; node = node->next) {
+                out[got++] = node;
+            }
+        }
+    }
+    return got;
+}
+
 size_t hm_size(HMap *hmap) {
     return hmap->newer.size + hmap->older.size;
 }
+
+void hm_clear(HMap *hmap) {
+    for (HTab *htab : {&hmap->newer, &hmap->older}) {
+        if (htab->tab) {
+            g_table_free(htab->tab, (htab->mask + 1) * sizeof(HNode *));
+        }
+    }
+    *hmap = HMap{};
+}
+
+size_t hm_mem_usage(HMap *hmap) {
+    size_t nslots = 0;
+    if (hmap->newer.tab) {
+        nslots += hmap->newer.mask + 1;
+    }
+    if (hmap->older.tab) {
+        nslots += hmap->older.mask + 1;
+    }
+    return nslots * sizeof(HNode *);
+}
+
+void hm_stats(HMap *hmap, HMapStats *out) {
+    *out = hmap->stats;
+    out->slots = hmap->newer.tab ? hmap->newer.mask + 1 : 0;
+    out->rehash_pending = hmap->older.size;
+}
+
+// a key can be in either table while rehashing, so both are prefetched
+void hm_prefetch(HMap *hmap, uint64_t hcode) {
+    if (hmap->newer.tab) {
+        __builtin_prefetch(&hmap->newer.tab[hcode & hmap->newer.mask]);
+    }
+    if (hmap->older.tab) {
+        __builtin_prefetch(&hmap->older.tab[hcode & hmap->older.mask]);
+    }
+}
+
+void hm_prefetch_node(HMap *hmap, uint64_t hcode) {
+    if (hmap->newer.tab) {
+        if (HNode *node = hmap->newer.tab[hcode & hmap->newer.mask]) {
+            __builtin_prefetch(node);
+        }
+    }
+    if (hmap->older.tab) {
+        if (HNode *node = hmap->older.tab[hcode & hmap->older.mask]) {
+            __builtin_prefetch(node);
+        }
+    }
+}
+
+#endif // HMAP_OPEN_ADDRESSING
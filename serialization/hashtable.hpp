@@ -4,15 +4,48 @@
 #include <cstddef>
 #include <cstdint>
 
+// Two engines implement the hm_* API, picked at build time:
+//  - chained (default, hashtable.cpp): a bucket array of intrusive HNode
+//    lists, resized incrementally by moving nodes from `older` to `newer`.
+//  - open addressing (-DHMAP_OPEN_ADDRESSING, hashtable_oa.cpp): a flat array
+//    of HNode pointers plus one control byte per slot holding a 7-bit tag of
+//    the hash. 16 control bytes are matched at once (SSE2, or a portable
+//    64-bit SWAR fallback), so a lookup usually touches the control group,
+//    one slot and the node itself. Resizes are done in one go.
+//
+// Both grow when full and shrink once fewer than 1 in k_shrink_ratio slots
+// is in use.
+
 const size_t k_max_load_factor = 8;
+const size_t k_shrink_ratio = 8;
+// rehashing work per insert or delete, and per lookup: one unit per bucket
+// visited or node moved
 const size_t k_rehashing_work = 128;
+const size_t k_rehashing_read_work = 16;
+
+struct HMapStats
+{
+    uint64_t resizes = 0; // rehashes started, growing or shrinking
+    uint64_t shrinks = 0;
+    uint64_t migrated = 0; // nodes moved to a resized table
+    // time spent rehashing: per step for the chained engine, per whole
+    // resize for open addressing
+    uint64_t pause_max_ns = 0;
+    uint64_t pause_total_ns = 0;
+    // filled in by hm_stats()
+    size_t slots = 0;          // capacity of the current table
+    size_t rehash_pending = 0; // nodes still waiting in the old table
+};
 
 struct HNode
 {
+#ifndef HMAP_OPEN_ADDRESSING
     HNode *next = nullptr;
+#endif
     uint64_t hcode = 0;
 };
 
+#ifndef HMAP_OPEN_ADDRESSING
 struct HTab
 {
     HNode **tab = nullptr;
@@ -25,6 +58,7 @@ struct HMap
     HTab newer;
     HTab older;
     size_t migrate_pos = 0;
+    HMapStats stats;
 };
 
 void h_init(HTab *htab, size_t n);
@@ -32,13 +66,79 @@ void h_insert(HTab *htab, HNode *node);
 HNode **h_lookup(HTab *htab, HNode *key, bool (*eq)(HNode *, HNode *));
 HNode *h_detach(HTab *htab, HNode **from);
 
-void hm_trigger_rehasing(HMap *hmap);
-void hm_help_rehashing(HMap *hmap);
+void hm_trigger_rehasing(HMap *hmap, size_t n);
+void hm_help_rehashing(HMap *hmap, size_t work);
+#else
+const size_t k_oa_group = 16; // slots per control group
+
+struct HMap
+{
+    // one control byte per slot: k_ctrl_empty, k_ctrl_deleted, or the low
+    // 7 bits of the node's hash. Slots are probed a group at a time.
+    uint8_t *ctrl = nullptr;
+    HNode **slots = nullptr;
+    size_t mask = 0;       // capacity - 1, capacity is a power of 2
+    size_t size = 0;       // live nodes
+    size_t tombstones = 0; // deleted slots not yet reclaimed
+    size_t growth_left = 0; // inserts into empty slots before a resize
+    HMapStats stats;
+};
+#endif
+
 HNode *h_lookup(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *));
 HNode *hm_delete(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *));
 void hm_insert(HMap *hmap, HNode *node);
 // for each key, do a callback => void func(HNode *, Buffer &buf)
 void hm_foreach(HMap *hmap, bool (*f)(HNode *, void *), void *arg);
 size_t hm_size(HMap *hmap);
+// frees the table arrays, not the nodes, and leaves the map empty
+void hm_clear(HMap *hmap);
+// bytes used by the table itself, not counting the nodes
+size_t hm_mem_usage(HMap *hmap);
+// Stateless iteration: start with cursor 0 and pass back the returned cursor
+// until it is 0 again. Each call visits one bucket (open addressing: every
+// node whose probe sequence starts at one group). Buckets are visited in
+// reverse-binary order of their index, so a table that doubles or halves
+// between calls only splits or merges buckets the cursor has or has not
+// covered yet: every node present for the whole scan is reported at least
+// once, with repeats possible after a shrink.
+uint64_t hm_scan(HMap *hmap, uint64_t cursor, void (*cb)(HNode *, void *), void *arg);
+// Up to `n` nodes from the buckets (open addressing: slots) following
+// `start`, which the caller picks at random, for sampling-based eviction.
+// Gives up after a bounded number of buckets, so it can return fewer than n
+// on a sparse table and 0 only when the table is (nearly) empty.
+size_t hm_sample(HMap *hmap, uint64_t start, HNode **out, size_t n);
+void hm_stats(HMap *hmap, HMapStats *out);
+// How the arrays of a table that was resized away are freed, free() by
+// default. A huge array can take a while to unmap, so the server hands them
+// to its lazy-free thread.
+void hm_set_table_free(void (*fn)(void *ptr, size_t size));
+// Whether a migration to a resized table is in progress. The chained engine
+// advances it a little on every operation; hm_rehash_for() lets the event
+// loop spend up to `budget_us` on it and returns whether there is more to do.
+// Open addressing never has a migration pending.
+bool hm_rehashing(HMap *hmap);
+bool hm_rehash_for(HMap *hmap, uint64_t budget_us);
+// Software prefetch for a later lookup of `hcode`, split in two steps so a
+// batch of lookups can overlap their cache misses: hm_prefetch() touches the
+// table memory the hash maps to, hm_prefetch_node() then reads it (cached by
+// now) and prefetches the first candidate node. Both are hints only.
+void hm_prefetch(HMap *hmap, uint64_t hcode);
+void hm_prefetch_node(HMap *hmap, uint64_t hcode);
+
+static inline uint64_t hm_bit_reverse(uint64_t v)
+{
+    v = __builtin_bswap64(v);
+    v = ((v >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((v & 0x0F0F0F0F0F0F0F0Full) << 4);
+    v = ((v >> 2) & 0x3333333333333333ull) | ((v & 0x3333333333333333ull) << 2);
+    v = ((v >> 1) & 0x5555555555555555ull) | ((v & 0x5555555555555555ull) << 1);
+    return v;
+}
+
+// the next cursor: add 1 to the reversed bits of cursor & mask, 0 at the end
+static inline uint64_t hm_cursor_next(uint64_t cursor, uint64_t mask)
+{
+    return hm_bit_reverse(hm_bit_reverse(cursor | ~mask) + 1);
+}
 
 #endif // HASHTABLE_HPP
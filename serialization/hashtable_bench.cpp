@@ -0,0 +1,136 @@
+// Hash table engine benchmark. Built once per engine (make bench builds
+// hm_chain_bench and hm_oa_bench from this file); reports insert and lookup
+// throughput and memory per key for each table size.
+//
+//   ./hm_chain_bench [nkeys,...]      default 1000000,10000000
+#include "hash.hpp"
+#include "hashtable.hpp"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#define container_of(ptr, T, member) ((T *)((char *)ptr - offsetof(T, member)))
+
+struct BEntry {
+    HNode node;
+    uint64_t key = 0;
+};
+
+static bool bentry_eq(HNode *x, HNode *y) {
+    return container_of(x, BEntry, node)->key == container_of(y, BEntry, node)->key;
+}
+
+static uint64_t now_ns() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+static size_t rss_bytes() {
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) {
+        return 0;
+    }
+    unsigned long pages = 0, resident = 0;
+    if (fscanf(f, "%lu %lu", &pages, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(f);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static uint64_t xorshift(uint64_t &s) {
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+}
+
+// distinct keys: even numbers are stored, odd ones are guaranteed misses
+static uint64_t key_of(size_t i) {
+    return (uint64_t)i * 2;
+}
+
+static void run(size_t n) {
+    std::vector<BEntry> entries(n);
+    for (size_t i = 0; i < n; ++i) {
+        entries[i].key = key_of(i);
+        entries[i].node.hcode = hash64(&entries[i].key, 8, g_hash_seed);
+    }
+
+    HMap map = {};
+    size_t rss_before = rss_bytes();
+    uint64_t t0 = now_ns();
+    for (size_t i = 0; i < n; ++i) {
+        hm_insert(&map, &entries[i].node);
+    }
+    uint64_t t1 = now_ns();
+    size_t rss_after = rss_bytes();
+
+    size_t nlookups = n < 10000000 ? n : 10000000;
+    uint64_t seed = 0x12345678;
+    size_t found = 0;
+    uint64_t t2 = now_ns();
+    for (size_t i = 0; i < nlookups; ++i) {
+        BEntry key;
+        key.key = key_of(xorshift(seed) % n);
+        key.node.hcode = hash64(&key.key, 8, g_hash_seed);
+        found += h_lookup(&map, &key.node, bentry_eq) != nullptr;
+    }
+    uint64_t t3 = now_ns();
+    size_t missed = 0;
+    for (size_t i = 0; i < nlookups; ++i) {
+        BEntry key;
+        key.key = key_of(xorshift(seed) % n) + 1;
+        key.node.hcode = hash64(&key.key, 8, g_hash_seed);
+        missed += h_lookup(&map, &key.node, bentry_eq) == nullptr;
+    }
+    uint64_t t4 = now_ns();
+    if (found != nlookups || missed != nlookups || hm_size(&map) != n) {
+        fprintf(stderr, "bad result: found %zu missed %zu size %zu\n", found,
+                missed, hm_size(&map));
+        exit(1);
+    }
+    size_t table_bytes = hm_mem_usage(&map);
+    for (size_t i = 0; i < n; ++i) {
+        hm_delete(&map, &entries[i].node, bentry_eq);
+    }
+    uint64_t t5 = now_ns();
+    HMapStats hs;
+    hm_stats(&map, &hs);
+
+    printf("%10zu keys %9.2f M ins/s %9.2f M hit/s %9.2f M miss/s %9.2f M del/s"
+           "  table %5.1f B/key  rss %5.1f B/key (+%zu B node)"
+           "  rehash pause max %6.1f us, empty table %zu B\n",
+           n, n * 1e3 / (t1 - t0), nlookups * 1e3 / (t3 - t2),
+           nlookups * 1e3 / (t4 - t3), n * 1e3 / (t5 - t4),
+           double(table_bytes) / n, double(rss_after - rss_before) / n,
+           sizeof(BEntry), hs.pause_max_ns / 1e3, hm_mem_usage(&map));
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    hash_seed_init();
+    std::vector<size_t> sizes = {1000000, 10000000};
+    if (argc > 1) {
+        sizes.clear();
+        for (char *s = argv[1]; *s;) {
+            char *end = NULL;
+            sizes.push_back(strtoull(s, &end, 10));
+            s = (*end == ',') ? end + 1 : end;
+        }
+    }
+#ifdef HMAP_OPEN_ADDRESSING
+    printf("engine: open addressing\n");
+#else
+    printf("engine: chained\n");
+#endif
+    for (size_t n : sizes) {
+        run(n);
+    }
+    return 0;
+}
@@ -0,0 +1,414 @@
+#include "hashtable.hpp"
+
+#ifdef HMAP_OPEN_ADDRESSING
+#include "assert.h"
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// control byte values; a full slot holds its 7-bit tag (high bit clear)
+static const uint8_t k_ctrl_empty = 0x80;
+static const uint8_t k_ctrl_deleted = 0xFE;
+
+// bits 0..6 of the hash are the tag, the rest picks the first group
+static inline uint8_t h2(uint64_t hcode)
+{
+    return (uint8_t)(hcode & 0x7F);
+}
+
+static inline size_t h1(uint64_t hcode)
+{
+    return (size_t)(hcode >> 7);
+}
+
+// Bit i of the returned masks is set when control byte i of the group matches.
+#ifdef __SSE2__
+static inline uint32_t group_match(const uint8_t *g, uint8_t tag)
+{
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)g);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)tag)));
+}
+
+static inline uint32_t group_match_empty_or_deleted(const uint8_t *g)
+{
+    // only the two special values have the high bit set
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)g));
+}
+#else
+// portable fallback: two 64-bit words of 8 control bytes each (SWAR)
+static const uint64_t k_lsb = 0x0101010101010101ull;
+static const uint64_t k_msb = 0x8080808080808080ull;
+
+// 0x80 in every byte of x that is zero, exact (no carries between bytes)
+static inline uint64_t zero_bytes(uint64_t x)
+{
+    uint64_t low7 = ~k_msb;
+    return ~(((x & low7) + low7) | x | low7);
+}
+
+// gather the high bit of each byte into an 8-bit mask
+static inline uint32_t msb_to_mask(uint64_t x)
+{
+    return (uint32_t)(((x >> 7) * 0x0102040810204080ull) >> 56);
+}
+
+static inline uint64_t load64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint32_t group_match(const uint8_t *g, uint8_t tag)
+{
+    uint64_t pattern = k_lsb * tag;
+    return msb_to_mask(zero_bytes(load64(g) ^ pattern)) |
+           (msb_to_mask(zero_bytes(load64(g + 8) ^ pattern)) << 8);
+}
+
+static inline uint32_t group_match_empty_or_deleted(const uint8_t *g)
+{
+    return msb_to_mask(load64(g) & k_msb) | (msb_to_mask(load64(g + 8) & k_msb) << 8);
+}
+#endif
+
+static inline uint32_t group_match_empty(const uint8_t *g)
+{
+    return group_match(g, k_ctrl_empty);
+}
+
+static void table_free_default(void *ptr, size_t)
+{
+    free(ptr);
+}
+
+static void (*g_table_free)(void *ptr, size_t size) = table_free_default;
+
+void hm_set_table_free(void (*fn)(void *ptr, size_t size))
+{
+    g_table_free = fn;
+}
+
+static size_t max_fill(size_t capacity)
+{
+    return capacity - capacity / 8; // 7/8 load factor
+}
+
+static void oa_init(HMap *hmap, size_t capacity)
+{
+    assert(capacity >= k_oa_group && ((capacity - 1) & capacity) == 0);
+    hmap->ctrl = (uint8_t *)malloc(capacity);
+    memset(hmap->ctrl, k_ctrl_empty, capacity);
+    hmap->slots = (HNode **)calloc(capacity, sizeof(HNode *));
+    hmap->mask = capacity - 1;
+    hmap->size = 0;
+    hmap->tombstones = 0;
+    hmap->growth_left = max_fill(capacity);
+}
+
+// Groups are probed with triangular steps, which visits every group of a
+// power-of-2 table. Returns the first slot that is empty or deleted.
+static size_t oa_find_free(HMap *hmap, uint64_t hcode)
+{
+    size_t ngroups = (hmap->mask + 1) / k_oa_group;
+    size_t g = h1(hcode) & (ngroups - 1);
+    for (size_t step = 1;; ++step)
+    {
+        const uint8_t *ctrl = hmap->ctrl + g * k_oa_group;
+        uint32_t m = group_match_empty_or_deleted(ctrl);
+        if (m)
+        {
+            return g * k_oa_group + __builtin_ctz(m);
+        }
+        g = (g + step) & (ngroups - 1);
+    }
+}
+
+static void oa_set(HMap *hmap, size_t slot, HNode *node)
+{
+    hmap->ctrl[slot] = h2(node->hcode);
+    hmap->slots[slot] = node;
+}
+
+static uint64_t oa_now_ns()
+{
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+// rebuild into a table of `capacity` slots, dropping the tombstones
+static void oa_resize(HMap *hmap, size_t capacity)
+{
+    uint64_t start = oa_now_ns();
+    HMap old = *hmap;
+    oa_init(hmap, capacity);
+    hmap->stats.resizes++;
+    if (capacity < old.mask + 1)
+    {
+        hmap->stats.shrinks++;
+    }
+    for (size_t i = 0; old.ctrl && i <= old.mask; ++i)
+    {
+        if (old.ctrl[i] & 0x80)
+        {
+            continue; // empty or deleted
+        }
+        size_t slot = oa_find_free(hmap, old.slots[i]->hcode);
+        oa_set(hmap, slot, old.slots[i]);
+        hmap->growth_left--;
+        hmap->size++;
+        hmap->stats.migrated++;
+    }
+    if (old.ctrl)
+    {
+        g_table_free(old.ctrl, old.mask + 1);
+        g_table_free(old.slots, (old.mask + 1) * sizeof(HNode *));
+    }
+    uint64_t ns = oa_now_ns() - start;
+    hmap->stats.pause_total_ns += ns;
+    if (ns > hmap->stats.pause_max_ns)
+    {
+        hmap->stats.pause_max_ns = ns;
+    }
+}
+
+// returns the slot holding the key, or (size_t)-1
+static size_t oa_find(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *))
+{
+    if (!hmap->ctrl)
+    {
+        return (size_t)-1;
+    }
+    size_t ngroups = (hmap->mask + 1) / k_oa_group;
+    size_t g = h1(key->hcode) & (ngroups - 1);
+    uint8_t tag = h2(key->hcode);
+    for (size_t step = 1;; ++step)
+    {
+        const uint8_t *ctrl = hmap->ctrl + g * k_oa_group;
+        for (uint32_t m = group_match(ctrl, tag); m; m &= m - 1)
+        {
+            size_t slot = g * k_oa_group + __builtin_ctz(m);
+            HNode *cur = hmap->slots[slot];
+            if (cur->hcode == key->hcode && eq(cur, key))
+            {
+                return slot;
+            }
+        }
+        // an empty slot ends every probe sequence that reaches this group
+        if (group_match_empty(ctrl))
+        {
+            return (size_t)-1;
+        }
+        g = (g + step) & (ngroups - 1);
+    }
+}
+
+HNode *h_lookup(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *))
+{
+    size_t slot = oa_find(hmap, key, eq);
+    return slot == (size_t)-1 ? nullptr : hmap->slots[slot];
+}
+
+HNode *hm_delete(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *))
+{
+    size_t slot = oa_find(hmap, key, eq);
+    if (slot == (size_t)-1)
+    {
+        return nullptr;
+    }
+    HNode *node = hmap->slots[slot];
+    hmap->slots[slot] = nullptr;
+    hmap->size--;
+    // If the group still has an empty slot, no probe sequence ever went past
+    // it, so this slot can be empty again. Otherwise leave a tombstone.
+    const uint8_t *group = hmap->ctrl + (slot & ~(k_oa_group - 1));
+    if (group_match_empty(group))
+    {
+        hmap->ctrl[slot] = k_ctrl_empty;
+        hmap->growth_left++;
+    }
+    else
+    {
+        hmap->ctrl[slot] = k_ctrl_deleted;
+        hmap->tombstones++;
+    }
+    // shrink once the load factor collapsed, to at most half full
+    size_t capacity = hmap->mask + 1;
+    if (capacity > k_oa_group && hmap->size < capacity / k_shrink_ratio)
+    {
+        size_t n = k_oa_group;
+        while (max_fill(n) / 2 < hmap->size)
+        {
+            n *= 2;
+        }
+        oa_resize(hmap, n);
+    }
+    return node;
+}
+
+void hm_insert(HMap *hmap, HNode *node)
+{
+    if (!hmap->ctrl)
+    {
+        oa_init(hmap, k_oa_group);
+    }
+    if (hmap->growth_left == 0)
+    {
+        size_t capacity = hmap->mask + 1;
+        // mostly tombstones: clean up in place instead of growing
+        if (hmap->size + 1 <= max_fill(capacity) / 2)
+        {
+            oa_resize(hmap, capacity);
+        }
+        else
+        {
+            oa_resize(hmap, capacity * 2);
+        }
+    }
+    size_t slot = oa_find_free(hmap, node->hcode);
+    if (hmap->ctrl[slot] == k_ctrl_deleted)
+    {
+        hmap->tombstones--;
+    }
+    else
+    {
+        hmap->growth_left--;
+    }
+    oa_set(hmap, slot, node);
+    hmap->size++;
+}
+
+void hm_foreach(HMap *hmap, bool (*cb)(HNode *, void *), void *arg)
+{
+    for (size_t i = 0; hmap->ctrl && i <= hmap->mask; ++i)
+    {
+        if (!(hmap->ctrl[i] & 0x80) && !cb(hmap->slots[i], arg))
+        {
+            return;
+        }
+    }
+}
+
+// Buckets are home groups: a cursor covers every node whose probe sequence
+// starts at its group. Like a lookup, those all sit before the first group of
+// the sequence that has an empty slot.
+uint64_t hm_scan(HMap *hmap, uint64_t cursor, void (*cb)(HNode *, void *), void *arg)
+{
+    if (!hmap->ctrl)
+    {
+        return 0;
+    }
+    size_t gmask = (hmap->mask + 1) / k_oa_group - 1;
+    size_t home = cursor & gmask;
+    size_t g = home;
+    for (size_t step = 1;; ++step)
+    {
+        const uint8_t *ctrl = hmap->ctrl + g * k_oa_group;
+        for (size_t i = 0; i < k_oa_group; ++i)
+        {
+            HNode *node = hmap->slots[g * k_oa_group + i];
+            if (!(ctrl[i] & 0x80) && (h1(node->hcode) & gmask) == home)
+            {
+                cb(node, arg);
+            }
+        }
+        if (group_match_empty(ctrl))
+        {
+            break;
+        }
+        g = (g + step) & gmask;
+    }
+    return hm_cursor_next(cursor, gmask);
+}
+
+size_t hm_sample(HMap *hmap, uint64_t start, HNode **out, size_t n)
+{
+    size_t got = 0;
+    for (size_t step = 0; hmap->ctrl && got < n && step < n * k_oa_group; ++step)
+    {
+        size_t slot = (start + step) & hmap->mask;
+        if (!(hmap->ctrl[slot] & 0x80))
+        {
+            out[got++] = hmap->slots[slot];
+        }
+    }
+    return got;
+}
+
+size_t hm_size(HMap *hmap)
+{
+    return hmap->size;
+}
+
+void hm_clear(HMap *hmap)
+{
+    if (hmap->ctrl)
+    {
+        g_table_free(hmap->ctrl, hmap->mask + 1);
+        g_table_free(hmap->slots, (hmap->mask + 1) * sizeof(HNode *));
+    }
+    *hmap = HMap{};
+}
+
+size_t hm_mem_usage(HMap *hmap)
+{
+    if (!hmap->ctrl)
+    {
+        return 0;
+    }
+    return (hmap->mask + 1) * (sizeof(uint8_t) + sizeof(HNode *));
+}
+
+void hm_stats(HMap *hmap, HMapStats *out)
+{
+    *out = hmap->stats;
+    out->slots = hmap->ctrl ? hmap->mask + 1 : 0;
+    out->rehash_pending = 0;
+}
+
+bool hm_rehashing(HMap *)
+{
+    return false;
+}
+
+bool hm_rehash_for(HMap *, uint64_t)
+{
+    return false;
+}
+
+// the first group's control bytes and its 16 slot pointers (two lines)
+void hm_prefetch(HMap *hmap, uint64_t hcode)
+{
+    if (!hmap->ctrl)
+    {
+        return;
+    }
+    size_t ngroups = (hmap->mask + 1) / k_oa_group;
+    size_t g = h1(hcode) & (ngroups - 1);
+    __builtin_prefetch(hmap->ctrl + g * k_oa_group);
+    __builtin_prefetch(hmap->slots + g * k_oa_group);
+    __builtin_prefetch(hmap->slots + g * k_oa_group + k_oa_group / 2);
+}
+
+// the node of the first tag match in the first group; keys that spilled into
+// a later group are not prefetched
+void hm_prefetch_node(HMap *hmap, uint64_t hcode)
+{
+    if (!hmap->ctrl)
+    {
+        return;
+    }
+    size_t ngroups = (hmap->mask + 1) / k_oa_group;
+    size_t g = h1(hcode) & (ngroups - 1);
+    uint32_t m = group_match(hmap->ctrl + g * k_oa_group, h2(hcode));
+    if (m)
+    {
+        __builtin_prefetch(hmap->slots[g * k_oa_group + __builtin_ctz(m)]);
+    }
+}
+
+#endif // HMAP_OPEN_ADDRESSING
@@ -0,0 +1,94 @@
+#include "heap.hpp"
+
+// 4-ary: half the depth of a binary heap, and the 4 children of a node are
+// 64 contiguous bytes, so sifting down costs about one cache miss per level
+const size_t k_heap_arity = 4;
+
+static size_t heap_parent(size_t i)
+{
+    return (i - 1) / k_heap_arity;
+}
+
+static void heap_up(HeapItem *a, size_t pos)
+{
+    HeapItem t = a[pos];
+    while (pos > 0 && a[heap_parent(pos)].val > t.val)
+    {
+        // swap with the parent
+        a[pos] = a[heap_parent(pos)];
+        *a[pos].ref = pos;
+        pos = heap_parent(pos);
+    }
+    a[pos] = t;
+    *a[pos].ref = pos;
+}
+
+static void heap_down(HeapItem *a, size_t pos, size_t len)
+{
+    HeapItem t = a[pos];
+    while (true)
+    {
+        // find the smallest one among the parent and their kids
+        size_t first = pos * k_heap_arity + 1;
+        size_t last = first + k_heap_arity < len ? first + k_heap_arity : len;
+        size_t min_pos = pos;
+        uint64_t min_val = t.val;
+        for (size_t k = first; k < last; ++k)
+        {
+            if (a[k].val < min_val)
+            {
+                min_pos = k;
+                min_val = a[k].val;
+            }
+        }
+        if (min_pos == pos)
+        {
+            break;
+        }
+        // swap with the kid
+        a[pos] = a[min_pos];
+        *a[pos].ref = pos;
+        pos = min_pos;
+    }
+    a[pos] = t;
+    *a[pos].ref = pos;
+}
+
+void heap_update(HeapItem *a, size_t pos, size_t len)
+{
+    if (pos > 0 && a[heap_parent(pos)].val > a[pos].val)
+    {
+        heap_up(a, pos);
+    }
+    else
+    {
+        heap_down(a, pos, len);
+    }
+}
+
+void heap_upsert(std::vector<HeapItem> &a, size_t pos, HeapItem t)
+{
+    if (pos < a.size())
+    {
+        a[pos] = t; // update an existing item
+    }
+    else
+    {
+        pos = a.size();
+        a.push_back(t); // or add a new item
+    }
+    heap_update(a.data(), pos, a.size());
+}
+
+void heap_delete(std::vector<HeapItem> &a, size_t pos)
+{
+    *a[pos].ref = k_heap_none;
+    // swap the erased item with the last item
+    a[pos] = a.back();
+    a.pop_back();
+    // update the swapped item
+    if (pos < a.size())
+    {
+        heap_update(a.data(), pos, a.size());
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef HEAP_HPP
+#define HEAP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Indexed 4-ary min-heap. Each item points back at a size_t in its owner
+// that always holds the item's current position, so an owner can update or
+// remove its item in O(log n) without searching for it.
+struct HeapItem
+{
+    uint64_t val = 0;
+    size_t *ref = nullptr;
+};
+
+const size_t k_heap_none = (size_t)-1; // *ref of an owner that is not queued
+
+// restore the heap order after a[pos].val changed
+void heap_update(HeapItem *a, size_t pos, size_t len);
+// pos == k_heap_none appends a new item
+void heap_upsert(std::vector<HeapItem> &a, size_t pos, HeapItem t);
+void heap_delete(std::vector<HeapItem> &a, size_t pos);
+
+#endif // HEAP_HPP
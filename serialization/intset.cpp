@@ -0,0 +1,334 @@
+#include "intset.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static bool fits32(int64_t val)
+{
+    return val >= INT32_MIN && val <= INT32_MAX;
+}
+
+int64_t intset_get(const IntSet *set, size_t i)
+{
+    if (set->width == 4)
+    {
+        return ((const int32_t *)set->data)[i];
+    }
+    return ((const int64_t *)set->data)[i];
+}
+
+static void intset_put(IntSet *set, size_t i, int64_t val)
+{
+    if (set->width == 4)
+    {
+        ((int32_t *)set->data)[i] = (int32_t)val;
+    }
+    else
+    {
+        ((int64_t *)set->data)[i] = val;
+    }
+}
+
+// position of the first value >= val; true if it is val
+static bool intset_search(const IntSet *set, int64_t val, size_t *pos)
+{
+    size_t lo = 0, hi = set->size;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (intset_get(set, mid) < val)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    *pos = lo;
+    return lo < set->size && intset_get(set, lo) == val;
+}
+
+static void intset_resize(IntSet *set, size_t cap)
+{
+    set->data = (uint8_t *)realloc(set->data, cap * set->width);
+    set->cap = cap;
+}
+
+static void intset_reserve(IntSet *set, size_t n)
+{
+    if (n > set->cap)
+    {
+        intset_resize(set, std::max({n, set->cap * 2, (size_t)8}));
+    }
+}
+
+// 4 bytes per value to 8, in place: from the end, so no value is
+// overwritten before it was read
+static void intset_widen(IntSet *set)
+{
+    set->data = (uint8_t *)realloc(set->data, set->cap * 8);
+    const int32_t *from = (const int32_t *)set->data;
+    int64_t *to = (int64_t *)set->data;
+    for (size_t i = set->size; i-- > 0;)
+    {
+        to[i] = from[i];
+    }
+    set->width = 8;
+}
+
+bool intset_has(const IntSet *set, int64_t val)
+{
+    size_t pos = 0;
+    return intset_search(set, val, &pos);
+}
+
+bool intset_add(IntSet *set, int64_t val)
+{
+    size_t pos = 0;
+    if (intset_search(set, val, &pos))
+    {
+        return false;
+    }
+    if (set->width == 4 && !fits32(val))
+    {
+        intset_widen(set);
+    }
+    intset_reserve(set, set->size + 1);
+    uint8_t *at = set->data + pos * set->width;
+    memmove(at + set->width, at, (set->size - pos) * set->width);
+    intset_put(set, pos, val);
+    set->size++;
+    return true;
+}
+
+size_t intset_add_many(IntSet *set, std::vector<int64_t> &vals)
+{
+    std::sort(vals.begin(), vals.end());
+    vals.erase(std::unique(vals.begin(), vals.end()), vals.end());
+    if (vals.empty())
+    {
+        return 0;
+    }
+    if (set->width == 4 && (!fits32(vals.front()) || !fits32(vals.back())))
+    {
+        intset_widen(set);
+    }
+    // count the new ones, then merge them in from the back
+    size_t added = 0;
+    for (size_t i = 0, j = 0; j < vals.size();)
+    {
+        if (i < set->size && intset_get(set, i) < vals[j])
+        {
+            i++;
+        }
+        else
+        {
+            added += i < set->size && intset_get(set, i) == vals[j] ? 0 : 1;
+            j++;
+        }
+    }
+    intset_reserve(set, set->size + added);
+    size_t i = set->size, j = vals.size(), k = set->size + added;
+    while (j > 0)
+    {
+        if (i > 0 && intset_get(set, i - 1) >= vals[j - 1])
+        {
+            if (intset_get(set, i - 1) == vals[j - 1])
+            {
+                j--;
+            }
+            intset_put(set, --k, intset_get(set, --i));
+        }
+        else
+        {
+            intset_put(set, --k, vals[--j]);
+        }
+    }
+    set->size += added;
+    return added;
+}
+
+bool intset_rem(IntSet *set, int64_t val)
+{
+    size_t pos = 0;
+    if (!intset_search(set, val, &pos))
+    {
+        return false;
+    }
+    uint8_t *at = set->data + pos * set->width;
+    memmove(at, at + set->width, (set->size - pos - 1) * set->width);
+    set->size--;
+    if (set->cap > 8 && set->size < set->cap / 4)
+    {
+        intset_resize(set, set->cap / 2);
+    }
+    return true;
+}
+
+void intset_clear(IntSet *set)
+{
+    free(set->data);
+    *set = IntSet();
+}
+
+size_t intset_mem_usage(const IntSet *set)
+{
+    return set->cap * set->width;
+}
+
+// Intersection kernels. Each stops once it has written `max` values.
+
+template <class TA, class TB, class TO>
+static size_t merge_t(const TA *a, size_t na, const TB *b, size_t nb, TO *out, size_t max)
+{
+    size_t i = 0, j = 0, n = 0;
+    while (i < na && j < nb && n < max)
+    {
+        if (a[i] < b[j])
+        {
+            i++;
+        }
+        else if (b[j] < a[i])
+        {
+            j++;
+        }
+        else
+        {
+            out[n++] = (TO)a[i];
+            i++;
+            j++;
+        }
+    }
+    return n;
+}
+
+template <class TA, class TB, class TO>
+static size_t gallop_t(const TA *a, size_t na, const TB *b, size_t nb, TO *out, size_t max)
+{
+    size_t j = 0, n = 0;
+    for (size_t i = 0; i < na && j < nb && n < max; ++i)
+    {
+        TA val = a[i];
+        if (b[j] < val)
+        {
+            // b[lo] < val; double the step until b[lo + step] is not
+            size_t lo = j, step = 1;
+            while (lo + step < nb && b[lo + step] < val)
+            {
+                lo += step;
+                step *= 2;
+            }
+            size_t hi = std::min(lo + step, nb);
+            j = std::lower_bound(b + lo + 1, b + hi, val) - b;
+        }
+        if (j < nb && b[j] == val)
+        {
+            out[n++] = (TO)val;
+            j++;
+        }
+    }
+    return n;
+}
+
+static size_t simd_merge(const int32_t *a, size_t na, const int32_t *b, size_t nb, int32_t *out,
+                         size_t max)
+{
+    size_t i = 0, j = 0, n = 0;
+#ifdef __SSE2__
+    // Each value of a's block against each of b's: b's block and its 3
+    // rotations, compared to a's lane by lane. The block with the smaller
+    // last value is used up; both are when the last values are equal.
+    while (i + 4 <= na && j + 4 <= nb && n < max)
+    {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + j));
+        __m128i eq = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi32(va, vb),
+                         _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1)))),
+            _mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))),
+                         _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3)))));
+        uint32_t mask = (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(eq));
+        while (mask && n < max)
+        {
+            out[n++] = a[i + __builtin_ctz(mask)];
+            mask &= mask - 1;
+        }
+        int32_t amax = a[i + 3], bmax = b[j + 3];
+        if (amax <= bmax)
+        {
+            i += 4;
+        }
+        if (bmax <= amax)
+        {
+            j += 4;
+        }
+    }
+#endif
+    // a value of a's current block that matched is not matched again: its
+    // equal in b is behind j
+    return n + merge_t(a + i, na - i, b + j, nb - j, out + n, max - n);
+}
+
+size_t inter_merge(const int32_t *a, size_t na, const int32_t *b, size_t nb, int32_t *out)
+{
+    return merge_t(a, na, b, nb, out, SIZE_MAX);
+}
+
+size_t inter_gallop(const int32_t *a, size_t na, const int32_t *b, size_t nb, int32_t *out)
+{
+    return gallop_t(a, na, b, nb, out, SIZE_MAX);
+}
+
+size_t inter_simd(const int32_t *a, size_t na, const int32_t *b, size_t nb, int32_t *out)
+{
+    return simd_merge(a, na, b, nb, out, SIZE_MAX);
+}
+
+template <class TA, class TB, class TO>
+static size_t inter_t(const TA *a, size_t na, const TB *b, size_t nb, TO *out, size_t max)
+{
+    if (nb / k_gallop_ratio >= na)
+    {
+        return gallop_t(a, na, b, nb, out, max);
+    }
+    return merge_t(a, na, b, nb, out, max);
+}
+
+void intset_inter(const IntSet *a, const IntSet *b, IntSet *out, size_t limit)
+{
+    if (a->size > b->size)
+    {
+        std::swap(a, b);
+    }
+    size_t max = limit ? std::min(limit, a->size) : a->size;
+    IntSet res;
+    res.width = std::min(a->width, b->width);
+    intset_reserve(&res, max);
+    const int32_t *a32 = (const int32_t *)a->data, *b32 = (const int32_t *)b->data;
+    const int64_t *a64 = (const int64_t *)a->data, *b64 = (const int64_t *)b->data;
+    int32_t *o32 = (int32_t *)res.data;
+    if (a->width == 4 && b->width == 4)
+    {
+        res.size = b->size / k_gallop_ratio >= a->size
+                       ? gallop_t(a32, a->size, b32, b->size, o32, max)
+                       : simd_merge(a32, a->size, b32, b->size, o32, max);
+    }
+    else if (a->width == 4)
+    {
+        res.size = inter_t(a32, a->size, b64, b->size, o32, max);
+    }
+    else if (b->width == 4)
+    {
+        res.size = inter_t(a64, a->size, b32, b->size, o32, max);
+    }
+    else
+    {
+        res.size = inter_t(a64, a->size, b64, b->size, (int64_t *)res.data, max);
+    }
+    intset_clear(out);
+    *out = res;
+}
@@ -0,0 +1,56 @@
+#ifndef INTSET_HPP
+#define INTSET_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Sorted array of distinct integers, 4 bytes per value while they all fit
+// in an int32, 8 once one does not (the array is widened in place, and
+// never narrowed again).
+//
+// Membership is a binary search, and an insert or delete moves the tail of
+// the array, which is cheap at the end of it (growing IDs) and a memmove of
+// up to the whole array otherwise. intset_add_many() merges a batch in one
+// pass instead.
+//
+// Intersections pick a kernel by the sizes: galloping (exponential then
+// binary search of the larger array for each value of the smaller one) when
+// one is k_gallop_ratio times the other, otherwise a linear merge, by blocks
+// of 4 x 4 values compared at once with SSE2 when both are 4 bytes wide.
+
+const size_t k_gallop_ratio = 128;
+
+struct IntSet
+{
+    uint8_t *data = nullptr;
+    size_t size = 0;
+    size_t cap = 0;    // values allocated
+    uint8_t width = 4; // bytes per value
+};
+
+int64_t intset_get(const IntSet *set, size_t i);
+bool intset_has(const IntSet *set, int64_t val);
+// true if the value is new
+bool intset_add(IntSet *set, int64_t val);
+// Adds a batch, sorting `vals` in place. Returns the values that were new.
+size_t intset_add_many(IntSet *set, std::vector<int64_t> &vals);
+// false if there was no such value
+bool intset_rem(IntSet *set, int64_t val);
+// Out gets a ∩ b, in order, replacing what it held; only its first `limit`
+// values unless limit is 0, and the kernels stop there.
+void intset_inter(const IntSet *a, const IntSet *b, IntSet *out, size_t limit);
+// frees the array, the set is left empty
+void intset_clear(IntSet *set);
+// bytes allocated for the array
+size_t intset_mem_usage(const IntSet *set);
+
+// The intersection kernels on int32 arrays, for the benchmark. `out` has
+// room for min(na, nb) values; each returns how many it wrote.
+size_t inter_merge(const int32_t *a, size_t na, const int32_t *b, size_t nb, int32_t *out);
+// a is the smaller array
+size_t inter_gallop(const int32_t *a, size_t na, const int32_t *b, size_t nb, int32_t *out);
+// the merge, by SSE2 blocks where available
+size_t inter_simd(const int32_t *a, size_t na, const int32_t *b, size_t nb, int32_t *out);
+
+#endif // INTSET_HPP
@@ -0,0 +1,104 @@
+// Intersection kernels of intset.cpp on sorted int32 arrays of random IDs:
+// the linear merge, the SSE2 block merge, galloping, and intset_inter(),
+// which picks between the last two by the size ratio. Each kernel runs on
+// the same pairs and must find the same intersection.
+//
+//   ./intset_bench [large set size]        default 4000000
+#include "intset.hpp"
+#include <algorithm>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+
+static uint64_t now_ns() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t &s) {
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+}
+
+// n distinct sorted IDs out of [0, range)
+static std::vector<int32_t> random_ids(size_t n, size_t range, uint64_t &rnd) {
+    std::vector<int32_t> ids;
+    ids.reserve(n + n / 4);
+    while (ids.size() < n) {
+        for (size_t i = ids.size(); i < n; ++i) {
+            ids.push_back((int32_t)(xorshift(rnd) % range));
+        }
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    }
+    return ids;
+}
+
+static IntSet to_intset(const std::vector<int32_t> &ids) {
+    std::vector<int64_t> vals(ids.begin(), ids.end());
+    IntSet set;
+    intset_add_many(&set, vals);
+    return set;
+}
+
+typedef size_t (*Kernel)(const int32_t *, size_t, const int32_t *, size_t, int32_t *);
+
+static double run_kernel(Kernel k, const std::vector<int32_t> &a, const std::vector<int32_t> &b,
+                         size_t reps, size_t *found) {
+    std::vector<int32_t> out(std::min(a.size(), b.size()));
+    uint64_t t0 = now_ns();
+    for (size_t r = 0; r < reps; ++r) {
+        *found = k(a.data(), a.size(), b.data(), b.size(), out.data());
+    }
+    return double(now_ns() - t0) / reps / 1e3;
+}
+
+int main(int argc, char **argv) {
+    size_t large = argc > 1 ? strtoull(argv[1], NULL, 10) : 4000000;
+    uint64_t rnd = 0x9E3779B97F4A7C15ull;
+#ifdef __SSE2__
+    printf("simd: SSE2 4x4 blocks\n");
+#else
+    printf("simd: not built with SSE2, same as merge\n");
+#endif
+    // small set size, and the ID range as a multiple of the large size
+    // (the density of the large set)
+    const size_t ratios[] = {1, 4, 16, 64, 1024};
+    for (size_t density : {2, 8}) {
+        for (size_t ratio : ratios) {
+            size_t range = large * density;
+            std::vector<int32_t> b = random_ids(large, range, rnd);
+            std::vector<int32_t> a = random_ids(large / ratio, range, rnd);
+            size_t reps = std::max<size_t>(1, 10000000 / (a.size() + b.size()));
+            size_t n_merge = 0, n_simd = 0, n_gallop = 0;
+            double us_merge = run_kernel(inter_merge, a, b, reps, &n_merge);
+            double us_simd = run_kernel(inter_simd, a, b, reps, &n_simd);
+            double us_gallop = run_kernel(inter_gallop, a, b, reps, &n_gallop);
+
+            IntSet sa = to_intset(a), sb = to_intset(b), out;
+            uint64_t t0 = now_ns();
+            for (size_t r = 0; r < reps; ++r) {
+                intset_inter(&sa, &sb, &out, 0);
+            }
+            double us_inter = double(now_ns() - t0) / reps / 1e3;
+            if (n_simd != n_merge || n_gallop != n_merge || out.size != n_merge) {
+                fprintf(stderr, "bad result: %zu %zu %zu %zu\n", n_merge, n_simd, n_gallop,
+                        out.size);
+                return 1;
+            }
+            printf("%8zu x %8zu  1/%zu dense  %7zu common  merge %9.1f us  simd %9.1f us"
+                   "  gallop %9.1f us  intset_inter %9.1f us\n",
+                   a.size(), b.size(), density, n_merge, us_merge, us_simd, us_gallop,
+                   us_inter);
+            intset_clear(&sa);
+            intset_clear(&sb);
+            intset_clear(&out);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,193 @@
+#include "intset.hpp"
+#include "test_util.hpp"
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <set>
+#include <stdint.h>
+#include <vector>
+
+// the set, read in order, is the model, and has each of its values
+static bool sameAsModel(const IntSet *set, const std::set<int64_t> &model) {
+  if (set->size != model.size()) {
+    return false;
+  }
+  size_t i = 0;
+  for (int64_t v : model) {
+    if (intset_get(set, i++) != v || !intset_has(set, v)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static IntSet makeSet(std::vector<int64_t> vals) {
+  IntSet set;
+  intset_add_many(&set, vals);
+  return set;
+}
+
+// the array is 4 bytes wide until a value needs 8, is widened in place with
+// the values kept, and is not narrowed again
+void testWidening() {
+  IntSet set;
+  std::set<int64_t> model;
+  const int64_t small[] = {5, -3, INT32_MAX, INT32_MIN, 0};
+  for (int64_t v : small) {
+    intset_add(&set, v);
+    model.insert(v);
+  }
+  bool passed = set.width == 4 && sameAsModel(&set, model);
+  passed = passed && !intset_has(&set, int64_t(INT32_MAX) + 1) &&
+           !intset_has(&set, int64_t(INT32_MIN) - 1);
+
+  passed = passed && intset_add(&set, int64_t(INT32_MAX) + 1) && set.width == 8;
+  model.insert(int64_t(INT32_MAX) + 1);
+  passed = passed && intset_add(&set, INT64_MIN) && intset_add(&set, INT64_MAX) &&
+           !intset_add(&set, INT64_MAX);
+  model.insert(INT64_MIN);
+  model.insert(INT64_MAX);
+  passed = passed && sameAsModel(&set, model);
+
+  passed = passed && intset_rem(&set, INT64_MIN) && intset_rem(&set, INT64_MAX) &&
+           intset_rem(&set, int64_t(INT32_MAX) + 1) && !intset_rem(&set, INT64_MAX);
+  model.erase(INT64_MIN);
+  model.erase(INT64_MAX);
+  model.erase(int64_t(INT32_MAX) + 1);
+  passed = passed && set.width == 8 && sameAsModel(&set, model);
+  intset_clear(&set);
+  passed = passed && set.size == 0 && set.data == nullptr;
+
+  runTest("Widening", passed);
+}
+
+// batches with duplicates, values already there, and a wide value, merged
+// in one pass
+void testAddMany() {
+  IntSet set;
+  std::set<int64_t> model;
+  uint64_t rnd = 0x9E3779B97F4A7C15ull;
+  bool passed = true;
+  for (int round = 0; round < 200 && passed; ++round) {
+    std::vector<int64_t> vals;
+    size_t n = xorshift(rnd) % 50;
+    for (size_t i = 0; i < n; ++i) {
+      vals.push_back(int64_t(xorshift(rnd) % 2000) - 1000);
+    }
+    if (round == 150) {
+      vals.push_back(int64_t(1) << 40);
+    }
+    size_t added = 0;
+    for (int64_t v : vals) {
+      added += model.insert(v).second ? 1 : 0;
+    }
+    passed = intset_add_many(&set, vals) == added && sameAsModel(&set, model);
+  }
+  passed = passed && set.width == 8;
+  intset_clear(&set);
+
+  runTest("Add Many", passed);
+}
+
+// removes at the front, middle, end, and of values that are not there
+void testRem() {
+  IntSet set;
+  std::set<int64_t> model;
+  for (int64_t i = 0; i < 1000; ++i) {
+    intset_add(&set, i * 3);
+    model.insert(i * 3);
+  }
+  bool passed = true;
+  const int64_t gone[] = {0, 2997, 1500, 1, -3, 3000};
+  for (int64_t v : gone) {
+    passed = passed && intset_rem(&set, v) == (model.erase(v) == 1);
+  }
+  for (int64_t i = 0; i < 1000; i += 2) {
+    intset_rem(&set, i * 3);
+    model.erase(i * 3);
+  }
+  passed = passed && sameAsModel(&set, model);
+  // the array shrinks once it is mostly empty
+  size_t cap = set.cap;
+  while (model.size() > 10) {
+    intset_rem(&set, *model.rbegin());
+    model.erase(*model.rbegin());
+  }
+  passed = passed && sameAsModel(&set, model) && set.cap < cap / 4;
+  intset_clear(&set);
+
+  runTest("Rem", passed);
+}
+
+// The three int32 kernels agree with std::set_intersection, at size ratios
+// on both sides of k_gallop_ratio, and so does intset_inter() at each width
+// and with a limit
+void testInterKernels() {
+  uint64_t rnd = 12345;
+  bool passed = true;
+  const size_t sizes[][2] = {{0, 10},   {10, 0},  {1, 1},     {7, 9},     {100, 100},
+                             {33, 1000}, {5, 5000}, {2, 20000}, {300, 299}, {1000, 128000}};
+  for (const auto &sz : sizes) {
+    for (int64_t spread : {int64_t(4), int64_t(1) << 33}) {
+      std::set<int64_t> ma, mb;
+      while (ma.size() < sz[0]) {
+        ma.insert(int64_t(xorshift(rnd) % (4 * (sz[0] + sz[1]) + 1)) - int64_t(sz[0]));
+      }
+      while (mb.size() < sz[1]) {
+        mb.insert(int64_t(xorshift(rnd) % (4 * (sz[0] + sz[1]) + 1)) - int64_t(sz[0]));
+      }
+      if (spread > INT32_MAX && !mb.empty()) {
+        mb.insert(spread); // b is 8 bytes wide
+      }
+      std::vector<int64_t> want;
+      std::set_intersection(ma.begin(), ma.end(), mb.begin(), mb.end(),
+                            std::back_inserter(want));
+
+      if (spread <= INT32_MAX) {
+        std::vector<int32_t> a(ma.begin(), ma.end()), b(mb.begin(), mb.end());
+        std::vector<int32_t> out(std::min(a.size(), b.size()) + 1);
+        size_t n = inter_merge(a.data(), a.size(), b.data(), b.size(), out.data());
+        passed = passed && std::vector<int64_t>(out.begin(), out.begin() + n) == want;
+        const int32_t *small = a.size() <= b.size() ? a.data() : b.data();
+        const int32_t *large = a.size() <= b.size() ? b.data() : a.data();
+        size_t ns = std::min(a.size(), b.size()), nl = std::max(a.size(), b.size());
+        n = inter_gallop(small, ns, large, nl, out.data());
+        passed = passed && std::vector<int64_t>(out.begin(), out.begin() + n) == want;
+        n = inter_simd(a.data(), a.size(), b.data(), b.size(), out.data());
+        passed = passed && std::vector<int64_t>(out.begin(), out.begin() + n) == want;
+      }
+
+      IntSet sa = makeSet(std::vector<int64_t>(ma.begin(), ma.end()));
+      IntSet sb = makeSet(std::vector<int64_t>(mb.begin(), mb.end()));
+      for (size_t limit : {size_t(0), size_t(1), size_t(3), want.size(), want.size() + 5}) {
+        IntSet out;
+        intset_inter(&sa, &sb, &out, limit);
+        size_t n = limit ? std::min(limit, want.size()) : want.size();
+        std::set<int64_t> first(want.begin(), want.begin() + n);
+        passed = passed && sameAsModel(&out, first);
+        intset_inter(&sb, &sa, &out, limit);
+        passed = passed && sameAsModel(&out, first);
+        intset_clear(&out);
+      }
+      // the output may be one of the inputs
+      intset_inter(&sa, &sb, &sa, 0);
+      passed = passed && sameAsModel(&sa, std::set<int64_t>(want.begin(), want.end()));
+      intset_clear(&sa);
+      intset_clear(&sb);
+    }
+  }
+
+  runTest("Inter Kernels", passed);
+}
+
+int main() {
+  std::cout << "Running IntSet Tests:" << std::endl;
+
+  testWidening();
+  testAddMany();
+  testRem();
+  testInterKernels();
+
+  std::cout << "All tests completed." << std::endl;
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,339 @@
+// I/O thread and reactor scaling benchmark.
+//
+// For every --io-threads value this starts a fresh ./server with that many
+// I/O threads (0 is the plain single-threaded epoll loop), then drives --conns
+// connections from --client-threads client threads, each connection keeping
+// --pipeline GETs of a small keyspace in flight, for a fixed time. Commands
+// still run on the server's main thread, so throughput grows with the I/O
+// threads until that thread, or the cores, run out. Then the same for every
+// --reactors value: the keyspace is sharded and most GETs are forwarded to
+// another reactor, so this one should grow with the cores. An empty list
+// skips a sweep.
+//
+//   ./io_bench [--server ./server] [--io-threads 0,1,2,4,8,16]
+//              [--reactors 1,2,4,8] [--conns 64] [--client-threads 4]
+//              [--pipeline 16] [--seconds 3]
+#include <arpa/inet.h>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/ip.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+static void die(const char *msg) {
+    int err = errno;
+    fprintf(stderr, "[%d] %s\n", err, msg);
+    abort();
+}
+
+static uint64_t now_us() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return uint64_t(tv.tv_sec) * 1000000 + tv.tv_nsec / 1000;
+}
+
+static int connect_to(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        die("socket()");
+    }
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = ntohs(port);
+    addr.sin_addr.s_addr = ntohl(INADDR_LOOPBACK);
+    if (connect(fd, (const struct sockaddr *)&addr, sizeof(addr))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// one request: [len][nstr][len][str]...
+static void append_req(std::string &out, const std::vector<std::string> &cmd) {
+    uint32_t len = 4;
+    for (const std::string &s : cmd) {
+        len += 4 + s.size();
+    }
+    out.append((const char *)&len, 4);
+    uint32_t n = cmd.size();
+    out.append((const char *)&n, 4);
+    for (const std::string &s : cmd) {
+        uint32_t p = s.size();
+        out.append((const char *)&p, 4);
+        out.append(s);
+    }
+}
+
+static void write_all(int fd, const std::string &buf) {
+    const char *p = buf.data();
+    size_t n = buf.size();
+    while (n > 0) {
+        ssize_t rv = write(fd, p, n);
+        if (rv <= 0) {
+            die("write()");
+        }
+        n -= rv;
+        p += rv;
+    }
+}
+
+// returns the number of complete responses consumed from the buffer
+static uint32_t consume_responses(std::string &rbuf) {
+    uint32_t n = 0;
+    size_t pos = 0;
+    while (rbuf.size() - pos >= 4) {
+        uint32_t len = 0;
+        memcpy(&len, rbuf.data() + pos, 4);
+        if (rbuf.size() - pos < 4 + len) {
+            break;
+        }
+        pos += 4 + len;
+        n++;
+    }
+    rbuf.erase(0, pos);
+    return n;
+}
+
+// blocks until `count` responses have arrived, returns nothing but checks
+// that the stream stays framed
+static void read_responses(int fd, std::string &rbuf, uint32_t count) {
+    char buf[64 * 1024];
+    while (count > 0) {
+        size_t pos = 0;
+        while (count > 0 && rbuf.size() - pos >= 4) {
+            uint32_t len = 0;
+            memcpy(&len, rbuf.data() + pos, 4);
+            if (rbuf.size() - pos < 4 + len) {
+                break;
+            }
+            pos += 4 + len;
+            count--;
+        }
+        rbuf.erase(0, pos);
+        if (count == 0) {
+            break;
+        }
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            die("read()");
+        }
+        rbuf.append(buf, n);
+    }
+}
+
+static double proc_cpu_seconds(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return 0;
+    }
+    char buf[1024];
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    // fields after the ")" of the command name; utime and stime are 14 and 15
+    const char *p = strrchr(buf, ')');
+    unsigned long utime = 0, stime = 0;
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                     &utime, &stime) != 2) {
+        return 0;
+    }
+    return double(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+const size_t k_keys = 1000;
+
+struct Config {
+    const char *server = "./server";
+    std::vector<size_t> io_threads = {0, 1, 2, 4, 8, 16};
+    std::vector<size_t> reactors = {1, 2, 4, 8};
+    size_t conns = 64;
+    size_t client_threads = 4;
+    uint32_t pipeline = 16;
+    double seconds = 3;
+    uint16_t port = 12540;
+};
+
+// drives `fds` until `deadline`, returns the responses received
+static uint64_t client_loop(const std::vector<int> &fds, const std::string &batch,
+                            uint32_t pipeline, uint64_t deadline) {
+    std::vector<struct pollfd> pfds(fds.size());
+    std::vector<std::string> rbufs(fds.size());
+    std::vector<uint32_t> inflight(fds.size(), 0);
+    for (size_t i = 0; i < fds.size(); ++i) {
+        pfds[i] = {fds[i], POLLIN, 0};
+    }
+    uint64_t done = 0;
+    char buf[64 * 1024];
+    while (now_us() < deadline) {
+        for (size_t i = 0; i < fds.size(); ++i) {
+            if (inflight[i] == 0) {
+                write_all(fds[i], batch);
+                inflight[i] = pipeline;
+            }
+        }
+        int rv = poll(pfds.data(), pfds.size(), 1000);
+        if (rv < 0 && errno != EINTR) {
+            die("poll()");
+        }
+        for (size_t i = 0; i < fds.size(); ++i) {
+            if (!(pfds[i].revents & POLLIN)) {
+                continue;
+            }
+            ssize_t n = read(fds[i], buf, sizeof(buf));
+            if (n <= 0) {
+                die("read()");
+            }
+            rbufs[i].append(buf, n);
+            uint32_t got = consume_responses(rbufs[i]);
+            inflight[i] -= got;
+            done += got;
+        }
+    }
+    return done;
+}
+
+// mode: "--io-threads" or "--reactors"
+static void run_one(const Config &cfg, const char *mode, size_t threads) {
+    uint16_t port = cfg.port;
+    pid_t pid = fork();
+    if (pid < 0) {
+        die("fork()");
+    }
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, 2);
+        char portbuf[16], threadsbuf[16];
+        snprintf(portbuf, sizeof(portbuf), "%u", port);
+        snprintf(threadsbuf, sizeof(threadsbuf), "%zu", threads);
+        execl(cfg.server, cfg.server, "--port", portbuf, "--backend", "epoll",
+              mode, threadsbuf, (char *)NULL);
+        _exit(127);
+    }
+
+    int fd = -1;
+    for (int i = 0; i < 200 && fd < 0; ++i) {
+        usleep(10000);
+        fd = connect_to(port);
+    }
+    if (fd < 0) {
+        die("server did not start");
+    }
+    std::string out, rbuf;
+    char key[32];
+    for (size_t i = 0; i < k_keys; ++i) {
+        snprintf(key, sizeof(key), "key:%zu", i);
+        append_req(out, {"set", key, "value-of-some-16b"});
+    }
+    write_all(fd, out);
+    read_responses(fd, rbuf, k_keys);
+    close(fd);
+
+    std::vector<std::vector<int>> fds(cfg.client_threads);
+    for (size_t i = 0; i < cfg.conns; ++i) {
+        int cfd = connect_to(port);
+        if (cfd < 0) {
+            die("connect()");
+        }
+        fds[i % cfg.client_threads].push_back(cfd);
+    }
+    std::string batch;
+    for (uint32_t i = 0; i < cfg.pipeline; ++i) {
+        snprintf(key, sizeof(key), "key:%u", i * 37 % (uint32_t)k_keys);
+        append_req(batch, {"get", key});
+    }
+
+    double cpu_start = proc_cpu_seconds(pid);
+    uint64_t start = now_us();
+    uint64_t deadline = start + uint64_t(cfg.seconds * 1e6);
+    std::atomic<uint64_t> done{0};
+    std::vector<std::thread> clients;
+    for (const std::vector<int> &part : fds) {
+        clients.emplace_back([&, part]() {
+            done += client_loop(part, batch, cfg.pipeline, deadline);
+        });
+    }
+    for (std::thread &t : clients) {
+        t.join();
+    }
+    double elapsed = (now_us() - start) / 1e6;
+    double cpu = proc_cpu_seconds(pid) - cpu_start;
+
+    printf("%s=%-3zu conns=%-4zu pipeline=%-4u %10.0f req/s  %6.3f us server cpu/req\n",
+           mode + 2, threads, cfg.conns, cfg.pipeline, done / elapsed, cpu * 1e6 / done);
+    fflush(stdout);
+
+    for (const std::vector<int> &part : fds) {
+        for (int cfd : part) {
+            close(cfd);
+        }
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+}
+
+static std::vector<size_t> parse_list(const char *s) {
+    std::vector<size_t> out;
+    while (*s) {
+        char *end = NULL;
+        out.push_back(strtoull(s, &end, 10));
+        s = (*end == ',') ? end + 1 : end;
+        if (end == s && *s) {
+            break;
+        }
+    }
+    return out;
+}
+
+int main(int argc, char **argv) {
+    Config cfg;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "--server")) {
+            cfg.server = argv[i + 1];
+        } else if (!strcmp(argv[i], "--io-threads")) {
+            cfg.io_threads = parse_list(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--reactors")) {
+            cfg.reactors = parse_list(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--conns")) {
+            cfg.conns = strtoull(argv[i + 1], NULL, 10);
+        } else if (!strcmp(argv[i], "--client-threads")) {
+            cfg.client_threads = strtoull(argv[i + 1], NULL, 10);
+        } else if (!strcmp(argv[i], "--pipeline")) {
+            cfg.pipeline = atoi(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--seconds")) {
+            cfg.seconds = atof(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--port")) {
+            cfg.port = atoi(argv[i + 1]);
+        } else {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (cfg.client_threads == 0 || cfg.client_threads > cfg.conns) {
+        cfg.client_threads = cfg.conns;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    for (size_t n : cfg.io_threads) {
+        run_one(cfg, "--io-threads", n);
+        cfg.port++; // avoid TIME_WAIT leftovers on the previous port
+    }
+    for (size_t n : cfg.reactors) {
+        run_one(cfg, "--reactors", n);
+        cfg.port++;
+    }
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include "lazyfree.hpp"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <semaphore.h>
+#include <thread>
+
+// written into the first bytes of the block being freed
+struct LazyBlock
+{
+    LazyBlock *next;
+    size_t size;
+};
+
+static struct
+{
+    std::atomic<LazyBlock *> head{nullptr};
+    std::atomic<size_t> pending_bytes{0};
+    std::atomic<uint64_t> queued{0};
+    sem_t wake;
+    bool started = false;
+} g_lazy;
+
+static void lazyfree_main()
+{
+    while (true)
+    {
+        while (sem_wait(&g_lazy.wake) != 0)
+        {
+            // EINTR
+        }
+        LazyBlock *b = g_lazy.head.exchange(nullptr, std::memory_order_acquire);
+        while (b)
+        {
+            LazyBlock *next = b->next;
+            size_t size = b->size;
+            free(b);
+            g_lazy.pending_bytes.fetch_sub(size, std::memory_order_relaxed);
+            b = next;
+        }
+    }
+}
+
+void lazyfree_init()
+{
+    if (sem_init(&g_lazy.wake, 0, 0) != 0)
+    {
+        perror("sem_init()");
+        return; // everything is freed inline
+    }
+    std::thread(lazyfree_main).detach();
+    g_lazy.started = true;
+}
+
+void lazyfree_free(void *ptr, size_t size)
+{
+    if (!ptr)
+    {
+        return;
+    }
+    if (!g_lazy.started || size < k_lazyfree_min)
+    {
+        free(ptr);
+        return;
+    }
+    LazyBlock *b = (LazyBlock *)ptr;
+    b->size = size;
+    b->next = g_lazy.head.load(std::memory_order_relaxed);
+    g_lazy.pending_bytes.fetch_add(size, std::memory_order_relaxed);
+    while (!g_lazy.head.compare_exchange_weak(b->next, b, std::memory_order_release,
+                                              std::memory_order_relaxed))
+    {
+    }
+    g_lazy.queued.fetch_add(1, std::memory_order_relaxed);
+    sem_post(&g_lazy.wake);
+}
+
+void lazyfree_stats(LazyFreeStats *out)
+{
+    out->pending_bytes = g_lazy.pending_bytes.load(std::memory_order_relaxed);
+    out->queued = g_lazy.queued.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,30 @@
+#ifndef LAZYFREE_HPP
+#define LAZYFREE_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// Frees big malloc blocks on a background thread, so unmapping hundreds of
+// MB does not stall the event loop. Loop threads push blocks onto a
+// lock-free stack that is linked through the dead blocks themselves (no
+// allocation per job), and posts a semaphore; the thread takes the whole
+// stack with one exchange and frees it.
+//
+// Blocks under k_lazyfree_min, or any block before lazyfree_init(), are
+// freed right away: handing them over would cost more than free() itself.
+
+const size_t k_lazyfree_min = 64 << 10;
+
+void lazyfree_init();
+// free(ptr), now or later
+void lazyfree_free(void *ptr, size_t size);
+
+struct LazyFreeStats
+{
+    size_t pending_bytes = 0; // queued, not freed yet
+    uint64_t queued = 0;      // blocks handed to the thread so far
+};
+
+void lazyfree_stats(LazyFreeStats *out);
+
+#endif // LAZYFREE_HPP
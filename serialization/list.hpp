@@ -0,0 +1,42 @@
+#ifndef LIST_HPP
+#define LIST_HPP
+
+// Intrusive circular doubly linked list. The owner embeds a DList and gets
+// back to itself with container_of(). A detached node links to itself, so
+// detaching twice, or detaching a node that was never inserted, is harmless.
+struct DList
+{
+    DList *prev = this;
+    DList *next = this;
+};
+
+inline void dlist_init(DList *node)
+{
+    node->prev = node->next = node;
+}
+
+inline bool dlist_empty(const DList *node)
+{
+    return node->next == node;
+}
+
+inline void dlist_detach(DList *node)
+{
+    DList *prev = node->prev;
+    DList *next = node->next;
+    prev->next = next;
+    next->prev = prev;
+    dlist_init(node);
+}
+
+// insert `rookie` before `target`; before the list head is the tail
+inline void dlist_insert_before(DList *target, DList *rookie)
+{
+    DList *prev = target->prev;
+    prev->next = rookie;
+    rookie->prev = prev;
+    rookie->next = target;
+    target->prev = rookie;
+}
+
+#endif // LIST_HPP
@@ -0,0 +1,163 @@
+// List benchmark: QList (qlist.cpp) against std::list<std::string> and
+// std::deque<std::string>, with n elements of a few value sizes. Each run is
+// a fork()ed child, so RSS is measured from a clean heap:
+//  - rpush:  n elements onto the tail, and the RSS grown per element
+//  - lpop:   all of them again from the head (a queue)
+//  - lrange: QList only, 10 elements from a random index. Finding it walks
+//            the nodes from the nearer end, O(n / elements per node).
+//
+//   ./list_bench [n]        default 2000000
+#include "qlist.hpp"
+#include <deque>
+#include <list>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+const size_t k_ranges = 10000;
+const size_t k_range = 10;
+
+static uint64_t now_ns() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+static size_t rss_bytes() {
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) {
+        return 0;
+    }
+    unsigned long pages = 0, resident = 0;
+    if (fscanf(f, "%lu %lu", &pages, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(f);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static uint64_t xorshift(uint64_t &s) {
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+}
+
+// the element's first 8 bytes are its number, so the pops can be checked
+static std::string_view value(char *buf, size_t vlen, size_t i) {
+    memcpy(buf, &i, sizeof(i));
+    return std::string_view(buf, vlen);
+}
+
+static uint64_t value_id(std::string_view v) {
+    uint64_t i = 0;
+    memcpy(&i, v.data(), sizeof(i));
+    return i;
+}
+
+static void report(const char *name, size_t vlen, size_t n, uint64_t push_ns,
+                   uint64_t pop_ns, size_t rss) {
+    printf("%-6s %4zu B  rpush %6.2f M ops/s  lpop %6.2f M ops/s  %6.1f B/elem\n",
+           name, vlen, n * 1e3 / push_ns, n * 1e3 / pop_ns, double(rss) / n);
+}
+
+static void fail(const char *what, size_t i) {
+    fprintf(stderr, "bad result: %s at %zu\n", what, i);
+    exit(1);
+}
+
+static void run_qlist(size_t n, size_t vlen) {
+    char buf[256] = {};
+    size_t rss0 = rss_bytes();
+    QList list;
+    uint64_t t0 = now_ns();
+    for (size_t i = 0; i < n; ++i) {
+        qlist_push(&list, false, value(buf, vlen, i));
+    }
+    uint64_t t1 = now_ns();
+    size_t rss = rss_bytes() - rss0;
+    size_t nodes = list.nodes;
+
+    uint64_t rnd = 0x9E3779B97F4A7C15ull;
+    uint64_t t2 = now_ns();
+    for (size_t q = 0; q < k_ranges; ++q) {
+        size_t start = xorshift(rnd) % n;
+        QIter it;
+        qlist_iter_init(&it, &list, start);
+        std::string_view v;
+        for (size_t k = 0; k < k_range && qlist_iter_get(&it, &v); ++k) {
+            if (value_id(v) != start + k) {
+                fail("qlist lrange", start + k);
+            }
+            qlist_iter_next(&it);
+        }
+    }
+    uint64_t t3 = now_ns();
+
+    uint64_t t4 = now_ns();
+    for (size_t i = 0; i < n; ++i) {
+        if (value_id(qlist_peek(&list, true)) != i) {
+            fail("qlist lpop", i);
+        }
+        qlist_pop(&list, true);
+    }
+    uint64_t t5 = now_ns();
+    report("qlist", vlen, n, t1 - t0, t5 - t4, rss);
+    printf("       %zu nodes, %.0f elements each  lrange %zu  %8.1f us/op\n", nodes,
+           double(n) / nodes, k_range, (t3 - t2) / 1e3 / k_ranges);
+}
+
+template <class T>
+static void run_std(const char *name, size_t n, size_t vlen) {
+    char buf[256] = {};
+    size_t rss0 = rss_bytes();
+    T list;
+    uint64_t t0 = now_ns();
+    for (size_t i = 0; i < n; ++i) {
+        list.emplace_back(value(buf, vlen, i));
+    }
+    uint64_t t1 = now_ns();
+    size_t rss = rss_bytes() - rss0;
+    uint64_t t2 = now_ns();
+    for (size_t i = 0; i < n; ++i) {
+        if (value_id(list.front()) != i) {
+            fail(name, i);
+        }
+        list.pop_front();
+    }
+    uint64_t t3 = now_ns();
+    report(name, vlen, n, t1 - t0, t3 - t2, rss);
+}
+
+int main(int argc, char **argv) {
+    size_t n = argc > 1 ? strtoull(argv[1], NULL, 10) : 2000000;
+    const size_t vlens[] = {8, 32, 128};
+    for (size_t vlen : vlens) {
+        for (int kind = 0; kind < 3; ++kind) {
+            fflush(stdout);
+            pid_t pid = fork();
+            if (pid == 0) {
+                if (kind == 0) {
+                    run_qlist(n, vlen);
+                } else if (kind == 1) {
+                    run_std<std::list<std::string>>("list", n, vlen);
+                } else {
+                    run_std<std::deque<std::string>>("deque", n, vlen);
+                }
+                fflush(stdout);
+                _exit(0);
+            }
+            int status = 0;
+            waitpid(pid, &status, 0);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
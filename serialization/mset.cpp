@@ -0,0 +1,445 @@
+#include "mset.hpp"
+#include "hash.hpp"
+#include "lazyfree.hpp"
+#include "slab.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#define container_of(ptr, T, member) ((T *)((char *)ptr - offsetof(T, member)))
+
+// the member as an integer, if it is one in canonical form
+static bool member_int(std::string_view s, int64_t *out)
+{
+    bool neg = !s.empty() && s[0] == '-';
+    std::string_view digits = s.substr(neg ? 1 : 0);
+    if (digits.empty() || digits.size() > 19 || (digits[0] == '0' && (neg || digits.size() > 1)))
+    {
+        return false;
+    }
+    uint64_t v = 0;
+    for (char c : digits)
+    {
+        if (c < '0' || c > '9')
+        {
+            return false;
+        }
+        v = v * 10 + (uint64_t)(c - '0'); // 19 digits do not overflow
+    }
+    if (v > (uint64_t)INT64_MAX + (neg ? 1 : 0))
+    {
+        return false;
+    }
+    *out = neg ? (int64_t)(0 - v) : (int64_t)v;
+    return true;
+}
+
+struct IntStr
+{
+    char buf[24];
+    std::string_view str;
+};
+
+static void int_str(IntStr *s, int64_t val)
+{
+    char *end = std::to_chars(s->buf, s->buf + sizeof(s->buf), val).ptr;
+    s->str = std::string_view(s->buf, end - s->buf);
+}
+
+// Table
+
+struct SKey
+{
+    HNode node;
+    std::string_view name;
+};
+
+static bool snode_eq(HNode *node, HNode *key)
+{
+    SNode *snode = container_of(node, SNode, node);
+    SKey *skey = container_of(key, SKey, node);
+    return std::string_view(snode->name, snode->len) == skey->name;
+}
+
+static size_t snode_size(size_t len)
+{
+    return sizeof(SNode) + len;
+}
+
+static void skey_init(SKey *key, std::string_view name)
+{
+    key->node.hcode = hash64(name.data(), name.size(), g_hash_seed);
+    key->name = name;
+}
+
+static void table_insert(STable *table, std::string_view name)
+{
+    size_t size = snode_size(name.size());
+    SNode *node = new (slab_alloc(size)) SNode();
+    node->node.hcode = hash64(name.data(), name.size(), g_hash_seed);
+    node->len = (uint32_t)name.size();
+    memcpy(node->name, name.data(), name.size());
+    hm_insert(&table->hmap, &node->node);
+    table->node_bytes += slab_good_size(size);
+}
+
+static void table_free_node(STable *table, SNode *node)
+{
+    size_t size = snode_size(node->len);
+    table->node_bytes -= slab_good_size(size);
+    node->~SNode();
+    slab_free(node, size);
+}
+
+// the integers move to a table, as strings
+static void mset_convert(MSet *set)
+{
+    STable *table = new STable();
+    IntStr s;
+    for (size_t i = 0; i < set->ints.size; ++i)
+    {
+        int_str(&s, intset_get(&set->ints, i));
+        table_insert(table, s.str);
+    }
+    intset_clear(&set->ints);
+    set->table = table;
+}
+
+bool mset_add(MSet *set, std::string_view member)
+{
+    if (!set->table)
+    {
+        int64_t val = 0;
+        if (member_int(member, &val) &&
+            (set->size < k_mset_intset_max || intset_has(&set->ints, val)))
+        {
+            bool added = intset_add(&set->ints, val);
+            set->size += added ? 1 : 0;
+            return added;
+        }
+        mset_convert(set);
+    }
+    SKey key;
+    skey_init(&key, member);
+    if (h_lookup(&set->table->hmap, &key.node, snode_eq))
+    {
+        return false;
+    }
+    table_insert(set->table, member);
+    set->size++;
+    return true;
+}
+
+size_t mset_add_many(MSet *set, const std::string_view *members, size_t n)
+{
+    if (!set->table && set->size + n <= k_mset_intset_max)
+    {
+        std::vector<int64_t> vals(n);
+        size_t i = 0;
+        while (i < n && member_int(members[i], &vals[i]))
+        {
+            i++;
+        }
+        if (i == n)
+        {
+            size_t added = intset_add_many(&set->ints, vals);
+            set->size += added;
+            return added;
+        }
+    }
+    size_t added = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        added += mset_add(set, members[i]) ? 1 : 0;
+    }
+    return added;
+}
+
+bool mset_rem(MSet *set, std::string_view member)
+{
+    if (!set->table)
+    {
+        int64_t val = 0;
+        if (!member_int(member, &val) || !intset_rem(&set->ints, val))
+        {
+            return false;
+        }
+        set->size--;
+        return true;
+    }
+    SKey key;
+    skey_init(&key, member);
+    HNode *found = hm_delete(&set->table->hmap, &key.node, snode_eq);
+    if (!found)
+    {
+        return false;
+    }
+    table_free_node(set->table, container_of(found, SNode, node));
+    set->size--;
+    return true;
+}
+
+bool mset_has(MSet *set, std::string_view member)
+{
+    if (!set->table)
+    {
+        int64_t val = 0;
+        return member_int(member, &val) && intset_has(&set->ints, val);
+    }
+    SKey key;
+    skey_init(&key, member);
+    return h_lookup(&set->table->hmap, &key.node, snode_eq) != nullptr;
+}
+
+struct ForeachCtx
+{
+    void (*f)(std::string_view member, void *arg);
+    void *arg;
+};
+
+static bool foreach_node(HNode *hnode, void *arg)
+{
+    ForeachCtx *ctx = (ForeachCtx *)arg;
+    SNode *node = container_of(hnode, SNode, node);
+    ctx->f(std::string_view(node->name, node->len), ctx->arg);
+    return true;
+}
+
+static void intset_foreach(const IntSet *ints, void (*f)(std::string_view member, void *arg),
+                           void *arg)
+{
+    IntStr s;
+    for (size_t i = 0; i < ints->size; ++i)
+    {
+        int_str(&s, intset_get(ints, i));
+        f(s.str, arg);
+    }
+}
+
+void mset_foreach(MSet *set, void (*f)(std::string_view member, void *arg), void *arg)
+{
+    if (!set->table)
+    {
+        intset_foreach(&set->ints, f, arg);
+        return;
+    }
+    ForeachCtx ctx = {f, arg};
+    hm_foreach(&set->table->hmap, foreach_node, &ctx);
+}
+
+struct WalkCtx
+{
+    bool (*f)(std::string_view member, void *arg);
+    void *arg;
+};
+
+static bool walk_node(HNode *hnode, void *arg)
+{
+    WalkCtx *ctx = (WalkCtx *)arg;
+    SNode *node = container_of(hnode, SNode, node);
+    return ctx->f(std::string_view(node->name, node->len), ctx->arg);
+}
+
+// mset_foreach() that stops when f returns false
+static void mset_walk(MSet *set, bool (*f)(std::string_view member, void *arg), void *arg)
+{
+    if (!set->table)
+    {
+        IntStr s;
+        for (size_t i = 0; i < set->ints.size; ++i)
+        {
+            int_str(&s, intset_get(&set->ints, i));
+            if (!f(s.str, arg))
+            {
+                return;
+            }
+        }
+        return;
+    }
+    WalkCtx ctx = {f, arg};
+    hm_foreach(&set->table->hmap, walk_node, &ctx);
+}
+
+// passes on the members of the first set that are (or, for a diff, are
+// not) in all of the others, up to `limit` of them unless it is 0
+struct FilterCtx
+{
+    MSet **others = nullptr;
+    size_t n = 0;
+    bool keep_if_in = true;
+    void (*f)(std::string_view member, void *arg) = nullptr;
+    void *arg = nullptr;
+    size_t count = 0;
+    size_t limit = 0;
+};
+
+static bool filter_member(std::string_view member, void *arg)
+{
+    FilterCtx *ctx = (FilterCtx *)arg;
+    for (size_t i = 0; i < ctx->n; ++i)
+    {
+        if (ctx->others[i] && mset_has(ctx->others[i], member) != ctx->keep_if_in)
+        {
+            return true;
+        }
+    }
+    ctx->f(member, ctx->arg);
+    ctx->count++;
+    return ctx->count != ctx->limit;
+}
+
+size_t mset_inter(MSet **sets, size_t n, size_t limit,
+                  void (*f)(std::string_view member, void *arg), void *arg)
+{
+    // smallest first: it bounds the result, and the kernels' work
+    std::vector<MSet *> order(sets, sets + n);
+    std::sort(order.begin(), order.end(),
+              [](const MSet *a, const MSet *b) { return a->size < b->size; });
+    bool all_ints = std::none_of(order.begin(), order.end(),
+                                 [](const MSet *s) { return s->table != nullptr; });
+    if (all_ints && n > 1)
+    {
+        // only the last step can stop at the limit, the others still
+        // filter what it leaves
+        IntSet acc;
+        intset_inter(&order[0]->ints, &order[1]->ints, &acc, n == 2 ? limit : 0);
+        for (size_t i = 2; i < n && acc.size > 0; ++i)
+        {
+            intset_inter(&acc, &order[i]->ints, &acc, i == n - 1 ? limit : 0);
+        }
+        intset_foreach(&acc, f, arg);
+        size_t count = acc.size;
+        intset_clear(&acc);
+        return count;
+    }
+    FilterCtx ctx;
+    ctx.others = order.data() + 1;
+    ctx.n = n - 1;
+    ctx.f = f;
+    ctx.arg = arg;
+    ctx.limit = limit;
+    mset_walk(order[0], filter_member, &ctx);
+    return ctx.count;
+}
+
+size_t mset_diff(MSet **sets, size_t n, void (*f)(std::string_view member, void *arg),
+                 void *arg)
+{
+    if (!sets[0])
+    {
+        return 0;
+    }
+    FilterCtx ctx;
+    ctx.others = sets + 1;
+    ctx.n = n - 1;
+    ctx.keep_if_in = false;
+    ctx.f = f;
+    ctx.arg = arg;
+    mset_walk(sets[0], filter_member, &ctx);
+    return ctx.count;
+}
+
+static void add_member(std::string_view member, void *arg)
+{
+    mset_add((MSet *)arg, member);
+}
+
+void mset_union(MSet **sets, size_t n, MSet *out)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        MSet *set = sets[i];
+        if (!set)
+        {
+            continue;
+        }
+        if (!set->table && !out->table && out->size + set->size <= k_mset_intset_max)
+        {
+            std::vector<int64_t> vals(set->ints.size);
+            for (size_t j = 0; j < vals.size(); ++j)
+            {
+                vals[j] = intset_get(&set->ints, j);
+            }
+            out->size += intset_add_many(&out->ints, vals);
+            continue;
+        }
+        mset_foreach(set, add_member, out);
+    }
+}
+
+static bool collect_node(HNode *node, void *arg)
+{
+    ((std::vector<SNode *> *)arg)->push_back(container_of(node, SNode, node));
+    return true;
+}
+
+void mset_clear(MSet *set)
+{
+    if (STable *table = set->table)
+    {
+        // hm_foreach() reads a node's link after the callback
+        std::vector<SNode *> nodes;
+        nodes.reserve(set->size);
+        hm_foreach(&table->hmap, collect_node, &nodes);
+        for (SNode *node : nodes)
+        {
+            table_free_node(table, node);
+        }
+        hm_clear(&table->hmap);
+        delete table;
+    }
+    intset_clear(&set->ints);
+    *set = MSet();
+}
+
+static void collect_hnode(HNode *node, void *arg)
+{
+    ((std::vector<HNode *> *)arg)->push_back(node);
+}
+
+static bool hnode_same(HNode *node, HNode *key)
+{
+    return node == key;
+}
+
+bool mset_clear_some(MSet *set, uint64_t *cursor, size_t work)
+{
+    if (set->ints.data)
+    {
+        lazyfree_free(set->ints.data, intset_mem_usage(&set->ints));
+        set->ints = IntSet();
+    }
+    STable *table = set->table;
+    std::vector<HNode *> nodes;
+    // a bucket at a time, as in zset_clear_some()
+    for (size_t done = 0; table && hm_size(&table->hmap) > 0 && done < work;)
+    {
+        nodes.clear();
+        *cursor = hm_scan(&table->hmap, *cursor, collect_hnode, &nodes);
+        for (HNode *node : nodes)
+        {
+            hm_delete(&table->hmap, node, hnode_same);
+            table_free_node(table, container_of(node, SNode, node));
+        }
+        done += nodes.size() + 1;
+    }
+    if (table && hm_size(&table->hmap) > 0)
+    {
+        return false;
+    }
+    mset_clear(set);
+    return true;
+}
+
+size_t mset_mem_usage(const MSet *set)
+{
+    size_t size = sizeof(MSet) + intset_mem_usage(&set->ints);
+    if (const STable *table = set->table)
+    {
+        size += sizeof(STable) + table->node_bytes + hm_mem_usage((HMap *)&table->hmap);
+    }
+    return size;
+}
@@ -0,0 +1,71 @@
+#ifndef MSET_HPP
+#define MSET_HPP
+
+#include "hashtable.hpp"
+#include "intset.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Set value: distinct members, in no particular order.
+//
+// While every member is an integer in canonical form ("12", "-3", not "012"
+// or "+3") and there are at most k_mset_intset_max of them, the set is an
+// IntSet (intset.hpp), which also makes intersections of such sets a merge
+// of sorted arrays. Any other member converts the set, for good, to an
+// STable: an SNode per member in an HMap.
+
+const size_t k_mset_intset_max = 1 << 23;
+
+struct SNode
+{
+    HNode node;
+    uint32_t len = 0;
+    char name[];
+};
+
+struct STable
+{
+    HMap hmap;
+    size_t node_bytes = 0; // allocated for the SNodes
+};
+
+struct MSet
+{
+    size_t size = 0;         // members
+    IntSet ints;             // while there is no table
+    STable *table = nullptr; // once converted
+};
+
+// true if the member is new
+bool mset_add(MSet *set, std::string_view member);
+// Adds a batch of members, integers in one merge while the set stays an
+// IntSet. Returns the members that were new.
+size_t mset_add_many(MSet *set, const std::string_view *members, size_t n);
+// false if there was no such member
+bool mset_rem(MSet *set, std::string_view member);
+bool mset_has(MSet *set, std::string_view member);
+// calls f for each member; the view is only valid during the call
+void mset_foreach(MSet *set, void (*f)(std::string_view member, void *arg), void *arg);
+// Calls f for each member of the intersection of sets[0..n), n >= 1, and
+// returns how many there are. With a limit other than 0 it stops after that
+// many.
+size_t mset_inter(MSet **sets, size_t n, size_t limit,
+                  void (*f)(std::string_view member, void *arg), void *arg);
+// Calls f for each member of sets[0] that is in none of sets[1..n), and
+// returns how many there are. A set may be nullptr for an empty one.
+size_t mset_diff(MSet **sets, size_t n, void (*f)(std::string_view member, void *arg),
+                 void *arg);
+// out gets the union of sets[0..n), nullptr ones skipped
+void mset_union(MSet **sets, size_t n, MSet *out);
+// frees the members, the set is left empty
+void mset_clear(MSet *set);
+// Frees about `work` members of a set that is being dropped, resuming from
+// *cursor (0 the first time). An IntSet's array goes to the lazy-free
+// thread in one piece. True once all of it is freed, as by mset_clear();
+// the set is not usable before.
+bool mset_clear_some(MSet *set, uint64_t *cursor, size_t work);
+// bytes allocated for the set, the MSet itself included
+size_t mset_mem_usage(const MSet *set);
+
+#endif // MSET_HPP
@@ -0,0 +1,191 @@
+#include "mset.hpp"
+#include "test_util.hpp"
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+typedef std::set<std::string> Model;
+
+static void collectMember(std::string_view member, void *arg) {
+  ((std::vector<std::string> *)arg)->emplace_back(member);
+}
+
+// the members, each once, as a set
+static Model members(MSet *set) {
+  std::vector<std::string> all;
+  mset_foreach(set, collectMember, &all);
+  Model out(all.begin(), all.end());
+  return out.size() == all.size() ? out : Model{"<duplicate>"};
+}
+
+static bool sameAsModel(MSet *set, const Model &model) {
+  if (set->size != model.size() || members(set) != model) {
+    return false;
+  }
+  for (const std::string &m : model) {
+    if (!mset_has(set, m)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Integers in canonical form keep the set an IntSet; any other member,
+// including an integer written another way, converts it with its members
+void testConversion() {
+  bool passed = true;
+  const char *others[] = {"a", "007", "+5", "-0", "", "1.0", "9223372036854775808"};
+  for (const char *other : others) {
+    MSet set;
+    Model model;
+    const char *ints[] = {"0", "-1", "42", "2147483648", "-9223372036854775808",
+                          "9223372036854775807"};
+    for (const char *v : ints) {
+      passed = passed && mset_add(&set, v);
+      model.insert(v);
+    }
+    passed = passed && set.table == nullptr && set.ints.width == 8 && sameAsModel(&set, model);
+    passed = passed && !mset_has(&set, other) && mset_add(&set, other) && set.table != nullptr;
+    model.insert(other);
+    passed = passed && sameAsModel(&set, model) && !mset_add(&set, "42") && mset_rem(&set, "42") &&
+             !mset_has(&set, "42");
+    model.erase("42");
+    passed = passed && sameAsModel(&set, model);
+    mset_clear(&set);
+    passed = passed && set.size == 0 && set.table == nullptr;
+  }
+
+  runTest("Conversion", passed);
+}
+
+// a batch of integers is merged in one go, and one that is not converts
+void testAddMany() {
+  MSet set;
+  std::string_view ints[] = {"3", "1", "2", "3", "1"};
+  bool passed = mset_add_many(&set, ints, 5) == 3 && set.table == nullptr;
+  std::string_view mixed[] = {"4", "x", "1", "x"};
+  passed = passed && mset_add_many(&set, mixed, 4) == 2 && set.table != nullptr &&
+           sameAsModel(&set, Model{"1", "2", "3", "4", "x"});
+  mset_clear(&set);
+
+  runTest("Add Many", passed);
+}
+
+// Random sets, some IntSets and some tables, and their intersections (with
+// and without a limit), differences and unions, against std::set
+void testSetOps() {
+  uint64_t rnd = 0x9E3779B97F4A7C15ull;
+  bool passed = true;
+  for (int round = 0; round < 60 && passed; ++round) {
+    size_t n = 1 + xorshift(rnd) % 4;
+    std::vector<MSet> sets(n);
+    std::vector<Model> models(n);
+    std::vector<MSet *> ptrs;
+    for (size_t i = 0; i < n; ++i) {
+      size_t size = xorshift(rnd) % (i == 0 ? 300 : 3000);
+      bool strs = xorshift(rnd) % 3 == 0;
+      for (size_t k = 0; k < size; ++k) {
+        std::string m = std::to_string(xorshift(rnd) % 1000);
+        if (strs && k % 5 == 0) {
+          m = "s" + m;
+        }
+        mset_add(&sets[i], m);
+        models[i].insert(m);
+      }
+      ptrs.push_back(&sets[i]);
+    }
+
+    Model inter = models[0];
+    Model diff = models[0];
+    Model all;
+    for (size_t i = 0; i < n; ++i) {
+      Model keep;
+      std::set_intersection(inter.begin(), inter.end(), models[i].begin(), models[i].end(),
+                            std::inserter(keep, keep.end()));
+      inter = keep;
+      if (i > 0) {
+        for (const std::string &m : models[i]) {
+          diff.erase(m);
+        }
+      }
+      all.insert(models[i].begin(), models[i].end());
+    }
+
+    std::vector<std::string> got;
+    passed = passed && mset_inter(ptrs.data(), n, 0, collectMember, &got) == inter.size() &&
+             Model(got.begin(), got.end()) == inter && got.size() == inter.size();
+    for (size_t limit : {size_t(1), size_t(7)}) {
+      got.clear();
+      size_t count = mset_inter(ptrs.data(), n, limit, collectMember, &got);
+      passed = passed && count == std::min(limit, inter.size()) && got.size() == count &&
+               std::all_of(got.begin(), got.end(),
+                           [&](const std::string &m) { return inter.count(m) == 1; });
+    }
+    got.clear();
+    passed = passed && mset_diff(ptrs.data(), n, collectMember, &got) == diff.size() &&
+             Model(got.begin(), got.end()) == diff;
+    MSet u;
+    mset_union(ptrs.data(), n, &u);
+    passed = passed && sameAsModel(&u, all);
+    mset_clear(&u);
+    for (MSet &s : sets) {
+      mset_clear(&s);
+    }
+  }
+
+  runTest("Set Ops", passed);
+}
+
+// a missing set in a diff or union counts as empty
+void testMissingSets() {
+  MSet a;
+  mset_add(&a, "1");
+  mset_add(&a, "x");
+  MSet *sets[] = {&a, nullptr};
+  std::vector<std::string> got;
+  bool passed = mset_diff(sets, 2, collectMember, &got) == 2;
+  MSet *first_missing[] = {nullptr, &a};
+  passed = passed && mset_diff(first_missing, 2, collectMember, &got) == 0;
+  MSet u;
+  mset_union(first_missing, 2, &u);
+  passed = passed && sameAsModel(&u, Model{"1", "x"});
+  mset_clear(&u);
+  mset_clear(&a);
+
+  runTest("Missing Sets", passed);
+}
+
+// 5000 members: an IntSet's array goes in one call, a table's nodes about
+// 100 a call
+void testClearSome() {
+  bool passed = true;
+  for (bool table : {false, true}) {
+    MSet set;
+    for (int i = 0; i < 5000; ++i) {
+      mset_add(&set, (table ? "m" : "") + std::to_string(i));
+    }
+    uint64_t cursor = 0;
+    int calls = callsUntilDone([&]() { return mset_clear_some(&set, &cursor, 100); });
+    passed = passed && (table ? calls >= 25 : calls == 0) && set.size == 0 &&
+             set.table == nullptr && mset_mem_usage(&set) == sizeof(MSet);
+  }
+
+  runTest("Clear Some", passed);
+}
+
+int main() {
+  std::cout << "Running MSet Tests:" << std::endl;
+
+  testConversion();
+  testAddMany();
+  testSetOps();
+  testMissingSets();
+  testClearSome();
+
+  std::cout << "All tests completed." << std::endl;
+  return failures ? 1 : 0;
+}
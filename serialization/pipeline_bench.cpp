@@ -0,0 +1,277 @@
+// Pipelined GET throughput against a keyspace much larger than the caches.
+//
+// For every --batch value this starts a fresh ./server with that batch size,
+// loads --keys keys, then has one connection send pipelined GETs of random
+// keys for a fixed time. --batch 1 executes each request as soon as it is
+// parsed; larger batches prefetch the table memory for the whole batch before
+// running it. The interesting number is the server CPU time per request.
+//
+// With big values (--value-size 1048576 --keys 1000) it measures the reply
+// path instead: such values are sent from where they are stored, and
+// --server-arg --zerocopy has them sent with MSG_ZEROCOPY.
+//
+//   ./pipeline_bench [--server ./server] [--keys 4000000] [--pipeline 100]
+//                    [--batch 1,8,32,128] [--seconds 3] [--value-size 16]
+//                    [--server-arg ARG]
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/ip.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+static void die(const char *msg) {
+    int err = errno;
+    fprintf(stderr, "[%d] %s\n", err, msg);
+    abort();
+}
+
+static uint64_t now_us() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return uint64_t(tv.tv_sec) * 1000000 + tv.tv_nsec / 1000;
+}
+
+static int connect_to(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        die("socket()");
+    }
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = ntohs(port);
+    addr.sin_addr.s_addr = ntohl(INADDR_LOOPBACK);
+    if (connect(fd, (const struct sockaddr *)&addr, sizeof(addr))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// one request: [len][nstr][len][str]...
+static void append_req(std::string &out, const std::vector<std::string> &cmd) {
+    uint32_t len = 4;
+    for (const std::string &s : cmd) {
+        len += 4 + s.size();
+    }
+    out.append((const char *)&len, 4);
+    uint32_t n = cmd.size();
+    out.append((const char *)&n, 4);
+    for (const std::string &s : cmd) {
+        uint32_t p = s.size();
+        out.append((const char *)&p, 4);
+        out.append(s);
+    }
+}
+
+static void write_all(int fd, const std::string &buf) {
+    const char *p = buf.data();
+    size_t n = buf.size();
+    while (n > 0) {
+        ssize_t rv = write(fd, p, n);
+        if (rv <= 0) {
+            die("write()");
+        }
+        n -= rv;
+        p += rv;
+    }
+}
+
+// blocks until `count` responses have arrived, returns nothing but checks
+// that the stream stays framed
+static void read_responses(int fd, std::string &rbuf, uint32_t count) {
+    char buf[64 * 1024];
+    while (count > 0) {
+        size_t pos = 0;
+        while (count > 0 && rbuf.size() - pos >= 4) {
+            uint32_t len = 0;
+            memcpy(&len, rbuf.data() + pos, 4);
+            if (rbuf.size() - pos < 4 + len) {
+                break;
+            }
+            pos += 4 + len;
+            count--;
+        }
+        rbuf.erase(0, pos);
+        if (count == 0) {
+            break;
+        }
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            die("read()");
+        }
+        rbuf.append(buf, n);
+    }
+}
+
+static double proc_cpu_seconds(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return 0;
+    }
+    char buf[1024];
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    // fields after the ")" of the command name; utime and stime are 14 and 15
+    const char *p = strrchr(buf, ')');
+    unsigned long utime = 0, stime = 0;
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                     &utime, &stime) != 2) {
+        return 0;
+    }
+    return double(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static uint64_t xorshift(uint64_t &s) {
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+}
+
+struct Config {
+    const char *server = "./server";
+    size_t keys = 4000000;
+    uint32_t pipeline = 100;
+    std::vector<size_t> batch = {1, 8, 32, 128};
+    double seconds = 3;
+    uint16_t port = 12440;
+    size_t value_size = 16;
+    const char *server_arg = NULL; // one more argument for the server
+};
+
+static void run_one(const Config &cfg, size_t batch) {
+    uint16_t port = cfg.port;
+    pid_t pid = fork();
+    if (pid < 0) {
+        die("fork()");
+    }
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, 2);
+        char portbuf[16], batchbuf[16];
+        snprintf(portbuf, sizeof(portbuf), "%u", port);
+        snprintf(batchbuf, sizeof(batchbuf), "%zu", batch);
+        execl(cfg.server, cfg.server, "--port", portbuf, "--batch", batchbuf,
+              cfg.server_arg, (char *)NULL);
+        _exit(127);
+    }
+
+    int fd = -1;
+    for (int i = 0; i < 200 && fd < 0; ++i) {
+        usleep(10000);
+        fd = connect_to(port);
+    }
+    if (fd < 0) {
+        die("server did not start");
+    }
+
+    // load the keyspace, 100 SETs per round trip. Bigger rounds make the
+    // server answer in several small writes, which Nagle holds back until
+    // the client's delayed ACK.
+    std::string rbuf;
+    std::string out;
+    char key[32];
+    const std::string value(cfg.value_size, 'v');
+    for (size_t i = 0; i < cfg.keys;) {
+        out.clear();
+        uint32_t n = 0;
+        for (; n < 100 && i < cfg.keys; ++n, ++i) {
+            snprintf(key, sizeof(key), "key:%zu", i);
+            append_req(out, {"set", key, value});
+        }
+        write_all(fd, out);
+        read_responses(fd, rbuf, n);
+    }
+
+    // pregenerate the GET batches so the client does little work per request
+    const size_t nbatches = 256;
+    std::vector<std::string> batches(nbatches);
+    uint64_t rnd = 0x9E3779B97F4A7C15ull;
+    for (std::string &b : batches) {
+        for (uint32_t j = 0; j < cfg.pipeline; ++j) {
+            snprintf(key, sizeof(key), "key:%zu", size_t(xorshift(rnd) % cfg.keys));
+            append_req(b, {"get", key});
+        }
+    }
+
+    double cpu_start = proc_cpu_seconds(pid);
+    uint64_t start = now_us();
+    uint64_t deadline = start + uint64_t(cfg.seconds * 1e6);
+    uint64_t done = 0;
+    for (size_t i = 0; now_us() < deadline; ++i) {
+        write_all(fd, batches[i % nbatches]);
+        read_responses(fd, rbuf, cfg.pipeline);
+        done += cfg.pipeline;
+    }
+    double elapsed = (now_us() - start) / 1e6;
+    double cpu = proc_cpu_seconds(pid) - cpu_start;
+
+    printf("batch=%-4zu keys=%-9zu value=%-8zu pipeline=%-4u %10.0f req/s  %8.1f MB/s"
+           "  %6.3f us server cpu/req\n",
+           batch, cfg.keys, cfg.value_size, cfg.pipeline, done / elapsed,
+           done * (double)cfg.value_size / elapsed / 1e6, cpu * 1e6 / done);
+    fflush(stdout);
+
+    close(fd);
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+}
+
+static std::vector<size_t> parse_list(const char *s) {
+    std::vector<size_t> out;
+    while (*s) {
+        char *end = NULL;
+        out.push_back(strtoull(s, &end, 10));
+        s = (*end == ',') ? end + 1 : end;
+        if (end == s && *s) {
+            break;
+        }
+    }
+    return out;
+}
+
+int main(int argc, char **argv) {
+    Config cfg;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "--server")) {
+            cfg.server = argv[i + 1];
+        } else if (!strcmp(argv[i], "--keys")) {
+            cfg.keys = strtoull(argv[i + 1], NULL, 10);
+        } else if (!strcmp(argv[i], "--pipeline")) {
+            cfg.pipeline = atoi(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--batch")) {
+            cfg.batch = parse_list(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--seconds")) {
+            cfg.seconds = atof(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--port")) {
+            cfg.port = atoi(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--value-size")) {
+            cfg.value_size = strtoull(argv[i + 1], NULL, 10);
+        } else if (!strcmp(argv[i], "--server-arg")) {
+            cfg.server_arg = argv[i + 1];
+        } else {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    for (size_t batch : cfg.batch) {
+        run_one(cfg, batch);
+        cfg.port++; // avoid TIME_WAIT leftovers on the previous port
+    }
+    return 0;
+}
@@ -0,0 +1,299 @@
+#include "qlist.hpp"
+#include <algorithm>
+#include <assert.h>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// a new node starts this small, and doubles up to k_qlist_node_max
+const uint32_t k_node_min = 64;
+
+// Records: [len][bytes][len], see qlist.hpp
+
+static uint32_t len_size(uint32_t len)
+{
+    return len < 0x80 ? 1 : 5;
+}
+
+static uint32_t rec_size(uint32_t len)
+{
+    return 2 * len_size(len) + len;
+}
+
+static void rec_write(uint8_t *rec, std::string_view val)
+{
+    uint32_t len = (uint32_t)val.size();
+    if (len < 0x80)
+    {
+        rec[0] = (uint8_t)len;
+        memcpy(rec + 1, val.data(), len);
+        rec[1 + len] = (uint8_t)len;
+        return;
+    }
+    rec[0] = 0x80;
+    memcpy(rec + 1, &len, 4);
+    memcpy(rec + 5, val.data(), len);
+    memcpy(rec + 5 + len, &len, 4);
+    rec[9 + len] = 0x80;
+}
+
+static std::string_view rec_val(const uint8_t *rec)
+{
+    if (rec[0] < 0x80)
+    {
+        return std::string_view((const char *)rec + 1, rec[0]);
+    }
+    uint32_t len = 0;
+    memcpy(&len, rec + 1, 4);
+    return std::string_view((const char *)rec + 5, len);
+}
+
+// the size of the record that starts at `rec`
+static uint32_t rec_size_fwd(const uint8_t *rec)
+{
+    return rec_size((uint32_t)rec_val(rec).size());
+}
+
+// the size of the record that ends right before `end`
+static uint32_t rec_size_back(const uint8_t *end)
+{
+    if (end[-1] < 0x80)
+    {
+        return rec_size(end[-1]);
+    }
+    uint32_t len = 0;
+    memcpy(&len, end - 5, 4);
+    return rec_size(len);
+}
+
+// Nodes
+
+static QNode *node_new(QList *list, uint32_t cap)
+{
+    QNode *node = new (malloc(sizeof(QNode) + cap)) QNode();
+    node->cap = cap;
+    list->bytes += sizeof(QNode) + cap;
+    list->nodes++;
+    return node;
+}
+
+static void node_unlink(QList *list, QNode *node)
+{
+    (node->prev ? node->prev->next : list->head) = node->next;
+    (node->next ? node->next->prev : list->tail) = node->prev;
+    list->bytes -= sizeof(QNode) + node->cap;
+    list->nodes--;
+    list->size -= node->count;
+    free(node);
+}
+
+// Makes room for `size` more bytes on one side of node's records: moves
+// them to the other side of the buffer, and grows it first if they would
+// not fit. Returns the node, which may have moved.
+static QNode *node_make_room(QList *list, QNode *node, bool front, uint32_t size)
+{
+    if (front ? node->begin >= size : node->cap - node->end >= size)
+    {
+        return node;
+    }
+    uint32_t used = node->end - node->begin;
+    if (used + size > node->cap)
+    {
+        uint32_t cap = node->cap;
+        while (cap < used + size)
+        {
+            cap *= 2;
+        }
+        cap = std::min(cap, std::max(k_qlist_node_max, used + size));
+        list->bytes += cap - node->cap;
+        node = (QNode *)realloc(node, sizeof(QNode) + cap);
+        node->cap = cap;
+        (node->prev ? node->prev->next : list->head) = node;
+        (node->next ? node->next->prev : list->tail) = node;
+    }
+    uint32_t begin = front ? node->cap - used : 0;
+    memmove(node->data + begin, node->data + node->begin, used);
+    node->begin = begin;
+    node->end = begin + used;
+    return node;
+}
+
+void qlist_push(QList *list, bool front, std::string_view val)
+{
+    uint32_t size = rec_size((uint32_t)val.size());
+    QNode *node = front ? list->head : list->tail;
+    if (!node || node->end - node->begin + size > k_qlist_node_max)
+    {
+        node = node_new(list, std::max(k_node_min, size));
+        if (front)
+        {
+            node->begin = node->end = node->cap;
+            node->next = list->head;
+            (list->head ? list->head->prev : list->tail) = node;
+            list->head = node;
+        }
+        else
+        {
+            node->prev = list->tail;
+            (list->tail ? list->tail->next : list->head) = node;
+            list->tail = node;
+        }
+    }
+    node = node_make_room(list, node, front, size);
+    if (front)
+    {
+        node->begin -= size;
+        rec_write(node->data + node->begin, val);
+    }
+    else
+    {
+        rec_write(node->data + node->end, val);
+        node->end += size;
+    }
+    node->count++;
+    list->size++;
+}
+
+std::string_view qlist_peek(const QList *list, bool front)
+{
+    assert(list->size > 0);
+    if (front)
+    {
+        return rec_val(list->head->data + list->head->begin);
+    }
+    const uint8_t *end = list->tail->data + list->tail->end;
+    return rec_val(end - rec_size_back(end));
+}
+
+void qlist_pop(QList *list, bool front)
+{
+    assert(list->size > 0);
+    QNode *node = front ? list->head : list->tail;
+    if (node->count == 1)
+    {
+        node_unlink(list, node);
+        return;
+    }
+    if (front)
+    {
+        node->begin += rec_size_fwd(node->data + node->begin);
+    }
+    else
+    {
+        node->end -= rec_size_back(node->data + node->end);
+    }
+    node->count--;
+    list->size--;
+}
+
+void qlist_trim(QList *list, bool front, size_t n)
+{
+    n = std::min(n, list->size);
+    while (n > 0)
+    {
+        QNode *node = front ? list->head : list->tail;
+        if (node->count <= n)
+        {
+            n -= node->count;
+            node_unlink(list, node);
+            continue;
+        }
+        for (; n > 0; --n)
+        {
+            qlist_pop(list, front);
+        }
+    }
+}
+
+void qlist_iter_init(QIter *it, const QList *list, size_t index)
+{
+    *it = QIter();
+    if (index >= list->size)
+    {
+        return;
+    }
+    QNode *node = nullptr;
+    if (index < list->size / 2)
+    {
+        node = list->head;
+        while (index >= node->count)
+        {
+            index -= node->count;
+            node = node->next;
+        }
+    }
+    else
+    {
+        size_t back = list->size - 1 - index; // counted from the tail
+        node = list->tail;
+        while (back >= node->count)
+        {
+            back -= node->count;
+            node = node->prev;
+        }
+        index = node->count - 1 - back;
+    }
+    it->node = node;
+    it->pos = node->begin;
+    for (; index > 0; --index)
+    {
+        it->pos += rec_size_fwd(node->data + it->pos);
+    }
+}
+
+bool qlist_iter_get(const QIter *it, std::string_view *val)
+{
+    if (!it->node)
+    {
+        return false;
+    }
+    *val = rec_val(it->node->data + it->pos);
+    return true;
+}
+
+void qlist_iter_next(QIter *it)
+{
+    if (!it->node)
+    {
+        return;
+    }
+    it->pos += rec_size_fwd(it->node->data + it->pos);
+    if (it->pos == it->node->end)
+    {
+        it->node = it->node->next;
+        it->pos = it->node ? it->node->begin : 0;
+    }
+}
+
+void qlist_clear(QList *list)
+{
+    QNode *node = list->head;
+    while (node)
+    {
+        QNode *next = node->next;
+        free(node);
+        node = next;
+    }
+    *list = QList();
+}
+
+bool qlist_clear_some(QList *list, size_t work)
+{
+    for (size_t done = 0; list->head && done < work; ++done)
+    {
+        QNode *node = list->head;
+        list->head = node->next;
+        free(node);
+    }
+    if (list->head)
+    {
+        return false;
+    }
+    *list = QList();
+    return true;
+}
+
+size_t qlist_mem_usage(const QList *list)
+{
+    return sizeof(QList) + list->bytes;
+}
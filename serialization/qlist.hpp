@@ -0,0 +1,74 @@
+#ifndef QLIST_HPP
+#define QLIST_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// List: a doubly linked list of QNodes, each a buffer packed with up to
+// k_qlist_node_max bytes of elements, in order.
+//
+// An element is a record [len][bytes][len]. The length is 1 byte below 128,
+// otherwise 0x80 and 4 bytes (the trailing copy the other way round), so a
+// record can be skipped from either end and a short element costs 2 bytes on
+// top of its own. That is all the per-element overhead; links and
+// allocations are per node.
+//
+// The records sit in data[begin, end) of a node, with free room on both
+// sides, so a push or pop at either end of the list touches one node and
+// moves no bytes unless that side ran out of room. An element bigger than a
+// node gets a node of its own.
+
+const uint32_t k_qlist_node_max = 8192;
+
+struct QNode
+{
+    QNode *prev = nullptr;
+    QNode *next = nullptr;
+    uint32_t count = 0; // elements
+    uint32_t begin = 0; // the records are data[begin, end)
+    uint32_t end = 0;
+    uint32_t cap = 0; // bytes allocated for data
+    uint8_t data[];
+};
+
+struct QList
+{
+    QNode *head = nullptr;
+    QNode *tail = nullptr;
+    size_t size = 0;  // elements
+    size_t nodes = 0;
+    size_t bytes = 0; // allocated for the nodes
+};
+
+// a position in the list, for reading ranges
+struct QIter
+{
+    QNode *node = nullptr; // nullptr past the end
+    uint32_t pos = 0;      // offset of the record in node->data
+};
+
+void qlist_push(QList *list, bool front, std::string_view val);
+// the element at an end; the list must not be empty. The bytes are valid
+// until the list is modified.
+std::string_view qlist_peek(const QList *list, bool front);
+// drops the element at an end; the list must not be empty
+void qlist_pop(QList *list, bool front);
+// drops n elements from an end, whole nodes at a time where it can
+void qlist_trim(QList *list, bool front, size_t n);
+// positions `it` at `index`; past the end if index >= list->size. Walks
+// from the nearer end a node at a time: O(index / elements per node).
+void qlist_iter_init(QIter *it, const QList *list, size_t index);
+// false past the end
+bool qlist_iter_get(const QIter *it, std::string_view *val);
+void qlist_iter_next(QIter *it);
+// frees the nodes, the list is left empty
+void qlist_clear(QList *list);
+// Frees up to `work` nodes from the head of a list that is being dropped.
+// True once all of it is freed, as by qlist_clear(); the list is not
+// usable before.
+bool qlist_clear_some(QList *list, size_t work);
+// bytes allocated for the list, the QList itself included
+size_t qlist_mem_usage(const QList *list);
+
+#endif // QLIST_HPP
@@ -0,0 +1,179 @@
+#include "qlist.hpp"
+#include "test_util.hpp"
+#include <deque>
+#include <iostream>
+#include <stdint.h>
+#include <string>
+
+// the list, read front to back and from every 37th index, is the model
+static bool sameAsModel(const QList *list, const std::deque<std::string> &model) {
+  if (list->size != model.size()) {
+    return false;
+  }
+  QIter it;
+  qlist_iter_init(&it, list, 0);
+  std::string_view val;
+  for (const std::string &m : model) {
+    if (!qlist_iter_get(&it, &val) || val != m) {
+      return false;
+    }
+    qlist_iter_next(&it);
+  }
+  if (qlist_iter_get(&it, &val)) {
+    return false;
+  }
+  for (size_t i = 0; i < model.size(); i += 37) {
+    qlist_iter_init(&it, list, i);
+    if (!qlist_iter_get(&it, &val) || val != model[i]) {
+      return false;
+    }
+  }
+  return model.empty() ||
+         (qlist_peek(list, true) == model.front() && qlist_peek(list, false) == model.back());
+}
+
+// lengths on both sides of the 1-byte length limit, and elements bigger than
+// a node, pushed and popped at both ends
+void testElementSizes() {
+  QList list;
+  std::deque<std::string> model;
+  const size_t sizes[] = {0, 1, 126, 127, 128, 129, 1000, k_qlist_node_max - 1,
+                          k_qlist_node_max, k_qlist_node_max + 1, 3 * k_qlist_node_max};
+  char c = 'a';
+  for (size_t size : sizes) {
+    std::string val(size, c++);
+    qlist_push(&list, true, val);
+    model.push_front(val);
+    qlist_push(&list, false, val);
+    model.push_back(val);
+  }
+  bool passed = sameAsModel(&list, model) && list.nodes > 1;
+  while (!model.empty() && passed) {
+    bool front = model.size() % 2 == 0;
+    passed = qlist_peek(&list, front) == (front ? model.front() : model.back());
+    qlist_pop(&list, front);
+    front ? model.pop_front() : model.pop_back();
+    passed = passed && sameAsModel(&list, model);
+  }
+  passed = passed && list.size == 0 && list.nodes == 0 && list.bytes == 0;
+  qlist_clear(&list);
+
+  runTest("Element Sizes", passed);
+}
+
+// positions at and past the ends
+void testIterBounds() {
+  QList list;
+  bool passed = true;
+  QIter it;
+  std::string_view val;
+  qlist_iter_init(&it, &list, 0);
+  passed = passed && !qlist_iter_get(&it, &val);
+  for (int i = 0; i < 5000; ++i) {
+    qlist_push(&list, false, std::to_string(i));
+  }
+  qlist_iter_init(&it, &list, 4999);
+  passed = passed && qlist_iter_get(&it, &val) && val == "4999";
+  qlist_iter_next(&it);
+  passed = passed && !qlist_iter_get(&it, &val);
+  qlist_iter_init(&it, &list, 5000);
+  passed = passed && !qlist_iter_get(&it, &val);
+  qlist_iter_init(&it, &list, SIZE_MAX);
+  passed = passed && !qlist_iter_get(&it, &val);
+  qlist_iter_init(&it, &list, 2500);
+  passed = passed && qlist_iter_get(&it, &val) && val == "2500";
+  qlist_clear(&list);
+
+  runTest("Iter Bounds", passed);
+}
+
+// trims that drop whole nodes, part of one, nothing, or more than there is
+void testTrim() {
+  QList list;
+  std::deque<std::string> model;
+  for (int i = 0; i < 20000; ++i) {
+    std::string val = "v" + std::to_string(i);
+    qlist_push(&list, false, val);
+    model.push_back(val);
+  }
+  size_t nodes = list.nodes;
+  bool passed = nodes > 2;
+  const size_t trims[] = {0, 1, 3000, 7, 5000};
+  for (size_t n : trims) {
+    qlist_trim(&list, true, n);
+    model.erase(model.begin(), model.begin() + n);
+    qlist_trim(&list, false, n);
+    model.erase(model.end() - n, model.end());
+    passed = passed && sameAsModel(&list, model);
+  }
+  passed = passed && list.nodes < nodes;
+  qlist_trim(&list, false, list.size + 10);
+  passed = passed && list.size == 0 && list.nodes == 0 && list.bytes == 0;
+  qlist_clear(&list);
+
+  runTest("Trim", passed);
+}
+
+// pushes, pops and trims at both ends, of elements up to 200 bytes
+void testRandomAgainstModel() {
+  QList list;
+  std::deque<std::string> model;
+  uint64_t rnd = 0x9E3779B97F4A7C15ull;
+  bool passed = true;
+  for (int i = 0; i < 50000 && passed; ++i) {
+    bool front = xorshift(rnd) % 2;
+    uint64_t op = xorshift(rnd) % 10;
+    if (op < 6 || model.empty()) {
+      std::string val(xorshift(rnd) % 200, char('a' + i % 26));
+      qlist_push(&list, front, val);
+      front ? model.push_front(val) : model.push_back(val);
+    } else if (op < 9) {
+      passed = qlist_peek(&list, front) == (front ? model.front() : model.back());
+      qlist_pop(&list, front);
+      front ? model.pop_front() : model.pop_back();
+    } else {
+      size_t n = xorshift(rnd) % (model.size() + 1);
+      qlist_trim(&list, front, n);
+      if (front) {
+        model.erase(model.begin(), model.begin() + n);
+      } else {
+        model.erase(model.end() - n, model.end());
+      }
+    }
+    if (i % 1000 == 0) {
+      passed = passed && sameAsModel(&list, model);
+    }
+  }
+  passed = passed && sameAsModel(&list, model);
+  qlist_clear(&list);
+
+  runTest("Random Against Model", passed);
+}
+
+// 10 nodes a call from the head; the call that frees the last one resets
+// the QList
+void testClearSome() {
+  QList list;
+  for (int i = 0; i < 100000; ++i) {
+    qlist_push(&list, false, "element " + std::to_string(i));
+  }
+  size_t nodes = list.nodes;
+  int calls = callsUntilDone([&]() { return qlist_clear_some(&list, 10); });
+  bool passed = nodes > 100 && calls == int((nodes - 1) / 10) && list.size == 0 &&
+                list.head == nullptr && qlist_mem_usage(&list) == sizeof(QList);
+
+  runTest("Clear Some", passed);
+}
+
+int main() {
+  std::cout << "Running QList Tests:" << std::endl;
+
+  testElementSizes();
+  testIterBounds();
+  testTrim();
+  testRandomAgainstModel();
+  testClearSome();
+
+  std::cout << "All tests completed." << std::endl;
+  return failures ? 1 : 0;
+}
@@ -1,5 +1,8 @@
 #pragma once
-#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "buffer.hpp"
 
 enum {
     TAG_NIL = 0,
@@ -12,16 +15,17 @@ enum {
 enum {
     ERR_UNKNOWN = 1,
     ERR_TOO_LONG = 2,
+    ERR_BAD_ARG = 3,
+    ERR_OOM = 4, // over maxmemory and nothing to evict
+    ERR_BAD_TYP = 5, // the key holds a value of another type
 };
 
 // Buffer
-typedef std::vector<uint8_t> Buffer;
-
 static void buf_append(Buffer& buf, const uint8_t *data, size_t size) {
-    buf.insert(buf.end(), data, data + size);
+    buf.append(data, size);
 }
 static void buf_append_u8(Buffer& buf, uint8_t value) {
-    buf.push_back(value);
+    buf.append(&value, 1);
 }
 static void buf_append_u32(Buffer &buf, uint32_t data) {
     buf_append(buf, (const uint8_t *)&data, 4);
@@ -32,9 +36,9 @@ static void buf_append_i64(Buffer &buf, int64_t data) {
 static void buf_append_dbl(Buffer &buf, double data) {
     buf_append(buf, (const uint8_t *)&data, 8);
 }
-// remove from the front
+// remove from the front, O(1): only the head pointer moves
 static void buf_consume(Buffer &buf, size_t n) {
-    buf.erase(buf.begin(), buf.begin() + n);
+    buf.consume(n);
 }
 
 
@@ -46,7 +50,12 @@ static void out_nil(Buffer &buf) {
 
 static void out_int(Buffer &buf, int64_t value) {
     buf_append_u8(buf, TAG_INT);
-    buf_append_u8(buf, value);
+    buf_append_i64(buf, value);
+}
+
+static void out_dbl(Buffer &buf, double value) {
+    buf_append_u8(buf, TAG_DBL);
+    buf_append_dbl(buf, value);
 }
 
 static void out_str(Buffer &buf, const char *s, const size_t len) {
@@ -60,6 +69,17 @@ static void out_arr(Buffer &buf, uint32_t n) {
     buf_append_u32(buf, n);
 }
 
+// for arrays whose length is only known once the elements are written
+static size_t out_begin_arr(Buffer &buf) {
+    buf_append_u8(buf, TAG_ARR);
+    buf_append_u32(buf, 0); // filled in by out_end_arr()
+    return buf.data_size() - 4;
+}
+
+static void out_end_arr(Buffer &buf, size_t pos, uint32_t n) {
+    memcpy(buf.data() + pos, &n, 4);
+}
+
 static void out_err(Buffer &buf, uint32_t err_code, const std::string &msg) {
     buf_append_u8(buf, TAG_ERR);
     buf_append_u32(buf, err_code);
@@ -1,6 +1,10 @@
 #include "server.hpp"
 #include "hashtable.hpp"
+#include <algorithm>
 #include <assert.h>
+#include <atomic>
+#include <charconv>
+#include <cmath>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
@@ -8,465 +12,4334 @@
 #include <fcntl.h>
 #include <netinet/ip.h>
 #include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <string_view>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <thread>
+#include <time.h>
+#ifdef __linux__
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
 #include <unistd.h>
 #include <vector>
+#include "evict.hpp"
+#include "fmap.hpp"
+#include "lazyfree.hpp"
+#include "mset.hpp"
+#include "qlist.hpp"
 #include "serialization.hpp"
+#include "slab.hpp"
+#include "spsc.hpp"
+#include "uring.hpp"
+#include "zset.hpp"
 
-static struct
+// A dropped value of another type that is freed a bit at a time, see
+// db_obj_free()
+struct LazyObj
+{
+  uint8_t type = ENT_STR;
+  void *obj = nullptr;
+  uint64_t cursor = 0; // where its *_clear_some() is
+  size_t bytes = 0;    // its memory when it was dropped
+};
+
+// The keyspace. One per thread: with --reactors every reactor thread owns a
+// shard of it, otherwise only the thread that runs the commands uses it.
+static thread_local struct
 {
   HMap db;
+  // TTLs: a min-heap of deadlines, each item refers to Entry::heap_idx
+  std::vector<HeapItem> heap;
+  uint64_t expired_keys = 0;
+  // bytes allocated for entries, keys and values, see db_entry_mem()
+  size_t entry_bytes = 0;
+  EvictPool evict_pool;
+  uint64_t evicted_keys = 0;
+  uint64_t now_ms = 0; // when the current batch of requests started
+  // every open connection, least recently active first, for idle timeouts
+  DList idle_list;
+  uint32_t shard = 0; // --reactors: the reactor this thread runs
+  // values referenced by the response being built, see out_val()
+  std::vector<OutRef> out_refs;
+  uint64_t ref_replies = 0; // responses that sent their value by reference
+  // big values of other types being freed between events, and their bytes
+  std::vector<LazyObj> lazy_objs;
+  size_t lazy_obj_bytes = 0;
 } g_data;
 
-static void do_request(std::vector<std::string> &cmd, Buffer &out)
+// connections closed by idle timeouts, counted by every thread that closes
+// them
+static std::atomic<uint64_t> g_idle_closed{0};
+// --zerocopy: MSG_ZEROCOPY sends, and those the kernel reported it copied
+// after all (e.g. on loopback)
+static std::atomic<uint64_t> g_zerocopy_sends{0};
+static std::atomic<uint64_t> g_zerocopy_copied{0};
+
+// batches of 1 turn the prefetching off
+const size_t k_batch_default = 32;
+const size_t k_batch_max = 256;
+// rehashing time per event loop iteration while a resize is pending
+const uint64_t k_rehash_us_default = 100;
+// keys deleted by active expiry per event loop iteration
+const size_t k_max_expire_work = 2000;
+// A value of another type with this many members (a list: nodes) is freed
+// between events, up to k_lazy_obj_work of them per loop iteration, rather
+// than by the command that dropped it.
+const size_t k_lazy_obj_min = 1024;
+const size_t k_lazy_obj_work = 1024;
+const size_t k_io_threads_max = 64;
+const size_t k_reactors_max = 64;
+// connections without any I/O for this long are closed, 0 never closes them
+const uint64_t k_idle_timeout_ms_default = 300 * 1000;
+// GET sends values at least this big by reference; copying a smaller one
+// costs less than an extra iovec
+const size_t k_out_ref_min = 16 << 10;
+static_assert(k_out_ref_min > k_slab_max, "only ValBlocks are referenced");
+// --zerocopy: values at least this big go out with MSG_ZEROCOPY, below it
+// the page pinning and the completion cost more than the copy
+const size_t k_zerocopy_min = 64 << 10;
+// iovecs per sendmsg()
+const size_t k_out_max_iov = 64;
+
+// server options, set from the command line
+enum
+{
+  BACKEND_POLL = 0,
+  BACKEND_EPOLL = 1,
+  BACKEND_URING = 2,
+};
+
+static struct
+{
+  int backend = BACKEND_POLL;
+  bool edge_triggered = false;
+  uint16_t port = 1234;
+  size_t batch = k_batch_default; // pipelined requests parsed per batch
+  uint64_t rehash_us = k_rehash_us_default;
+  uint64_t idle_timeout_ms = k_idle_timeout_ms_default;
+  uint32_t io_threads = 0; // epoll only
+  uint32_t reactors = 1;   // epoll only, more than 1 shards the keyspace
+  size_t maxmemory = 0;    // 0: no limit
+  int evict_policy = EVICT_NONE;
+  bool zerocopy = false;   // not with io_uring
+} g_opts;
+
+// the io_uring loop only sends from outgoing and turns references off
+static size_t g_out_ref_min = k_out_ref_min;
+
+// --reactors: whether cmd[first], cmd[first + step], ... cmd[last] are all
+// keys of one shard. A command only sees the shard of its first key.
+static bool keys_one_shard(const std::vector<std::string_view> &cmd, size_t first,
+                           size_t last, size_t step)
+{
+  uint32_t shard = 0;
+  for (size_t i = first; i <= last && i < cmd.size(); i += step)
+  {
+    uint32_t s = key_shard(str_hash((const uint8_t *)cmd[i].data(), cmd[i].size()));
+    if (i != first && s != shard)
+    {
+      return false;
+    }
+    shard = s;
+  }
+  return true;
+}
+
+static void do_request(const Command *c, std::vector<std::string_view> &cmd,
+                       Buffer &out)
 {
-  if (cmd.size() == 2 && cmd[0] == "get")
+  if (!c)
   {
-    return do_get(cmd, out);
+    return out_err(out, ERR_UNKNOWN, "unknown command.");
   }
-  else if (cmd.size() == 3 && cmd[0] == "set")
+  int32_t argc = (int32_t)cmd.size();
+  if (c->arity >= 0 ? argc != c->arity : argc < -c->arity)
   {
-    return do_set(cmd, out);
+    return out_err(out, ERR_BAD_ARG, "wrong number of arguments.");
   }
-  else if (cmd.size() == 2 && cmd[0] == "del")
+  if (g_opts.reactors > 1 && c->first_key > 0 && c->last_key != c->first_key)
   {
-    return do_del(cmd, out);
+    size_t last = c->last_key < 0 ? cmd.size() + c->last_key : (size_t)c->last_key;
+    if (!keys_one_shard(cmd, c->first_key, last, c->key_step))
+    {
+      return out_err(out, ERR_BAD_ARG, "keys in different shards.");
+    }
   }
-  else if (cmd.size() == 1 && cmd[0] == "keys")
+  if ((c->flags & CMD_DENYOOM) && !db_make_room())
   {
-      return do_keys(cmd, out);
+    return out_err(out, ERR_OOM, "command not allowed when used memory > maxmemory.");
   }
-  else
+  c->handler(cmd, out);
+}
+
+// a finite or infinite score, not NaN
+static bool parse_dbl(std::string_view s, double &out)
+{
+  char tmp[64];
+  if (s.empty() || s.size() >= sizeof(tmp))
   {
-      return out_err(out, ERR_UNKNOWN, "unknown error.");
+    return false;
   }
+  memcpy(tmp, s.data(), s.size());
+  tmp[s.size()] = '\0';
+  char *end = NULL;
+  out = strtod(tmp, &end);
+  return end == tmp + s.size() && !std::isnan(out);
 }
 
-static void do_del(std::vector<std::string> &cmd, Buffer &buf)
+static bool parse_u64(std::string_view s, uint64_t &out)
 {
-  assert(cmd.size() == 2);
-  Entry key;
-  key.key.swap(cmd[1]);
-  key.node.hcode = str_hash((uint8_t *)key.key.data(), key.key.size());
-  HNode *node = h_lookup(&g_data.db, &key.node, entry_eq);
-  if (node)
+  if (s.empty() || s.size() > 20)
+  {
+    return false;
+  }
+  uint64_t v = 0;
+  for (char c : s)
+  {
+    if (c < '0' || c > '9' || v > (UINT64_MAX - (c - '0')) / 10)
+    {
+      return false;
+    }
+    v = v * 10 + (c - '0');
+  }
+  out = v;
+  return true;
+}
+
+static bool parse_i64(std::string_view s, int64_t &out)
+{
+  bool neg = !s.empty() && s[0] == '-';
+  uint64_t v = 0;
+  if (!parse_u64(neg ? s.substr(1) : s, v) || v > (uint64_t)INT64_MAX + neg)
+  {
+    return false;
+  }
+  out = neg ? (int64_t)(0 - v) : (int64_t)v;
+  return true;
+}
+
+// An int64 in canonical form, the way it would be formatted: no sign but
+// "-", no leading zeros. Only such a string value is kept as an integer, so
+// a read gets back the same bytes.
+static bool parse_int_val(std::string_view s, int64_t &out)
+{
+  char tmp[24];
+  int64_t v = 0;
+  if (!parse_i64(s, v))
+  {
+    return false;
+  }
+  char *end = std::to_chars(tmp, tmp + sizeof(tmp), v).ptr;
+  if (std::string_view(tmp, end - tmp) != s)
+  {
+    return false;
+  }
+  out = v;
+  return true;
+}
+
+static uint64_t get_monotonic_msec()
+{
+  struct timespec tv = {0, 0};
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return uint64_t(tv.tv_sec) * 1000 + tv.tv_nsec / 1000 / 1000;
+}
+
+static bool hnode_same(HNode *node, HNode *key)
+{
+  return node == key;
+}
+
+// ttl_ms < 0 removes the TTL
+static void entry_set_ttl(Entry *ent, int64_t ttl_ms)
+{
+  if (ttl_ms < 0)
+  {
+    if (ent->heap_idx != k_heap_none)
+    {
+      heap_delete(g_data.heap, ent->heap_idx);
+    }
+    return;
+  }
+  HeapItem item;
+  item.val = get_monotonic_msec() + (uint64_t)ttl_ms;
+  item.ref = &ent->heap_idx;
+  heap_upsert(g_data.heap, ent->heap_idx, item);
+}
+
+static bool entry_expired(const Entry *ent)
+{
+  return ent->heap_idx != k_heap_none &&
+         g_data.heap[ent->heap_idx].val <= get_monotonic_msec();
+}
+
+// an entry's memory, with the container of a value that is not a string
+static size_t db_entry_mem(const Entry *ent)
+{
+  size_t size = entry_mem_usage(ent);
+  if (ent->type == ENT_ZSET)
+  {
+    size += zset_mem_usage((const ZSet *)entry_obj(ent));
+  }
+  else if (ent->type == ENT_LIST)
+  {
+    size += qlist_mem_usage((const QList *)entry_obj(ent));
+  }
+  else if (ent->type == ENT_HASH)
+  {
+    size += fmap_mem_usage((const FMap *)entry_obj(ent));
+  }
+  else if (ent->type == ENT_SET)
+  {
+    size += mset_mem_usage((const MSet *)entry_obj(ent));
+  }
+  return size;
+}
+
+// what freeing the container costs: its members, or nodes for a list
+static size_t db_obj_work(const Entry *ent)
+{
+  switch (ent->type)
+  {
+  case ENT_ZSET:
+    return ((const ZSet *)entry_obj(ent))->size;
+  case ENT_LIST:
+    return ((const QList *)entry_obj(ent))->nodes;
+  case ENT_HASH:
+    return ((const FMap *)entry_obj(ent))->size;
+  case ENT_SET:
+    return ((const MSet *)entry_obj(ent))->size;
+  }
+  return 0;
+}
+
+// Frees about `work` members of a dropped container, and the container
+// once they are all gone; true then.
+static bool lazy_obj_free_some(LazyObj *lz, size_t work)
+{
+  if (lz->type == ENT_ZSET)
+  {
+    ZSet *zset = (ZSet *)lz->obj;
+    if (!zset_clear_some(zset, &lz->cursor, work))
+    {
+      return false;
+    }
+    delete zset;
+  }
+  else if (lz->type == ENT_LIST)
+  {
+    QList *list = (QList *)lz->obj;
+    if (!qlist_clear_some(list, work))
+    {
+      return false;
+    }
+    delete list;
+  }
+  else if (lz->type == ENT_HASH)
+  {
+    FMap *fmap = (FMap *)lz->obj;
+    if (!fmap_clear_some(fmap, &lz->cursor, work))
+    {
+      return false;
+    }
+    delete fmap;
+  }
+  else if (lz->type == ENT_SET)
+  {
+    MSet *set = (MSet *)lz->obj;
+    if (!mset_clear_some(set, &lz->cursor, work))
+    {
+      return false;
+    }
+    delete set;
+  }
+  return true;
+}
+
+// Frees the container of a value that is not a string, which leaves the
+// entry an empty string. A big one is only taken out of the entry (on DEL,
+// UNLINK, expiry, eviction or SET alike) and freed between events by
+// process_lazy_objs(): its nodes are slab memory, which only this thread
+// can free, so unlike a big string it cannot go to the lazy-free thread;
+// the arrays of its hash table and of an IntSet do.
+static void db_obj_free(Entry *ent)
+{
+  if (ent->type != ENT_STR && db_obj_work(ent) >= k_lazy_obj_min)
+  {
+    LazyObj lz;
+    lz.type = ent->type;
+    lz.obj = entry_obj(ent);
+    lz.bytes = db_entry_mem(ent) - entry_mem_usage(ent);
+    g_data.lazy_objs.push_back(lz);
+    g_data.lazy_obj_bytes += lz.bytes;
+    entry_set_val(ent, "");
+    return;
+  }
+  if (ent->type == ENT_ZSET)
+  {
+    ZSet *zset = (ZSet *)entry_obj(ent);
+    zset_clear(zset);
+    delete zset;
+  }
+  else if (ent->type == ENT_LIST)
+  {
+    QList *list = (QList *)entry_obj(ent);
+    qlist_clear(list);
+    delete list;
+  }
+  else if (ent->type == ENT_HASH)
+  {
+    FMap *fmap = (FMap *)entry_obj(ent);
+    fmap_clear(fmap);
+    delete fmap;
+  }
+  else if (ent->type == ENT_SET)
+  {
+    MSet *set = (MSet *)entry_obj(ent);
+    mset_clear(set);
+    delete set;
+  }
+  if (ent->type != ENT_STR)
+  {
+    entry_set_val(ent, "");
+  }
+}
+
+// frees an entry that was already taken out of the table
+static void db_entry_del(Entry *ent)
+{
+  entry_set_ttl(ent, -1);
+  g_data.entry_bytes -= db_entry_mem(ent);
+  db_obj_free(ent);
+  entry_del(ent);
+}
+
+// unlink: a big value goes to the lazy-free thread, the rest is freed here
+static void db_entry_del_lazy(Entry *ent)
+{
+  if ((ent->flags & ENT_VAL_EXT) && ent->vlen >= k_lazyfree_min)
+  {
+    size_t size = valblock_size(ent->vlen);
+    g_data.entry_bytes -= size;
+    ValBlock *blk = entry_take_val(ent);
+    if (valblock_unique(blk))
+    {
+      lazyfree_free(blk, size);
+    }
+    else
+    {
+      valblock_unref(blk); // a response still sends it, the last one frees it
+    }
+  }
+  db_entry_del(ent);
+}
+
+static void db_expire(Entry *ent)
+{
+  hm_delete(&g_data.db, &ent->node, hnode_same);
+  db_entry_del(ent);
+  g_data.expired_keys++;
+}
+
+// finds a live key: one whose deadline passed is deleted on access, even if
+// active expiry has not got to it yet
+static Entry *db_lookup(LookupKey *key)
+{
+  HNode *node = h_lookup(&g_data.db, &key->node, entry_eq_key);
+  if (!node)
+  {
+    return nullptr;
+  }
+  Entry *ent = container_of(node, Entry, node);
+  if (entry_expired(ent))
+  {
+    db_expire(ent);
+    return nullptr;
+  }
+  evict_touch(ent, g_opts.evict_policy, g_data.now_ms);
+  return ent;
+}
+
+// what maxmemory is compared against: the entries plus the table and TTL
+// heap arrays, not the connection buffers
+static size_t db_used_memory()
+{
+  return g_data.entry_bytes + hm_mem_usage(&g_data.db) +
+         g_data.heap.capacity() * sizeof(HeapItem);
+}
+
+// Evicts keys until the data fits in maxmemory again. Runs before each
+// command that can grow it, so the limit may be exceeded by one write.
+// Returns false when it cannot get below the limit. With --reactors each
+// shard gets an equal part of the limit.
+static bool db_make_room()
+{
+  if (!g_opts.maxmemory)
+  {
+    return true;
+  }
+  while (db_used_memory() > g_opts.maxmemory / g_opts.reactors)
   {
-    delete container_of(node, Entry, node);
+    Entry *ent = evict_pick(&g_data.db, &g_data.evict_pool, g_opts.evict_policy,
+                            g_data.now_ms);
+    if (!ent)
+    {
+      return false;
+    }
+    hm_delete(&g_data.db, &ent->node, hnode_same);
+    db_entry_del(ent);
+    g_data.evicted_keys++;
   }
-  out_int(buf, node ? 1:0);
+  return true;
 }
 
-static void do_set(std::vector<std::string> &cmd, Buffer &buf)
+static void db_del_key(std::string_view name, Buffer &buf, bool lazy)
 {
-  assert(cmd.size() == 3);
-  Entry key;
-  key.key.swap(cmd[1]);
-  key.node.hcode = str_hash((uint8_t *)key.key.data(), key.key.size());
-  HNode *node = h_lookup(&g_data.db, &key.node, entry_eq);
+  LookupKey key;
+  lookup_key_init(&key, name);
+  HNode *node = hm_delete(&g_data.db, &key.node, entry_eq_key);
+  bool live = false;
   if (node)
   {
-    container_of(node, Entry, node)->val.swap(cmd[2]);
+    Entry *ent = container_of(node, Entry, node);
+    live = !entry_expired(ent);
+    if (lazy)
+    {
+      db_entry_del_lazy(ent);
+    }
+    else
+    {
+      db_entry_del(ent);
+    }
+  }
+  out_int(buf, live ? 1 : 0);
+}
+
+static void do_del(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  assert(cmd.size() == 2);
+  db_del_key(cmd[1], buf, false);
+}
+
+// like del, but the memory of a big value is freed in the background
+static void do_unlink(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  assert(cmd.size() == 2);
+  db_del_key(cmd[1], buf, true);
+}
+
+// set key value [px ms | ex s]; without an expiry any old TTL is dropped
+static void do_set(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  int64_t ttl_ms = -1;
+  if (cmd.size() == 5)
+  {
+    int64_t n = 0;
+    if (!parse_i64(cmd[4], n) || n <= 0)
+    {
+      return out_err(buf, ERR_BAD_ARG, "invalid expire time.");
+    }
+    if (cmd[3] == "px")
+    {
+      ttl_ms = n;
+    }
+    else if (cmd[3] == "ex" && n <= INT64_MAX / 1000)
+    {
+      ttl_ms = n * 1000;
+    }
+    else
+    {
+      return out_err(buf, ERR_BAD_ARG, "syntax error.");
+    }
+  }
+  else if (cmd.size() != 3)
+  {
+    return out_err(buf, ERR_BAD_ARG, "syntax error.");
+  }
+
+  int64_t ival = 0;
+  bool is_int = parse_int_val(cmd[2], ival);
+  LookupKey key;
+  lookup_key_init(&key, cmd[1]);
+  Entry *ent = db_lookup(&key);
+  if (ent)
+  {
+    g_data.entry_bytes -= db_entry_mem(ent);
+    db_obj_free(ent); // set replaces a value of any type
+    if (!is_int)
+    {
+      entry_set_val(ent, cmd[2]);
+    }
   }
   else
   {
-    Entry *ent = new Entry();
-    ent->key.swap(key.key);
-    ent->node.hcode = key.node.hcode;
-    ent->val.swap(cmd[2]);
+    // the only place where the key and value get copied out of the request
+    ent = entry_new(cmd[1], key.node.hcode, is_int ? "" : cmd[2]);
+    evict_init(ent, g_opts.evict_policy, g_data.now_ms);
     hm_insert(&g_data.db, &ent->node);
   }
+  if (is_int)
+  {
+    entry_set_int(ent, ival);
+  }
+  g_data.entry_bytes += db_entry_mem(ent);
+  entry_set_ttl(ent, ttl_ms);
   out_nil(buf);
 }
 
-static void do_get(std::vector<std::string> &cmd, Buffer &buf)
+// The value as a string. A big one is not copied: the response only gets
+// its header, and a reference to the block in g_data.out_refs, which
+// run_request() passes on along with the response.
+static void out_val(Buffer &buf, const Entry *ent)
+{
+  if (ent->flags & ENT_VAL_INT)
+  {
+    char tmp[24];
+    char *end = std::to_chars(tmp, tmp + sizeof(tmp), entry_int(ent)).ptr;
+    return out_str(buf, tmp, end - tmp);
+  }
+  std::string_view val = entry_val(ent);
+  assert(val.size() < k_max_msg);
+  ValBlock *blk = val.size() >= g_out_ref_min ? entry_val_block(ent) : nullptr;
+  if (!blk)
+  {
+    out_str(buf, val.data(), val.size());
+    return;
+  }
+  buf_append_u8(buf, TAG_STR);
+  buf_append_u32(buf, (uint32_t)val.size());
+  valblock_ref(blk);
+  g_data.out_refs.push_back(OutRef{buf.data_size(), blk});
+  g_data.ref_replies++;
+}
+
+static void do_get(std::vector<std::string_view> &cmd, Buffer &buf)
 {
   assert(cmd.size() == 2);
-  Entry key;
-  key.key.swap(cmd[1]);
-  key.node.hcode = str_hash((uint8_t *)key.key.data(), key.key.size());
-  const HNode *lookup_node = h_lookup(&g_data.db, &key.node, entry_eq);
-  if (!lookup_node)
+  LookupKey key;
+  lookup_key_init(&key, cmd[1]);
+  const Entry *ent = db_lookup(&key);
+  if (!ent)
   {
     out_nil(buf);
     return;
   }
-  // copy the value
-  const auto &val = container_of(lookup_node, Entry, node)->val;
-  assert(val.size() < k_max_msg);
-  out_str(buf, val.data(), val.size());
+  if (ent->type != ENT_STR)
+  {
+    return out_err(buf, ERR_BAD_TYP, "expect string.");
+  }
+  out_val(buf, ent);
 }
 
-static bool cb_keys(HNode *node, void *arg) {
-    Buffer &out = *(Buffer *)arg;
-    const std::string &key = container_of(node, Entry, node)->key;
-    out_str(out, key.data(), key.size());
-    return true;
+// pexpire key ms => 1 if the key exists; a TTL <= 0 deletes it right away
+static void do_pexpire(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  int64_t ttl_ms = 0;
+  if (!parse_i64(cmd[2], ttl_ms))
+  {
+    return out_err(buf, ERR_BAD_ARG, "expect int64.");
+  }
+  LookupKey key;
+  lookup_key_init(&key, cmd[1]);
+  Entry *ent = db_lookup(&key);
+  if (ent && ttl_ms <= 0)
+  {
+    hm_delete(&g_data.db, &ent->node, hnode_same);
+    db_entry_del(ent);
+  }
+  else if (ent)
+  {
+    entry_set_ttl(ent, ttl_ms);
+  }
+  out_int(buf, ent ? 1 : 0);
 }
 
-static void do_keys(std::vector<std::string> &_, Buffer &buf) {
-    out_arr(buf, (uint32_t)hm_size(&g_data.db));
-    hm_foreach(&g_data.db, &cb_keys, (void *)&buf);
+// pttl key => milliseconds left, -1 without a TTL, -2 if there is no key
+static void do_pttl(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  LookupKey key;
+  lookup_key_init(&key, cmd[1]);
+  Entry *ent = db_lookup(&key);
+  if (!ent)
+  {
+    return out_int(buf, -2);
+  }
+  if (ent->heap_idx == k_heap_none)
+  {
+    return out_int(buf, -1);
+  }
+  uint64_t deadline = g_data.heap[ent->heap_idx].val;
+  uint64_t now = get_monotonic_msec();
+  out_int(buf, deadline > now ? (int64_t)(deadline - now) : 0);
 }
 
-void fd_set_nb(int fd)
+// persist key => 1 if a TTL was removed
+static void do_persist(std::vector<std::string_view> &cmd, Buffer &buf)
 {
-  errno = 0;
-  int flags = fcntl(fd, F_GETFL, 0);
-  if (errno)
+  LookupKey key;
+  lookup_key_init(&key, cmd[1]);
+  Entry *ent = db_lookup(&key);
+  bool had_ttl = ent && ent->heap_idx != k_heap_none;
+  if (had_ttl)
   {
-    die("fcntl error");
-    return;
+    entry_set_ttl(ent, -1);
   }
+  out_int(buf, had_ttl ? 1 : 0);
+}
 
-  // set the nonblocking flag
-  flags |= O_NONBLOCK;
-  errno = 0;
-  (void)fcntl(fd, F_SETFL, flags);
-  if (errno)
+// Looks up the key of a command on values of `type`. Returns false, with
+// the error written, if it holds another type; *ent is nullptr if there is
+// no such key.
+static bool db_lookup_obj(std::string_view name, uint8_t type, Buffer &buf,
+                          Entry **ent)
+{
+  static const char *const k_type_errs[] = {
+      "expect string.", // ENT_STR
+      "expect zset.",   // ENT_ZSET
+      "expect list.",   // ENT_LIST
+      "expect hash.",   // ENT_HASH
+      "expect set.",    // ENT_SET
+  };
+  LookupKey key;
+  lookup_key_init(&key, name);
+  *ent = db_lookup(&key);
+  if (*ent && (*ent)->type != type)
+  {
+    out_err(buf, ERR_BAD_TYP, k_type_errs[type]);
+    return false;
+  }
+  return true;
+}
+
+// a new key holding `obj`; the caller accounts for its memory
+static Entry *db_obj_new(std::string_view name, uint8_t type, void *obj)
+{
+  LookupKey key;
+  lookup_key_init(&key, name);
+  Entry *ent = entry_new(name, key.node.hcode, "");
+  entry_set_obj(ent, type, obj);
+  evict_init(ent, g_opts.evict_policy, g_data.now_ms);
+  hm_insert(&g_data.db, &ent->node);
+  return ent;
+}
+
+// Clamps an inclusive range of positions, negative ones counted from the
+// end, to 0..size-1. False if nothing is left of it.
+static bool range_clamp(int64_t size, int64_t &start, int64_t &stop)
+{
+  if (start < 0)
+  {
+    start = std::max<int64_t>(start + size, 0);
+  }
+  if (stop < 0)
+  {
+    stop += size;
+  }
+  stop = std::min(stop, size - 1);
+  return start <= stop;
+}
+
+// Counters: strings kept as integers, see entry.hpp
+
+// a new key holding an empty string; the caller accounts for its memory
+static Entry *db_str_new(std::string_view name)
+{
+  LookupKey key;
+  lookup_key_init(&key, name);
+  Entry *ent = entry_new(name, key.node.hcode, "");
+  evict_init(ent, g_opts.evict_policy, g_data.now_ms);
+  hm_insert(&g_data.db, &ent->node);
+  return ent;
+}
+
+// Adds delta to the integer in a string key, a missing key counting as 0,
+// and replies with the result. The key keeps its TTL.
+static void incr_by(std::string_view name, int64_t delta, Buffer &buf)
+{
+  Entry *ent = nullptr;
+  if (!db_lookup_obj(name, ENT_STR, buf, &ent))
+  {
+    return;
+  }
+  int64_t val = 0;
+  if (ent && (ent->flags & ENT_VAL_INT))
+  {
+    val = entry_int(ent);
+  }
+  else if (ent && !parse_int_val(entry_val(ent), val))
+  {
+    return out_err(buf, ERR_BAD_ARG, "value is not an int64.");
+  }
+  if (__builtin_add_overflow(val, delta, &val))
+  {
+    return out_err(buf, ERR_BAD_ARG, "increment would overflow.");
+  }
+  if (!ent)
+  {
+    ent = db_str_new(name);
+  }
+  else
+  {
+    g_data.entry_bytes -= db_entry_mem(ent);
+  }
+  entry_set_int(ent, val);
+  g_data.entry_bytes += db_entry_mem(ent);
+  out_int(buf, val);
+}
+
+// incr key => the new value
+static void do_incr(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  incr_by(cmd[1], 1, buf);
+}
+
+// decr key => the new value
+static void do_decr(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  incr_by(cmd[1], -1, buf);
+}
+
+// incrby key delta => the new value
+static void do_incrby(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  int64_t delta = 0;
+  if (!parse_i64(cmd[2], delta))
+  {
+    return out_err(buf, ERR_BAD_ARG, "expect int64.");
+  }
+  incr_by(cmd[1], delta, buf);
+}
+
+// incrbyfloat key delta => the new value, which is stored in fixed notation
+// with the fewest digits that read back as the same double (an integer one
+// as an integer)
+static void do_incrbyfloat(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  double delta = 0;
+  if (!parse_dbl(cmd[2], delta))
+  {
+    return out_err(buf, ERR_BAD_ARG, "expect float.");
+  }
+  Entry *ent = nullptr;
+  if (!db_lookup_obj(cmd[1], ENT_STR, buf, &ent))
+  {
+    return;
+  }
+  double val = 0;
+  if (ent && (ent->flags & ENT_VAL_INT))
+  {
+    val = (double)entry_int(ent);
+  }
+  else if (ent && !parse_dbl(entry_val(ent), val))
+  {
+    return out_err(buf, ERR_BAD_ARG, "value is not a number.");
+  }
+  val += delta;
+  if (!std::isfinite(val))
+  {
+    return out_err(buf, ERR_BAD_ARG, "increment would produce NaN or infinity.");
+  }
+  // Fixed notation, as few digits as read back the same double: "0.3",
+  // "100000000000000000000", never an exponent. The longest is a
+  // subnormal, 0. and 323 zeros before its digit.
+  char tmp[340];
+  char *end = std::to_chars(tmp, tmp + sizeof(tmp), val, std::chars_format::fixed).ptr;
+  std::string_view str(tmp, end - tmp);
+  if (!ent)
+  {
+    ent = db_str_new(cmd[1]);
+  }
+  else
+  {
+    g_data.entry_bytes -= db_entry_mem(ent);
+  }
+  int64_t ival = 0;
+  if (parse_int_val(str, ival))
+  {
+    entry_set_int(ent, ival);
+  }
+  else
+  {
+    entry_set_val(ent, str);
+  }
+  g_data.entry_bytes += db_entry_mem(ent);
+  out_dbl(buf, val);
+}
+
+// Sorted sets, see zset.hpp
+
+// *zset is nullptr if there is no such key
+static bool zset_lookup(std::string_view name, Buffer &buf, Entry **ent, ZSet **zset)
+{
+  *zset = nullptr;
+  if (!db_lookup_obj(name, ENT_ZSET, buf, ent))
+  {
+    return false;
+  }
+  if (*ent)
+  {
+    *zset = (ZSet *)entry_obj(*ent);
+  }
+  return true;
+}
+
+// zadd key score member [score member ...] => members added, not counting
+// the ones that only got a new score
+static void do_zadd(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  if (cmd.size() % 2 != 0)
+  {
+    return out_err(buf, ERR_BAD_ARG, "syntax error.");
+  }
+  double score = 0;
+  for (size_t i = 2; i < cmd.size(); i += 2)
+  {
+    if (!parse_dbl(cmd[i], score))
+    {
+      return out_err(buf, ERR_BAD_ARG, "expect float.");
+    }
+  }
+  Entry *ent = nullptr;
+  ZSet *zset = nullptr;
+  if (!zset_lookup(cmd[1], buf, &ent, &zset))
+  {
+    return;
+  }
+  if (!ent)
+  {
+    zset = new ZSet();
+    ent = db_obj_new(cmd[1], ENT_ZSET, zset);
+  }
+  else
+  {
+    g_data.entry_bytes -= db_entry_mem(ent);
+  }
+  int64_t added = 0;
+  for (size_t i = 2; i < cmd.size(); i += 2)
+  {
+    parse_dbl(cmd[i], score);
+    added += zset_add(zset, cmd[i + 1], score) ? 1 : 0;
+  }
+  g_data.entry_bytes += db_entry_mem(ent);
+  out_int(buf, added);
+}
+
+// zrem key member [member ...] => members removed; an empty zset is deleted
+static void do_zrem(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  Entry *ent = nullptr;
+  ZSet *zset = nullptr;
+  if (!zset_lookup(cmd[1], buf, &ent, &zset))
+  {
+    return;
+  }
+  if (!zset)
+  {
+    return out_int(buf, 0);
+  }
+  g_data.entry_bytes -= db_entry_mem(ent);
+  int64_t removed = 0;
+  for (size_t i = 2; i < cmd.size(); ++i)
+  {
+    removed += zset_rem(zset, cmd[i]) ? 1 : 0;
+  }
+  g_data.entry_bytes += db_entry_mem(ent);
+  if (zset->size == 0)
+  {
+    hm_delete(&g_data.db, &ent->node, hnode_same);
+    db_entry_del(ent);
+  }
+  out_int(buf, removed);
+}
+
+// zscore key member => the score, nil if there is no such member
+static void do_zscore(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  Entry *ent = nullptr;
+  ZSet *zset = nullptr;
+  if (!zset_lookup(cmd[1], buf, &ent, &zset))
+  {
+    return;
+  }
+  double score = 0;
+  if (!zset || !zset_score(zset, cmd[2], &score))
+  {
+    return out_nil(buf);
+  }
+  out_dbl(buf, score);
+}
+
+// zrank key member => 0-based position by (score, member), nil if there is
+// no such member. O(log n).
+static void do_zrank(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  Entry *ent = nullptr;
+  ZSet *zset = nullptr;
+  if (!zset_lookup(cmd[1], buf, &ent, &zset))
+  {
+    return;
+  }
+  size_t rank = 0;
+  if (!zset || !zset_rank(zset, cmd[2], &rank))
+  {
+    return out_nil(buf);
+  }
+  out_int(buf, (int64_t)rank);
+}
+
+// zcard key => members, 0 if there is no such key
+static void do_zcard(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  Entry *ent = nullptr;
+  ZSet *zset = nullptr;
+  if (!zset_lookup(cmd[1], buf, &ent, &zset))
+  {
+    return;
+  }
+  out_int(buf, zset ? (int64_t)zset->size : 0);
+}
+
+// the members from `rank` on, as [member, score, ...] pairs or only the
+// members; at most `limit`, and none whose score is above `max`
+static void out_zrange(Buffer &buf, ZSet *zset, size_t rank, size_t limit,
+                       double max, bool with_scores)
+{
+  size_t pos = out_begin_arr(buf);
+  uint32_t n = 0;
+  ZIter it;
+  zset_iter_init(&it, zset, rank);
+  std::string_view name;
+  double score = 0;
+  for (size_t i = 0; i < limit && zset_iter_get(&it, &name, &score) && score <= max;
+       ++i, zset_iter_next(&it))
+  {
+    out_str(buf, name.data(), name.size());
+    n++;
+    if (with_scores)
+    {
+      out_dbl(buf, score);
+      n++;
+    }
+  }
+  out_end_arr(buf, pos, n);
+}
+
+// zrange key start stop [withscores] => the members ranked start..stop,
+// inclusive, counted from the end when negative
+static void do_zrange(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  int64_t start = 0, stop = 0;
+  if (!parse_i64(cmd[2], start) || !parse_i64(cmd[3], stop))
+  {
+    return out_err(buf, ERR_BAD_ARG, "expect int64.");
+  }
+  bool with_scores = cmd.size() == 5 && cmd[4] == "withscores";
+  if (cmd.size() > 4 && !with_scores)
+  {
+    return out_err(buf, ERR_BAD_ARG, "syntax error.");
+  }
+  Entry *ent = nullptr;
+  ZSet *zset = nullptr;
+  if (!zset_lookup(cmd[1], buf, &ent, &zset))
+  {
+    return;
+  }
+  if (!zset || !range_clamp((int64_t)zset->size, start, stop))
+  {
+    return out_arr(buf, 0);
+  }
+  out_zrange(buf, zset, (size_t)start, (size_t)(stop - start + 1), INFINITY,
+             with_scores);
+}
+
+// zrangebyscore key min max [withscores] [limit offset count] => the
+// members with min <= score <= max in order; -inf and +inf work as bounds
+static void do_zrangebyscore(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  double min = 0, max = 0;
+  if (!parse_dbl(cmd[2], min) || !parse_dbl(cmd[3], max))
+  {
+    return out_err(buf, ERR_BAD_ARG, "expect float.");
+  }
+  bool with_scores = false;
+  int64_t offset = 0, count = -1;
+  for (size_t i = 4; i < cmd.size(); ++i)
+  {
+    if (cmd[i] == "withscores")
+    {
+      with_scores = true;
+    }
+    else if (cmd[i] == "limit" && i + 2 < cmd.size())
+    {
+      if (!parse_i64(cmd[i + 1], offset) || !parse_i64(cmd[i + 2], count) ||
+          offset < 0)
+      {
+        return out_err(buf, ERR_BAD_ARG, "expect int64.");
+      }
+      i += 2;
+    }
+    else
+    {
+      return out_err(buf, ERR_BAD_ARG, "syntax error.");
+    }
+  }
+  Entry *ent = nullptr;
+  ZSet *zset = nullptr;
+  if (!zset_lookup(cmd[1], buf, &ent, &zset))
+  {
+    return;
+  }
+  if (!zset)
+  {
+    return out_arr(buf, 0);
+  }
+  // "" sorts before any member with the same score
+  size_t rank = zset_seekge(zset, min, "") + (size_t)offset;
+  out_zrange(buf, zset, rank, count < 0 ? SIZE_MAX : (size_t)count, max,
+             with_scores);
+}
+
+// zquery key score member offset limit => up to `limit` [member, score]
+// pairs, starting `offset` positions (negative: before) from the first one
+// >= (score, member). Paging through a leaderboard costs O(log n) per page.
+static void do_zquery(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  double score = 0;
+  if (!parse_dbl(cmd[2], score))
+  {
+    return out_err(buf, ERR_BAD_ARG, "expect float.");
+  }
+  int64_t offset = 0, limit = 0;
+  if (!parse_i64(cmd[4], offset) || !parse_i64(cmd[5], limit))
+  {
+    return out_err(buf, ERR_BAD_ARG, "expect int64.");
+  }
+  Entry *ent = nullptr;
+  ZSet *zset = nullptr;
+  if (!zset_lookup(cmd[1], buf, &ent, &zset))
+  {
+    return;
+  }
+  if (!zset || limit <= 0)
+  {
+    return out_arr(buf, 0);
+  }
+  int64_t rank = (int64_t)zset_seekge(zset, score, cmd[3]) + offset;
+  if (rank < 0)
+  {
+    return out_arr(buf, 0);
+  }
+  out_zrange(buf, zset, (size_t)rank, (size_t)limit, INFINITY, true);
+}
+
+// Lists, see qlist.hpp
+
+// *list is nullptr if there is no such key
+static bool list_lookup(std::string_view name, Buffer &buf, Entry **ent, QList **list)
+{
+  *list = nullptr;
+  if (!db_lookup_obj(name, ENT_LIST, buf, ent))
+  {
+    return false;
+  }
+  if (*ent)
+  {
+    *list = (QList *)entry_obj(*ent);
+  }
+  return true;
+}
+
+// lpush/rpush key value [value ...] => the length after the push; the values
+// go in one at a time, so lpush leaves them in reverse order
+static void list_push(std::vector<std::string_view> &cmd, Buffer &buf, bool front)
+{
+  Entry *ent = nullptr;
+  QList *list = nullptr;
+  if (!list_lookup(cmd[1], buf, &ent, &list))
+  {
+    return;
+  }
+  if (!ent)
+  {
+    list = new QList();
+    ent = db_obj_new(cmd[1], ENT_LIST, list);
+  }
+  else
+  {
+    g_data.entry_bytes -= db_entry_mem(ent);
+  }
+  for (size_t i = 2; i < cmd.size(); ++i)
+  {
+    qlist_push(list, front, cmd[i]);
+  }
+  g_data.entry_bytes += db_entry_mem(ent);
+  out_int(buf, (int64_t)list->size);
+}
+
+static void do_lpush(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  list_push(cmd, buf, true);
+}
+
+static void do_rpush(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  list_push(cmd, buf, false);
+}
+
+// lpop/rpop key => the element, nil if there is no such key; an empty list
+// is deleted
+static void list_pop(std::vector<std::string_view> &cmd, Buffer &buf, bool front)
+{
+  Entry *ent = nullptr;
+  QList *list = nullptr;
+  if (!list_lookup(cmd[1], buf, &ent, &list))
+  {
+    return;
+  }
+  if (!list)
+  {
+    return out_nil(buf);
+  }
+  std::string_view val = qlist_peek(list, front);
+  out_str(buf, val.data(), val.size());
+  g_data.entry_bytes -= db_entry_mem(ent);
+  qlist_pop(list, front);
+  g_data.entry_bytes += db_entry_mem(ent);
+  if (list->size == 0)
+  {
+    hm_delete(&g_data.db, &ent->node, hnode_same);
+    db_entry_del(ent);
+  }
+}
+
+static void do_lpop(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  list_pop(cmd, buf, true);
+}
+
+static void do_rpop(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  list_pop(cmd, buf, false);
+}
+
+// llen key => elements, 0 if there is no such key
+static void do_llen(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  Entry *ent = nullptr;
+  QList *list = nullptr;
+  if (!list_lookup(cmd[1], buf, &ent, &list))
+  {
+    return;
+  }
+  out_int(buf, list ? (int64_t)list->size : 0);
+}
+
+// lindex key index => the element, counted from the end when negative; nil
+// if there is none
+static void do_lindex(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  int64_t index = 0;
+  if (!parse_i64(cmd[2], index))
+  {
+    return out_err(buf, ERR_BAD_ARG, "expect int64.");
+  }
+  Entry *ent = nullptr;
+  QList *list = nullptr;
+  if (!list_lookup(cmd[1], buf, &ent, &list))
+  {
+    return;
+  }
+  if (!list)
+  {
+    return out_nil(buf);
+  }
+  if (index < 0)
+  {
+    index += (int64_t)list->size;
+  }
+  QIter it;
+  qlist_iter_init(&it, list, index < 0 ? SIZE_MAX : (size_t)index);
+  std::string_view val;
+  if (!qlist_iter_get(&it, &val))
+  {
+    return out_nil(buf);
+  }
+  out_str(buf, val.data(), val.size());
+}
+
+// lrange key start stop => the elements start..stop, inclusive, counted from
+// the end when negative
+static void do_lrange(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  int64_t start = 0, stop = 0;
+  if (!parse_i64(cmd[2], start) || !parse_i64(cmd[3], stop))
+  {
+    return out_err(buf, ERR_BAD_ARG, "expect int64.");
+  }
+  Entry *ent = nullptr;
+  QList *list = nullptr;
+  if (!list_lookup(cmd[1], buf, &ent, &list))
+  {
+    return;
+  }
+  if (!list || !range_clamp((int64_t)list->size, start, stop))
+  {
+    return out_arr(buf, 0);
+  }
+  out_arr(buf, (uint32_t)(stop - start + 1));
+  QIter it;
+  qlist_iter_init(&it, list, (size_t)start);
+  std::string_view val;
+  for (int64_t i = start; i <= stop && qlist_iter_get(&it, &val);
+       ++i, qlist_iter_next(&it))
+  {
+    out_str(buf, val.data(), val.size());
+  }
+}
+
+// ltrim key start stop => nil; keeps only the elements start..stop, counted
+// like lrange. Nothing left deletes the key.
+static void do_ltrim(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  int64_t start = 0, stop = 0;
+  if (!parse_i64(cmd[2], start) || !parse_i64(cmd[3], stop))
+  {
+    return out_err(buf, ERR_BAD_ARG, "expect int64.");
+  }
+  Entry *ent = nullptr;
+  QList *list = nullptr;
+  if (!list_lookup(cmd[1], buf, &ent, &list))
+  {
+    return;
+  }
+  if (!list)
+  {
+    return out_nil(buf);
+  }
+  int64_t size = (int64_t)list->size;
+  g_data.entry_bytes -= db_entry_mem(ent);
+  if (range_clamp(size, start, stop))
+  {
+    qlist_trim(list, true, (size_t)start);
+    qlist_trim(list, false, (size_t)(size - 1 - stop));
+  }
+  else
+  {
+    qlist_trim(list, true, (size_t)size);
+  }
+  g_data.entry_bytes += db_entry_mem(ent);
+  if (list->size == 0)
+  {
+    hm_delete(&g_data.db, &ent->node, hnode_same);
+    db_entry_del(ent);
+  }
+  out_nil(buf);
+}
+
+// Hashes, see fmap.hpp
+
+// *fmap is nullptr if there is no such key
+static bool hash_lookup(std::string_view name, Buffer &buf, Entry **ent, FMap **fmap)
+{
+  *fmap = nullptr;
+  if (!db_lookup_obj(name, ENT_HASH, buf, ent))
+  {
+    return false;
+  }
+  if (*ent)
+  {
+    *fmap = (FMap *)entry_obj(*ent);
+  }
+  return true;
+}
+
+// Looks up the hash of a write command, and creates it if there is no such
+// key. Its memory is taken out of entry_bytes until hash_write_end().
+static bool hash_write_begin(std::string_view name, Buffer &buf, Entry **ent, FMap **fmap)
+{
+  if (!hash_lookup(name, buf, ent, fmap))
+  {
+    return false;
+  }
+  if (!*ent)
+  {
+    *fmap = new FMap();
+    *ent = db_obj_new(name, ENT_HASH, *fmap);
+  }
+  else
+  {
+    g_data.entry_bytes -= db_entry_mem(*ent);
+  }
+  return true;
+}
+
+// accounts for the memory again; an empty hash is deleted
+static void hash_write_end(Entry *ent, FMap *fmap)
+{
+  g_data.entry_bytes += db_entry_mem(ent);
+  if (fmap->size == 0)
+  {
+    hm_delete(&g_data.db, &ent->node, hnode_same);
+    db_entry_del(ent);
+  }
+}
+
+// hset key field value [field value ...] => fields added, not counting the
+// ones that only got a new value
+static void do_hset(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  if (cmd.size() % 2 != 0)
+  {
+    return out_err(buf, ERR_BAD_ARG, "syntax error.");
+  }
+  Entry *ent = nullptr;
+  FMap *fmap = nullptr;
+  if (!hash_write_begin(cmd[1], buf, &ent, &fmap))
+  {
+    return;
+  }
+  int64_t added = 0;
+  for (size_t i = 2; i < cmd.size(); i += 2)
+  {
+    added += fmap_set(fmap, cmd[i], cmd[i + 1]) ? 1 : 0;
+  }
+  hash_write_end(ent, fmap);
+  out_int(buf, added);
+}
+
+// hget key field => the value, nil if there is no such field
+static void do_hget(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  Entry *ent = nullptr;
+  FMap *fmap = nullptr;
+  if (!hash_lookup(cmd[1], buf, &ent, &fmap))
+  {
+    return;
+  }
+  std::string_view val;
+  if (!fmap || !fmap_get(fmap, cmd[2], &val))
+  {
+    return out_nil(buf);
+  }
+  out_str(buf, val.data(), val.size());
+}
+
+// hdel key field [field ...] => fields removed; an empty hash is deleted
+static void do_hdel(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  Entry *ent = nullptr;
+  FMap *fmap = nullptr;
+  if (!hash_lookup(cmd[1], buf, &ent, &fmap))
+  {
+    return;
+  }
+  if (!fmap)
+  {
+    return out_int(buf, 0);
+  }
+  g_data.entry_bytes -= db_entry_mem(ent);
+  int64_t removed = 0;
+  for (size_t i = 2; i < cmd.size(); ++i)
+  {
+    removed += fmap_del(fmap, cmd[i]) ? 1 : 0;
+  }
+  hash_write_end(ent, fmap);
+  out_int(buf, removed);
+}
+
+// hlen key => fields, 0 if there is no such key
+static void do_hlen(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  Entry *ent = nullptr;
+  FMap *fmap = nullptr;
+  if (!hash_lookup(cmd[1], buf, &ent, &fmap))
+  {
+    return;
+  }
+  out_int(buf, fmap ? (int64_t)fmap->size : 0);
+}
+
+static void out_field(std::string_view field, std::string_view val, void *arg)
+{
+  Buffer &buf = *(Buffer *)arg;
+  out_str(buf, field.data(), field.size());
+  out_str(buf, val.data(), val.size());
+}
+
+// hgetall key => [field, value, ...], in no particular order
+static void do_hgetall(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  Entry *ent = nullptr;
+  FMap *fmap = nullptr;
+  if (!hash_lookup(cmd[1], buf, &ent, &fmap))
+  {
+    return;
+  }
+  if (!fmap)
+  {
+    return out_arr(buf, 0);
+  }
+  out_arr(buf, (uint32_t)(fmap->size * 2));
+  fmap_foreach(fmap, out_field, &buf);
+}
+
+// hmget key field [field ...] => the values, nil for a missing field
+static void do_hmget(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  Entry *ent = nullptr;
+  FMap *fmap = nullptr;
+  if (!hash_lookup(cmd[1], buf, &ent, &fmap))
+  {
+    return;
+  }
+  out_arr(buf, (uint32_t)(cmd.size() - 2));
+  for (size_t i = 2; i < cmd.size(); ++i)
+  {
+    std::string_view val;
+    if (fmap && fmap_get(fmap, cmd[i], &val))
+    {
+      out_str(buf, val.data(), val.size());
+    }
+    else
+    {
+      out_nil(buf);
+    }
+  }
+}
+
+// hincrby key field delta => the new value; a missing field counts as 0
+static void do_hincrby(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  int64_t delta = 0;
+  if (!parse_i64(cmd[3], delta))
+  {
+    return out_err(buf, ERR_BAD_ARG, "expect int64.");
+  }
+  Entry *ent = nullptr;
+  FMap *fmap = nullptr;
+  if (!hash_write_begin(cmd[1], buf, &ent, &fmap))
+  {
+    return;
+  }
+  // A new field reads as 0, so only an existing one can fail, and then
+  // nothing has changed.
+  FSlot slot;
+  std::string_view old;
+  bool added = fmap_find_or_add(fmap, cmd[2], &slot, &old);
+  int64_t val = 0;
+  if (!added && !parse_int_val(old, val))
+  {
+    hash_write_end(ent, fmap);
+    return out_err(buf, ERR_BAD_ARG, "value is not an int64.");
+  }
+  if (__builtin_add_overflow(val, delta, &val))
+  {
+    hash_write_end(ent, fmap);
+    return out_err(buf, ERR_BAD_ARG, "increment would overflow.");
+  }
+  char tmp[32];
+  char *end = std::to_chars(tmp, tmp + sizeof(tmp), val).ptr;
+  fmap_slot_set(fmap, &slot, std::string_view(tmp, end - tmp));
+  hash_write_end(ent, fmap);
+  out_int(buf, val);
+}
+
+// Sets, see mset.hpp
+
+// *set is nullptr if there is no such key
+static bool set_lookup(std::string_view name, Buffer &buf, Entry **ent, MSet **set)
+{
+  *set = nullptr;
+  if (!db_lookup_obj(name, ENT_SET, buf, ent))
+  {
+    return false;
+  }
+  if (*ent)
+  {
+    *set = (MSet *)entry_obj(*ent);
+  }
+  return true;
+}
+
+// the sets of keys cmd[first, last), nullptr for a missing key; false, with
+// the error written, if one holds another type
+static bool set_lookup_many(std::vector<std::string_view> &cmd, size_t first, size_t last,
+                            Buffer &buf, std::vector<MSet *> &sets)
+{
+  for (size_t i = first; i < last; ++i)
+  {
+    Entry *ent = nullptr;
+    MSet *set = nullptr;
+    if (!set_lookup(cmd[i], buf, &ent, &set))
+    {
+      return false;
+    }
+    sets.push_back(set);
+  }
+  return true;
+}
+
+// sadd key member [member ...] => members added
+static void do_sadd(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  Entry *ent = nullptr;
+  MSet *set = nullptr;
+  if (!set_lookup(cmd[1], buf, &ent, &set))
+  {
+    return;
+  }
+  if (!ent)
+  {
+    set = new MSet();
+    ent = db_obj_new(cmd[1], ENT_SET, set);
+  }
+  else
+  {
+    g_data.entry_bytes -= db_entry_mem(ent);
+  }
+  size_t added = mset_add_many(set, cmd.data() + 2, cmd.size() - 2);
+  g_data.entry_bytes += db_entry_mem(ent);
+  out_int(buf, (int64_t)added);
+}
+
+// srem key member [member ...] => members removed; an empty set is deleted
+static void do_srem(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  Entry *ent = nullptr;
+  MSet *set = nullptr;
+  if (!set_lookup(cmd[1], buf, &ent, &set))
+  {
+    return;
+  }
+  if (!set)
+  {
+    return out_int(buf, 0);
+  }
+  g_data.entry_bytes -= db_entry_mem(ent);
+  int64_t removed = 0;
+  for (size_t i = 2; i < cmd.size(); ++i)
+  {
+    removed += mset_rem(set, cmd[i]) ? 1 : 0;
+  }
+  g_data.entry_bytes += db_entry_mem(ent);
+  if (set->size == 0)
+  {
+    hm_delete(&g_data.db, &ent->node, hnode_same);
+    db_entry_del(ent);
+  }
+  out_int(buf, removed);
+}
+
+// sismember key member => 1 or 0
+static void do_sismember(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  Entry *ent = nullptr;
+  MSet *set = nullptr;
+  if (!set_lookup(cmd[1], buf, &ent, &set))
+  {
+    return;
+  }
+  out_int(buf, set && mset_has(set, cmd[2]) ? 1 : 0);
+}
+
+// scard key => members, 0 if there is no such key
+static void do_scard(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  Entry *ent = nullptr;
+  MSet *set = nullptr;
+  if (!set_lookup(cmd[1], buf, &ent, &set))
+  {
+    return;
+  }
+  out_int(buf, set ? (int64_t)set->size : 0);
+}
+
+static void out_member(std::string_view member, void *arg)
+{
+  Buffer &buf = *(Buffer *)arg;
+  out_str(buf, member.data(), member.size());
+}
+
+// sinter key [key ...] => the members in all of the sets; a missing key is
+// an empty set
+static void do_sinter(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  std::vector<MSet *> sets;
+  if (!set_lookup_many(cmd, 1, cmd.size(), buf, sets))
+  {
+    return;
+  }
+  if (std::count(sets.begin(), sets.end(), nullptr) > 0)
+  {
+    return out_arr(buf, 0);
+  }
+  size_t pos = out_begin_arr(buf);
+  size_t n = mset_inter(sets.data(), sets.size(), 0, out_member, &buf);
+  out_end_arr(buf, pos, (uint32_t)n);
+}
+
+// sunion key [key ...] => the members in any of the sets
+static void do_sunion(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  std::vector<MSet *> sets;
+  if (!set_lookup_many(cmd, 1, cmd.size(), buf, sets))
+  {
+    return;
+  }
+  MSet all;
+  mset_union(sets.data(), sets.size(), &all);
+  out_arr(buf, (uint32_t)all.size);
+  mset_foreach(&all, out_member, &buf);
+  mset_clear(&all);
+}
+
+// sdiff key [key ...] => the members of the first set in none of the others
+static void do_sdiff(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  std::vector<MSet *> sets;
+  if (!set_lookup_many(cmd, 1, cmd.size(), buf, sets))
+  {
+    return;
+  }
+  size_t pos = out_begin_arr(buf);
+  size_t n = mset_diff(sets.data(), sets.size(), out_member, &buf);
+  out_end_arr(buf, pos, (uint32_t)n);
+}
+
+static void count_member(std::string_view, void *arg)
+{
+  (*(size_t *)arg)++;
+}
+
+// sintercard numkeys key [key ...] [limit n] => the size of the
+// intersection, at most n unless n is 0
+static void do_sintercard(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  int64_t nkeys = 0;
+  if (!parse_i64(cmd[1], nkeys) || nkeys <= 0 || (size_t)nkeys > cmd.size() - 2)
+  {
+    return out_err(buf, ERR_BAD_ARG, "expect a key count.");
+  }
+  size_t end = 2 + (size_t)nkeys;
+  int64_t limit = 0;
+  if (end != cmd.size() &&
+      (end + 2 != cmd.size() || cmd[end] != "limit" || !parse_i64(cmd[end + 1], limit) ||
+       limit < 0))
+  {
+    return out_err(buf, ERR_BAD_ARG, "syntax error.");
+  }
+  // the key positions depend on numkeys, so the command table only knows
+  // the first one
+  if (g_opts.reactors > 1 && !keys_one_shard(cmd, 2, end - 1, 1))
+  {
+    return out_err(buf, ERR_BAD_ARG, "keys in different shards.");
+  }
+  std::vector<MSet *> sets;
+  if (!set_lookup_many(cmd, 2, end, buf, sets))
+  {
+    return;
+  }
+  // the intersection stops at the limit instead of being counted in full
+  size_t n = 0;
+  if (std::count(sets.begin(), sets.end(), nullptr) == 0)
+  {
+    mset_inter(sets.data(), sets.size(), (size_t)limit, count_member, &n);
+  }
+  out_int(buf, (int64_t)n);
+}
+
+struct KeysCtx {
+    Buffer *out = nullptr;
+    uint32_t n = 0;
+};
+
+static bool cb_keys(HNode *node, void *arg) {
+    KeysCtx &ctx = *(KeysCtx *)arg;
+    Entry *ent = container_of(node, Entry, node);
+    if (!entry_expired(ent)) {
+        std::string_view key = entry_key(ent);
+        out_str(*ctx.out, key.data(), key.size());
+        ctx.n++;
+    }
+    return true;
+}
+
+static void do_keys(std::vector<std::string_view> &, Buffer &buf) {
+    KeysCtx ctx;
+    ctx.out = &buf;
+    size_t pos = out_begin_arr(buf);
+    hm_foreach(&g_data.db, &cb_keys, (void *)&ctx);
+    out_end_arr(buf, pos, ctx.n);
+}
+
+// one [...] class of a glob pattern, pat[p] is the '['. Moves p past the ']'.
+static bool glob_match_class(std::string_view pat, size_t &p, char c)
+{
+  p++;
+  bool negate = p < pat.size() && pat[p] == '^';
+  if (negate)
+  {
+    p++;
+  }
+  bool found = false;
+  while (p < pat.size() && pat[p] != ']')
+  {
+    if (pat[p] == '\\' && p + 1 < pat.size())
+    {
+      p++;
+    }
+    char lo = pat[p];
+    char hi = lo;
+    if (p + 2 < pat.size() && pat[p + 1] == '-' && pat[p + 2] != ']')
+    {
+      hi = pat[p + 2];
+      p += 2;
+    }
+    if (lo > hi)
+    {
+      std::swap(lo, hi);
+    }
+    found = found || (lo <= c && c <= hi);
+    p++;
+  }
+  p++; // the ']'
+  return found != negate;
+}
+
+// glob-style matching: * ? [abc] [a-z] [^a], and \ to escape
+static bool glob_match(std::string_view pat, std::string_view str)
+{
+  size_t p = 0, s = 0;
+  size_t star_p = std::string_view::npos, star_s = 0;
+  while (s < str.size())
+  {
+    if (p < pat.size())
+    {
+      if (pat[p] == '*')
+      {
+        star_p = ++p;
+        star_s = s;
+        continue;
+      }
+      size_t next = p + 1;
+      bool ok = true;
+      if (pat[p] == '[')
+      {
+        next = p;
+        ok = glob_match_class(pat, next, str[s]);
+      }
+      else if (pat[p] != '?')
+      {
+        char c = pat[p];
+        if (c == '\\' && p + 1 < pat.size())
+        {
+          c = pat[p + 1];
+          next = p + 2;
+        }
+        ok = c == str[s];
+      }
+      if (ok)
+      {
+        p = next;
+        s++;
+        continue;
+      }
+    }
+    // mismatch: let the last * swallow one more character
+    if (star_p == std::string_view::npos)
+    {
+      return false;
+    }
+    p = star_p;
+    s = ++star_s;
+  }
+  while (p < pat.size() && pat[p] == '*')
+  {
+    p++;
+  }
+  return p == pat.size();
+}
+
+struct ScanCtx
+{
+  std::string_view pattern;
+  bool has_pattern = false;
+  std::vector<std::string_view> keys; // views into the Entries
+};
+
+static void cb_scan(HNode *node, void *arg)
+{
+  ScanCtx &ctx = *(ScanCtx *)arg;
+  Entry *ent = container_of(node, Entry, node);
+  std::string_view key = entry_key(ent);
+  if ((!ctx.has_pattern || glob_match(ctx.pattern, key)) && !entry_expired(ent))
+  {
+    ctx.keys.push_back(key);
+  }
+}
+
+// COUNT is a hint; a bigger one is cut to this, which bounds the buckets a
+// single call visits (10x the count)
+const int64_t k_scan_count_max = 1000;
+
+// scan cursor [match pattern] [count n] => [next cursor, [key...]]
+// Start with cursor "0" and repeat with the returned cursor until it is "0"
+// again. Each call visits buckets until it has `count` keys (default 10), or
+// has visited 10x that many buckets, so it stays short on any keyspace.
+static void do_scan(std::vector<std::string_view> &cmd, Buffer &buf)
+{
+  uint64_t cursor = 0;
+  if (!parse_u64(cmd[1], cursor))
+  {
+    return out_err(buf, ERR_BAD_ARG, "invalid cursor.");
+  }
+  ScanCtx ctx; // per call: with --reactors every reactor runs scans
+  int64_t count = 10;
+  for (size_t i = 2; i < cmd.size(); i += 2)
+  {
+    if (i + 1 == cmd.size())
+    {
+      return out_err(buf, ERR_BAD_ARG, "syntax error.");
+    }
+    if (cmd[i] == "match")
+    {
+      ctx.pattern = cmd[i + 1];
+      ctx.has_pattern = true;
+    }
+    else if (cmd[i] == "count")
+    {
+      if (!parse_i64(cmd[i + 1], count) || count <= 0)
+      {
+        return out_err(buf, ERR_BAD_ARG, "invalid count.");
+      }
+      count = std::min(count, k_scan_count_max);
+    }
+    else
+    {
+      return out_err(buf, ERR_BAD_ARG, "syntax error.");
+    }
+  }
+
+  uint64_t budget = count * 10;
+  do
+  {
+    cursor = hm_scan(&g_data.db, cursor, cb_scan, &ctx);
+  } while (cursor != 0 && ctx.keys.size() < (size_t)count && --budget > 0);
+
+  std::string next = std::to_string(cursor);
+  out_arr(buf, 2);
+  out_str(buf, next.data(), next.size());
+  out_arr(buf, (uint32_t)ctx.keys.size());
+  for (std::string_view key : ctx.keys)
+  {
+    out_str(buf, key.data(), key.size());
+  }
+}
+
+static void info_add(std::string &out, const char *name, uint64_t value)
+{
+  out.append(name);
+  out.push_back(':');
+  out.append(std::to_string(value));
+  out.push_back('\n');
+}
+
+// "name:value" lines, one bulk string
+static void do_info(std::vector<std::string_view> &, Buffer &buf)
+{
+  std::string out;
+  info_add(out, "keys", hm_size(&g_data.db));
+  info_add(out, "expires", g_data.heap.size());
+  info_add(out, "expired_keys", g_data.expired_keys);
+  info_add(out, "idle_closed", g_idle_closed.load());
+  info_add(out, "ref_replies", g_data.ref_replies);
+  info_add(out, "zerocopy_sends", g_zerocopy_sends.load());
+  info_add(out, "zerocopy_copied", g_zerocopy_copied.load());
+  info_add(out, "io_threads", g_opts.io_threads);
+  info_add(out, "reactors", g_opts.reactors);
+  info_add(out, "reactor", g_data.shard);
+  info_add(out, "table_bytes", hm_mem_usage(&g_data.db));
+  info_add(out, "used_memory", db_used_memory());
+  info_add(out, "maxmemory", g_opts.maxmemory);
+  out.append("maxmemory_policy:");
+  out.append(evict_policy_name(g_opts.evict_policy));
+  out.push_back('\n');
+  info_add(out, "evicted_keys", g_data.evicted_keys);
+
+  LazyFreeStats lz;
+  lazyfree_stats(&lz);
+  info_add(out, "lazyfree_pending_bytes", lz.pending_bytes);
+  info_add(out, "lazyfree_queued", lz.queued);
+  info_add(out, "lazy_objs", g_data.lazy_objs.size());
+  info_add(out, "lazy_obj_bytes", g_data.lazy_obj_bytes);
+
+  HMapStats hs;
+  hm_stats(&g_data.db, &hs);
+  info_add(out, "table_slots", hs.slots);
+  info_add(out, "rehashing", hm_rehashing(&g_data.db));
+  info_add(out, "rehash_pending", hs.rehash_pending);
+  info_add(out, "rehash_resizes", hs.resizes);
+  info_add(out, "rehash_shrinks", hs.shrinks);
+  info_add(out, "rehash_migrated", hs.migrated);
+  info_add(out, "rehash_pause_max_us", hs.pause_max_ns / 1000);
+  info_add(out, "rehash_pause_total_us", hs.pause_total_ns / 1000);
+
+  SlabStats st;
+  slab_stats(&st);
+  info_add(out, "slab_arena_bytes", st.arena_bytes);
+  info_add(out, "slab_resident_bytes", st.resident_bytes);
+  info_add(out, "slab_used_bytes", st.used_bytes);
+  info_add(out, "slab_slabs", st.slabs);
+  info_add(out, "slab_free_slabs", st.free_slabs);
+  info_add(out, "slab_objects", st.objects);
+  // resident / used, x1000: 1000 means the slabs are fully packed
+  info_add(out, "slab_fragmentation_permille",
+           st.used_bytes ? st.resident_bytes * 1000 / st.used_bytes : 0);
+  info_add(out, "large_alloc_bytes", st.large_bytes);
+  out_str(buf, out.data(), out.size());
+}
+
+static constexpr Command k_commands[] = {
+    {"get", 2, CMD_READ, 1, 1, 1, do_get},
+    {"set", -3, CMD_WRITE | CMD_DENYOOM, 1, 1, 1, do_set},
+    {"incr", 2, CMD_WRITE | CMD_DENYOOM, 1, 1, 1, do_incr},
+    {"decr", 2, CMD_WRITE | CMD_DENYOOM, 1, 1, 1, do_decr},
+    {"incrby", 3, CMD_WRITE | CMD_DENYOOM, 1, 1, 1, do_incrby},
+    {"incrbyfloat", 3, CMD_WRITE | CMD_DENYOOM, 1, 1, 1, do_incrbyfloat},
+    {"del", 2, CMD_WRITE, 1, 1, 1, do_del},
+    {"unlink", 2, CMD_WRITE, 1, 1, 1, do_unlink},
+    {"pexpire", 3, CMD_WRITE, 1, 1, 1, do_pexpire},
+    {"pttl", 2, CMD_READ, 1, 1, 1, do_pttl},
+    {"persist", 2, CMD_WRITE, 1, 1, 1, do_persist},
+    {"keys", 1, CMD_READ, 0, 0, 0, do_keys},
+    {"scan", -2, CMD_READ, 0, 0, 0, do_scan},
+    {"info", 1, 0, 0, 0, 0, do_info},
+    {"zadd", -4, CMD_WRITE | CMD_DENYOOM, 1, 1, 1, do_zadd},
+    {"zrem", -3, CMD_WRITE, 1, 1, 1, do_zrem},
+    {"zscore", 3, CMD_READ, 1, 1, 1, do_zscore},
+    {"zrank", 3, CMD_READ, 1, 1, 1, do_zrank},
+    {"zcard", 2, CMD_READ, 1, 1, 1, do_zcard},
+    {"zrange", -4, CMD_READ, 1, 1, 1, do_zrange},
+    {"zrangebyscore", -4, CMD_READ, 1, 1, 1, do_zrangebyscore},
+    {"zquery", 6, CMD_READ, 1, 1, 1, do_zquery},
+    {"lpush", -3, CMD_WRITE | CMD_DENYOOM, 1, 1, 1, do_lpush},
+    {"rpush", -3, CMD_WRITE | CMD_DENYOOM, 1, 1, 1, do_rpush},
+    {"lpop", 2, CMD_WRITE, 1, 1, 1, do_lpop},
+    {"rpop", 2, CMD_WRITE, 1, 1, 1, do_rpop},
+    {"llen", 2, CMD_READ, 1, 1, 1, do_llen},
+    {"lindex", 3, CMD_READ, 1, 1, 1, do_lindex},
+    {"lrange", 4, CMD_READ, 1, 1, 1, do_lrange},
+    {"ltrim", 4, CMD_WRITE, 1, 1, 1, do_ltrim},
+    {"hset", -4, CMD_WRITE | CMD_DENYOOM, 1, 1, 1, do_hset},
+    {"hget", 3, CMD_READ, 1, 1, 1, do_hget},
+    {"hdel", -3, CMD_WRITE, 1, 1, 1, do_hdel},
+    {"hlen", 2, CMD_READ, 1, 1, 1, do_hlen},
+    {"hgetall", 2, CMD_READ, 1, 1, 1, do_hgetall},
+    {"hmget", -3, CMD_READ, 1, 1, 1, do_hmget},
+    {"hincrby", 4, CMD_WRITE | CMD_DENYOOM, 1, 1, 1, do_hincrby},
+    {"sadd", -3, CMD_WRITE | CMD_DENYOOM, 1, 1, 1, do_sadd},
+    {"srem", -3, CMD_WRITE, 1, 1, 1, do_srem},
+    {"sismember", 3, CMD_READ, 1, 1, 1, do_sismember},
+    {"scard", 2, CMD_READ, 1, 1, 1, do_scard},
+    {"sinter", -2, CMD_READ, 1, -1, 1, do_sinter},
+    {"sunion", -2, CMD_READ, 1, -1, 1, do_sunion},
+    {"sdiff", -2, CMD_READ, 1, -1, 1, do_sdiff},
+    {"sintercard", -3, CMD_READ, 2, 2, 1, do_sintercard},
+};
+constexpr size_t k_ncommands = sizeof(k_commands) / sizeof(k_commands[0]);
+
+// Open-addressing index over k_commands, built at compile time. A slot holds
+// the command's position + 1, 0 is empty. The table is the smallest power of
+// 2, from 4x the commands up, in which no name is more than k_cmd_max_probe
+// slots from where it hashes, so adding a command never needs a hand-picked
+// size.
+constexpr size_t k_cmd_max_probe = 2;
+
+static constexpr uint32_t cmd_name_hash(std::string_view name)
+{
+  uint32_t h = 0x811C9DC5;
+  for (char c : name)
+  {
+    h = (h ^ (uint8_t)c) * 0x01000193;
+  }
+  return h;
+}
+
+template <size_t Slots>
+struct CmdIndex
+{
+  uint8_t slots[Slots] = {};
+  size_t max_probe = 0;
+};
+
+template <size_t Slots>
+static constexpr CmdIndex<Slots> cmd_index_build()
+{
+  CmdIndex<Slots> idx;
+  for (size_t i = 0; i < k_ncommands; ++i)
+  {
+    size_t pos = cmd_name_hash(k_commands[i].name) & (Slots - 1);
+    size_t probe = 1;
+    while (idx.slots[pos])
+    {
+      pos = (pos + 1) & (Slots - 1);
+      probe++;
+    }
+    idx.slots[pos] = (uint8_t)(i + 1);
+    if (probe > idx.max_probe)
+    {
+      idx.max_probe = probe;
+    }
+  }
+  return idx;
+}
+
+// 0 if no table up to 64K slots will do: two names hash alike
+template <size_t Slots>
+static constexpr size_t cmd_slots_fit()
+{
+  if constexpr (Slots > (1 << 16))
+  {
+    return 0;
+  }
+  else if constexpr (cmd_index_build<Slots>().max_probe <= k_cmd_max_probe)
+  {
+    return Slots;
+  }
+  else
+  {
+    return cmd_slots_fit<Slots * 2>();
+  }
+}
+
+static constexpr size_t pow2_at_least(size_t n)
+{
+  size_t p = 1;
+  while (p < n)
+  {
+    p *= 2;
+  }
+  return p;
+}
+
+constexpr size_t k_cmd_slots = cmd_slots_fit<pow2_at_least(k_ncommands * 4)>();
+static_assert(k_cmd_slots != 0, "two command names have the same hash");
+static constexpr CmdIndex<k_cmd_slots> k_cmd_index = cmd_index_build<k_cmd_slots>();
+static_assert(k_ncommands < 255, "command index is a uint8_t");
+
+// O(1): one hash of the name and at most k_cmd_max_probe compares
+static const Command *cmd_lookup(std::string_view name)
+{
+  size_t pos = cmd_name_hash(name) & (k_cmd_slots - 1);
+  for (size_t i = 0; i < k_cmd_max_probe; ++i)
+  {
+    uint8_t slot = k_cmd_index.slots[pos];
+    if (!slot)
+    {
+      return nullptr;
+    }
+    const Command *c = &k_commands[slot - 1];
+    if (c->name == name)
+    {
+      return c;
+    }
+    pos = (pos + 1) & (k_cmd_slots - 1);
+  }
+  return nullptr;
+}
+
+void fd_set_nb(int fd)
+{
+  errno = 0;
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (errno)
+  {
+    die("fcntl error");
+    return;
+  }
+
+  // set the nonblocking flag
+  flags |= O_NONBLOCK;
+  errno = 0;
+  (void)fcntl(fd, F_SETFL, flags);
+  if (errno)
+  {
+    die("fcntl error");
+  }
+}
+
+// a nonblocking listening socket on the wildcard address; reuseport lets
+// several of them share the port
+static int listen_on(uint16_t port, bool reuseport)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+  {
+    die("socket()");
+  }
+  int val = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+  if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val)))
+  {
+    die("setsockopt(SO_REUSEPORT)");
+  }
+
+  // bind
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = ntohs(port);
+  addr.sin_addr.s_addr = ntohl(0); // wildcard address 0.0.0.0
+  int rv = bind(fd, (const sockaddr *)&addr, sizeof(addr));
+  if (rv)
+  {
+    die("bind()");
+  }
+
+  // set the listen fd to nonblocking mode
+  fd_set_nb(fd);
+
+#ifdef SO_ZEROCOPY
+  // accepted sockets inherit it
+  if (g_opts.zerocopy && setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &val, sizeof(val)))
+  {
+    msg_errno("setsockopt(SO_ZEROCOPY), sending without MSG_ZEROCOPY");
+    g_opts.zerocopy = false;
+  }
+#endif
+
+  // listen
+  fprintf(stderr, "trying to listen\n");
+  rv = listen(fd, SOMAXCONN);
+  if (rv)
+  {
+    die("listen()");
+  }
+  return fd;
+}
+
+static Conn *handle_accept(int fd)
+{
+  struct sockaddr_in client_addr = {};
+  socklen_t addrlen = sizeof(client_addr);
+#ifdef __linux__
+  int connfd = accept4(fd, (struct sockaddr *)&client_addr, &addrlen,
+                       SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+  int connfd = accept(fd, (struct sockaddr *)&client_addr, &addrlen);
+#endif
+  if (connfd < 0)
+  {
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+    {
+      msg_errno("accept() error");
+    }
+    return NULL;
+  }
+
+#ifndef __linux__
+  fd_set_nb(connfd);
+#endif
+  Conn *conn = new Conn();
+  conn->fd = connfd;
+  conn->want_to_read = true;
+  return conn;
+}
+
+static bool read_u32(const uint8_t *&cur, const uint8_t *end, uint32_t &out)
+{
+  if (cur + 4 > end)
+  {
+    return -1;
+  }
+
+  memcpy(&out, cur, 4);
+  cur += 4;
+  return 0;
+}
+
+// `out` points into the request, no copy
+static bool read_str(const uint8_t *&cur, const uint8_t *end, size_t n,
+                     std::string_view &out)
+{
+  if (cur + n > end)
+  {
+    return -1;
+  }
+  out = std::string_view((const char *)cur, n);
+  cur += n;
+  return 0;
+}
+
+// the parsed arguments are views into `data` and are only valid until the
+// request is consumed from the connection's incoming buffer
+static int32_t parse_request(const uint8_t *data, size_t size,
+                             std::vector<std::string_view> &out)
+{
+
+  const uint8_t *end = data + size; // advance by size bytes
+
+  uint32_t nstr = 0;
+  int result;
+  if ((result = read_u32(data, end, nstr)) != 0)
+  {
+    return -1;
+  }
+
+  if (nstr > k_max_msg)
+  {
+    return -1;
+  }
+
+  // append until the out is of size nstr
+  // other way of saying, run the while loop for nstr times
+  while (out.size() < nstr)
+  {
+    uint32_t len = 0;
+    if (read_u32(data, end, len))
+    {
+      return -1;
+    }
+    if (len > k_max_msg)
+    {
+      return -1;
+    }
+    out.push_back(std::string_view());
+    int read_str_result = read_str(data, end, len, out.back());
+    if (read_str_result)
+    {
+      return -1;
+    }
+  }
+
+  if (data != end)
+  {
+    return -1;
+  }
+
+  return 0;
+}
+
+// Looks at the request `offset` bytes into the incoming buffer without
+// consuming it. Returns its size including the length prefix, 0 if it is not
+// complete yet, or -1 on a protocol error (and sets want_to_close).
+static int64_t parse_one_request(Conn *conn, size_t offset,
+                                 std::vector<std::string_view> &cmd)
+{
+  size_t avail = conn->incoming.data_size() - offset;
+  if (avail < 4)
+  {
+    return 0; // want to read more
+  }
+
+  uint32_t len = 0;
+  memcpy(&len, conn->incoming.data() + offset, 4);
+  if (len > k_max_msg) // error handling
+  {
+    msg("too long");
+    conn->want_to_close = true;
+    return -1;
+  }
+
+  if (4 + len > avail)
+  {
+    return 0;
+  }
+
+  cmd.clear();
+  if (parse_request(conn->incoming.data() + offset + 4, len, cmd) < 0)
+  {
+    msg("bad request");
+    conn->want_to_close = true;
+    return -1;
+  }
+  return 4 + (int64_t)len;
+}
+
+static void request_prepare(Request &req)
+{
+  req.c = req.cmd.empty() ? nullptr : cmd_lookup(req.cmd[0]);
+  req.has_key = req.c && req.c->first_key > 0 &&
+                (size_t)req.c->first_key < req.cmd.size();
+  if (req.has_key)
+  {
+    std::string_view key = req.cmd[req.c->first_key];
+    req.hcode = str_hash((const uint8_t *)key.data(), key.size());
+  }
+}
+
+// parses up to `max` complete requests from the start of incoming, returns
+// how many and sets `used` to the bytes they take. Touches nothing but the
+// connection, so the I/O threads run it too.
+static size_t parse_requests(Conn *conn, Request *batch, size_t max,
+                             size_t &used)
+{
+  size_t n = 0;
+  used = 0;
+  while (n < max)
+  {
+    int64_t size = parse_one_request(conn, used, batch[n].cmd);
+    if (size <= 0)
+    {
+      break;
+    }
+    request_prepare(batch[n]);
+    used += (size_t)size;
+    n++;
+  }
+  return n;
+}
+
+// Runs one request, its response goes at the end of `out`. The values it
+// references go to `refs`, at `base` plus their offset in `out`.
+static void run_request(Request &req, Buffer &out, std::vector<OutRef> &refs,
+                        uint64_t base)
+{
+  // we dont the size of header, so reserve some space for the response header
+  size_t header_pos = 0;
+  response_begin(out, &header_pos);
+  do_request(req.c, req.cmd, out);
+  response_end(out, header_pos);
+  for (OutRef &ref : g_data.out_refs)
+  {
+    refs.push_back(OutRef{base + ref.pos, ref.val});
+  }
+  g_data.out_refs.clear();
+}
+
+// prefetch the table memory for the keys of a batch, then run it in order;
+// pipelined lookups then wait on memory in parallel instead of one after
+// another
+static void execute_requests(Conn *conn, Request *batch, size_t n)
+{
+  g_data.now_ms = get_monotonic_msec();
+
+  // two passes: the bucket or control group first, then the node it
+  // points to, which by now should be a cache hit to find
+  if (n > 1)
+  {
+    for (size_t i = 0; i < n; ++i)
+    {
+      if (batch[i].has_key)
+      {
+        hm_prefetch(&g_data.db, batch[i].hcode);
+      }
+    }
+    for (size_t i = 0; i < n; ++i)
+    {
+      if (batch[i].has_key)
+      {
+        hm_prefetch_node(&g_data.db, batch[i].hcode);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < n; ++i)
+  {
+    run_request(batch[i], conn->outgoing, conn->out_refs, conn->out_head);
+  }
+}
+
+// Runs every complete request in the incoming buffer, g_opts.batch at a time.
+// The requests of a batch are only consumed after it ran, since their
+// arguments point into the buffer.
+static void process_requests(Conn *conn)
+{
+  // reused across batches so parsing does not allocate
+  static std::vector<Request> batch(k_batch_max);
+  while (!conn->want_to_close)
+  {
+    size_t used = 0;
+    size_t n = parse_requests(conn, batch.data(), g_opts.batch, used);
+    if (n == 0)
+    {
+      return;
+    }
+    execute_requests(conn, batch.data(), n);
+
+    // application logic done! remove the request messages.
+    buf_consume(conn->incoming, used);
+  }
+}
+
+static bool conn_has_output(Conn *conn)
+{
+  return conn->outgoing.data_size() > 0 || !conn->out_refs.empty();
+}
+
+// Gathers what goes out next: the bytes of outgoing up to the first
+// referenced value, the value, and so on. Sets `zc` when the first iovec is
+// a value for MSG_ZEROCOPY: it then goes alone, since the kernel must not
+// be left reading outgoing, which moves as it is consumed.
+static size_t out_iov(Conn *conn, struct iovec *iov, bool *zc)
+{
+  uint8_t *data = conn->outgoing.data();
+  size_t off = 0; // in outgoing
+  size_t n = 0;
+  *zc = false;
+  for (size_t i = 0; i < conn->out_refs.size() && n + 2 <= k_out_max_iov; ++i)
+  {
+    const OutRef &ref = conn->out_refs[i];
+    size_t gap = (size_t)(ref.pos - conn->out_head) - off;
+    size_t sent = i == 0 ? conn->out_ref_sent : 0;
+    size_t left = ref.val->len - sent;
+    bool big = g_opts.zerocopy && left >= k_zerocopy_min;
+    if (gap > 0)
+    {
+      iov[n++] = {data + off, gap};
+      off += gap;
+    }
+    if (big && n > 0)
+    {
+      return n; // the next call sends it
+    }
+    iov[n++] = {ref.val->data + sent, left};
+    if (big)
+    {
+      *zc = true;
+      return n;
+    }
+  }
+  if (off < conn->outgoing.data_size() && n < k_out_max_iov)
+  {
+    iov[n++] = {data + off, conn->outgoing.data_size() - off};
+  }
+  return n;
+}
+
+// drops `n` sent bytes off the front of the stream: bytes of outgoing and
+// referenced values, in order
+static void out_consume(Conn *conn, size_t n)
+{
+  size_t done = 0; // values sent in full
+  while (n > 0 && done < conn->out_refs.size())
+  {
+    OutRef &ref = conn->out_refs[done];
+    size_t k = std::min((size_t)(ref.pos - conn->out_head), n);
+    buf_consume(conn->outgoing, k);
+    conn->out_head += k;
+    n -= k;
+    k = std::min(ref.val->len - conn->out_ref_sent, n);
+    conn->out_ref_sent += k;
+    n -= k;
+    if (conn->out_ref_sent < ref.val->len)
+    {
+      break;
+    }
+    valblock_unref(ref.val);
+    conn->out_ref_sent = 0;
+    done++;
+  }
+  conn->out_refs.erase(conn->out_refs.begin(), conn->out_refs.begin() + done);
+  buf_consume(conn->outgoing, n);
+  conn->out_head += n;
+}
+
+// returns true if some bytes were written, false if the socket would block
+// (or the connection is going away).
+static bool handle_write(Conn *conn)
+{
+  assert(conn_has_output(conn));
+  struct iovec iov[k_out_max_iov];
+  bool zc = false;
+  struct msghdr mh = {};
+  mh.msg_iov = iov;
+  mh.msg_iovlen = out_iov(conn, iov, &zc);
+  int flags = MSG_NOSIGNAL;
+#ifdef __linux__
+  if (zc)
+  {
+    flags |= MSG_ZEROCOPY;
+  }
+#endif
+  ssize_t rv = sendmsg(conn->fd, &mh, flags);
+  if (rv < 0 && errno == ENOBUFS && zc)
+  {
+    // out of option memory for the notifications: copy this one
+    zc = false;
+    rv = sendmsg(conn->fd, &mh, MSG_NOSIGNAL);
+  }
+  if (rv < 0 && (errno == EAGAIN || errno == EINTR))
+  {
+    return false;
+  }
+  if (rv < 0)
+  {
+    msg_errno("write() error");
+    conn->want_to_close = true;
+    return false;
+  }
+  if (zc)
+  {
+    // every MSG_ZEROCOPY send that took some bytes gets the next number
+    ValBlock *val = conn->out_refs[0].val;
+    valblock_ref(val);
+    conn->zc_holds.push_back(ZcHold{conn->zc_seq++, val});
+    g_zerocopy_sends++;
+  }
+  out_consume(conn, (size_t)rv);
+  if (!conn_has_output(conn)) // all data written
+  {
+    conn->want_to_write = false;
+    conn->want_to_read = true;
+  }
+  return true;
+}
+
+#ifdef __linux__
+// --zerocopy: the completions are read from the socket's error queue, each
+// covers a range of sends and releases their values. Also reported as
+// POLLERR / EPOLLERR; returns false if there was nothing but a real error.
+static bool conn_reap_zerocopy(Conn *conn)
+{
+  if (!g_opts.zerocopy || conn->zc_holds.empty())
+  {
+    return false;
+  }
+  bool reaped = false;
+  while (true)
+  {
+    char control[128];
+    struct msghdr mh = {};
+    mh.msg_control = control;
+    mh.msg_controllen = sizeof(control);
+    if (recvmsg(conn->fd, &mh, MSG_ERRQUEUE) < 0)
+    {
+      return reaped; // EAGAIN: the queue is empty
+    }
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+    if (!cm || !((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                 (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+    {
+      return false;
+    }
+    struct sock_extended_err serr;
+    memcpy(&serr, CMSG_DATA(cm), sizeof(serr));
+    if (serr.ee_errno != 0 || serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+    {
+      return false;
+    }
+    // sends ee_info..ee_data are done, in order on TCP
+    if (serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+    {
+      g_zerocopy_copied += serr.ee_data - serr.ee_info + 1;
+    }
+    size_t done = 0;
+    while (done < conn->zc_holds.size() &&
+           (int32_t)(conn->zc_holds[done].seq - serr.ee_data) <= 0)
+    {
+      valblock_unref(conn->zc_holds[done].val);
+      done++;
+    }
+    conn->zc_holds.erase(conn->zc_holds.begin(), conn->zc_holds.begin() + done);
+    reaped = true;
+  }
+}
+
+static_assert(POLLERR == EPOLLERR && POLLHUP == EPOLLHUP, "same bits");
+#endif
+
+// the readiness of a poll or epoll event, less an error flag that only
+// stood for zerocopy completions
+static uint32_t conn_ready_events(Conn *conn, uint32_t ready)
+{
+#ifdef __linux__
+  if ((ready & POLLERR) && !(ready & POLLHUP) && conn_reap_zerocopy(conn))
+  {
+    ready &= ~POLLERR;
+  }
+#else
+  (void)conn;
+#endif
+  return ready;
+}
+
+// one read() into incoming; returns true if some bytes were read, false if
+// the socket would block (or the connection is going away).
+static bool read_incoming(Conn *conn)
+{
+  // read straight into the free tail of the incoming buffer
+  uint8_t *dst = conn->incoming.reserve_tail(k_min_read);
+  if (!dst)
+  {
+    conn->want_to_close = true;
+    return false;
+  }
+  ssize_t rv = read(conn->fd, dst, conn->incoming.tail_space());
+  if (rv < 0 && (errno == EAGAIN || errno == EINTR))
+  {
+    return false;
+  }
+  if (rv < 0) // handle IO error -> err < 0 and err == 0 i.e EOF
+  {
+    msg_errno("handle_read -> read() error");
+    conn->want_to_close = true;
+    return false;
+  }
+  if (rv == 0)
+  {
+    if (conn->incoming.data_size() == 0)
+    {
+      msg("client closed");
+    }
+    else
+    {
+      msg("unexpected EOF");
+    }
+    conn->want_to_close = true;
+    return false; // want close
+  }
+  conn->incoming.commit_tail((size_t)rv);
+  return true;
+}
+
+static bool handle_read(Conn *conn)
+{
+  if (!read_incoming(conn))
+  {
+    return false;
+  }
+
+  // this is critical to the pipelined request handling
+  process_requests(conn);
+
+  if (conn_has_output(conn))
+  {
+    conn->want_to_write = true;
+    conn->want_to_read = false;
+    handle_write(conn);
+  }
+
+  return true;
+}
+
+static void conn_destroy(std::vector<Conn *> &fd2conn, Conn *conn)
+{
+  (void)close(conn->fd);
+  fd2conn[conn->fd] = NULL;
+  delete conn;
+}
+
+static void conn_put(std::vector<Conn *> &fd2conn, Conn *conn)
+{
+  if (fd2conn.size() <= (size_t)conn->fd)
+  {
+    fd2conn.resize(conn->fd + 1);
+  }
+  fd2conn[conn->fd] = conn;
+}
+
+// called on any I/O of the connection: moving it to the tail keeps the idle
+// list sorted by last_active_ms, so the head is always the next to time out.
+static void conn_touch(DList *idle_list, Conn *conn, uint64_t now)
+{
+  if (conn->want_to_close)
+  {
+    return;
+  }
+  conn->last_active_ms = now;
+  dlist_detach(&conn->idle_node);
+  dlist_insert_before(idle_list, &conn->idle_node);
+}
+
+static void conn_touch(Conn *conn, uint64_t now)
+{
+  conn_touch(&g_data.idle_list, conn, now);
+}
+
+static void conn_destroy_cb(Conn *conn, void *arg)
+{
+  conn_destroy(*(std::vector<Conn *> *)arg, conn);
+}
+
+// when the least recently active connection of the list times out,
+// UINT64_MAX for never
+static uint64_t idle_deadline(DList *idle_list)
+{
+  if (!g_opts.idle_timeout_ms || dlist_empty(idle_list))
+  {
+    return UINT64_MAX;
+  }
+  Conn *conn = container_of(idle_list->next, Conn, idle_node);
+  return conn->last_active_ms + g_opts.idle_timeout_ms;
+}
+
+// Takes the next timed-out connection off the list, oldest first. Stops at
+// the first one still within the timeout, so the caller's loop is
+// O(closed connections).
+static Conn *idle_conn_pop(DList *idle_list, uint64_t now)
+{
+  if (idle_deadline(idle_list) > now)
+  {
+    return nullptr;
+  }
+  Conn *conn = container_of(idle_list->next, Conn, idle_node);
+  dlist_detach(&conn->idle_node);
+  return conn;
+}
+
+// poll/epoll timeout until `deadline`, -1 for UINT64_MAX
+static int timeout_until(uint64_t deadline)
+{
+  if (deadline == UINT64_MAX)
+  {
+    return -1;
+  }
+  uint64_t now = get_monotonic_msec();
+  return deadline <= now ? 0 : (int)std::min<uint64_t>(deadline - now, INT32_MAX);
+}
+
+// Work done between events. The loops wait at most until the nearest key
+// deadline or idle timeout, and not at all while the keyspace is being
+// rehashed: each iteration gives the rehash up to g_opts.rehash_us, so it
+// also finishes while the server is idle.
+static int loop_timeout_ms()
+{
+  if (hm_rehashing(&g_data.db) || !g_data.lazy_objs.empty())
+  {
+    return 0;
+  }
+  uint64_t next = idle_deadline(&g_data.idle_list);
+  if (!g_data.heap.empty())
+  {
+    next = std::min(next, g_data.heap[0].val);
+  }
+  return timeout_until(next);
+}
+
+// Active expiry, in batches of k_max_expire_work keys so that a mass expiry
+// cannot stall the loop. If more keys are due, the next wait is 0.
+static void process_timers()
+{
+  uint64_t now = get_monotonic_msec();
+  size_t nwork = 0;
+  while (!g_data.heap.empty() && g_data.heap[0].val <= now &&
+         nwork++ < k_max_expire_work)
+  {
+    db_expire(container_of(g_data.heap[0].ref, Entry, heap_idx));
+  }
+}
+
+// Frees up to k_lazy_obj_work members of the values dropped by
+// db_obj_free(). If more are left, the next wait is 0.
+static void process_lazy_objs()
+{
+  if (g_data.lazy_objs.empty())
+  {
+    return;
+  }
+  LazyObj &lz = g_data.lazy_objs.back();
+  if (lazy_obj_free_some(&lz, k_lazy_obj_work))
+  {
+    g_data.lazy_obj_bytes -= lz.bytes;
+    g_data.lazy_objs.pop_back();
+  }
+}
+
+// Close the connections that timed out. close_conn() is per backend; the
+// connection is off the list by then.
+static void process_idle_conns(void (*close_conn)(Conn *, void *), void *arg)
+{
+  uint64_t now = get_monotonic_msec();
+  while (Conn *conn = idle_conn_pop(&g_data.idle_list, now))
+  {
+    g_idle_closed.fetch_add(1, std::memory_order_relaxed);
+    close_conn(conn, arg);
+  }
+}
+
+static void loop_tick(void (*close_conn)(Conn *, void *), void *arg)
+{
+  process_timers();
+  process_lazy_objs();
+  process_idle_conns(close_conn, arg);
+  hm_rehash_for(&g_data.db, g_opts.rehash_us);
+}
+
+// the original event loop: rebuild the pollfd array from every connection on
+// each iteration. O(connections) per wakeup, kept for portability and as the
+// baseline for conn_bench.
+static void run_poll_loop(int fd)
+{
+  std::vector<Conn *> fd2conn;
+  std::vector<struct pollfd> poll_args;
+
+  fprintf(stderr, "started listening (poll)....\n");
+  while (true)
+  {
+    poll_args.clear();
+    struct pollfd pfd = {fd, POLLIN, 0};
+    poll_args.push_back(pfd);
+
+    for (Conn *conn : fd2conn)
+    {
+      if (!conn)
+      {
+        continue;
+      }
+
+      struct pollfd pfd = {conn->fd, POLLERR, 0};
+      if (conn->want_to_read)
+      {
+        pfd.events |= POLLIN;
+      }
+      if (conn->want_to_write)
+      {
+        pfd.events |= POLLOUT;
+      }
+      poll_args.push_back(pfd);
+    }
+
+    int rv = poll(poll_args.data(), (nfds_t)poll_args.size(), loop_timeout_ms());
+    if (rv < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (rv < 0)
+    {
+      fprintf(stderr, "poll returned - %d", rv);
+      die("poll");
+    }
+    uint64_t now = get_monotonic_msec();
+
+    // We set POLLIN for server fd, so now we have connections to process
+    if (poll_args[0].revents)
+    {
+      while (Conn *conn = handle_accept(fd))
+      {
+        conn_put(fd2conn, conn);
+        conn_touch(conn, now);
+      }
+    }
+
+    // handle connection sockets
+    // go over all polled connections and check if they have revents
+    for (size_t i = 1; i < poll_args.size(); ++i)
+    {
+      uint32_t ready = poll_args[i].revents;
+      if (ready == 0)
+      {
+        continue;
+      }
+
+      Conn *conn = fd2conn[poll_args[i].fd];
+      if (!conn)
+      {
+        die("connection is nil");
+      }
+      conn_touch(conn, now);
+      ready = conn_ready_events(conn, ready);
+      // check if they are POLLIN or POLLOUT or both
+      if (ready & POLLIN)
+      {
+        assert(conn->want_to_read);
+        handle_read(conn);
+      }
+
+      if ((ready & POLLOUT) && conn->want_to_write)
+      {
+        handle_write(conn);
+      }
+
+      if ((ready & (POLLERR | POLLHUP)) || conn->want_to_close)
+      {
+        conn_destroy(fd2conn, conn);
+      }
+    }
+    loop_tick(conn_destroy_cb, &fd2conn);
+  }
+}
+
+#ifdef __linux__
+// readiness the connection currently wants, as epoll flags
+static uint32_t conn_epoll_events(Conn *conn)
+{
+  if (g_opts.edge_triggered)
+  {
+    // registered once for both directions; the want_* flags decide what we
+    // actually do when an edge arrives.
+    return EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  }
+  uint32_t events = 0;
+  if (conn->want_to_read)
+  {
+    events |= EPOLLIN;
+  }
+  if (conn->want_to_write)
+  {
+    events |= EPOLLOUT;
+  }
+  return events;
+}
+
+static void conn_epoll_sync(int epfd, Conn *conn)
+{
+  uint32_t events = conn_epoll_events(conn);
+  if (events == conn->epoll_events)
+  {
+    return; // nothing changed, no syscall
+  }
+  struct epoll_event ev = {};
+  ev.events = events;
+  ev.data.ptr = conn;
+  int op = conn->epoll_events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+  if (epoll_ctl(epfd, op, conn->fd, &ev) < 0)
+  {
+    msg_errno("epoll_ctl()");
+    conn->want_to_close = true;
+    return;
+  }
+  conn->epoll_events = events;
+}
+
+// edge-triggered: an edge is only reported once, so keep reading / writing
+// until the socket says EAGAIN.
+static void conn_drain(Conn *conn)
+{
+  while (!conn->want_to_close)
+  {
+    bool progress = false;
+    if (conn->want_to_read)
+    {
+      progress = handle_read(conn);
+    }
+    else if (conn->want_to_write)
+    {
+      progress = handle_write(conn);
+    }
+    if (!progress)
+    {
+      break;
+    }
+  }
+}
+
+// epoll event loop: interest is registered once per connection and only
+// updated when want_to_read / want_to_write flips, and each wakeup only
+// touches the ready fds. O(active connections) per wakeup.
+static void run_epoll_loop(int fd)
+{
+  std::vector<Conn *> fd2conn;
+  const int k_max_events = 1024;
+  struct epoll_event events[k_max_events];
+
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd < 0)
+  {
+    die("epoll_create1()");
+  }
+  struct epoll_event lev = {};
+  lev.events = EPOLLIN;
+  if (g_opts.edge_triggered)
+  {
+    lev.events |= EPOLLET;
+  }
+  lev.data.ptr = NULL; // the listening socket
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &lev) < 0)
+  {
+    die("epoll_ctl(listen)");
+  }
+
+  fprintf(stderr, "started listening (epoll%s)....\n",
+          g_opts.edge_triggered ? ", edge-triggered" : "");
+  while (true)
+  {
+    int n = epoll_wait(epfd, events, k_max_events, loop_timeout_ms());
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n < 0)
+    {
+      die("epoll_wait");
+    }
+    uint64_t now = get_monotonic_msec();
+
+    for (int i = 0; i < n; ++i)
+    {
+      uint32_t ready = events[i].events;
+      Conn *conn = (Conn *)events[i].data.ptr;
+      if (!conn)
+      {
+        // drain the accept queue, required for edge-triggered mode
+        while (Conn *conn = handle_accept(fd))
+        {
+          conn_put(fd2conn, conn);
+          conn_touch(conn, now);
+          conn_epoll_sync(epfd, conn);
+          if (conn->want_to_close)
+          {
+            conn_destroy(fd2conn, conn);
+          }
+        }
+        continue;
+      }
+
+      conn_touch(conn, now);
+      ready = conn_ready_events(conn, ready);
+      if (g_opts.edge_triggered)
+      {
+        conn_drain(conn);
+      }
+      else
+      {
+        if ((ready & EPOLLIN) && conn->want_to_read)
+        {
+          handle_read(conn);
+        }
+        if ((ready & EPOLLOUT) && conn->want_to_write)
+        {
+          handle_write(conn);
+        }
+      }
+
+      if ((ready & (EPOLLERR | EPOLLHUP)) || conn->want_to_close)
+      {
+        conn_destroy(fd2conn, conn); // close() also drops the epoll interest
+        continue;
+      }
+      conn_epoll_sync(epfd, conn);
+      if (conn->want_to_close)
+      {
+        conn_destroy(fd2conn, conn);
+      }
+    }
+    loop_tick(conn_destroy_cb, &fd2conn);
+  }
+}
+
+// --io-threads N: the epoll loop split across threads. Each I/O thread has
+// its own epoll set and connections: it reads, parses up to g_opts.batch
+// requests and hands the Conn to the main thread over an SPSC ring. The main
+// thread runs them against g_data, which stays single-threaded, and hands
+// the Conn back over a second ring for the I/O thread to write the
+// responses. A Conn belongs to one side at a time, so it needs no lock.
+// Connections are registered with EPOLLONESHOT and only re-armed by their
+// I/O thread while it holds them, so no event can turn up for a Conn that is
+// with the main thread. A side only writes to the other's eventfd when that
+// one is about to sleep, or sleeping, in epoll_wait().
+const size_t k_io_ring_size = 4096;
+const uintptr_t k_io_new_conn = 1; // ring item tag: a newly accepted Conn
+
+struct IoWaker
+{
+  int efd = -1;
+  std::atomic<bool> sleeping{false};
+};
+
+struct IoThread
+{
+  uint32_t id = 0;
+  int epfd = -1;
+  IoWaker waker;
+  SpscRing to_io;   // main -> I/O: new and returning connections
+  SpscRing to_main; // I/O -> main: connections with parsed requests
+  // what did not fit into a full ring, pushed again on the next iteration
+  std::vector<uintptr_t> to_io_backlog;   // main thread
+  std::vector<uintptr_t> to_main_backlog; // I/O thread
+  bool to_io_pushed = false;              // main thread
+  bool to_main_pushed = false;            // I/O thread
+  DList idle_list; // only the connections this thread holds
+};
+
+static struct
+{
+  std::vector<IoThread *> threads;
+  IoWaker waker; // the main thread's
+} g_io;
+
+static void io_push(SpscRing *ring, std::vector<uintptr_t> &backlog, uintptr_t v)
+{
+  if (!backlog.empty() || !spsc_push(ring, v))
+  {
+    backlog.push_back(v);
+  }
+}
+
+static void io_flush(SpscRing *ring, std::vector<uintptr_t> &backlog)
+{
+  size_t i = 0;
+  while (i < backlog.size() && spsc_push(ring, backlog[i]))
+  {
+    i++;
+  }
+  backlog.erase(backlog.begin(), backlog.begin() + i);
+}
+
+// The fences pair up: either the sleeper's check of its rings sees what was
+// pushed, or the waker sees it sleeping and writes the eventfd.
+static void io_sleep_begin(IoWaker *w)
+{
+  w->sleeping.store(true, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+static void io_sleep_end(IoWaker *w)
+{
+  w->sleeping.store(false, std::memory_order_relaxed);
+}
+
+static void io_wake(IoWaker *w)
+{
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (w->sleeping.load(std::memory_order_relaxed) &&
+      w->sleeping.exchange(false, std::memory_order_relaxed))
+  {
+    uint64_t one = 1;
+    if (write(w->efd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    {
+      die("write(eventfd)");
+    }
+  }
+}
+
+static void io_drain_eventfd(IoWaker *w)
+{
+  uint64_t count = 0;
+  (void)!read(w->efd, &count, sizeof(count));
+}
+
+static void io_conn_destroy(Conn *conn)
+{
+  (void)close(conn->fd);
+  delete conn; // also takes it off the idle list
+}
+
+static void io_conn_arm(IoThread *t, Conn *conn, uint32_t events)
+{
+  struct epoll_event ev = {};
+  ev.events = events | EPOLLONESHOT;
+  ev.data.ptr = conn;
+  int op = conn->epoll_events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+  if (epoll_ctl(t->epfd, op, conn->fd, &ev) < 0)
+  {
+    msg_errno("epoll_ctl()");
+    conn->want_to_close = true;
+    return;
+  }
+  conn->epoll_events = ev.events;
+}
+
+// The I/O thread holds the connection and nothing is pending on it: hand the
+// complete requests to the main thread, or wait for the socket.
+static void io_conn_next(IoThread *t, Conn *conn)
+{
+  if (!conn->want_to_close && conn->want_to_read)
+  {
+    if (conn->io_reqs.empty())
+    {
+      conn->io_reqs.resize(g_opts.batch); // not for connections that stay idle
+    }
+    conn->io_nreqs = parse_requests(conn, conn->io_reqs.data(),
+                                    conn->io_reqs.size(), conn->io_used);
+    if (conn->io_nreqs > 0)
+    {
+      dlist_detach(&conn->idle_node);
+      io_push(&t->to_main, t->to_main_backlog, (uintptr_t)conn);
+      t->to_main_pushed = true;
+      return;
+    }
+  }
+  if (!conn->want_to_close)
+  {
+    io_conn_arm(t, conn, conn->want_to_read ? EPOLLIN : EPOLLOUT);
+  }
+  if (conn->want_to_close)
+  {
+    io_conn_destroy(conn);
+  }
+}
+
+static void io_conn_ready(IoThread *t, Conn *conn, uint32_t ready, uint64_t now)
+{
+  conn_touch(&t->idle_list, conn, now);
+  ready = conn_ready_events(conn, ready);
+  if (ready & (EPOLLERR | EPOLLHUP))
+  {
+    conn->want_to_close = true;
+  }
+  else if (conn->want_to_read)
+  {
+    read_incoming(conn);
+  }
+  else if (conn->want_to_write)
+  {
+    handle_write(conn);
+  }
+  io_conn_next(t, conn);
+}
+
+// back from the main thread, with the responses in outgoing
+static void io_conn_returned(IoThread *t, Conn *conn, uint64_t now)
+{
+  conn_touch(&t->idle_list, conn, now);
+  if (conn_has_output(conn))
+  {
+    conn->want_to_write = true;
+    conn->want_to_read = false;
+    handle_write(conn);
+  }
+  io_conn_next(t, conn);
+}
+
+static void io_thread_main(IoThread *t)
+{
+  const int k_max_events = 256;
+  struct epoll_event events[k_max_events];
+  while (true)
+  {
+    uint64_t now = get_monotonic_msec();
+    uintptr_t v = 0;
+    while (spsc_pop(&t->to_io, &v))
+    {
+      Conn *conn = (Conn *)(v & ~k_io_new_conn);
+      if (v & k_io_new_conn)
+      {
+        conn->io_thread = t->id;
+        conn_touch(&t->idle_list, conn, now);
+        io_conn_next(t, conn);
+      }
+      else
+      {
+        io_conn_returned(t, conn, now);
+      }
+    }
+    while (Conn *conn = idle_conn_pop(&t->idle_list, now))
+    {
+      g_idle_closed.fetch_add(1, std::memory_order_relaxed);
+      io_conn_destroy(conn);
+    }
+
+    io_flush(&t->to_main, t->to_main_backlog);
+    if (t->to_main_pushed)
+    {
+      t->to_main_pushed = false;
+      io_wake(&g_io.waker);
+    }
+
+    int timeout = t->to_main_backlog.empty()
+                      ? timeout_until(idle_deadline(&t->idle_list))
+                      : 0;
+    io_sleep_begin(&t->waker);
+    if (!spsc_empty(&t->to_io))
+    {
+      timeout = 0;
+    }
+    int n = epoll_wait(t->epfd, events, k_max_events, timeout);
+    io_sleep_end(&t->waker);
+    if (n < 0 && errno != EINTR)
+    {
+      die("epoll_wait");
+    }
+    now = get_monotonic_msec();
+    for (int i = 0; i < n; ++i)
+    {
+      if (events[i].data.ptr == &t->waker)
+      {
+        io_drain_eventfd(&t->waker);
+        continue;
+      }
+      io_conn_ready(t, (Conn *)events[i].data.ptr, events[i].events, now);
+    }
+  }
+}
+
+static void io_waker_init(IoWaker *w, int epfd)
+{
+  w->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (w->efd < 0)
+  {
+    die("eventfd()");
+  }
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.ptr = w;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, w->efd, &ev) < 0)
+  {
+    die("epoll_ctl(eventfd)");
+  }
+}
+
+// The main thread: accepts, deals the connections out round-robin, and runs
+// the requests the I/O threads parsed. Idle timeouts are up to the I/O
+// threads, the main thread's idle list stays empty.
+static void run_io_threads_loop(int fd)
+{
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd < 0)
+  {
+    die("epoll_create1()");
+  }
+  struct epoll_event lev = {};
+  lev.events = EPOLLIN;
+  lev.data.ptr = NULL; // the listening socket
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &lev) < 0)
+  {
+    die("epoll_ctl(listen)");
+  }
+  io_waker_init(&g_io.waker, epfd);
+
+  for (uint32_t i = 0; i < g_opts.io_threads; ++i)
+  {
+    IoThread *t = new IoThread();
+    t->id = i;
+    spsc_init(&t->to_io, k_io_ring_size);
+    spsc_init(&t->to_main, k_io_ring_size);
+    t->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (t->epfd < 0)
+    {
+      die("epoll_create1()");
+    }
+    io_waker_init(&t->waker, t->epfd);
+    g_io.threads.push_back(t);
+    std::thread(io_thread_main, t).detach();
+  }
+
+  const int k_max_events = 64;
+  struct epoll_event events[k_max_events];
+  size_t next_thread = 0;
+  fprintf(stderr, "started listening (epoll, %u I/O threads)....\n",
+          g_opts.io_threads);
+  while (true)
+  {
+    bool backlog = false;
+    for (IoThread *t : g_io.threads)
+    {
+      io_flush(&t->to_io, t->to_io_backlog);
+      backlog = backlog || !t->to_io_backlog.empty();
+    }
+    int timeout = backlog ? 0 : loop_timeout_ms();
+    io_sleep_begin(&g_io.waker);
+    for (IoThread *t : g_io.threads)
+    {
+      if (!spsc_empty(&t->to_main))
+      {
+        timeout = 0;
+      }
+    }
+    int n = epoll_wait(epfd, events, k_max_events, timeout);
+    io_sleep_end(&g_io.waker);
+    if (n < 0 && errno != EINTR)
+    {
+      die("epoll_wait");
+    }
+
+    for (int i = 0; i < n; ++i)
+    {
+      if (events[i].data.ptr == &g_io.waker)
+      {
+        io_drain_eventfd(&g_io.waker);
+        continue;
+      }
+      while (Conn *conn = handle_accept(fd))
+      {
+        IoThread *t = g_io.threads[next_thread++ % g_io.threads.size()];
+        io_push(&t->to_io, t->to_io_backlog, (uintptr_t)conn | k_io_new_conn);
+        t->to_io_pushed = true;
+      }
+    }
+
+    for (IoThread *t : g_io.threads)
+    {
+      uintptr_t v = 0;
+      while (spsc_pop(&t->to_main, &v))
+      {
+        Conn *conn = (Conn *)v;
+        execute_requests(conn, conn->io_reqs.data(), conn->io_nreqs);
+        buf_consume(conn->incoming, conn->io_used);
+        conn->io_nreqs = 0;
+        io_push(&t->to_io, t->to_io_backlog, v);
+        t->to_io_pushed = true;
+      }
+    }
+    for (IoThread *t : g_io.threads)
+    {
+      if (t->to_io_pushed)
+      {
+        t->to_io_pushed = false;
+        io_wake(&t->waker);
+      }
+    }
+    loop_tick(NULL, NULL); // no idle list to close from here
+  }
+}
+
+// --reactors N: shared-nothing threads. Every reactor has its own listening
+// socket on the port (SO_REUSEPORT, the kernel spreads the connections), its
+// own epoll loop and connections, and its own shard of the keyspace: g_data
+// is thread_local. A request goes to the shard that owns its first key. The
+// requests of a batch for other shards travel as one ShardMsg per shard over
+// an SPSC ring per pair of reactors; the owner runs them against its shard
+// and sends the message back with the responses, which are then put back in
+// request order. Commands without a key (keys, scan, info) only see the
+// local shard. The wakeups are those of the I/O threads.
+const size_t k_shard_ring_size = 1024;
+
+struct Reactor
+{
+  uint32_t id = 0;
+  int fd = -1; // listening socket
+  int epfd = -1;
+  IoWaker waker;
+  SpscRing *inbox = nullptr; // [from], filled by the other reactors
+  // per destination: what did not fit into its ring, and whether to wake it
+  std::vector<std::vector<uintptr_t>> backlog;
+  std::vector<bool> pushed;
+  std::vector<Conn *> fd2conn;
+};
+
+static std::vector<Reactor *> g_reactors;
+
+// the high bits, so that the shard says nothing about the bucket in it
+static uint32_t key_shard(uint64_t hcode)
+{
+  return (uint32_t)(((hcode >> 32) * g_opts.reactors) >> 32);
+}
+
+static void shard_send(Reactor *r, uint32_t to, ShardMsg *msg)
+{
+  io_push(&g_reactors[to]->inbox[r->id], r->backlog[to], (uintptr_t)msg);
+  r->pushed[to] = true;
+}
+
+// runs the requests of `msg` against this thread's shard
+static void shard_execute(ShardMsg *msg)
+{
+  Request *reqs = msg->conn->io_reqs.data();
+  g_data.now_ms = get_monotonic_msec();
+  if (msg->idx.size() > 1)
+  {
+    for (uint32_t i : msg->idx)
+    {
+      hm_prefetch(&g_data.db, reqs[i].hcode);
+    }
+    for (uint32_t i : msg->idx)
+    {
+      hm_prefetch_node(&g_data.db, reqs[i].hcode);
+    }
+  }
+  for (uint32_t i : msg->idx)
+  {
+    run_request(reqs[i], msg->out, msg->refs, 0);
+    msg->ends.push_back(msg->out.data_size());
+  }
+}
+
+// Runs the parsed batch: the requests for this shard here, the others sent
+// off. Returns false if some went to other reactors; the batch then
+// completes in reactor_conn_resume().
+static bool shard_dispatch(Reactor *r, Conn *conn)
+{
+  Request *reqs = conn->io_reqs.data();
+  size_t n = conn->io_nreqs;
+  bool remote = false;
+  for (size_t i = 0; i < n; ++i)
+  {
+    reqs[i].shard = reqs[i].has_key ? key_shard(reqs[i].hcode) : r->id;
+    remote = remote || reqs[i].shard != r->id;
+  }
+  if (!remote)
+  {
+    execute_requests(conn, reqs, n);
+    return true;
+  }
+
+  if (!conn->shard_msgs)
+  {
+    conn->shard_msgs = new ShardMsg[g_opts.reactors];
+    for (uint32_t s = 0; s < g_opts.reactors; ++s)
+    {
+      conn->shard_msgs[s].conn = conn;
+      conn->shard_msgs[s].from = r->id;
+      conn->shard_msgs[s].to = s;
+    }
+  }
+  for (size_t i = 0; i < n; ++i)
+  {
+    conn->shard_msgs[reqs[i].shard].idx.push_back((uint32_t)i);
+  }
+  for (uint32_t s = 0; s < g_opts.reactors; ++s)
+  {
+    if (s != r->id && !conn->shard_msgs[s].idx.empty())
+    {
+      conn->shard_pending++;
+      shard_send(r, s, &conn->shard_msgs[s]);
+    }
+  }
+  shard_execute(&conn->shard_msgs[r->id]);
+  return false;
+}
+
+// every reply is in: the responses go out in request order
+static void shard_gather(Conn *conn)
+{
+  for (size_t i = 0; i < conn->io_nreqs; ++i)
+  {
+    ShardMsg &msg = conn->shard_msgs[conn->io_reqs[i].shard];
+    size_t begin = msg.cursor ? msg.ends[msg.cursor - 1] : 0;
+    size_t end = msg.ends[msg.cursor];
+    // a response starts with its length, so a reference at `begin` belongs
+    // to the one before
+    uint64_t base = conn->out_head + conn->outgoing.data_size();
+    for (; msg.ref_cursor < msg.refs.size() && msg.refs[msg.ref_cursor].pos <= end;
+         msg.ref_cursor++)
+    {
+      OutRef &ref = msg.refs[msg.ref_cursor];
+      conn->out_refs.push_back(OutRef{base + ref.pos - begin, ref.val});
+    }
+    conn->outgoing.append(msg.out.data() + begin, end - begin);
+    msg.cursor++;
+  }
+  for (uint32_t s = 0; s < g_opts.reactors; ++s)
+  {
+    ShardMsg &msg = conn->shard_msgs[s];
+    buf_consume(msg.out, msg.out.data_size());
+    msg.idx.clear();
+    msg.ends.clear();
+    msg.refs.clear(); // moved to the connection
+    msg.cursor = 0;
+    msg.ref_cursor = 0;
+  }
+}
+
+// like process_requests(), but stops at a batch that waits for other shards
+static void reactor_conn_process(Reactor *r, Conn *conn)
+{
+  if (conn->io_reqs.empty())
+  {
+    conn->io_reqs.resize(g_opts.batch);
+  }
+  while (!conn->want_to_close)
+  {
+    conn->io_nreqs = parse_requests(conn, conn->io_reqs.data(),
+                                    conn->io_reqs.size(), conn->io_used);
+    if (conn->io_nreqs == 0)
+    {
+      break;
+    }
+    if (!shard_dispatch(r, conn))
+    {
+      return;
+    }
+    buf_consume(conn->incoming, conn->io_used);
+  }
+  if (conn_has_output(conn))
+  {
+    conn->want_to_write = true;
+    conn->want_to_read = false;
+    handle_write(conn);
+  }
+}
+
+// A connection waiting for replies must not be freed; it only leaves epoll
+// and is destroyed with the last reply.
+static void reactor_conn_close(Reactor *r, Conn *conn)
+{
+  if (conn->shard_pending > 0)
+  {
+    conn->want_to_close = true;
+    (void)epoll_ctl(r->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    dlist_detach(&conn->idle_node);
+    return;
+  }
+  conn_destroy(r->fd2conn, conn);
+}
+
+static void reactor_close_cb(Conn *conn, void *arg)
+{
+  reactor_conn_close((Reactor *)arg, conn);
+}
+
+// no interest at all while replies are pending; registered on accept, so
+// always a MOD
+static void reactor_conn_update(Reactor *r, Conn *conn)
+{
+  if (conn->want_to_close)
+  {
+    reactor_conn_close(r, conn);
+    return;
+  }
+  uint32_t events = conn->shard_pending ? 0 : conn_epoll_events(conn);
+  if (events == conn->epoll_events)
+  {
+    return;
+  }
+  struct epoll_event ev = {};
+  ev.events = events;
+  ev.data.ptr = conn;
+  if (epoll_ctl(r->epfd, EPOLL_CTL_MOD, conn->fd, &ev) < 0)
+  {
+    msg_errno("epoll_ctl()");
+    conn->want_to_close = true;
+    reactor_conn_close(r, conn);
+    return;
+  }
+  conn->epoll_events = events;
+}
+
+static void reactor_conn_resume(Reactor *r, Conn *conn)
+{
+  if (conn->want_to_close)
+  {
+    conn_destroy(r->fd2conn, conn);
+    return;
+  }
+  shard_gather(conn);
+  buf_consume(conn->incoming, conn->io_used);
+  conn->io_nreqs = 0;
+  reactor_conn_process(r, conn);
+  reactor_conn_update(r, conn);
+}
+
+static void reactor_on_msg(Reactor *r, ShardMsg *msg)
+{
+  if (msg->from != r->id)
+  {
+    shard_execute(msg);
+    shard_send(r, msg->from, msg);
+    return;
+  }
+  if (--msg->conn->shard_pending == 0)
+  {
+    reactor_conn_resume(r, msg->conn);
+  }
+}
+
+static void reactor_conn_ready(Reactor *r, Conn *conn, uint32_t ready)
+{
+  ready = conn_ready_events(conn, ready);
+  if (ready & (EPOLLERR | EPOLLHUP))
+  {
+    conn->want_to_close = true;
+  }
+  else
+  {
+    if ((ready & EPOLLIN) && conn->want_to_read && read_incoming(conn))
+    {
+      reactor_conn_process(r, conn);
+    }
+    if ((ready & EPOLLOUT) && conn->want_to_write)
+    {
+      handle_write(conn);
+    }
+  }
+  reactor_conn_update(r, conn);
+}
+
+static void reactor_main(Reactor *r)
+{
+  g_data.shard = r->id;
+  const int k_max_events = 256;
+  struct epoll_event events[k_max_events];
+  uint32_t nr = g_opts.reactors;
+  while (true)
+  {
+    for (uint32_t from = 0; from < nr; ++from)
+    {
+      uintptr_t v = 0;
+      while (spsc_pop(&r->inbox[from], &v))
+      {
+        reactor_on_msg(r, (ShardMsg *)v);
+      }
+    }
+    bool backlog = false;
+    for (uint32_t to = 0; to < nr; ++to)
+    {
+      io_flush(&g_reactors[to]->inbox[r->id], r->backlog[to]);
+      backlog = backlog || !r->backlog[to].empty();
+      if (r->pushed[to])
+      {
+        r->pushed[to] = false;
+        io_wake(&g_reactors[to]->waker);
+      }
+    }
+
+    int timeout = backlog ? 0 : loop_timeout_ms();
+    io_sleep_begin(&r->waker);
+    for (uint32_t from = 0; from < nr; ++from)
+    {
+      if (!spsc_empty(&r->inbox[from]))
+      {
+        timeout = 0;
+      }
+    }
+    int n = epoll_wait(r->epfd, events, k_max_events, timeout);
+    io_sleep_end(&r->waker);
+    if (n < 0 && errno != EINTR)
+    {
+      die("epoll_wait");
+    }
+    uint64_t now = get_monotonic_msec();
+
+    for (int i = 0; i < n; ++i)
+    {
+      void *ptr = events[i].data.ptr;
+      if (ptr == &r->waker)
+      {
+        io_drain_eventfd(&r->waker);
+        continue;
+      }
+      if (!ptr)
+      {
+        while (Conn *conn = handle_accept(r->fd))
+        {
+          conn_put(r->fd2conn, conn);
+          conn_touch(conn, now);
+          conn_epoll_sync(r->epfd, conn);
+          if (conn->want_to_close)
+          {
+            conn_destroy(r->fd2conn, conn);
+          }
+        }
+        continue;
+      }
+      Conn *conn = (Conn *)ptr;
+      conn_touch(conn, now);
+      reactor_conn_ready(r, conn, events[i].events);
+    }
+    loop_tick(reactor_close_cb, r);
+  }
+}
+
+// Sets up every reactor before any of them runs, then runs reactor 0 on the
+// calling thread. `fd` is reactor 0's listening socket.
+static void run_reactors(int fd)
+{
+  uint32_t nr = g_opts.reactors;
+  g_opts.edge_triggered = false; // the reactors are level-triggered
+  for (uint32_t i = 0; i < nr; ++i)
+  {
+    Reactor *r = new Reactor();
+    r->id = i;
+    r->fd = i == 0 ? fd : listen_on(g_opts.port, true);
+    r->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epfd < 0)
+    {
+      die("epoll_create1()");
+    }
+    struct epoll_event lev = {};
+    lev.events = EPOLLIN;
+    lev.data.ptr = NULL; // the listening socket
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->fd, &lev) < 0)
+    {
+      die("epoll_ctl(listen)");
+    }
+    io_waker_init(&r->waker, r->epfd);
+    r->inbox = new SpscRing[nr];
+    for (uint32_t from = 0; from < nr; ++from)
+    {
+      spsc_init(&r->inbox[from], k_shard_ring_size);
+    }
+    r->backlog.resize(nr);
+    r->pushed.resize(nr);
+    g_reactors.push_back(r);
+  }
+
+  fprintf(stderr, "started listening (epoll, %u reactors)....\n", nr);
+  for (uint32_t i = 1; i < nr; ++i)
   {
-    die("fcntl error");
+    std::thread(reactor_main, g_reactors[i]).detach();
   }
+  reactor_main(g_reactors[0]);
 }
 
-static Conn *handle_accept(int fd)
+// io_uring event loop: completion-based instead of readiness-based. One
+// multishot accept on the listening socket, one multishot recv per connection
+// that fills buffers from a kernel-provided buffer ring, and responses go out
+// as a chain of linked sends. A whole batch of those is submitted with a
+// single io_uring_enter(). Request framing and process_requests() are the same
+// as in the other loops; like handle_read(), no new request is processed
+// while a response is still being sent.
+enum
 {
-  struct sockaddr_in client_addr = {};
-  socklen_t addrlen = sizeof(client_addr);
-  int connfd = accept(fd, (struct sockaddr *)&client_addr, &addrlen);
-  if (connfd < 0)
+  UOP_ACCEPT = 0,
+  UOP_RECV = 1,
+  UOP_SEND = 2,
+  UOP_MASK = 3,
+};
+
+const unsigned k_uring_entries = 4096;
+const unsigned k_uring_nbufs = 2048;       // must be a power of 2
+const unsigned k_uring_buf_size = 8 << 10; // per provided recv buffer
+const size_t k_uring_send_chunk = 256 << 10;
+const size_t k_uring_max_links = 8;
+
+static struct
+{
+  URing ring;
+  UBufRing bufs;
+  int listen_fd = -1;
+  // cleared when the kernel rejects the multishot flavour
+  bool multishot_accept = true;
+  bool multishot_recv = true;
+  uint64_t now_ms = 0; // when the completions being handled arrived
+} g_uring;
+
+static struct io_uring_sqe *uring_sqe()
+{
+  struct io_uring_sqe *sqe = uring_get_sqe(&g_uring.ring);
+  if (!sqe)
   {
-    // accept the request and process it
-    return NULL;
+    // SQ is full, flush it to the kernel and retry
+    int rv = uring_submit_and_wait(&g_uring.ring, 0);
+    if (rv < 0 && rv != -EINTR && rv != -EAGAIN && rv != -EBUSY)
+    {
+      errno = -rv;
+      die("io_uring_enter()");
+    }
+    sqe = uring_get_sqe(&g_uring.ring);
   }
-
-  fd_set_nb(connfd);
-  Conn *conn = new Conn();
-  conn->fd = connfd;
-  conn->want_to_read = true;
-  return conn;
+  assert(sqe);
+  return sqe;
 }
 
-static void make_response(const Response &resp, std::vector<uint8_t> &out)
+static void uring_arm_accept()
 {
-  uint32_t resp_len = 4 + (uint32_t)resp.data.size();
-  buf_append(out, (const uint8_t *)&resp_len, 4);
-  buf_append(out, (const uint8_t *)&resp.status, 4);
-  buf_append(out, resp.data.data(), resp.data.size());
+  struct io_uring_sqe *sqe = uring_sqe();
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = g_uring.listen_fd;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  if (g_uring.multishot_accept)
+  {
+    sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+  }
+  sqe->user_data = UOP_ACCEPT;
 }
 
-static bool read_u32(const uint8_t *&cur, const uint8_t *end, uint32_t &out)
+static void uring_arm_recv(Conn *conn)
 {
-  if (cur + 4 > end)
+  struct io_uring_sqe *sqe = uring_sqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = conn->fd;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = g_uring.bufs.bgid;
+  if (g_uring.multishot_recv)
   {
-    return -1;
+    sqe->ioprio |= IORING_RECV_MULTISHOT;
   }
-
-  memcpy(&out, cur, 4);
-  cur += 4;
-  return 0;
+  sqe->user_data = (uint64_t)(uintptr_t)conn | UOP_RECV;
+  conn->uring_inflight++;
+  conn->uring_recv_armed = true;
 }
 
-static bool read_str(const uint8_t *&cur, const uint8_t *end, size_t n,
-                     std::string &out)
+// send `outgoing` as a chain of linked sends; the buffer is left alone until
+// every send of the chain has completed.
+static void uring_send(Conn *conn)
 {
-  if (cur + n > end)
+  assert(conn->uring_sends == 0);
+  size_t total = conn->outgoing.data_size();
+  size_t off = 0;
+  for (size_t i = 0; i < k_uring_max_links && off < total; ++i)
   {
-    return -1;
+    size_t len = std::min(total - off, k_uring_send_chunk);
+    struct io_uring_sqe *sqe = uring_sqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(conn->outgoing.data() + off);
+    sqe->len = (uint32_t)len;
+    // a short send fails the rest of the chain with -ECANCELED, the
+    // remainder is sent again once the chain is done
+    sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+    sqe->user_data = (uint64_t)(uintptr_t)conn | UOP_SEND;
+    off += len;
+    if (off < total && i + 1 < k_uring_max_links)
+    {
+      sqe->flags |= IOSQE_IO_LINK;
+    }
+    conn->uring_sends++;
+    conn->uring_inflight++;
   }
-  out.assign(cur, cur + n);
-  cur += n;
-  return 0;
+  conn->uring_sent = 0;
 }
 
-static int32_t parse_request(const uint8_t *data, size_t size,
-                             std::vector<std::string> &out)
+// run the buffered requests, then start sending if there is a response
+static void uring_process(Conn *conn)
 {
-
-  const uint8_t *end = data + size; // advance by size bytes
-
-  uint32_t nstr = 0;
-  int result;
-  if ((result = read_u32(data, end, nstr)) != 0)
+  process_requests(conn);
+  if (!conn->want_to_close && conn->outgoing.data_size() > 0)
   {
-    return -1;
+    conn->want_to_write = true;
+    conn->want_to_read = false;
+    uring_send(conn);
   }
+}
 
-  if (nstr > k_max_msg)
+// close a connection once the kernel holds no more references to it
+static void uring_conn_check(Conn *conn)
+{
+  if (!conn->want_to_close)
   {
-    return -1;
+    return;
   }
-
-  // append until the out is of size nstr
-  // other way of saying, run the while loop for nstr times
-  while (out.size() < nstr)
+  if (conn->uring_inflight > 0)
   {
-    uint32_t len = 0;
-    if (read_u32(data, end, len))
-    {
-      return -1;
-    }
-    if (len > k_max_msg)
+    // wake up the pending recv/send so they complete
+    if (!conn->uring_shutdown)
     {
-      return -1;
-    }
-    out.push_back(std::string());
-    int read_str_result = read_str(data, end, len, out.back());
-    if (read_str_result)
-    {
-      return -1;
+      shutdown(conn->fd, SHUT_RDWR);
+      conn->uring_shutdown = true;
     }
+    return;
   }
+  (void)close(conn->fd);
+  delete conn;
+}
 
-  if (data != end)
-  {
-    return -1;
-  }
-
-  return 0;
+static void uring_close_cb(Conn *conn, void *)
+{
+  conn->want_to_close = true;
+  uring_conn_check(conn);
 }
 
-// conn.want_to_close = true => on any protocol error
-// returns true if message is processed
-static bool try_one_request(Conn *conn)
+static void uring_on_accept(struct io_uring_cqe *cqe)
 {
-  if (conn->incoming.size() < 4)
+  if (!(cqe->flags & IORING_CQE_F_MORE))
   {
-    return false; // want to read more
+    if (cqe->res == -EINVAL && g_uring.multishot_accept)
+    {
+      msg("io_uring: no multishot accept, using single-shot");
+      g_uring.multishot_accept = false;
+    }
+    uring_arm_accept();
   }
-
-  uint32_t len = 0;
-  memcpy(&len, conn->incoming.data(), 4);
-  if (len > k_max_msg) // error handling
+  if (cqe->res < 0)
   {
-    msg("too long");
-    conn->want_to_close = true;
-    return false;
+    return;
   }
+  Conn *conn = new Conn();
+  conn->fd = cqe->res;
+  conn->want_to_read = true;
+  conn_touch(conn, g_uring.now_ms);
+  uring_arm_recv(conn);
+}
 
-  if (4 + len > conn->incoming.size())
+static void uring_on_recv(Conn *conn, struct io_uring_cqe *cqe)
+{
+  bool more = cqe->flags & IORING_CQE_F_MORE;
+  if (!more)
   {
-    return false;
+    conn->uring_recv_armed = false;
+    conn->uring_inflight--;
   }
 
-  const uint8_t *request = &conn->incoming[4];
-  std::vector<std::string> cmd;
-  if (parse_request(request, len, cmd) < 0)
+  int res = cqe->res;
+  if (res > 0)
   {
-        msg("bad request");
-        conn->want_to_close = true;
-        return false;   // want close
+    conn_touch(conn, g_uring.now_ms);
+    assert(cqe->flags & IORING_CQE_F_BUFFER);
+    uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    buf_append(conn->incoming, ubuf_ring_buf(&g_uring.bufs, bid), (size_t)res);
+    ubuf_ring_recycle(&g_uring.bufs, bid);
+    if (conn->want_to_read)
+    {
+      uring_process(conn);
+    }
   }
-  // we dont the size of header, so reserve some space for the response header
-  size_t header_pos = 0;
-  response_begin(conn->outgoing, &header_pos);
-  do_request(cmd, conn->outgoing);
-  response_end(conn->outgoing, header_pos);
-
-  // application logic done! remove the request message.
-  buf_consume(conn->incoming, 4 + len);
-
-  return true; // success
-}
-
-
-
-static void handle_write(Conn *conn)
-{
-  assert(conn->outgoing.size() > 0);
-  size_t rv = write(conn->fd, &conn->outgoing[0], conn->outgoing.size());
-  if (rv < 0 && rv == EAGAIN)
+  else if (res == 0)
   {
-    return;
+    if (!conn->want_to_close)
+    {
+      msg(conn->incoming.data_size() == 0 ? "client closed" : "unexpected EOF");
+    }
+    conn->want_to_close = true;
   }
-  if (rv < 0)
+  else if (res == -EINVAL && g_uring.multishot_recv)
   {
-    msg_errno("write() error");
+    msg("io_uring: no multishot recv, using single-shot");
+    g_uring.multishot_recv = false;
+  }
+  else if (res != -ENOBUFS && res != -EINTR)
+  {
+    if (!conn->want_to_close)
+    {
+      errno = -res;
+      msg_errno("io_uring recv error");
+    }
     conn->want_to_close = true;
-    return;
   }
-  buf_consume(conn->outgoing, rv);
-  if (conn->outgoing.size() == 0) // all data written
+
+  if (!conn->uring_recv_armed && !conn->want_to_close)
   {
-    conn->want_to_write = false;
-    conn->want_to_read = true;
+    uring_arm_recv(conn);
   }
-  return;
+  uring_conn_check(conn);
 }
 
-static void handle_read(Conn *conn)
+static void uring_on_send(Conn *conn, struct io_uring_cqe *cqe)
 {
-  uint8_t buf[64 * 1024];
-  int rv = read(conn->fd, buf, sizeof(buf));
-  if (rv < 0 || rv == EAGAIN) // handle IO error -> err < 0 and err == 0 i.e EOF
+  conn->uring_inflight--;
+  conn->uring_sends--;
+  if (cqe->res > 0)
   {
-    return;
+    conn_touch(conn, g_uring.now_ms);
+    conn->uring_sent += (size_t)cqe->res;
   }
-  if (rv < 0) // handle IO error -> err < 0 and err == 0 i.e EOF
+  else if (cqe->res < 0 && cqe->res != -ECANCELED && cqe->res != -EAGAIN &&
+           cqe->res != -EINTR)
   {
-    msg_errno("handle_read -> read() error");
+    if (!conn->want_to_close)
+    {
+      errno = -cqe->res;
+      msg_errno("io_uring send error");
+    }
     conn->want_to_close = true;
-    return;
   }
-  if (rv == 0)
+
+  if (conn->uring_sends == 0 && !conn->want_to_close)
   {
-    if (conn->incoming.size() == 0)
+    buf_consume(conn->outgoing, conn->uring_sent);
+    if (conn->outgoing.data_size() > 0)
     {
-      msg("client closed");
+      uring_send(conn); // short send, go again with the rest
     }
     else
     {
-      msg("unexpected EOF");
+      conn->want_to_write = false;
+      conn->want_to_read = true;
+      // requests that arrived while we were sending
+      uring_process(conn);
     }
-    conn->want_to_close = true;
-    return; // want close
   }
-  buf_append(conn->incoming, buf, (size_t)rv);
+  uring_conn_check(conn);
+}
 
-  // this is critical to the pipelined request handling
-  while (try_one_request(conn))
+// returns false if io_uring is not usable here, the caller falls back
+static bool run_uring_loop(int fd)
+{
+  int err = uring_init(&g_uring.ring, k_uring_entries);
+  if (err)
   {
-    printf("processed one request from conn %d\n", conn->fd);
+    fprintf(stderr, "io_uring unavailable (%s), falling back\n",
+            strerror(-err));
+    return false;
+  }
+  err = ubuf_ring_init(&g_uring.ring, &g_uring.bufs, 0, k_uring_nbufs,
+                       k_uring_buf_size);
+  if (err)
+  {
+    fprintf(stderr, "io_uring provided buffers unavailable (%s), falling back\n",
+            strerror(-err));
+    uring_exit(&g_uring.ring);
+    return false;
   }
+  g_uring.listen_fd = fd;
+  // the sends take their bytes from outgoing alone
+  g_out_ref_min = SIZE_MAX;
+  uring_arm_accept();
 
-  if (conn->outgoing.size() > 0)
+  fprintf(stderr, "started listening (io_uring)....\n");
+  while (true)
   {
-    conn->want_to_write = true;
-    conn->want_to_read = false;
-    return handle_write(conn);
+    int rv = uring_submit_and_wait_timeout(&g_uring.ring, 1, loop_timeout_ms());
+    if (rv < 0 && rv != -EINTR && rv != -EAGAIN && rv != -EBUSY && rv != -ETIME)
+    {
+      errno = -rv;
+      die("io_uring_enter()");
+    }
+    g_uring.now_ms = get_monotonic_msec();
+
+    while (struct io_uring_cqe *cqe = uring_peek_cqe(&g_uring.ring))
+    {
+      uint64_t data = cqe->user_data;
+      Conn *conn = (Conn *)(uintptr_t)(data & ~(uint64_t)UOP_MASK);
+      switch (data & UOP_MASK)
+      {
+      case UOP_ACCEPT:
+        uring_on_accept(cqe);
+        break;
+      case UOP_RECV:
+        uring_on_recv(conn, cqe);
+        break;
+      case UOP_SEND:
+        uring_on_send(conn, cqe);
+        break;
+      }
+      uring_cqe_seen(&g_uring.ring);
+    }
+    loop_tick(uring_close_cb, NULL);
   }
+  return true;
+}
+#endif // __linux__
 
-  return;
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s [--port N] [--backend poll|epoll|uring] [--edge-triggered]\n"
+          "          [--batch 1..%zu] [--rehash-us N] [--idle-timeout MS]\n"
+          "          [--io-threads 0..%zu] [--reactors 1..%zu]\n"
+          "          [--maxmemory BYTES[k|m|g]] [--zerocopy]\n"
+          "          [--maxmemory-policy noeviction|allkeys-lru|allkeys-lfu|allkeys-random]\n",
+          prog, k_batch_max, k_io_threads_max, k_reactors_max);
+  exit(1);
 }
 
-int main()
+// "100m" => 100 << 20
+static bool parse_bytes(const char *s, size_t &out)
 {
-  int fd = socket(AF_INET, SOCK_STREAM, 0);
-  if (fd < 0)
+  char *end = NULL;
+  unsigned long long n = strtoull(s, &end, 10);
+  if (end == s)
   {
-    die("socket()");
+    return false;
   }
-  int val = 1;
-  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
-
-  // bind
-  struct sockaddr_in addr = {};
-  addr.sin_family = AF_INET;
-  addr.sin_port = ntohs(1234);
-  addr.sin_addr.s_addr = ntohl(0); // wildcard address 0.0.0.0
-  int rv = bind(fd, (const sockaddr *)&addr, sizeof(addr));
-  if (rv)
+  int shift = 0;
+  switch (*end)
   {
-    die("bind()");
+  case 'k':
+    shift = 10;
+    break;
+  case 'm':
+    shift = 20;
+    break;
+  case 'g':
+    shift = 30;
+    break;
   }
-
-  // set the listen fd to nonblocking mode
-  fd_set_nb(fd);
-
-  // listen
-  fprintf(stderr, "trying to listen\n");
-  rv = listen(fd, SOMAXCONN);
-  if (rv)
+  if (shift)
   {
-    die("listen()");
+    end++;
   }
-  fprintf(stderr, "server FD = %d\n", fd);
-
-  std::vector<Conn *> fd2conn;
-  std::vector<struct pollfd> poll_args;
+  out = (size_t)n << shift;
+  return *end == '\0';
+}
 
-  fprintf(stderr, "started listening....\n");
-  while (true)
+static void parse_args(int argc, char **argv)
+{
+#ifdef __linux__
+  g_opts.backend = BACKEND_EPOLL;
+#endif
+  for (int i = 1; i < argc; ++i)
   {
-    poll_args.clear();
-    struct pollfd pfd = {fd, POLLIN, 0};
-    poll_args.push_back(pfd);
-
-    for (Conn *conn : fd2conn)
+    const char *arg = argv[i];
+    if (!strcmp(arg, "--port") && i + 1 < argc)
     {
-      if (!conn)
+      g_opts.port = (uint16_t)atoi(argv[++i]);
+    }
+    else if (!strcmp(arg, "--backend") && i + 1 < argc)
+    {
+      const char *name = argv[++i];
+      if (!strcmp(name, "poll"))
       {
-        continue;
+        g_opts.backend = BACKEND_POLL;
       }
-
-      struct pollfd pfd = {conn->fd, POLLERR, 0};
-      if (conn->want_to_read)
+#ifdef __linux__
+      else if (!strcmp(name, "epoll"))
       {
-        pfd.events |= POLLIN;
+        g_opts.backend = BACKEND_EPOLL;
       }
-      if (conn->want_to_write)
+      else if (!strcmp(name, "uring"))
       {
-        pfd.events |= POLLOUT;
+        g_opts.backend = BACKEND_URING;
+      }
+#endif
+      else
+      {
+        usage(argv[0]);
       }
-      poll_args.push_back(pfd);
     }
-
-    int rv = poll(poll_args.data(), (nfds_t)poll_args.size(), -1);
-    if (rv < 0 && errno == EINTR)
+    else if (!strcmp(arg, "--edge-triggered"))
     {
-      fprintf(stderr, "poll returned - %d, errno - %d, trying again\n", rv,
-              errno);
-      continue;
+      g_opts.edge_triggered = true;
     }
-    if (rv < 0)
+    else if (!strcmp(arg, "--batch") && i + 1 < argc)
     {
-      fprintf(stderr, "poll returned - %d", rv);
-      die("poll");
+      long n = atol(argv[++i]);
+      if (n < 1 || n > (long)k_batch_max)
+      {
+        usage(argv[0]);
+      }
+      g_opts.batch = (size_t)n;
     }
-
-    // We set POLLIN for server fd, so now we have connections to process
-    if (poll_args[0].revents)
+    else if (!strcmp(arg, "--rehash-us") && i + 1 < argc)
+    {
+      g_opts.rehash_us = strtoull(argv[++i], NULL, 10);
+    }
+    else if (!strcmp(arg, "--idle-timeout") && i + 1 < argc)
+    {
+      g_opts.idle_timeout_ms = strtoull(argv[++i], NULL, 10);
+    }
+    else if (!strcmp(arg, "--io-threads") && i + 1 < argc)
     {
-      if (Conn *conn = handle_accept(fd))
+      g_opts.io_threads = (uint32_t)atoi(argv[++i]);
+      if (g_opts.io_threads > k_io_threads_max)
       {
-        if (fd2conn.size() <= (size_t)conn->fd)
-        {
-          fd2conn.resize(conn->fd + 1);
-        }
-        fd2conn[conn->fd] = conn;
+        usage(argv[0]);
       }
     }
-
-    // handle connection sockets
-    // go over all known connections
-    // and check if they have revents
-    for (size_t i = 1; i < fd2conn.size(); ++i)
+    else if (!strcmp(arg, "--reactors") && i + 1 < argc)
     {
-      uint32_t ready = poll_args[i].revents;
-      if (ready == 0)
+      g_opts.reactors = (uint32_t)atoi(argv[++i]);
+      if (g_opts.reactors < 1 || g_opts.reactors > k_reactors_max)
       {
-        continue;
+        usage(argv[0]);
       }
-
-      Conn *conn = fd2conn[poll_args[i].fd];
-      if (!conn)
+    }
+    else if (!strcmp(arg, "--zerocopy"))
+    {
+      g_opts.zerocopy = true;
+    }
+    else if (!strcmp(arg, "--maxmemory") && i + 1 < argc)
+    {
+      if (!parse_bytes(argv[++i], g_opts.maxmemory))
       {
-        die("connection is nil");
+        usage(argv[0]);
       }
-      // check if they are POLLIN or POLLOUT or both
-      if (ready & POLLIN)
+    }
+    else if (!strcmp(arg, "--maxmemory-policy") && i + 1 < argc)
+    {
+      g_opts.evict_policy = evict_policy_parse(argv[++i]);
+      if (g_opts.evict_policy < 0)
       {
-        assert(conn->want_to_read);
-        handle_read(conn);
+        usage(argv[0]);
       }
+    }
+    else
+    {
+      usage(argv[0]);
+    }
+  }
+}
 
-      if (ready & POLLOUT)
-      {
-        assert(conn->want_to_write);
-        handle_write(conn);
-      }
+int main(int argc, char **argv)
+{
+  parse_args(argc, argv);
+  hash_seed_init();
+  signal(SIGPIPE, SIG_IGN); // a peer that went away must not kill the server
+  lazyfree_init();
+  hm_set_table_free(lazyfree_free);
 
-      if ((ready & POLLERR) || conn->want_to_close)
-      {
-        (void)close(conn->fd);
-        fd2conn[conn->fd] = NULL;
-        delete conn;
-        conn = nullptr;
-      }
-    }
+  int fd = listen_on(g_opts.port, g_opts.reactors > 1);
+  fprintf(stderr, "server FD = %d\n", fd);
+
+#ifdef __linux__
+  if (g_opts.reactors > 1)
+  {
+    run_reactors(fd);
+    return 0;
   }
+  if (g_opts.io_threads > 0)
+  {
+    run_io_threads_loop(fd);
+    return 0;
+  }
+  if (g_opts.backend == BACKEND_URING && run_uring_loop(fd))
+  {
+    return 0;
+  }
+  if (g_opts.backend != BACKEND_POLL)
+  {
+    run_epoll_loop(fd);
+    return 0;
+  }
+#endif
+  run_poll_loop(fd);
   return 0;
 }
 
@@ -485,22 +4358,31 @@ int main()
 
 
 static void response_begin(Buffer &buf, size_t *header_pos) {
-    *header_pos = buf.size();
+    *header_pos = buf.data_size();
     buf_append_u32(buf, 0); // place holder for now
 }
 
+// including the values it references
 static size_t response_size(Buffer &buf, size_t header) {
-    return buf.size() - header - 4;
+    size_t size = buf.data_size() - header - 4;
+    for (const OutRef &ref : g_data.out_refs) {
+        size += ref.val->len;
+    }
+    return size;
 }
 
 static void response_end(Buffer &buf, size_t header) {
     size_t msg_size = response_size(buf, header);
     if (msg_size > k_max_msg) {
+        for (OutRef &ref : g_data.out_refs) {
+            valblock_unref(ref.val);
+        }
+        g_data.out_refs.clear();
         // we just need 4 bytes for err
-        buf.resize(header + 4);
+        buf.truncate(header + 4);
         out_err(buf, ERR_TOO_LONG, "response is too big.");
         msg_size = response_size(buf, header);
     }
     uint32_t len = (uint32_t)msg_size;
-    memcpy(&buf[header], &len, 4);
+    memcpy(buf.data() + header, &len, 4);
 }
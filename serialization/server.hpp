@@ -1,30 +1,142 @@
+#include "entry.hpp"
+#include "hash.hpp"
 #include "hashtable.hpp"
+#include "list.hpp"
 #include "serialization.hpp"
 #include "vector"
+#include <cstring>
+#include <string>
+#include <string_view>
 
 constexpr size_t k_max_msg = 32 << 20;
+// handle_read() asks for at least this much free tail space per read()
+constexpr size_t k_min_read = 16 << 10;
 
 #define container_of(ptr, T, member) ((T *)((char *)ptr - offsetof(T, member)))
 
+struct Command;
+struct Conn;
+
+// a parsed request waiting in a pipelined batch
+struct Request {
+  std::vector<std::string_view> cmd; // views into Conn::incoming
+  const Command *c = nullptr;        // nullptr for an unknown command
+  bool has_key = false;
+  uint64_t hcode = 0; // hash of the first key, for prefetching
+  uint32_t shard = 0; // --reactors: the reactor that owns the key
+};
+
+// A big value that a response sends from its ValBlock instead of copying it
+// into a buffer (see out_val()): it goes out after the first `pos` bytes
+// that were ever appended to the buffer. Holds a reference.
+struct OutRef {
+  uint64_t pos = 0;
+  ValBlock *val = nullptr;
+};
+
+// --zerocopy: a value the kernel may still read, released once the send
+// with this sequence number is reported complete
+struct ZcHold {
+  uint32_t seq = 0;
+  ValBlock *val = nullptr;
+};
+
+// --reactors: the requests of a batch that go to one shard, and on the way
+// back their responses, back to back
+struct ShardMsg {
+  Conn *conn = nullptr;
+  uint32_t from = 0; // the connection's reactor
+  uint32_t to = 0;
+  std::vector<uint32_t> idx; // positions in Conn::io_reqs
+  Buffer out;
+  std::vector<size_t> ends; // where each response ends in `out`
+  std::vector<OutRef> refs; // positions in `out`
+  size_t cursor = 0;        // responses already gathered
+  size_t ref_cursor = 0;
+
+  ~ShardMsg() {
+    for (OutRef &ref : refs) {
+      valblock_unref(ref.val);
+    }
+  }
+};
+
 struct Conn {
   int fd = -1;
   bool want_to_read = false;
   bool want_to_write = false;
   bool want_to_close = false;
-  std::vector<uint8_t> incoming;
-  std::vector<uint8_t> outgoing;
+  uint32_t epoll_events = 0; // interest currently registered with epoll
+  // io_uring backend: the Conn is only freed once no request references it
+  uint32_t uring_inflight = 0;
+  uint32_t uring_sends = 0; // sends of the current linked chain
+  size_t uring_sent = 0;    // bytes sent by the current chain
+  bool uring_recv_armed = false;
+  bool uring_shutdown = false;
+  // idle timeout: position in the idle list of the thread doing the I/O,
+  // least recently active first
+  DList idle_node;
+  uint64_t last_active_ms = 0;
+  // --io-threads: the connection's I/O thread parses up to k_batch_max
+  // requests into io_reqs, the main thread runs them and consumes io_used
+  // bytes of incoming. Whichever side holds the Conn owns all of it.
+  uint32_t io_thread = 0;
+  std::vector<Request> io_reqs;
+  size_t io_nreqs = 0;
+  size_t io_used = 0;
+  // --reactors: one message per shard, allocated on the first batch that
+  // needs another shard. While replies are pending, nothing is read or
+  // consumed, since the other reactors look at io_reqs and incoming.
+  ShardMsg *shard_msgs = nullptr;
+  uint32_t shard_pending = 0;
+  Buffer incoming;
+  Buffer outgoing;
+  // the values sent by reference, in order, and where they go in the
+  // stream of outgoing: out_head bytes of it were sent, and out_ref_sent
+  // bytes of the first value
+  std::vector<OutRef> out_refs;
+  uint64_t out_head = 0;
+  size_t out_ref_sent = 0;
+  // --zerocopy: oldest send first
+  std::vector<ZcHold> zc_holds;
+  uint32_t zc_seq = 0; // of the next MSG_ZEROCOPY send
+
+  ~Conn() {
+    dlist_detach(&idle_node);
+    delete[] shard_msgs;
+    // the kernel keeps its own hold on the pages it still sends from
+    for (OutRef &ref : out_refs) {
+      valblock_unref(ref.val);
+    }
+    for (ZcHold &hold : zc_holds) {
+      valblock_unref(hold.val);
+    }
+  }
 };
 
-struct Entry {
-  struct HNode node;
-  std::string key;
-  std::string val;
+// what lookups hash and compare against: a view of the key in the request,
+// so finding an Entry does not need a temporary Entry or a string copy
+struct LookupKey {
+  struct HNode node; // only hcode is used
+  const char *data = nullptr;
+  size_t len = 0;
 };
 
-static bool entry_eq(HNode *x, HNode *y) {
-  Entry *ex = container_of(x, struct Entry, node);
-  Entry *ey = container_of(y, struct Entry, node);
-  return ex->key == ey->key;
+static uint64_t str_hash(const uint8_t *data, size_t len);
+// --reactors: the reactor that owns the key with this str_hash()
+static uint32_t key_shard(uint64_t hcode);
+
+static void lookup_key_init(LookupKey *key, std::string_view k) {
+  key->data = k.data();
+  key->len = k.size();
+  key->node.hcode = str_hash((const uint8_t *)k.data(), k.size());
+}
+
+// node is an Entry in the table, key is a LookupKey
+static bool entry_eq_key(HNode *node, HNode *key) {
+  Entry *ent = container_of(node, struct Entry, node);
+  LookupKey *lk = container_of(key, struct LookupKey, node);
+  return ent->klen == lk->len && memcmp(ent->data, lk->data, lk->len) == 0;
 }
 
 // server
@@ -40,11 +152,78 @@ struct Response {
 };
 // static int32_t write_all(int fd, const char *buf, size_t n);
 
-static void do_get(std::vector<std::string> &cmd, Buffer &);
-static void do_set(std::vector<std::string> &cmd, Buffer &);
-static void do_del(std::vector<std::string> &cmd, Buffer &);
-static void do_keys(std::vector<std::string> &, Buffer &);
-static void do_request(std::vector<std::string> &cmd, Buffer &);
+static void do_get(std::vector<std::string_view> &cmd, Buffer &);
+static void do_set(std::vector<std::string_view> &cmd, Buffer &);
+static void do_incr(std::vector<std::string_view> &cmd, Buffer &);
+static void do_decr(std::vector<std::string_view> &cmd, Buffer &);
+static void do_incrby(std::vector<std::string_view> &cmd, Buffer &);
+static void do_incrbyfloat(std::vector<std::string_view> &cmd, Buffer &);
+static void do_del(std::vector<std::string_view> &cmd, Buffer &);
+static void do_unlink(std::vector<std::string_view> &cmd, Buffer &);
+static void do_keys(std::vector<std::string_view> &, Buffer &);
+static void do_info(std::vector<std::string_view> &, Buffer &);
+static void do_scan(std::vector<std::string_view> &cmd, Buffer &);
+static void do_pexpire(std::vector<std::string_view> &cmd, Buffer &);
+static void do_pttl(std::vector<std::string_view> &cmd, Buffer &);
+static void do_persist(std::vector<std::string_view> &cmd, Buffer &);
+static void do_zadd(std::vector<std::string_view> &cmd, Buffer &);
+static void do_zrem(std::vector<std::string_view> &cmd, Buffer &);
+static void do_zscore(std::vector<std::string_view> &cmd, Buffer &);
+static void do_zrank(std::vector<std::string_view> &cmd, Buffer &);
+static void do_zcard(std::vector<std::string_view> &cmd, Buffer &);
+static void do_zrange(std::vector<std::string_view> &cmd, Buffer &);
+static void do_zrangebyscore(std::vector<std::string_view> &cmd, Buffer &);
+static void do_zquery(std::vector<std::string_view> &cmd, Buffer &);
+static void do_lpush(std::vector<std::string_view> &cmd, Buffer &);
+static void do_rpush(std::vector<std::string_view> &cmd, Buffer &);
+static void do_lpop(std::vector<std::string_view> &cmd, Buffer &);
+static void do_rpop(std::vector<std::string_view> &cmd, Buffer &);
+static void do_llen(std::vector<std::string_view> &cmd, Buffer &);
+static void do_lindex(std::vector<std::string_view> &cmd, Buffer &);
+static void do_lrange(std::vector<std::string_view> &cmd, Buffer &);
+static void do_ltrim(std::vector<std::string_view> &cmd, Buffer &);
+static void do_hset(std::vector<std::string_view> &cmd, Buffer &);
+static void do_hget(std::vector<std::string_view> &cmd, Buffer &);
+static void do_hdel(std::vector<std::string_view> &cmd, Buffer &);
+static void do_hlen(std::vector<std::string_view> &cmd, Buffer &);
+static void do_hgetall(std::vector<std::string_view> &cmd, Buffer &);
+static void do_hmget(std::vector<std::string_view> &cmd, Buffer &);
+static void do_hincrby(std::vector<std::string_view> &cmd, Buffer &);
+static void do_sadd(std::vector<std::string_view> &cmd, Buffer &);
+static void do_srem(std::vector<std::string_view> &cmd, Buffer &);
+static void do_sismember(std::vector<std::string_view> &cmd, Buffer &);
+static void do_scard(std::vector<std::string_view> &cmd, Buffer &);
+static void do_sinter(std::vector<std::string_view> &cmd, Buffer &);
+static void do_sunion(std::vector<std::string_view> &cmd, Buffer &);
+static void do_sdiff(std::vector<std::string_view> &cmd, Buffer &);
+static void do_sintercard(std::vector<std::string_view> &cmd, Buffer &);
+
+// command table
+enum {
+  CMD_READ = 1 << 0,  // reads the keyspace
+  CMD_WRITE = 1 << 1, // may modify the keyspace
+  CMD_DENYOOM = 1 << 2, // may use more memory: refused over maxmemory
+};
+
+typedef void (*cmd_handler)(std::vector<std::string_view> &cmd, Buffer &);
+
+struct Command {
+  std::string_view name;
+  // number of arguments including the name, -N means at least N
+  int32_t arity;
+  uint32_t flags;
+  // keys are cmd[first_key], cmd[first_key + key_step], ... up to last_key
+  // (negative: counted from the end); first_key == 0 means no keys
+  int8_t first_key;
+  int8_t last_key;
+  int8_t key_step;
+  cmd_handler handler;
+};
+
+static const Command *cmd_lookup(std::string_view name);
+static void do_request(const Command *c, std::vector<std::string_view> &cmd,
+                       Buffer &);
+static bool db_make_room();
 
 // Utils
 static void msg(const char *msg) { fprintf(stderr, "%s\n", msg); }
@@ -59,11 +238,7 @@ static void die(const char *msg) {
   abort();
 }
 static uint64_t str_hash(const uint8_t *data, size_t len) {
-  uint32_t h = 0x811C9DC5;
-  for (size_t i = 0; i < len; i++) {
-    h = (h + data[i]) * 0x01000193;
-  }
-  return h;
+  return hash64(data, len, g_hash_seed);
 }
 
 
@@ -0,0 +1,952 @@
+// Commands against a real ./server, started on a port of its own for each
+// group of tests and killed after.
+#include "test_util.hpp"
+#include "uring.hpp"
+#include <arpa/inet.h>
+#include <atomic>
+#include <fcntl.h>
+#include <iostream>
+#include <netinet/ip.h>
+#include <set>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+enum { TAG_NIL = 0, TAG_ERR = 1, TAG_STR = 2, TAG_INT = 3, TAG_DBL = 4, TAG_ARR = 5 };
+
+struct Reply {
+  uint8_t tag = TAG_NIL;
+  int64_t num = 0;  // TAG_INT, or the error code
+  double dbl = 0;   // TAG_DBL
+  std::string str;  // TAG_STR, or the error message
+  std::vector<Reply> arr;
+
+  bool isNil() const { return tag == TAG_NIL; }
+  bool isErr() const { return tag == TAG_ERR; }
+  bool isInt(int64_t v) const { return tag == TAG_INT && num == v; }
+  bool isStr(const std::string &s) const { return tag == TAG_STR && str == s; }
+};
+
+struct Server {
+  pid_t pid = -1;
+  uint16_t port = 0;
+};
+
+static int connectTo(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = ntohs(port);
+  addr.sin_addr.s_addr = ntohl(INADDR_LOOPBACK);
+  if (fd >= 0 && connect(fd, (const struct sockaddr *)&addr, sizeof(addr))) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// added to every ./server command line, to run tests again on another backend
+static std::vector<const char *> g_extraArgs;
+
+// ./server --port <port> plus `args`; false if it does not take connections
+static bool startServer(Server &srv, uint16_t port, std::vector<const char *> args) {
+  args.insert(args.end(), g_extraArgs.begin(), g_extraArgs.end());
+  srv.port = port;
+  srv.pid = fork();
+  if (srv.pid == 0) {
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, 2);
+    char portbuf[16];
+    snprintf(portbuf, sizeof(portbuf), "%u", port);
+    std::vector<const char *> argv = {"./server", "--port", portbuf};
+    argv.insert(argv.end(), args.begin(), args.end());
+    argv.push_back(NULL);
+    execv(argv[0], (char *const *)argv.data());
+    _exit(127);
+  }
+  for (int i = 0; i < 200; ++i) {
+    usleep(10000);
+    int fd = connectTo(port);
+    if (fd >= 0) {
+      close(fd);
+      return true;
+    }
+  }
+  return false;
+}
+
+static void stopServer(Server &srv) {
+  kill(srv.pid, SIGKILL);
+  waitpid(srv.pid, NULL, 0);
+}
+
+static bool readFull(int fd, char *buf, size_t n) {
+  while (n > 0) {
+    ssize_t rv = read(fd, buf, n);
+    if (rv <= 0) {
+      return false;
+    }
+    n -= rv;
+    buf += rv;
+  }
+  return true;
+}
+
+static bool writeAll(int fd, const std::string &buf) {
+  size_t off = 0;
+  while (off < buf.size()) {
+    ssize_t rv = write(fd, buf.data() + off, buf.size() - off);
+    if (rv <= 0) {
+      return false;
+    }
+    off += rv;
+  }
+  return true;
+}
+
+static bool parseReply(const std::string &data, size_t &pos, Reply &out) {
+  auto take = [&](void *dst, size_t n) {
+    if (data.size() - pos < n) {
+      return false;
+    }
+    memcpy(dst, data.data() + pos, n);
+    pos += n;
+    return true;
+  };
+  uint32_t len = 0, code = 0;
+  if (!take(&out.tag, 1)) {
+    return false;
+  }
+  switch (out.tag) {
+  case TAG_NIL:
+    return true;
+  case TAG_ERR:
+    if (!take(&code, 4) || !take(&len, 4) || data.size() - pos < len) {
+      return false;
+    }
+    out.num = code;
+    out.str = data.substr(pos, len);
+    pos += len;
+    return true;
+  case TAG_STR:
+    if (!take(&len, 4) || data.size() - pos < len) {
+      return false;
+    }
+    out.str = data.substr(pos, len);
+    pos += len;
+    return true;
+  case TAG_INT:
+    return take(&out.num, 8);
+  case TAG_DBL:
+    return take(&out.dbl, 8);
+  case TAG_ARR:
+    if (!take(&len, 4)) {
+      return false;
+    }
+    out.arr.resize(len);
+    for (Reply &r : out.arr) {
+      if (!parseReply(data, pos, r)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  return false;
+}
+
+// a request: [len][nstr][len][str]...
+static std::string encode(const std::vector<std::string> &cmd) {
+  std::string req;
+  uint32_t len = 4;
+  for (const std::string &s : cmd) {
+    len += 4 + s.size();
+  }
+  req.append((const char *)&len, 4);
+  uint32_t n = cmd.size();
+  req.append((const char *)&n, 4);
+  for (const std::string &s : cmd) {
+    uint32_t p = s.size();
+    req.append((const char *)&p, 4);
+    req.append(s);
+  }
+  return req;
+}
+
+// A broken connection or response comes back as an error with code -1.
+static Reply readReply(int fd) {
+  Reply reply;
+  reply.tag = TAG_ERR;
+  reply.num = -1;
+  uint32_t len = 0;
+  if (!readFull(fd, (char *)&len, 4)) {
+    return reply;
+  }
+  std::string data(len, '\0');
+  size_t pos = 0;
+  Reply parsed;
+  if (!readFull(fd, &data[0], len) || !parseReply(data, pos, parsed) || pos != len) {
+    return reply;
+  }
+  return parsed;
+}
+
+// one request, one response
+static Reply call(int fd, const std::vector<std::string> &cmd) {
+  if (!writeAll(fd, encode(cmd))) {
+    Reply reply;
+    reply.tag = TAG_ERR;
+    reply.num = -1;
+    return reply;
+  }
+  return readReply(fd);
+}
+
+// the requests in one write, so the server reads them in one go
+static std::vector<Reply> pipeline(int fd, const std::vector<std::vector<std::string>> &cmds) {
+  std::string reqs;
+  for (const std::vector<std::string> &cmd : cmds) {
+    reqs += encode(cmd);
+  }
+  std::vector<Reply> replies;
+  if (writeAll(fd, reqs)) {
+    for (size_t i = 0; i < cmds.size(); ++i) {
+      replies.push_back(readReply(fd));
+    }
+  }
+  return replies;
+}
+
+// a number from INFO, -1 if it is not there
+static int64_t info(int fd, const std::string &name) {
+  Reply r = call(fd, {"info"});
+  size_t pos = r.tag == TAG_STR ? r.str.find("\n" + name + ":") : std::string::npos;
+  if (r.tag == TAG_STR && r.str.compare(0, name.size() + 1, name + ":") == 0) {
+    pos = 0;
+  } else if (pos != std::string::npos) {
+    pos++;
+  } else {
+    return -1;
+  }
+  return std::stoll(r.str.substr(pos + name.size() + 1));
+}
+
+// Every key of this connection's shard, by SCAN; false on a bad reply
+static bool scanAll(int fd, std::set<std::string> &keys) {
+  std::string cursor = "0";
+  do {
+    Reply r = call(fd, {"scan", cursor, "count", "50"});
+    if (r.tag != TAG_ARR || r.arr.size() != 2 || r.arr[0].tag != TAG_STR ||
+        r.arr[1].tag != TAG_ARR) {
+      return false;
+    }
+    cursor = r.arr[0].str;
+    for (const Reply &key : r.arr[1].arr) {
+      keys.insert(key.str);
+    }
+  } while (cursor != "0");
+  return true;
+}
+
+// Each reactor scans its own shard. Several connections scanning at once,
+// on every reactor, must each get the same keys every time.
+void testConcurrentScan() {
+  Server srv;
+  bool passed = startServer(srv, 12470, {"--reactors", "4"});
+  int fd = passed ? connectTo(srv.port) : -1;
+  const int nkeys = 4000;
+  for (int i = 0; i < nkeys && fd >= 0; ++i) {
+    passed = passed && call(fd, {"set", "key:" + std::to_string(i), "v"}).isNil();
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+
+  std::atomic<bool> ok{passed};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8 && passed; ++t) {
+    threads.emplace_back([&]() {
+      int cfd = connectTo(srv.port);
+      std::set<std::string> first;
+      if (cfd < 0 || !scanAll(cfd, first) || first.empty()) {
+        ok = false;
+      }
+      for (int round = 0; round < 100 && ok; ++round) {
+        std::set<std::string> keys;
+        if (!scanAll(cfd, keys) || keys != first) {
+          ok = false;
+        }
+      }
+      for (const std::string &key : first) {
+        if (key.compare(0, 4, "key:") != 0 || std::stoi(key.substr(4)) >= nkeys) {
+          ok = false;
+        }
+      }
+      if (cfd >= 0) {
+        close(cfd);
+      }
+    });
+  }
+  for (std::thread &t : threads) {
+    t.join();
+  }
+  stopServer(srv);
+
+  runTest("Concurrent Scan", ok);
+}
+
+// COUNT is a bounded hint, and must be positive
+void testScanCount() {
+  Server srv;
+  bool passed = startServer(srv, 12471, {});
+  int fd = passed ? connectTo(srv.port) : -1;
+  for (int i = 0; i < 3000 && fd >= 0; ++i) {
+    passed = passed && call(fd, {"set", "key:" + std::to_string(i), "v"}).isNil();
+  }
+  Reply r = call(fd, {"scan", "0", "count", "99999999999999999"});
+  passed = passed && r.tag == TAG_ARR && r.arr.size() == 2 &&
+           r.arr[1].arr.size() < 3000 && r.arr[1].arr.size() >= 1000;
+  passed = passed && call(fd, {"scan", "0", "count", "0"}).isErr() &&
+           call(fd, {"scan", "0", "count", "-1"}).isErr();
+  if (fd >= 0) {
+    close(fd);
+  }
+  stopServer(srv);
+
+  runTest("Scan Count", passed);
+}
+
+// the members of a reply array, ignoring anything else in it
+static std::vector<std::string> strs(const Reply &r) {
+  std::vector<std::string> out;
+  for (const Reply &e : r.arr) {
+    if (e.tag == TAG_STR) {
+      out.push_back(e.str);
+    }
+  }
+  return out;
+}
+
+typedef std::vector<std::string> Strs;
+
+// z* commands: ranges by rank and score, bad arguments, type errors, and the
+// key going away with its last member
+void testZsetCommands() {
+  Server srv;
+  bool passed = startServer(srv, 12472, {});
+  int fd = passed ? connectTo(srv.port) : -1;
+
+  passed = passed && call(fd, {"zadd", "z", "1", "a", "2", "b", "3", "c"}).isInt(3) &&
+           call(fd, {"zadd", "z", "0", "c", "4", "d"}).isInt(1) &&
+           call(fd, {"zcard", "z"}).isInt(4);
+  // c, a, b, d
+  passed = passed && strs(call(fd, {"zrange", "z", "0", "-1"})) == Strs{"c", "a", "b", "d"} &&
+           strs(call(fd, {"zrange", "z", "-2", "-1"})) == Strs{"b", "d"} &&
+           strs(call(fd, {"zrange", "z", "-100", "1"})) == Strs{"c", "a"} &&
+           strs(call(fd, {"zrange", "z", "2", "100"})) == Strs{"b", "d"} &&
+           call(fd, {"zrange", "z", "3", "1"}).arr.empty() &&
+           call(fd, {"zrange", "z", "4", "10"}).arr.empty() &&
+           call(fd, {"zrange", "missing", "0", "-1"}).arr.empty();
+  Reply ws = call(fd, {"zrange", "z", "0", "0", "withscores"});
+  passed = passed && ws.arr.size() == 2 && ws.arr[0].isStr("c") && ws.arr[1].tag == TAG_DBL &&
+           ws.arr[1].dbl == 0;
+
+  passed = passed &&
+           strs(call(fd, {"zrangebyscore", "z", "-inf", "+inf"})) == Strs{"c", "a", "b", "d"} &&
+           strs(call(fd, {"zrangebyscore", "z", "1", "2"})) == Strs{"a", "b"} &&
+           strs(call(fd, {"zrangebyscore", "z", "0", "10", "limit", "1", "2"})) ==
+               Strs{"a", "b"} &&
+           call(fd, {"zrangebyscore", "z", "5", "10"}).arr.empty() &&
+           call(fd, {"zrangebyscore", "z", "0", "10", "limit", "-1", "2"}).isErr();
+  passed = passed && strs(call(fd, {"zquery", "z", "2", "", "-1", "2"})) == Strs{"a", "b"} &&
+           call(fd, {"zquery", "z", "0", "", "-5", "2"}).arr.empty() &&
+           call(fd, {"zquery", "z", "9", "", "0", "2"}).arr.empty();
+
+  Reply score = call(fd, {"zscore", "z", "d"});
+  passed = passed && score.tag == TAG_DBL && score.dbl == 4 &&
+           call(fd, {"zscore", "z", "x"}).isNil() && call(fd, {"zrank", "z", "b"}).isInt(2) &&
+           call(fd, {"zrank", "z", "x"}).isNil();
+
+  passed = passed && call(fd, {"zadd", "z", "nan", "e"}).isErr() &&
+           call(fd, {"zadd", "z", "x", "e"}).isErr() && call(fd, {"zadd", "z", "1"}).isErr() &&
+           call(fd, {"zcard", "z"}).isInt(4);
+  passed = passed && call(fd, {"set", "s", "v"}).isNil() &&
+           call(fd, {"zadd", "s", "1", "a"}).num == 5 &&
+           call(fd, {"zrange", "s", "0", "1"}).num == 5;
+
+  // the last member takes the key with it
+  passed = passed && call(fd, {"zrem", "z", "a", "b", "x"}).isInt(2) &&
+           call(fd, {"zrem", "z", "c", "d"}).isInt(2) && call(fd, {"pttl", "z"}).isInt(-2) &&
+           call(fd, {"zcard", "z"}).isInt(0);
+
+  // past the packed limits, and back
+  for (int i = 0; i < 300 && passed; ++i) {
+    passed = call(fd, {"zadd", "big", std::to_string(i), "m" + std::to_string(i)}).isInt(1);
+  }
+  passed = passed && call(fd, {"zrank", "big", "m299"}).isInt(299) &&
+           strs(call(fd, {"zrange", "big", "-1", "-1"})) == Strs{"m299"} &&
+           call(fd, {"del", "big"}).isInt(1) && call(fd, {"zcard", "big"}).isInt(0);
+
+  if (fd >= 0) {
+    close(fd);
+  }
+  stopServer(srv);
+
+  runTest("ZSet Commands", passed);
+}
+
+// list commands: indices from either end and out of range, trims, type
+// errors, and the key going away with its last element
+void testListCommands() {
+  Server srv;
+  bool passed = startServer(srv, 12473, {});
+  int fd = passed ? connectTo(srv.port) : -1;
+
+  passed = passed && call(fd, {"rpush", "l", "a", "b", "c"}).isInt(3) &&
+           call(fd, {"lpush", "l", "y", "z"}).isInt(5) && call(fd, {"llen", "l"}).isInt(5);
+  // z y a b c
+  passed = passed && strs(call(fd, {"lrange", "l", "0", "-1"})) ==
+                         Strs{"z", "y", "a", "b", "c"} &&
+           strs(call(fd, {"lrange", "l", "-2", "-1"})) == Strs{"b", "c"} &&
+           strs(call(fd, {"lrange", "l", "-100", "0"})) == Strs{"z"} &&
+           strs(call(fd, {"lrange", "l", "3", "100"})) == Strs{"b", "c"} &&
+           call(fd, {"lrange", "l", "2", "1"}).arr.empty() &&
+           call(fd, {"lrange", "l", "5", "9"}).arr.empty() &&
+           call(fd, {"lrange", "missing", "0", "-1"}).arr.empty() &&
+           call(fd, {"lrange", "l", "x", "1"}).isErr();
+  passed = passed && call(fd, {"lindex", "l", "0"}).isStr("z") &&
+           call(fd, {"lindex", "l", "-1"}).isStr("c") &&
+           call(fd, {"lindex", "l", "-5"}).isStr("z") && call(fd, {"lindex", "l", "-6"}).isNil() &&
+           call(fd, {"lindex", "l", "5"}).isNil() &&
+           call(fd, {"lindex", "l", "-9223372036854775808"}).isNil() &&
+           call(fd, {"lindex", "missing", "0"}).isNil();
+
+  passed = passed && call(fd, {"lpop", "l"}).isStr("z") && call(fd, {"rpop", "l"}).isStr("c") &&
+           call(fd, {"lpop", "missing"}).isNil();
+  // y a b
+  passed = passed && call(fd, {"ltrim", "l", "1", "-1"}).isNil() &&
+           strs(call(fd, {"lrange", "l", "0", "-1"})) == Strs{"a", "b"} &&
+           call(fd, {"ltrim", "l", "-100", "100"}).isNil() && call(fd, {"llen", "l"}).isInt(2);
+
+  passed = passed && call(fd, {"set", "s", "v"}).isNil() &&
+           call(fd, {"rpush", "s", "a"}).num == 5 && call(fd, {"llen", "s"}).num == 5;
+
+  // emptied by pops, and by a trim that keeps nothing
+  passed = passed && call(fd, {"rpop", "l"}).isStr("b") && call(fd, {"rpop", "l"}).isStr("a") &&
+           call(fd, {"pttl", "l"}).isInt(-2) && call(fd, {"llen", "l"}).isInt(0);
+  passed = passed && call(fd, {"rpush", "t", "a", "b"}).isInt(2) &&
+           call(fd, {"ltrim", "t", "2", "5"}).isNil() && call(fd, {"pttl", "t"}).isInt(-2);
+
+  // elements of many nodes, and bigger than one
+  std::string big(20000, 'x');
+  passed = passed && call(fd, {"rpush", "n", big}).isInt(1);
+  for (int i = 0; i < 2000 && passed; ++i) {
+    passed = call(fd, {"rpush", "n", std::string(100, 'a' + i % 26)}).isInt(i + 2);
+  }
+  passed = passed && call(fd, {"lindex", "n", "0"}).isStr(big) &&
+           call(fd, {"lindex", "n", "-1"}).isStr(std::string(100, 'a' + 1999 % 26)) &&
+           call(fd, {"ltrim", "n", "1", "-2"}).isNil() && call(fd, {"llen", "n"}).isInt(1999) &&
+           call(fd, {"lindex", "n", "0"}).isStr(std::string(100, 'a'));
+
+  if (fd >= 0) {
+    close(fd);
+  }
+  stopServer(srv);
+
+  runTest("List Commands", passed);
+}
+
+// h* commands: replies, bad arguments, type errors, hincrby's limits, and
+// the key going away with its last field
+void testHashCommands() {
+  Server srv;
+  bool passed = startServer(srv, 12474, {});
+  int fd = passed ? connectTo(srv.port) : -1;
+
+  passed = passed && call(fd, {"hset", "h", "a", "1", "b", "2"}).isInt(2) &&
+           call(fd, {"hset", "h", "a", "3", "c", "4"}).isInt(1) &&
+           call(fd, {"hset", "h", "a"}).isErr() && call(fd, {"hlen", "h"}).isInt(3) &&
+           call(fd, {"hlen", "missing"}).isInt(0);
+  passed = passed && call(fd, {"hget", "h", "a"}).isStr("3") &&
+           call(fd, {"hget", "h", "x"}).isNil() && call(fd, {"hget", "missing", "a"}).isNil();
+  Reply r = call(fd, {"hmget", "h", "c", "x", "a"});
+  passed = passed && r.arr.size() == 3 && r.arr[0].isStr("4") && r.arr[1].isNil() &&
+           r.arr[2].isStr("3");
+  std::set<std::string> all;
+  for (const std::string &s : strs(call(fd, {"hgetall", "h"}))) {
+    all.insert(s);
+  }
+  passed = passed && all == std::set<std::string>{"a", "3", "b", "2", "c", "4"} &&
+           call(fd, {"hgetall", "missing"}).arr.empty();
+
+  // a missing field counts as 0; values that are not int64s, and overflow,
+  // change nothing
+  passed = passed && call(fd, {"hincrby", "h", "a", "10"}).isInt(13) &&
+           call(fd, {"hincrby", "h", "n", "-5"}).isInt(-5) &&
+           call(fd, {"hget", "h", "n"}).isStr("-5") &&
+           call(fd, {"hincrby", "h", "a", "x"}).isErr() &&
+           call(fd, {"hset", "h", "s", "abc"}).isInt(1) &&
+           call(fd, {"hincrby", "h", "s", "1"}).isErr() &&
+           call(fd, {"hset", "h", "m", "9223372036854775807"}).isInt(1) &&
+           call(fd, {"hincrby", "h", "m", "1"}).isErr() &&
+           call(fd, {"hget", "h", "m"}).isStr("9223372036854775807") &&
+           call(fd, {"hincrby", "h", "m", "-9223372036854775807"}).isInt(0);
+  passed = passed && call(fd, {"hincrby", "fresh", "f", "x"}).isErr() &&
+           call(fd, {"pttl", "fresh"}).isInt(-2) &&
+           call(fd, {"hincrby", "fresh", "f", "7"}).isInt(7);
+
+  passed = passed && call(fd, {"set", "s", "v"}).isNil() &&
+           call(fd, {"hset", "s", "a", "1"}).num == 5 && call(fd, {"hget", "s", "a"}).num == 5 &&
+           call(fd, {"hincrby", "s", "a", "1"}).num == 5 && call(fd, {"get", "s"}).isStr("v");
+
+  // emptied by hdel
+  passed = passed && call(fd, {"hset", "e", "a", "1", "b", "2"}).isInt(2) &&
+           call(fd, {"hdel", "e", "a", "x"}).isInt(1) && call(fd, {"hdel", "e", "b"}).isInt(1) &&
+           call(fd, {"pttl", "e"}).isInt(-2) && call(fd, {"hdel", "e", "b"}).isInt(0);
+
+  // many fields, and long ones, in the converted map
+  for (int i = 0; i < 300 && passed; ++i) {
+    passed = call(fd, {"hset", "big", "f" + std::to_string(i), std::to_string(i)}).isInt(1);
+  }
+  std::string longField(200, 'f');
+  passed = passed && call(fd, {"hset", "big", longField, "v"}).isInt(1) &&
+           call(fd, {"hlen", "big"}).isInt(301) &&
+           call(fd, {"hget", "big", longField}).isStr("v") &&
+           call(fd, {"hincrby", "big", "f299", "1"}).isInt(300) &&
+           call(fd, {"hincrby", "big", "f0", "12345678901234"}).isInt(12345678901234) &&
+           call(fd, {"hget", "big", "f0"}).isStr("12345678901234");
+
+  if (fd >= 0) {
+    close(fd);
+  }
+  stopServer(srv);
+
+  runTest("Hash Commands", passed);
+}
+
+// s* commands: the set operations with missing keys, sintercard's LIMIT and
+// arguments, type errors, and the key going away with its last member
+void testSetCommands() {
+  Server srv;
+  bool passed = startServer(srv, 12475, {});
+  int fd = passed ? connectTo(srv.port) : -1;
+
+  passed = passed && call(fd, {"sadd", "a", "1", "2", "3", "4", "x"}).isInt(5) &&
+           call(fd, {"sadd", "a", "1", "5"}).isInt(1) &&
+           call(fd, {"sadd", "b", "2", "3", "4", "y"}).isInt(4) &&
+           call(fd, {"scard", "a"}).isInt(6) && call(fd, {"scard", "missing"}).isInt(0) &&
+           call(fd, {"sismember", "a", "x"}).isInt(1) &&
+           call(fd, {"sismember", "a", "y"}).isInt(0) &&
+           call(fd, {"sismember", "missing", "x"}).isInt(0);
+
+  auto sorted = [&](const std::vector<std::string> &cmd) {
+    std::set<std::string> out;
+    for (const std::string &m : strs(call(fd, cmd))) {
+      out.insert(m);
+    }
+    return out;
+  };
+  typedef std::set<std::string> Set;
+  passed = passed && sorted({"sinter", "a", "b"}) == Set{"2", "3", "4"} &&
+           sorted({"sinter", "a", "b", "missing"}).empty() &&
+           sorted({"sunion", "a", "b", "missing"}) == Set{"1", "2", "3", "4", "5", "x", "y"} &&
+           sorted({"sdiff", "a", "b", "missing"}) == Set{"1", "5", "x"} &&
+           sorted({"sdiff", "missing", "a"}).empty();
+
+  passed = passed && call(fd, {"sintercard", "2", "a", "b"}).isInt(3) &&
+           call(fd, {"sintercard", "2", "a", "b", "limit", "2"}).isInt(2) &&
+           call(fd, {"sintercard", "2", "a", "b", "limit", "0"}).isInt(3) &&
+           call(fd, {"sintercard", "2", "a", "b", "limit", "10"}).isInt(3) &&
+           call(fd, {"sintercard", "1", "a", "limit", "4"}).isInt(4) &&
+           call(fd, {"sintercard", "2", "a", "missing"}).isInt(0) &&
+           call(fd, {"sintercard", "0", "a"}).isErr() &&
+           call(fd, {"sintercard", "3", "a", "b"}).isErr() &&
+           call(fd, {"sintercard", "2", "a", "b", "limit"}).isErr() &&
+           call(fd, {"sintercard", "2", "a", "b", "limit", "-1"}).isErr() &&
+           call(fd, {"sintercard", "2", "a", "b", "count", "1"}).isErr();
+
+  // integer sets, one of them wide, through the merge kernels
+  std::vector<std::string> big = {"sadd", "ints"}, small = {"sadd", "few"};
+  for (int i = 0; i < 5000; ++i) {
+    big.push_back(std::to_string(i * 2));
+  }
+  big.push_back("4294967296");
+  for (int i = 0; i < 100; ++i) {
+    small.push_back(std::to_string(i));
+  }
+  passed = passed && call(fd, big).isInt(5001) && call(fd, small).isInt(100) &&
+           call(fd, {"sintercard", "2", "ints", "few"}).isInt(50) &&
+           call(fd, {"sintercard", "2", "ints", "few", "limit", "7"}).isInt(7) &&
+           call(fd, {"sintercard", "2", "few", "a", "limit", "2"}).isInt(2);
+
+  passed = passed && call(fd, {"set", "s", "v"}).isNil() &&
+           call(fd, {"sadd", "s", "a"}).num == 5 && call(fd, {"scard", "s"}).num == 5 &&
+           call(fd, {"sinter", "a", "s"}).num == 5 &&
+           call(fd, {"sintercard", "2", "a", "s"}).num == 5;
+
+  // emptied by srem
+  passed = passed && call(fd, {"sadd", "e", "1", "z"}).isInt(2) &&
+           call(fd, {"srem", "e", "1", "nope"}).isInt(1) && call(fd, {"srem", "e", "z"}).isInt(1) &&
+           call(fd, {"pttl", "e"}).isInt(-2) && call(fd, {"srem", "e", "z"}).isInt(0);
+
+  if (fd >= 0) {
+    close(fd);
+  }
+  stopServer(srv);
+
+  runTest("Set Commands", passed);
+}
+
+// incr and hincrby take only canonical integers, and incrbyfloat stores
+// fixed notation
+void testCounterCommands() {
+  Server srv;
+  bool passed = startServer(srv, 12476, {});
+  int fd = passed ? connectTo(srv.port) : -1;
+
+  for (const char *val : {"007", "+5", "-0", " 5", "5 ", "", "1.0"}) {
+    passed = passed && call(fd, {"set", "n", val}).isNil() && call(fd, {"incr", "n"}).isErr() &&
+             call(fd, {"get", "n"}).isStr(val) &&
+             call(fd, {"hset", "h", "f", val}).tag == TAG_INT &&
+             call(fd, {"hincrby", "h", "f", "1"}).isErr() &&
+             call(fd, {"hget", "h", "f"}).isStr(val);
+  }
+  passed = passed && call(fd, {"set", "n", "-9"}).isNil() &&
+           call(fd, {"incrby", "n", "10"}).isInt(1) && call(fd, {"get", "n"}).isStr("1");
+
+  passed = passed && call(fd, {"set", "d", "1e19"}).isNil() &&
+           call(fd, {"incrbyfloat", "d", "1e19"}).tag == TAG_DBL &&
+           call(fd, {"get", "d"}).isStr("20000000000000000000") &&
+           call(fd, {"incrbyfloat", "x", "1.5"}).tag == TAG_DBL &&
+           call(fd, {"get", "x"}).isStr("1.5") &&
+           call(fd, {"incrbyfloat", "x", "0.5"}).tag == TAG_DBL &&
+           call(fd, {"get", "x"}).isStr("2") && call(fd, {"incr", "x"}).isInt(3) &&
+           call(fd, {"incrbyfloat", "x", "-3.25e-5"}).tag == TAG_DBL &&
+           call(fd, {"get", "x"}).isStr("2.9999675");
+
+  if (fd >= 0) {
+    close(fd);
+  }
+  stopServer(srv);
+
+  runTest("Counter Commands", passed);
+}
+
+static bool between(const Reply &r, int64_t lo, int64_t hi) {
+  return r.tag == TAG_INT && r.num >= lo && r.num <= hi;
+}
+
+// TTLs: pexpire, set's px and ex, what drops or keeps a TTL, and keys going
+// away on access and on their own
+void testExpireCommands() {
+  Server srv;
+  bool passed = startServer(srv, 12477, {});
+  int fd = passed ? connectTo(srv.port) : -1;
+
+  // a TTL <= 0 deletes the key
+  passed = passed && call(fd, {"set", "k", "v"}).isNil() &&
+           call(fd, {"pexpire", "k", "0"}).isInt(1) && call(fd, {"pttl", "k"}).isInt(-2) &&
+           call(fd, {"set", "k", "v"}).isNil() && call(fd, {"pexpire", "k", "-5"}).isInt(1) &&
+           call(fd, {"get", "k"}).isNil() && call(fd, {"pexpire", "k", "100"}).isInt(0) &&
+           call(fd, {"pexpire", "k", "x"}).isErr();
+
+  passed = passed && call(fd, {"set", "k", "v", "px", "100000"}).isNil() &&
+           between(call(fd, {"pttl", "k"}), 90000, 100000) &&
+           call(fd, {"set", "k", "v", "ex", "100"}).isNil() &&
+           between(call(fd, {"pttl", "k"}), 90000, 100000) &&
+           call(fd, {"set", "k", "w", "ex", "9223372036854775"}).isNil() &&
+           call(fd, {"set", "k", "v", "ex", "9223372036854776"}).isErr() &&
+           call(fd, {"set", "k", "v", "ex", "0"}).isErr() &&
+           call(fd, {"set", "k", "v", "px", "-1"}).isErr() &&
+           call(fd, {"set", "k", "v", "nx", "1"}).isErr() && call(fd, {"get", "k"}).isStr("w");
+
+  // a plain set drops the TTL, persist removes it, incr keeps it
+  passed = passed && call(fd, {"set", "k", "v", "px", "100000"}).isNil() &&
+           call(fd, {"set", "k", "v"}).isNil() && call(fd, {"pttl", "k"}).isInt(-1) &&
+           call(fd, {"pexpire", "k", "100000"}).isInt(1) && call(fd, {"persist", "k"}).isInt(1) &&
+           call(fd, {"pttl", "k"}).isInt(-1) && call(fd, {"persist", "k"}).isInt(0) &&
+           call(fd, {"persist", "missing"}).isInt(0);
+  passed = passed && call(fd, {"set", "c", "1", "px", "100000"}).isNil() &&
+           call(fd, {"incr", "c"}).isInt(2) && between(call(fd, {"pttl", "c"}), 90000, 100000) &&
+           call(fd, {"incrbyfloat", "c", "0.5"}).tag == TAG_DBL &&
+           between(call(fd, {"pttl", "c"}), 90000, 100000) && call(fd, {"del", "c"}).isInt(1);
+
+  // Lazy: in one pipeline, so no timer runs in between, a key whose 1 ms
+  // passed during slow commands is still counted until a get deletes it.
+  std::vector<std::string> a = {"sadd", "a"}, b = {"sadd", "b"};
+  for (int i = 0; i < 100000; ++i) {
+    a.push_back("m" + std::to_string(i));
+    b.push_back("m" + std::to_string(i * 2));
+  }
+  passed = passed && call(fd, a).isInt(100000) && call(fd, b).isInt(100000);
+  int64_t keys = info(fd, "keys");
+  int64_t expired = info(fd, "expired_keys");
+  std::vector<std::vector<std::string>> cmds = {{"set", "lazy", "v", "px", "1"}};
+  for (int i = 0; i < 20; ++i) {
+    cmds.push_back({"sintercard", "2", "a", "b"});
+  }
+  cmds.push_back({"info"});
+  cmds.push_back({"get", "lazy"});
+  std::vector<Reply> replies = pipeline(fd, cmds);
+  passed = passed && replies.size() == cmds.size() && replies[1].isInt(50000) &&
+           replies[21].str.find("\nexpired_keys:" + std::to_string(expired) + "\n") !=
+               std::string::npos &&
+           replies[21].str.compare(0, 5 + std::to_string(keys + 1).size() + 1,
+                                   "keys:" + std::to_string(keys + 1) + "\n") == 0 &&
+           replies[22].isNil() && info(fd, "expired_keys") == expired + 1 &&
+           info(fd, "keys") == keys;
+
+  // active: keys that are never touched again go away too
+  for (int i = 0; i < 50 && passed; ++i) {
+    passed = call(fd, {"set", "t" + std::to_string(i), "v", "px", "50"}).isNil();
+  }
+  passed = passed && info(fd, "keys") == keys + 50;
+  usleep(300 * 1000);
+  passed = passed && info(fd, "keys") == keys && info(fd, "expired_keys") == expired + 51 &&
+           info(fd, "expires") == 0;
+
+  if (fd >= 0) {
+    close(fd);
+  }
+  stopServer(srv);
+
+  runTest("Expire Commands", passed);
+}
+
+// With --idle-timeout a connection that sends nothing is closed, and one
+// that keeps sending is not
+void testIdleTimeout() {
+  Server srv;
+  bool passed = startServer(srv, 12478, {"--idle-timeout", "200"});
+  int idle = passed ? connectTo(srv.port) : -1;
+  int active = passed ? connectTo(srv.port) : -1;
+  passed = passed && call(idle, {"set", "k", "v"}).isNil();
+  for (int i = 0; i < 12 && passed; ++i) {
+    usleep(50 * 1000);
+    passed = call(active, {"get", "k"}).isStr("v");
+  }
+  // the server's close shows up as EOF; a read that times out fails
+  struct timeval tv = {2, 0};
+  setsockopt(idle, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  char c = 0;
+  passed = passed && read(idle, &c, 1) == 0 && call(active, {"get", "k"}).isStr("v") &&
+           info(active, "idle_closed") == 1;
+
+  for (int fd : {idle, active}) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+  stopServer(srv);
+
+  runTest("Idle Timeout", passed);
+}
+
+// --maxmemory: allkeys-lru evicts to stay near the limit, noeviction turns
+// away the writes that would add memory (ERR_OOM = 4) but not reads
+void testMaxmemory() {
+  const int64_t limit = 1 << 20;
+  const std::string val(1000, 'v');
+  Server srv;
+  bool passed =
+      startServer(srv, 12479, {"--maxmemory", "1m", "--maxmemory-policy", "allkeys-lru"});
+  int fd = passed ? connectTo(srv.port) : -1;
+  for (int i = 0; i < 5000 && passed; ++i) {
+    passed = call(fd, {"set", "k" + std::to_string(i), val}).isNil();
+  }
+  int64_t used = info(fd, "used_memory");
+  passed = passed && used > limit / 2 && used <= limit + limit / 10 &&
+           info(fd, "evicted_keys") > 0 && info(fd, "keys") < 5000 &&
+           info(fd, "evicted_keys") + info(fd, "keys") == 5000 &&
+           call(fd, {"get", "k4999"}).isStr(val);
+  if (fd >= 0) {
+    close(fd);
+  }
+  stopServer(srv);
+
+  passed = passed && startServer(srv, 12480, {"--maxmemory", "1m"});
+  fd = passed ? connectTo(srv.port) : -1;
+  Reply r;
+  int n = 0;
+  for (; n < 5000 && passed; ++n) {
+    r = call(fd, {"set", "k" + std::to_string(n), val});
+    if (!r.isNil()) {
+      break;
+    }
+  }
+  passed = passed && r.isErr() && r.num == 4 && n > 100 && info(fd, "evicted_keys") == 0 &&
+           info(fd, "keys") == n && call(fd, {"get", "k0"}).isStr(val) &&
+           call(fd, {"incr", "n"}).num == 4 && call(fd, {"hset", "h", "f", "v"}).num == 4 &&
+           call(fd, {"pttl", "k1"}).isInt(-1) && call(fd, {"del", "k1"}).isInt(1);
+  if (fd >= 0) {
+    close(fd);
+  }
+  stopServer(srv);
+
+  runTest("Maxmemory", passed);
+}
+
+// unlink: the key is gone at once, a big string's block goes to the
+// lazy-free thread, and big containers are freed over the next loop ticks
+void testUnlink() {
+  Server srv;
+  bool passed = startServer(srv, 12481, {});
+  int fd = passed ? connectTo(srv.port) : -1;
+  int64_t empty = info(fd, "used_memory");
+
+  std::vector<std::string> zadd = {"zadd", "z"}, sadd = {"sadd", "s"};
+  for (int i = 0; i < 5000; ++i) {
+    zadd.push_back(std::to_string(i));
+    zadd.push_back("m" + std::to_string(i));
+    sadd.push_back("m" + std::to_string(i));
+  }
+  passed = passed && call(fd, {"set", "str", std::string(1 << 20, 'x')}).isNil() &&
+           call(fd, zadd).isInt(5000) && call(fd, sadd).isInt(5000);
+  int64_t full = info(fd, "used_memory");
+  int64_t queued = info(fd, "lazyfree_queued");
+  passed = passed && full > empty + (1 << 20);
+
+  for (const char *key : {"str", "z", "s"}) {
+    passed = passed && call(fd, {"unlink", key}).isInt(1) && call(fd, {"pttl", key}).isInt(-2) &&
+             call(fd, {"unlink", key}).isInt(0);
+  }
+  passed = passed && call(fd, {"get", "str"}).isNil() && call(fd, {"zcard", "z"}).isInt(0) &&
+           call(fd, {"scard", "s"}).isInt(0) && info(fd, "lazyfree_queued") > queued;
+
+  bool drained = false;
+  for (int i = 0; i < 200 && passed && !drained; ++i) {
+    drained = info(fd, "lazy_objs") == 0 && info(fd, "lazy_obj_bytes") == 0 &&
+              info(fd, "lazyfree_pending_bytes") == 0;
+    if (!drained) {
+      usleep(10 * 1000);
+    }
+  }
+  passed = passed && drained && info(fd, "used_memory") < empty + (full - empty) / 10;
+
+  if (fd >= 0) {
+    close(fd);
+  }
+  stopServer(srv);
+
+  runTest("Unlink", passed);
+}
+
+// Whether ./server --backend uring would run on io_uring: the same setup as
+// its run_uring_loop(), which falls back to epoll when either step fails.
+static bool uringUsable() {
+#ifdef __linux__
+  URing ring;
+  if (uring_init(&ring, 4096)) {
+    return false;
+  }
+  UBufRing bufs;
+  bool ok = ubuf_ring_init(&ring, &bufs, 0, 2048, 8 << 10) == 0;
+  if (ok) {
+    ubuf_ring_free(&ring, &bufs);
+  }
+  uring_exit(&ring);
+  return ok;
+#else
+  return false;
+#endif
+}
+
+// the tests of the commands themselves, which every backend must pass alike
+static void testCommands() {
+  testZsetCommands();
+  testListCommands();
+  testHashCommands();
+  testSetCommands();
+  testCounterCommands();
+}
+
+// Values of 16 KiB and more are sent by reference to their block. A
+// pipelined get's reply must keep the bytes it read even when later requests
+// in the same pipeline overwrite or delete the key before it is sent.
+void testBigReplies() {
+  Server srv;
+  bool passed = startServer(srv, 12482, {});
+  int fd = passed ? connectTo(srv.port) : -1;
+  const std::string a(1 << 20, 'a'), b(20000, 'b'), c(1 << 16, 'c');
+  passed = passed && call(fd, {"set", "big", a}).isNil();
+  int64_t refs = info(fd, "ref_replies");
+
+  std::vector<std::vector<std::string>> cmds;
+  for (int i = 0; i < 10; ++i) {
+    cmds.push_back({"get", "big"});
+  }
+  cmds.push_back({"set", "big", b});
+  cmds.push_back({"get", "big"});
+  cmds.push_back({"del", "big"});
+  cmds.push_back({"get", "big"});
+  cmds.push_back({"set", "big", c});
+  cmds.push_back({"get", "big"});
+  cmds.push_back({"unlink", "big"});
+  cmds.push_back({"set", "big", "small"});
+  cmds.push_back({"get", "big"});
+  std::vector<Reply> replies = pipeline(fd, cmds);
+  passed = passed && replies.size() == cmds.size();
+  for (int i = 0; i < 10 && passed; ++i) {
+    passed = replies[i].isStr(a);
+  }
+  passed = passed && replies[10].isNil() && replies[11].isStr(b) && replies[12].isInt(1) &&
+           replies[13].isNil() && replies[14].isNil() && replies[15].isStr(c) &&
+           replies[16].isInt(1) && replies[17].isNil() && replies[18].isStr("small");
+  // with --zerocopy those go out with MSG_ZEROCOPY
+  bool zerocopy = false;
+  for (const char *arg : g_extraArgs) {
+    zerocopy = zerocopy || !strcmp(arg, "--zerocopy");
+  }
+  passed = passed && info(fd, "ref_replies") >= refs + 12 &&
+           (info(fd, "zerocopy_sends") > 0) == zerocopy;
+
+  if (fd >= 0) {
+    close(fd);
+  }
+  stopServer(srv);
+
+  runTest("Big Replies", passed);
+}
+
+int main() {
+  std::cout << "Running Server Tests:" << std::endl;
+
+  testConcurrentScan();
+  testScanCount();
+  testCommands();
+  testExpireCommands();
+  testIdleTimeout();
+  testMaxmemory();
+  testUnlink();
+  testBigReplies();
+
+  // requests and replies handed between the I/O threads and the main one
+  std::cout << "With --io-threads 2:" << std::endl;
+  g_extraArgs = {"--io-threads", "2"};
+  testCommands();
+  g_extraArgs.clear();
+
+  std::cout << "With --io-threads 2 --zerocopy:" << std::endl;
+  g_extraArgs = {"--io-threads", "2", "--zerocopy"};
+  testBigReplies();
+  g_extraArgs.clear();
+
+  // multishot recv, provided buffers and linked sends
+  if (uringUsable()) {
+    std::cout << "With --backend uring:" << std::endl;
+    g_extraArgs = {"--backend", "uring"};
+    testCommands();
+    g_extraArgs.clear();
+  } else {
+    std::cout << "io_uring is not available, skipping --backend uring" << std::endl;
+  }
+
+  std::cout << "All tests completed." << std::endl;
+  return failures ? 1 : 0;
+}
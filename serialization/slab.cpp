@@ -0,0 +1,278 @@
+#include "slab.hpp"
+#include <assert.h>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <sys/mman.h>
+
+// header at the start of every slab; slabs are k_slab_size aligned so an
+// object finds its slab by masking its address
+struct Slab
+{
+    Slab *prev = nullptr; // partial list of the class, or the free list
+    Slab *next = nullptr;
+    void *freelist = nullptr; // freed objects
+    char *bump = nullptr;     // objects past this were never handed out
+    uint32_t nfree = 0;
+    uint32_t nobjs = 0;
+    uint32_t cls = 0;
+};
+
+struct SlabClass
+{
+    size_t size = 0;
+    Slab *partial = nullptr; // slabs with at least one free object
+    size_t nslabs = 0;
+    size_t nused = 0; // live objects
+};
+
+// 16-byte steps up to 256, then 64-byte steps up to k_slab_max
+const size_t k_small_step = 16;
+const size_t k_small_max = 256;
+const size_t k_large_step = 64;
+const size_t k_nclasses =
+    k_small_max / k_small_step + (k_slab_max - k_small_max) / k_large_step;
+const size_t k_slab_header = (sizeof(Slab) + 15) & ~(size_t)15;
+
+// per thread, see slab.hpp
+static thread_local struct
+{
+    SlabClass classes[k_nclasses];
+    Slab *free_slabs = nullptr; // empty slabs with no memory behind them
+    size_t nfree_slabs = 0;
+    char *arena_cur = nullptr; // unused part of the newest arena
+    char *arena_end = nullptr;
+    size_t arena_bytes = 0;
+    size_t large_bytes = 0;
+} g_slab;
+
+static size_t class_of(size_t size)
+{
+    if (size == 0)
+    {
+        size = 1;
+    }
+    if (size <= k_small_max)
+    {
+        return (size - 1) / k_small_step;
+    }
+    return k_small_max / k_small_step + (size - k_small_max - 1) / k_large_step;
+}
+
+static size_t class_size(size_t cls)
+{
+    size_t nsmall = k_small_max / k_small_step;
+    if (cls < nsmall)
+    {
+        return (cls + 1) * k_small_step;
+    }
+    return k_small_max + (cls - nsmall + 1) * k_large_step;
+}
+
+// malloc hands out 16-byte aligned chunks with an 8-byte header
+static size_t malloc_good_size(size_t size)
+{
+    const size_t overhead = sizeof(size_t);
+    return ((size + overhead + 15) & ~(size_t)15) - overhead;
+}
+
+size_t slab_good_size(size_t size)
+{
+#ifndef SLAB_USE_MALLOC
+    if (size <= k_slab_max)
+    {
+        return class_size(class_of(size));
+    }
+#endif
+    return malloc_good_size(size);
+}
+
+static void list_remove(Slab **head, Slab *s)
+{
+    if (s->prev)
+    {
+        s->prev->next = s->next;
+    }
+    else
+    {
+        *head = s->next;
+    }
+    if (s->next)
+    {
+        s->next->prev = s->prev;
+    }
+    s->prev = s->next = nullptr;
+}
+
+static void list_push(Slab **head, Slab *s)
+{
+    s->prev = nullptr;
+    s->next = *head;
+    if (*head)
+    {
+        (*head)->prev = s;
+    }
+    *head = s;
+}
+
+static Slab *slab_new(size_t cls)
+{
+    char *mem = nullptr;
+    if (g_slab.free_slabs)
+    {
+        Slab *s = g_slab.free_slabs;
+        list_remove(&g_slab.free_slabs, s);
+        g_slab.nfree_slabs--;
+        mem = (char *)s;
+    }
+    else
+    {
+        if (g_slab.arena_cur == g_slab.arena_end)
+        {
+            // over-map so the arena can be aligned to k_slab_size
+            size_t len = k_slab_arena_size + k_slab_size;
+            char *raw = (char *)mmap(NULL, len, PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (raw == MAP_FAILED)
+            {
+                return nullptr;
+            }
+            char *aligned =
+                (char *)(((uintptr_t)raw + k_slab_size - 1) & ~(k_slab_size - 1));
+            if (aligned > raw)
+            {
+                munmap(raw, aligned - raw);
+            }
+            char *end = aligned + k_slab_arena_size;
+            if (raw + len > end)
+            {
+                munmap(end, raw + len - end);
+            }
+            g_slab.arena_cur = aligned;
+            g_slab.arena_end = end;
+            g_slab.arena_bytes += k_slab_arena_size;
+        }
+        mem = g_slab.arena_cur;
+        g_slab.arena_cur += k_slab_size;
+    }
+
+    Slab *s = new (mem) Slab();
+    s->cls = (uint32_t)cls;
+    s->nobjs = (uint32_t)((k_slab_size - k_slab_header) / class_size(cls));
+    s->nfree = s->nobjs;
+    s->bump = mem + k_slab_header;
+    g_slab.classes[cls].nslabs++;
+    return s;
+}
+
+// an empty slab: drop its pages and keep the address range for any class
+static void slab_release(Slab *s)
+{
+    SlabClass &c = g_slab.classes[s->cls];
+    list_remove(&c.partial, s);
+    c.nslabs--;
+    madvise(s, k_slab_size, MADV_DONTNEED);
+    // the header was zeroed along with the rest
+    Slab *fs = new ((void *)s) Slab();
+    list_push(&g_slab.free_slabs, fs);
+    g_slab.nfree_slabs++;
+}
+
+void *slab_alloc(size_t size)
+{
+#ifndef SLAB_USE_MALLOC
+    if (size <= k_slab_max)
+    {
+        size_t cls = class_of(size);
+        SlabClass &c = g_slab.classes[cls];
+        if (!c.size)
+        {
+            c.size = class_size(cls);
+        }
+        Slab *s = c.partial;
+        if (!s)
+        {
+            s = slab_new(cls);
+            if (!s)
+            {
+                return nullptr;
+            }
+            list_push(&c.partial, s);
+        }
+        void *obj;
+        if (s->freelist)
+        {
+            obj = s->freelist;
+            memcpy(&s->freelist, obj, sizeof(void *));
+        }
+        else
+        {
+            obj = s->bump;
+            s->bump += c.size;
+        }
+        s->nfree--;
+        if (s->nfree == 0)
+        {
+            list_remove(&c.partial, s);
+        }
+        c.nused++;
+        return obj;
+    }
+#endif
+    g_slab.large_bytes += size;
+    return malloc(size ? size : 1);
+}
+
+void slab_free(void *ptr, size_t size)
+{
+    if (!ptr)
+    {
+        return;
+    }
+#ifndef SLAB_USE_MALLOC
+    if (size <= k_slab_max)
+    {
+        Slab *s = (Slab *)((uintptr_t)ptr & ~(k_slab_size - 1));
+        SlabClass &c = g_slab.classes[s->cls];
+        assert(s->cls == class_of(size));
+        memcpy(ptr, &s->freelist, sizeof(void *));
+        s->freelist = ptr;
+        if (s->nfree == 0)
+        {
+            list_push(&c.partial, s); // was full
+        }
+        s->nfree++;
+        c.nused--;
+        // keep one empty slab per class to absorb alloc/free ping-pong
+        if (s->nfree == s->nobjs && (c.partial != s || s->next))
+        {
+            slab_release(s);
+        }
+        return;
+    }
+#endif
+    g_slab.large_bytes -= size;
+    free(ptr);
+}
+
+void slab_disown_large(size_t size)
+{
+    assert(size > k_slab_max);
+    g_slab.large_bytes -= size;
+}
+
+void slab_stats(SlabStats *out)
+{
+    *out = SlabStats{};
+    out->arena_bytes = g_slab.arena_bytes;
+    out->free_slabs = g_slab.nfree_slabs;
+    out->large_bytes = g_slab.large_bytes;
+    for (size_t i = 0; i < k_nclasses; ++i)
+    {
+        const SlabClass &c = g_slab.classes[i];
+        out->slabs += c.nslabs;
+        out->objects += c.nused;
+        out->used_bytes += c.nused * class_size(i);
+    }
+    out->resident_bytes = out->slabs * k_slab_size;
+}
@@ -0,0 +1,47 @@
+#ifndef SLAB_HPP
+#define SLAB_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// Size-class slab allocator for entries and small values.
+//
+// Each size class carves objects out of 64 KiB slabs, which come from 2 MiB
+// mmap'd arenas. Freed objects go on their slab's freelist. A slab that
+// becomes empty is given back to the OS with madvise(MADV_DONTNEED) and kept
+// for reuse by any class, so RSS follows the live data under churn instead
+// of the peak. Requests larger than k_slab_max go to malloc.
+//
+// Every thread gets its own slabs, so there is no locking, but an object
+// must be freed by the thread that allocated it.
+//
+// Building with -DSLAB_USE_MALLOC turns every call into plain malloc/free,
+// for comparison.
+
+const size_t k_slab_size = 64 << 10;
+const size_t k_slab_arena_size = 2 << 20;
+const size_t k_slab_max = 1024;
+
+// the caller passes the same size to slab_free() as to slab_alloc()
+void *slab_alloc(size_t size);
+void slab_free(void *ptr, size_t size);
+// the size slab_alloc(size) actually hands out, the slack is usable
+size_t slab_good_size(size_t size);
+// Drops a block over k_slab_max from the accounting without freeing it. It is
+// plain malloc memory, so the new owner can free() it, on any thread.
+void slab_disown_large(size_t size);
+
+struct SlabStats
+{
+    size_t arena_bytes = 0;    // address space mapped for slabs
+    size_t resident_bytes = 0; // slabs holding at least one object
+    size_t used_bytes = 0;     // live objects, at their class size
+    size_t slabs = 0;          // slabs in use
+    size_t free_slabs = 0;     // empty slabs returned to the OS
+    size_t objects = 0;        // live objects
+    size_t large_bytes = 0;    // bytes handed to malloc (> k_slab_max)
+};
+
+void slab_stats(SlabStats *out);
+
+#endif // SLAB_HPP
@@ -0,0 +1,73 @@
+#ifndef SPSC_HPP
+#define SPSC_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+// Bounded single-producer single-consumer ring of pointer-sized values.
+// Each side owns one index and only reads the other's, with acquire/release
+// ordering, so what the producer wrote before a push is visible to the
+// consumer after the pop. The indices sit on separate cache lines, and each
+// side keeps a cached copy of the other's index so it only touches that line
+// when the ring looks full (or empty).
+struct SpscRing
+{
+    uintptr_t *slots = nullptr;
+    size_t mask = 0;
+    alignas(64) std::atomic<size_t> head{0}; // next pop, written by the consumer
+    size_t tail_cache = 0;
+    alignas(64) std::atomic<size_t> tail{0}; // next push, written by the producer
+    size_t head_cache = 0;
+};
+
+// n: a power of 2
+inline void spsc_init(SpscRing *r, size_t n)
+{
+    r->slots = (uintptr_t *)calloc(n, sizeof(uintptr_t));
+    r->mask = n - 1;
+}
+
+// false if the ring is full
+inline bool spsc_push(SpscRing *r, uintptr_t v)
+{
+    size_t tail = r->tail.load(std::memory_order_relaxed);
+    if (tail - r->head_cache > r->mask)
+    {
+        r->head_cache = r->head.load(std::memory_order_acquire);
+        if (tail - r->head_cache > r->mask)
+        {
+            return false;
+        }
+    }
+    r->slots[tail & r->mask] = v;
+    r->tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+// false if the ring is empty
+inline bool spsc_pop(SpscRing *r, uintptr_t *v)
+{
+    size_t head = r->head.load(std::memory_order_relaxed);
+    if (head == r->tail_cache)
+    {
+        r->tail_cache = r->tail.load(std::memory_order_acquire);
+        if (head == r->tail_cache)
+        {
+            return false;
+        }
+    }
+    *v = r->slots[head & r->mask];
+    r->head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+// consumer side: whether anything is waiting
+inline bool spsc_empty(SpscRing *r)
+{
+    return r->head.load(std::memory_order_relaxed) ==
+           r->tail.load(std::memory_order_acquire);
+}
+
+#endif // SPSC_HPP
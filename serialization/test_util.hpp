@@ -0,0 +1,38 @@
+#ifndef TEST_UTIL_HPP
+#define TEST_UTIL_HPP
+
+// Shared by the *_test.cpp programs: the PASSED/FAILED lines, whose failures
+// make the exit status, and what the randomized tests need.
+
+#include <cstdint>
+#include <iostream>
+
+static int failures = 0;
+
+// Helper function to print test results
+inline void runTest(const char *testName, bool passed) {
+  std::cout << testName << ": " << (passed ? "PASSED" : "FAILED") << std::endl;
+  if (!passed) {
+    failures++;
+  }
+}
+
+// xorshift64: the same sequence on every run
+inline uint64_t xorshift(uint64_t &s) {
+  s ^= s << 13;
+  s ^= s >> 7;
+  s ^= s << 17;
+  return s;
+}
+
+// Calls step() until it returns true, as the server does with a *_clear_some()
+// function. Returns the calls that came back false.
+template <class Step> int callsUntilDone(Step step) {
+  int calls = 0;
+  while (!step()) {
+    calls++;
+  }
+  return calls;
+}
+
+#endif // TEST_UTIL_HPP
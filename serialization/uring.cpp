@@ -0,0 +1,275 @@
+#include "uring.hpp"
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                              unsigned flags, void *arg = NULL, size_t argsz = 0)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                        arg, argsz);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg,
+                                 unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_init(URing *ring, unsigned entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    // multishot requests can post many CQEs per SQE
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = entries * 8;
+    int fd = sys_io_uring_setup(entries, &p);
+    if (fd < 0)
+    {
+        return -errno;
+    }
+    ring->fd = fd;
+    ring->features = p.features;
+
+    ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_len > ring->sq_len)
+        {
+            ring->sq_len = ring->cq_len;
+        }
+        ring->cq_len = ring->sq_len;
+    }
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED)
+    {
+        int err = -errno;
+        close(fd);
+        *ring = URing{};
+        return err;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->cq_ptr = ring->sq_ptr;
+    }
+    else
+    {
+        ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED)
+        {
+            int err = -errno;
+            munmap(ring->sq_ptr, ring->sq_len);
+            close(fd);
+            *ring = URing{};
+            return err;
+        }
+    }
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe *)mmap(
+        NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        int err = -errno;
+        uring_exit(ring);
+        return err;
+    }
+
+    char *sq = (char *)ring->sq_ptr;
+    ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_entries = *(unsigned *)(sq + p.sq_off.ring_entries);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring->sqe_tail = *ring->sq_tail;
+
+    char *cq = (char *)ring->cq_ptr;
+    ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+void uring_exit(URing *ring)
+{
+    if (ring->sqes && ring->sqes != MAP_FAILED)
+    {
+        munmap(ring->sqes, ring->sqes_len);
+    }
+    if (ring->cq_ptr && ring->cq_ptr != ring->sq_ptr)
+    {
+        munmap(ring->cq_ptr, ring->cq_len);
+    }
+    if (ring->sq_ptr)
+    {
+        munmap(ring->sq_ptr, ring->sq_len);
+    }
+    if (ring->fd >= 0)
+    {
+        close(ring->fd);
+    }
+    *ring = URing{};
+}
+
+struct io_uring_sqe *uring_get_sqe(URing *ring)
+{
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head >= ring->sq_entries)
+    {
+        return nullptr;
+    }
+    unsigned idx = ring->sqe_tail & ring->sq_mask;
+    ring->sq_array[idx] = idx;
+    ring->sqe_tail++;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int uring_submit_and_wait(URing *ring, unsigned wait_nr)
+{
+    unsigned tail = *ring->sq_tail;
+    unsigned to_submit = ring->sqe_tail - tail;
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+    if (!to_submit && !wait_nr)
+    {
+        return 0;
+    }
+    int rv = sys_io_uring_enter(ring->fd, to_submit, wait_nr, flags);
+    return rv < 0 ? -errno : rv;
+}
+
+int uring_submit_and_wait_timeout(URing *ring, unsigned wait_nr, int timeout_ms)
+{
+    if (timeout_ms < 0)
+    {
+        return uring_submit_and_wait(ring, wait_nr);
+    }
+    if (timeout_ms == 0 || !(ring->features & IORING_FEAT_EXT_ARG))
+    {
+        return uring_submit_and_wait(ring, 0);
+    }
+    unsigned tail = *ring->sq_tail;
+    unsigned to_submit = ring->sqe_tail - tail;
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+
+    struct __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+    int rv = sys_io_uring_enter(ring->fd, to_submit, wait_nr,
+                                IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg,
+                                sizeof(arg));
+    return rv < 0 ? -errno : rv;
+}
+
+struct io_uring_cqe *uring_peek_cqe(URing *ring)
+{
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    if (head == tail)
+    {
+        return nullptr;
+    }
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(URing *ring)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+static struct io_uring_buf *ubuf_ring_entries(UBufRing *br);
+
+int ubuf_ring_init(URing *ring, UBufRing *br, uint16_t bgid, unsigned entries,
+                   unsigned buf_size)
+{
+    if (entries == 0 || (entries & (entries - 1)) != 0)
+    {
+        return -EINVAL;
+    }
+    size_t ring_len = entries * sizeof(struct io_uring_buf);
+    void *mem = mmap(NULL, ring_len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        return -errno;
+    }
+    memset(mem, 0, ring_len);
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)mem;
+    reg.ring_entries = entries;
+    reg.bgid = bgid;
+    if (sys_io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        int err = -errno;
+        munmap(mem, ring_len);
+        return err;
+    }
+
+    br->br = (struct io_uring_buf_ring *)mem;
+    br->bufs = (uint8_t *)malloc((size_t)entries * buf_size);
+    br->entries = entries;
+    br->buf_size = buf_size;
+    br->bgid = bgid;
+    for (unsigned i = 0; i < entries; i++)
+    {
+        ubuf_ring_recycle(br, (uint16_t)i);
+    }
+    return 0;
+}
+
+void ubuf_ring_free(URing *ring, UBufRing *br)
+{
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = br->bgid;
+    sys_io_uring_register(ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    munmap(br->br, br->entries * sizeof(struct io_uring_buf));
+    free(br->bufs);
+    *br = UBufRing{};
+}
+
+uint8_t *ubuf_ring_buf(UBufRing *br, uint16_t bid)
+{
+    return br->bufs + (size_t)bid * br->buf_size;
+}
+
+// The ring is a plain array of io_uring_buf whose first `resv` doubles as the
+// tail. Index it by hand: in C++ the header's flexible-array union does not
+// start at offset 0.
+static struct io_uring_buf *ubuf_ring_entries(UBufRing *br)
+{
+    return (struct io_uring_buf *)(void *)br->br;
+}
+
+void ubuf_ring_recycle(UBufRing *br, uint16_t bid)
+{
+    uint16_t *tailp = &ubuf_ring_entries(br)[0].resv;
+    uint16_t tail = *tailp;
+    struct io_uring_buf *buf = &ubuf_ring_entries(br)[tail & (br->entries - 1)];
+    buf->addr = (uint64_t)(uintptr_t)ubuf_ring_buf(br, bid);
+    buf->len = br->buf_size;
+    buf->bid = bid;
+    __atomic_store_n(tailp, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+}
+
+#endif // __linux__
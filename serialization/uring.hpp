@@ -0,0 +1,75 @@
+#ifndef URING_HPP
+#define URING_HPP
+
+// A minimal io_uring wrapper on top of the raw syscalls (no liburing): ring
+// setup, SQE/CQE access and a provided-buffer ring. Only what the server's
+// io_uring event loop needs.
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+
+struct URing
+{
+    int fd = -1;
+    unsigned features = 0;
+
+    // submission queue
+    unsigned *sq_head = nullptr;
+    unsigned *sq_tail = nullptr;
+    unsigned *sq_array = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    unsigned sqe_tail = 0; // SQEs handed out but not yet published
+    struct io_uring_sqe *sqes = nullptr;
+
+    // completion queue
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    struct io_uring_cqe *cqes = nullptr;
+
+    void *sq_ptr = nullptr;
+    size_t sq_len = 0;
+    void *cq_ptr = nullptr;
+    size_t cq_len = 0;
+    size_t sqes_len = 0;
+};
+
+// ring of kernel-provided receive buffers (IORING_REGISTER_PBUF_RING)
+struct UBufRing
+{
+    struct io_uring_buf_ring *br = nullptr;
+    uint8_t *bufs = nullptr;
+    unsigned entries = 0;
+    unsigned buf_size = 0;
+    uint16_t bgid = 0;
+};
+
+// return 0 or -errno
+int uring_init(URing *ring, unsigned entries);
+void uring_exit(URing *ring);
+
+// returns nullptr when the SQ is full, submit first
+struct io_uring_sqe *uring_get_sqe(URing *ring);
+// publish pending SQEs and wait for at least `wait_nr` completions
+int uring_submit_and_wait(URing *ring, unsigned wait_nr);
+// the same, but gives up after timeout_ms (-1: no limit) with -ETIME. Without
+// IORING_FEAT_EXT_ARG (before 5.11) any timeout degrades to not waiting.
+int uring_submit_and_wait_timeout(URing *ring, unsigned wait_nr, int timeout_ms);
+// returns nullptr if the CQ is empty
+struct io_uring_cqe *uring_peek_cqe(URing *ring);
+void uring_cqe_seen(URing *ring);
+
+int ubuf_ring_init(URing *ring, UBufRing *br, uint16_t bgid, unsigned entries,
+                   unsigned buf_size);
+void ubuf_ring_free(URing *ring, UBufRing *br);
+uint8_t *ubuf_ring_buf(UBufRing *br, uint16_t bid);
+// give a consumed buffer back to the kernel
+void ubuf_ring_recycle(UBufRing *br, uint16_t bid);
+
+#endif // __linux__
+
+#endif // URING_HPP
@@ -0,0 +1,460 @@
+#include "zset.hpp"
+#include "hash.hpp"
+#include "slab.hpp"
+#include <assert.h>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#define container_of(ptr, T, member) ((T *)((char *)ptr - offsetof(T, member)))
+
+// (score, name) order
+static bool zless(double s1, std::string_view n1, double s2, std::string_view n2)
+{
+    if (s1 != s2)
+    {
+        return s1 < s2;
+    }
+    return n1 < n2;
+}
+
+// Packed records: [score, 8 bytes][len, 1 byte][name]
+
+const uint32_t k_rec_header = 9;
+
+static double rec_score(const uint8_t *rec)
+{
+    double score;
+    memcpy(&score, rec, sizeof(score));
+    return score;
+}
+
+static std::string_view rec_name(const uint8_t *rec)
+{
+    return std::string_view((const char *)rec + k_rec_header, rec[8]);
+}
+
+static uint32_t rec_size(const uint8_t *rec)
+{
+    return k_rec_header + rec[8];
+}
+
+// offset of the member's record, and its rank; false if it is not there
+static bool packed_find(ZSet *zset, std::string_view name, uint32_t *pos,
+                        size_t *rank)
+{
+    size_t r = 0;
+    for (uint32_t p = 0; p < zset->packed_used; p += rec_size(zset->packed + p), r++)
+    {
+        const uint8_t *rec = zset->packed + p;
+        if (rec[8] == name.size() && rec_name(rec) == name)
+        {
+            *pos = p;
+            *rank = r;
+            return true;
+        }
+    }
+    return false;
+}
+
+// the first record >= (score, name), and its rank
+static uint32_t packed_seekge(ZSet *zset, double score, std::string_view name,
+                              size_t *rank)
+{
+    uint32_t p = 0;
+    size_t r = 0;
+    for (; p < zset->packed_used; p += rec_size(zset->packed + p), r++)
+    {
+        const uint8_t *rec = zset->packed + p;
+        if (!zless(rec_score(rec), rec_name(rec), score, name))
+        {
+            break;
+        }
+    }
+    *rank = r;
+    return p;
+}
+
+static void packed_remove(ZSet *zset, uint32_t pos)
+{
+    uint32_t size = rec_size(zset->packed + pos);
+    memmove(zset->packed + pos, zset->packed + pos + size,
+            zset->packed_used - pos - size);
+    zset->packed_used -= size;
+}
+
+static void packed_insert(ZSet *zset, double score, std::string_view name)
+{
+    size_t rank = 0;
+    uint32_t pos = packed_seekge(zset, score, name, &rank);
+    uint32_t size = k_rec_header + (uint32_t)name.size();
+    if (zset->packed_used + size > zset->packed_cap)
+    {
+        uint32_t cap = zset->packed_cap ? zset->packed_cap : 64;
+        while (cap < zset->packed_used + size)
+        {
+            cap *= 2;
+        }
+        zset->packed = (uint8_t *)realloc(zset->packed, cap);
+        zset->packed_cap = cap;
+    }
+    uint8_t *rec = zset->packed + pos;
+    memmove(rec + size, rec, zset->packed_used - pos);
+    memcpy(rec, &score, sizeof(score));
+    rec[8] = (uint8_t)name.size();
+    memcpy(rec + k_rec_header, name.data(), name.size());
+    zset->packed_used += size;
+}
+
+// Tree
+
+struct ZKey
+{
+    HNode node;
+    std::string_view name;
+};
+
+static bool znode_eq(HNode *node, HNode *key)
+{
+    ZNode *znode = container_of(node, ZNode, hmap);
+    ZKey *zkey = container_of(key, ZKey, node);
+    return std::string_view(znode->name, znode->len) == zkey->name;
+}
+
+static size_t znode_size(size_t len)
+{
+    return sizeof(ZNode) + len;
+}
+
+static ZNode *tree_lookup(ZTree *tree, std::string_view name)
+{
+    ZKey key;
+    key.node.hcode = hash64(name.data(), name.size(), g_hash_seed);
+    key.name = name;
+    HNode *found = h_lookup(&tree->hmap, &key.node, znode_eq);
+    return found ? container_of(found, ZNode, hmap) : nullptr;
+}
+
+// links a detached node into the tree by its (score, name)
+static void tree_link(ZTree *tree, ZNode *node)
+{
+    std::string_view name(node->name, node->len);
+    AVLNode *parent = nullptr;
+    AVLNode **from = &tree->root;
+    while (*from)
+    {
+        parent = *from;
+        ZNode *cur = container_of(parent, ZNode, tree);
+        from = zless(node->score, name, cur->score, std::string_view(cur->name, cur->len))
+                   ? &parent->left
+                   : &parent->right;
+    }
+    node->tree = AVLNode();
+    node->tree.parent = parent;
+    *from = &node->tree;
+    tree->root = avl_fix(&node->tree);
+}
+
+static void tree_insert(ZTree *tree, std::string_view name, double score)
+{
+    size_t size = znode_size(name.size());
+    ZNode *node = new (slab_alloc(size)) ZNode();
+    node->hmap.hcode = hash64(name.data(), name.size(), g_hash_seed);
+    node->score = score;
+    node->len = (uint32_t)name.size();
+    memcpy(node->name, name.data(), name.size());
+    hm_insert(&tree->hmap, &node->hmap);
+    tree_link(tree, node);
+    tree->node_bytes += slab_good_size(size);
+}
+
+static void tree_free_node(ZTree *tree, ZNode *node)
+{
+    size_t size = znode_size(node->len);
+    tree->node_bytes -= slab_good_size(size);
+    node->~ZNode();
+    slab_free(node, size);
+}
+
+// the records move to a tree, in order
+static void zset_convert(ZSet *zset)
+{
+    ZTree *tree = new ZTree();
+    for (uint32_t p = 0; p < zset->packed_used; p += rec_size(zset->packed + p))
+    {
+        const uint8_t *rec = zset->packed + p;
+        tree_insert(tree, rec_name(rec), rec_score(rec));
+    }
+    free(zset->packed);
+    zset->packed = nullptr;
+    zset->packed_used = zset->packed_cap = 0;
+    zset->tree = tree;
+}
+
+bool zset_add(ZSet *zset, std::string_view name, double score)
+{
+    if (!zset->tree)
+    {
+        uint32_t pos = 0;
+        size_t rank = 0;
+        if (packed_find(zset, name, &pos, &rank))
+        {
+            if (rec_score(zset->packed + pos) != score)
+            {
+                packed_remove(zset, pos);
+                packed_insert(zset, score, name);
+            }
+            return false;
+        }
+        if (zset->size < k_zset_packed_max && name.size() <= k_zset_packed_name_max)
+        {
+            packed_insert(zset, score, name);
+            zset->size++;
+            return true;
+        }
+        zset_convert(zset);
+    }
+
+    ZTree *tree = zset->tree;
+    if (ZNode *node = tree_lookup(tree, name))
+    {
+        if (node->score != score)
+        {
+            tree->root = avl_del(&node->tree);
+            node->score = score;
+            tree_link(tree, node);
+        }
+        return false;
+    }
+    tree_insert(tree, name, score);
+    zset->size++;
+    return true;
+}
+
+bool zset_rem(ZSet *zset, std::string_view name)
+{
+    if (!zset->tree)
+    {
+        uint32_t pos = 0;
+        size_t rank = 0;
+        if (!packed_find(zset, name, &pos, &rank))
+        {
+            return false;
+        }
+        packed_remove(zset, pos);
+        zset->size--;
+        return true;
+    }
+
+    ZTree *tree = zset->tree;
+    ZKey key;
+    key.node.hcode = hash64(name.data(), name.size(), g_hash_seed);
+    key.name = name;
+    HNode *found = hm_delete(&tree->hmap, &key.node, znode_eq);
+    if (!found)
+    {
+        return false;
+    }
+    ZNode *node = container_of(found, ZNode, hmap);
+    tree->root = avl_del(&node->tree);
+    tree_free_node(tree, node);
+    zset->size--;
+    return true;
+}
+
+bool zset_score(ZSet *zset, std::string_view name, double *score)
+{
+    if (!zset->tree)
+    {
+        uint32_t pos = 0;
+        size_t rank = 0;
+        if (!packed_find(zset, name, &pos, &rank))
+        {
+            return false;
+        }
+        *score = rec_score(zset->packed + pos);
+        return true;
+    }
+    ZNode *node = tree_lookup(zset->tree, name);
+    if (!node)
+    {
+        return false;
+    }
+    *score = node->score;
+    return true;
+}
+
+bool zset_rank(ZSet *zset, std::string_view name, size_t *rank)
+{
+    if (!zset->tree)
+    {
+        uint32_t pos = 0;
+        return packed_find(zset, name, &pos, rank);
+    }
+    ZNode *node = tree_lookup(zset->tree, name);
+    if (!node)
+    {
+        return false;
+    }
+    *rank = avl_rank(&node->tree);
+    return true;
+}
+
+size_t zset_seekge(ZSet *zset, double score, std::string_view name)
+{
+    size_t rank = 0;
+    if (!zset->tree)
+    {
+        packed_seekge(zset, score, name, &rank);
+        return rank;
+    }
+    // on the way down, `base` counts the nodes known to be smaller
+    size_t found = zset->size;
+    size_t base = 0;
+    AVLNode *cur = zset->tree->root;
+    while (cur)
+    {
+        ZNode *node = container_of(cur, ZNode, tree);
+        if (zless(node->score, std::string_view(node->name, node->len), score, name))
+        {
+            base += avl_cnt(cur->left) + 1;
+            cur = cur->right;
+        }
+        else
+        {
+            found = base + avl_cnt(cur->left);
+            cur = cur->left;
+        }
+    }
+    return found;
+}
+
+void zset_iter_init(ZIter *it, ZSet *zset, size_t rank)
+{
+    *it = ZIter();
+    it->zset = zset;
+    it->rank = rank;
+    if (rank >= zset->size)
+    {
+        it->rank = zset->size;
+        it->pos = zset->packed_used;
+        return;
+    }
+    if (zset->tree)
+    {
+        it->node = container_of(avl_at(zset->tree->root, rank), ZNode, tree);
+        return;
+    }
+    for (size_t r = 0; r < rank; ++r)
+    {
+        it->pos += rec_size(zset->packed + it->pos);
+    }
+}
+
+bool zset_iter_get(const ZIter *it, std::string_view *name, double *score)
+{
+    if (it->rank >= it->zset->size)
+    {
+        return false;
+    }
+    if (it->zset->tree)
+    {
+        *name = std::string_view(it->node->name, it->node->len);
+        *score = it->node->score;
+        return true;
+    }
+    const uint8_t *rec = it->zset->packed + it->pos;
+    *name = rec_name(rec);
+    *score = rec_score(rec);
+    return true;
+}
+
+void zset_iter_next(ZIter *it)
+{
+    if (it->rank >= it->zset->size)
+    {
+        return;
+    }
+    it->rank++;
+    if (it->zset->tree)
+    {
+        AVLNode *next = avl_offset(&it->node->tree, 1);
+        it->node = next ? container_of(next, ZNode, tree) : nullptr;
+        return;
+    }
+    it->pos += rec_size(it->zset->packed + it->pos);
+}
+
+// children first; the depth is O(log n)
+static void tree_free(ZTree *tree, AVLNode *node)
+{
+    if (!node)
+    {
+        return;
+    }
+    tree_free(tree, node->left);
+    tree_free(tree, node->right);
+    tree_free_node(tree, container_of(node, ZNode, tree));
+}
+
+void zset_clear(ZSet *zset)
+{
+    if (ZTree *tree = zset->tree)
+    {
+        tree_free(tree, tree->root);
+        hm_clear(&tree->hmap);
+        delete tree;
+    }
+    free(zset->packed);
+    *zset = ZSet();
+}
+
+static void collect_hnode(HNode *node, void *arg)
+{
+    ((std::vector<HNode *> *)arg)->push_back(node);
+}
+
+static bool hnode_same(HNode *node, HNode *key)
+{
+    return node == key;
+}
+
+bool zset_clear_some(ZSet *zset, uint64_t *cursor, size_t work)
+{
+    ZTree *tree = zset->tree;
+    std::vector<HNode *> nodes;
+    // A bucket at a time. A node leaves the table before it is freed: the
+    // scan reads the nodes it passes over. An empty bucket counts as work.
+    for (size_t done = 0; tree && hm_size(&tree->hmap) > 0 && done < work;)
+    {
+        nodes.clear();
+        *cursor = hm_scan(&tree->hmap, *cursor, collect_hnode, &nodes);
+        for (HNode *node : nodes)
+        {
+            hm_delete(&tree->hmap, node, hnode_same);
+            tree_free_node(tree, container_of(node, ZNode, hmap));
+        }
+        done += nodes.size() + 1;
+    }
+    if (tree && hm_size(&tree->hmap) > 0)
+    {
+        return false;
+    }
+    if (tree)
+    {
+        tree->root = nullptr; // its nodes are gone
+    }
+    zset_clear(zset);
+    return true;
+}
+
+size_t zset_mem_usage(const ZSet *zset)
+{
+    size_t size = sizeof(ZSet) + zset->packed_cap;
+    if (const ZTree *tree = zset->tree)
+    {
+        size += sizeof(ZTree) + tree->node_bytes + hm_mem_usage((HMap *)&tree->hmap);
+    }
+    return size;
+}
@@ -0,0 +1,84 @@
+#ifndef ZSET_HPP
+#define ZSET_HPP
+
+#include "avl.hpp"
+#include "hashtable.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Sorted set: members with a score, ordered by (score, member bytes).
+//
+// A small set is packed: one buffer of [score][len][member] records in
+// order, up to k_zset_packed_max members of up to k_zset_packed_name_max
+// bytes. Finding a member there is a scan, but over a few cache lines and
+// without a pointer to chase. A set that outgrows either limit converts,
+// for good, to a ZTree: a ZNode per member, linked into an AVL tree ordered
+// like the records, whose subtree counts make rank and offset queries
+// O(log n), and into an HMap from member to node for O(1) score lookups.
+//
+// Everything is addressed by rank: find where a range starts
+// (zset_seekge(), zset_rank()), then read it with a ZIter.
+
+const size_t k_zset_packed_max = 128;
+const size_t k_zset_packed_name_max = 64;
+
+struct ZNode
+{
+    AVLNode tree;
+    HNode hmap;
+    double score = 0;
+    uint32_t len = 0;
+    char name[];
+};
+
+struct ZTree
+{
+    AVLNode *root = nullptr;
+    HMap hmap;
+    size_t node_bytes = 0; // allocated for the ZNodes
+};
+
+struct ZSet
+{
+    size_t size = 0; // members
+    // packed: the records, and the bytes in use / allocated for them
+    uint8_t *packed = nullptr;
+    uint32_t packed_used = 0;
+    uint32_t packed_cap = 0;
+    ZTree *tree = nullptr; // once converted
+};
+
+// a position in rank order, for reading ranges
+struct ZIter
+{
+    ZSet *zset = nullptr;
+    size_t rank = 0;
+    uint32_t pos = 0;      // packed: offset of the record
+    ZNode *node = nullptr; // tree: nullptr past the end
+};
+
+// true if the member is new, false if it only got the new score
+bool zset_add(ZSet *zset, std::string_view name, double score);
+// false if there was no such member
+bool zset_rem(ZSet *zset, std::string_view name);
+bool zset_score(ZSet *zset, std::string_view name, double *score);
+// 0-based position of the member, false if there is no such member
+bool zset_rank(ZSet *zset, std::string_view name, size_t *rank);
+// rank of the first member >= (score, name), zset->size if there is none
+size_t zset_seekge(ZSet *zset, double score, std::string_view name);
+// positions `it` at `rank`; past the end if rank >= zset->size
+void zset_iter_init(ZIter *it, ZSet *zset, size_t rank);
+// false past the end. The name is valid until the set is modified.
+bool zset_iter_get(const ZIter *it, std::string_view *name, double *score);
+void zset_iter_next(ZIter *it);
+// frees the members, the set is left empty and packed
+void zset_clear(ZSet *zset);
+// Frees about `work` members of a set that is being dropped, resuming from
+// *cursor (0 the first time), so a big one can go a bit at a time. True
+// once all of it is freed, as by zset_clear(); the set is not usable before.
+bool zset_clear_some(ZSet *zset, uint64_t *cursor, size_t work);
+// bytes allocated for the set, the ZSet itself included
+size_t zset_mem_usage(const ZSet *zset);
+
+#endif // ZSET_HPP
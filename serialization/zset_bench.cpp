@@ -0,0 +1,166 @@
+// Sorted set benchmark on zset.cpp itself, no server or sockets:
+//  - zadd:    one set of n members with random scores (the tree encoding)
+//  - zscore:  random members, through the member HMap
+//  - zrank:   random members, through the subtree counts
+//  - zquery:  seek to a random score, read the next 10 members
+//  - zrange:  a random rank, read the next 10 members
+//  - small:   n / 100 sets of 100 members, still packed, then zscore on them
+// Each query phase runs k_queries random queries and checks every answer.
+//
+//   ./zset_bench [n]        default 10000000
+#include "hash.hpp"
+#include "zset.hpp"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string_view>
+#include <time.h>
+#include <vector>
+
+const size_t k_queries = 2000000;
+const size_t k_range = 10;
+const size_t k_small_members = 100;
+
+static uint64_t now_ns() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t &s) {
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+}
+
+static std::string_view member(char *buf, size_t i) {
+    int len = snprintf(buf, 32, "player:%zu", i);
+    return std::string_view(buf, len);
+}
+
+// every member has a distinct score, so member i's rank is known
+static double score_of(size_t i, size_t n) {
+    return double((i * 2654435761ull) % n);
+}
+
+static void report(const char *name, size_t ops, uint64_t ns) {
+    printf("%-8s %9zu ops  %7.2f M ops/s  %7.1f ns/op\n", name, ops, ops * 1e3 / ns,
+           double(ns) / ops);
+}
+
+static void fail(const char *what, size_t i) {
+    fprintf(stderr, "bad result: %s for member %zu\n", what, i);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    size_t n = argc > 1 ? strtoull(argv[1], NULL, 10) : 10000000;
+    hash_seed_init();
+    uint64_t rnd = 0x9E3779B97F4A7C15ull;
+    char buf[32];
+
+    // n must be odd for score_of() to be a permutation of 0..n-1
+    n |= 1;
+    ZSet zset;
+    uint64_t t0 = now_ns();
+    for (size_t i = 0; i < n; ++i) {
+        zset_add(&zset, member(buf, i), score_of(i, n));
+    }
+    uint64_t t1 = now_ns();
+    report("zadd", n, t1 - t0);
+    printf("         %zu members, %.1f B/member\n", zset.size,
+           double(zset_mem_usage(&zset)) / n);
+
+    t0 = now_ns();
+    for (size_t q = 0; q < k_queries; ++q) {
+        size_t i = xorshift(rnd) % n;
+        double score = 0;
+        if (!zset_score(&zset, member(buf, i), &score) || score != score_of(i, n)) {
+            fail("zscore", i);
+        }
+    }
+    report("zscore", k_queries, now_ns() - t0);
+
+    t0 = now_ns();
+    for (size_t q = 0; q < k_queries; ++q) {
+        size_t i = xorshift(rnd) % n;
+        size_t rank = 0;
+        if (!zset_rank(&zset, member(buf, i), &rank) || rank != (size_t)score_of(i, n)) {
+            fail("zrank", i);
+        }
+    }
+    report("zrank", k_queries, now_ns() - t0);
+
+    t0 = now_ns();
+    for (size_t q = 0; q < k_queries; ++q) {
+        size_t r = xorshift(rnd) % n;
+        size_t rank = zset_seekge(&zset, double(r), "");
+        ZIter it;
+        zset_iter_init(&it, &zset, rank);
+        std::string_view name;
+        double score = 0;
+        for (size_t k = 0; k < k_range && zset_iter_get(&it, &name, &score); ++k) {
+            if (score != double(r + k)) {
+                fail("zquery", r);
+            }
+            zset_iter_next(&it);
+        }
+    }
+    report("zquery", k_queries, now_ns() - t0);
+
+    t0 = now_ns();
+    for (size_t q = 0; q < k_queries; ++q) {
+        size_t r = xorshift(rnd) % n;
+        ZIter it;
+        zset_iter_init(&it, &zset, r);
+        std::string_view name;
+        double score = 0;
+        for (size_t k = 0; k < k_range && zset_iter_get(&it, &name, &score); ++k) {
+            if (score != double(r + k)) {
+                fail("zrange", r);
+            }
+            zset_iter_next(&it);
+        }
+    }
+    report("zrange", k_queries, now_ns() - t0);
+
+    t0 = now_ns();
+    for (size_t i = 0; i < n; ++i) {
+        if (!zset_rem(&zset, member(buf, i))) {
+            fail("zrem", i);
+        }
+    }
+    report("zrem", n, now_ns() - t0);
+    zset_clear(&zset);
+
+    size_t nsets = n / k_small_members;
+    std::vector<ZSet> small(nsets);
+    t0 = now_ns();
+    size_t bytes = 0;
+    for (ZSet &s : small) {
+        for (size_t i = 0; i < k_small_members; ++i) {
+            zset_add(&s, member(buf, i), double(i));
+        }
+        bytes += zset_mem_usage(&s);
+    }
+    t1 = now_ns();
+    report("small", nsets * k_small_members, t1 - t0);
+    printf("         %zu sets of %zu, %.1f B/member\n", nsets, k_small_members,
+           double(bytes) / (nsets * k_small_members));
+    t0 = now_ns();
+    for (size_t q = 0; q < k_queries; ++q) {
+        size_t i = xorshift(rnd) % k_small_members;
+        double score = 0;
+        if (!zset_score(&small[xorshift(rnd) % nsets], member(buf, i), &score) ||
+            score != double(i)) {
+            fail("small zscore", i);
+        }
+    }
+    report("zscore", k_queries, now_ns() - t0);
+    for (ZSet &s : small) {
+        zset_clear(&s);
+    }
+    return 0;
+}
@@ -0,0 +1,207 @@
+#include "test_util.hpp"
+#include "zset.hpp"
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <utility>
+
+typedef std::set<std::pair<double, std::string>> Model;
+
+// the set, read in rank order, is the model; and every member's score and
+// rank are found
+static bool sameAsModel(ZSet *zset, const Model &model) {
+  if (zset->size != model.size()) {
+    return false;
+  }
+  ZIter it;
+  zset_iter_init(&it, zset, 0);
+  size_t rank = 0;
+  for (const auto &m : model) {
+    std::string_view name;
+    double score = 0;
+    size_t r = 0;
+    if (!zset_iter_get(&it, &name, &score) || name != m.second || score != m.first ||
+        !zset_score(zset, m.second, &score) || score != m.first ||
+        !zset_rank(zset, m.second, &r) || r != rank) {
+      return false;
+    }
+    zset_iter_next(&it);
+    rank++;
+  }
+  std::string_view name;
+  double score = 0;
+  return !zset_iter_get(&it, &name, &score);
+}
+
+// The set stays packed up to k_zset_packed_max members, and converts on
+// the next one, keeping the order
+void testConversionThreshold() {
+  ZSet zset;
+  Model model;
+  bool passed = true;
+  for (size_t i = 0; i < k_zset_packed_max; ++i) {
+    std::string name = "m" + std::to_string(i);
+    passed = passed && zset_add(&zset, name, double(i % 7));
+    model.insert({double(i % 7), name});
+  }
+  passed = passed && zset.tree == nullptr && sameAsModel(&zset, model);
+
+  passed = passed && zset_add(&zset, "last", -1);
+  model.insert({-1, "last"});
+  passed = passed && zset.tree != nullptr && sameAsModel(&zset, model);
+
+  zset_clear(&zset);
+  passed = passed && zset.size == 0 && zset.tree == nullptr;
+
+  runTest("Conversion Threshold", passed);
+}
+
+// a member name over k_zset_packed_name_max converts a small set too
+void testLongNameConverts() {
+  ZSet zset;
+  bool passed = zset_add(&zset, "a", 1) && zset.tree == nullptr;
+  std::string fits(k_zset_packed_name_max, 'x');
+  passed = passed && zset_add(&zset, fits, 2) && zset.tree == nullptr;
+  std::string big(k_zset_packed_name_max + 1, 'y');
+  passed = passed && zset_add(&zset, big, 0) && zset.tree != nullptr;
+  size_t rank = 9;
+  passed = passed && zset_rank(&zset, big, &rank) && rank == 0 &&
+           zset_rank(&zset, fits, &rank) && rank == 2;
+  zset_clear(&zset);
+
+  runTest("Long Name Converts", passed);
+}
+
+// a new score moves the member; equal scores order by name
+void testScoreUpdate() {
+  bool passed = true;
+  for (bool tree : {false, true}) {
+    ZSet zset;
+    Model model;
+    if (tree) {
+      zset_add(&zset, std::string(k_zset_packed_name_max + 1, 'z'), 100);
+      model.insert({100, std::string(k_zset_packed_name_max + 1, 'z')});
+    }
+    zset_add(&zset, "b", 1);
+    zset_add(&zset, "a", 1);
+    zset_add(&zset, "c", 0);
+    model.insert({1, "b"});
+    model.insert({1, "a"});
+    model.insert({0, "c"});
+    passed = passed && sameAsModel(&zset, model);
+
+    passed = passed && !zset_add(&zset, "c", 2); // not new
+    model.erase({0, "c"});
+    model.insert({2, "c"});
+    passed = passed && sameAsModel(&zset, model);
+    passed = passed && zset_rem(&zset, "a") && !zset_rem(&zset, "a");
+    model.erase({1, "a"});
+    double score = 0;
+    size_t rank = 0;
+    passed = passed && sameAsModel(&zset, model) && !zset_score(&zset, "a", &score) &&
+             !zset_rank(&zset, "a", &rank);
+    zset_clear(&zset);
+  }
+
+  runTest("Score Update", passed);
+}
+
+// seekge() and positions past the end, with infinite scores
+void testSeekAndBounds() {
+  bool passed = true;
+  for (bool tree : {false, true}) {
+    ZSet zset;
+    if (tree) {
+      for (int i = 0; i < 200; ++i) {
+        zset_add(&zset, "pad" + std::to_string(i), 1000 + i);
+      }
+    }
+    zset_add(&zset, "lo", -INFINITY);
+    zset_add(&zset, "x", 5);
+    zset_add(&zset, "y", 5);
+    zset_add(&zset, "hi", INFINITY);
+    passed = passed && (zset.tree != nullptr) == tree;
+    passed = passed && zset_seekge(&zset, -INFINITY, "") == 0 &&
+             zset_seekge(&zset, 5, "") == 1 && zset_seekge(&zset, 5, "y") == 2 &&
+             zset_seekge(&zset, 5, "yy") == 3 && zset_seekge(&zset, INFINITY, "zz") == zset.size;
+
+    ZIter it;
+    std::string_view name;
+    double score = 0;
+    zset_iter_init(&it, &zset, zset.size - 1);
+    passed = passed && zset_iter_get(&it, &name, &score) && name == "hi";
+    zset_iter_next(&it);
+    passed = passed && !zset_iter_get(&it, &name, &score);
+    zset_iter_init(&it, &zset, zset.size + 10);
+    passed = passed && !zset_iter_get(&it, &name, &score);
+    zset_clear(&zset);
+  }
+
+  runTest("Seek And Bounds", passed);
+}
+
+// adds, score updates and removes of 300 names, packed then as a tree
+void testRandomAgainstModel() {
+  ZSet zset;
+  Model model;
+  std::map<std::string, double> scores;
+  uint64_t rnd = 0x9E3779B97F4A7C15ull;
+  bool passed = true;
+  for (int i = 0; i < 20000 && passed; ++i) {
+    std::string name = "m" + std::to_string(xorshift(rnd) % 300);
+    auto found = scores.find(name);
+    if (xorshift(rnd) % 3 == 0) {
+      passed = zset_rem(&zset, name) == (found != scores.end());
+      if (found != scores.end()) {
+        model.erase({found->second, name});
+        scores.erase(found);
+      }
+    } else {
+      double score = double(xorshift(rnd) % 50) - 25;
+      passed = zset_add(&zset, name, score) == (found == scores.end());
+      if (found != scores.end()) {
+        model.erase({found->second, name});
+      }
+      model.insert({score, name});
+      scores[name] = score;
+    }
+    if (i % 500 == 0) {
+      passed = passed && sameAsModel(&zset, model);
+    }
+  }
+  passed = passed && zset.tree != nullptr && sameAsModel(&zset, model);
+  zset_clear(&zset);
+
+  runTest("Random Against Model", passed);
+}
+
+// 5000 members in the tree, at most 100 (and a bucket) a call
+void testClearSome() {
+  ZSet zset;
+  for (int i = 0; i < 5000; ++i) {
+    zset_add(&zset, "m" + std::to_string(i), i);
+  }
+  uint64_t cursor = 0;
+  int calls = callsUntilDone([&]() { return zset_clear_some(&zset, &cursor, 100); });
+  bool passed = calls >= 25 && zset.size == 0 && zset.tree == nullptr &&
+                zset_mem_usage(&zset) == sizeof(ZSet);
+
+  runTest("Clear Some", passed);
+}
+
+int main() {
+  std::cout << "Running ZSet Tests:" << std::endl;
+
+  testConversionThreshold();
+  testLongNameConverts();
+  testScoreUpdate();
+  testSeekAndBounds();
+  testRandomAgainstModel();
+  testClearSome();
+
+  std::cout << "All tests completed." << std::endl;
+  return failures ? 1 : 0;
+}